@@ -14,29 +14,12 @@
 #include "command.h"
 #include "utilities.h"
 
-#define S1G_CAPABILITY_FLAGS_WIDTH 4
 #define SET_S1G_CAP_FLAGS          BIT(0)
 #define SET_S1G_CAP_AMPDU_MSS      BIT(1)
 #define SET_S1G_CAP_BEAM_STS       BIT(2)
 #define SET_S1G_CAP_NUM_SOUND_DIMS BIT(3)
 #define SET_S1G_CAP_MAX_AMPDU_LEXP BIT(4)
 
-struct PACKED mm_capabilities
-{
-    /** Capability flags */
-    uint32_t flags[S1G_CAPABILITY_FLAGS_WIDTH];
-    /** The minimum A-MPDU start spacing required by firmware.*/
-    uint8_t ampdu_mss;
-    /** The beamformee STS capability value */
-    uint8_t beamformee_sts_capability;
-    /** Number of sounding dimensions */
-    uint8_t number_sounding_dimensions;
-    /** The maximum A-MPDU length. This is the exponent value such that
-     * (2^(13 + exponent) - 1) is the length
-     */
-    uint8_t maximum_ampdu_length_exponent;
-};
-
 struct PACKED command_set_capabilities_req
 {
     struct mm_capabilities capabilities;
@@ -44,17 +27,6 @@ struct PACKED command_set_capabilities_req
     uint8_t set_caps;
 };
 
-struct PACKED command_get_capabilities_req
-{
-};
-
-struct PACKED command_get_capabilities_cfm
-{
-    struct mm_capabilities capabilities;
-    /** Morse custom MMSS (Minimum MPDU Start Spacing) offset */
-    uint8_t morse_mmss_offset;
-};
-
 static void usage(struct morsectrl *mors)
 {
     mctrl_print("\tcapabilities [options]\tget or set the device capabilties manifest\n");
@@ -14,13 +14,23 @@
 
 #define MORSECTRL_CMD_REQ_FLAG      (BIT(0))
 
+/* Fill in the header of a command. */
+static void morsectrl_command_hdr(int message_id, struct morsectrl_transport_buff *cmd)
+{
+    struct command *command = (struct command *)cmd->data;
+
+    memset(&command->hdr, 0, sizeof(command->hdr));
+    command->hdr.message_id = htole16(message_id);
+    command->hdr.len = htole16(cmd->data_len - sizeof(struct command));
+    command->hdr.flags = MORSECTRL_CMD_REQ_FLAG;
+}
+
 int morsectrl_send_command(struct morsectrl_transport *transport,
                            int message_id,
                            struct morsectrl_transport_buff *cmd,
                            struct morsectrl_transport_buff *resp)
 {
     int ret = 0;
-    struct command *command;
     struct response *response;
 
     if (!cmd || !resp)
@@ -29,11 +39,7 @@ int morsectrl_send_command(struct morsectrl_transport *transport,
         goto exit;
     }
 
-    command = (struct command *)cmd->data;
-    memset(&command->hdr, 0, sizeof(command->hdr));
-    command->hdr.message_id = htole16(message_id);
-    command->hdr.len = htole16(cmd->data_len - sizeof(struct command));
-    command->hdr.flags = MORSECTRL_CMD_REQ_FLAG;
+    morsectrl_command_hdr(message_id, cmd);
     response = (struct response *)resp->data;
 
     ret = morsectrl_transport_send(transport, cmd, resp);
@@ -58,3 +64,69 @@ int morsectrl_send_command(struct morsectrl_transport *transport,
 exit:
     return ret;
 } // NOLINT - checkstyle.py seems to think this brace is in the wrong place.
+
+int morsectrl_send_commands(struct morsectrl_transport *transport,
+                            const int *message_ids,
+                            struct morsectrl_transport_buff **cmds,
+                            struct morsectrl_transport_buff **resps,
+                            int *rets,
+                            size_t count)
+{
+    size_t ii;
+    int ret;
+
+    for (ii = 0; ii < count; ii++)
+    {
+        if (!cmds[ii] || !resps[ii])
+            return -ENOMEM;
+
+        morsectrl_command_hdr(message_ids[ii], cmds[ii]);
+    }
+
+    ret = morsectrl_transport_send_many(transport, cmds, resps, rets, count);
+    if (ret < 0)
+    {
+        if (transport && transport->debug)
+            mctrl_err("messages failed %d\n", ret);
+
+        return ret;
+    }
+
+    for (ii = 0; ii < count; ii++)
+    {
+        if (!rets[ii])
+            rets[ii] = le32toh(((struct response *)resps[ii]->data)->status);
+    }
+
+    return 0;
+}
+
+int morsectrl_capability_supported(struct morsectrl *mors, unsigned int flag, bool *supported)
+{
+    struct command_get_capabilities_cfm *rsp_get_capabs;
+    struct morsectrl_transport_buff *cmd_get_tbuff;
+    struct morsectrl_transport_buff *rsp_get_tbuff;
+    int ret;
+
+    *supported = false;
+    if (flag >= (S1G_CAPABILITY_FLAGS_WIDTH * 32))
+        return -EINVAL;
+
+    cmd_get_tbuff = morsectrl_transport_cmd_alloc(&mors->transport,
+                                                  sizeof(struct command_get_capabilities_req));
+    rsp_get_tbuff = morsectrl_transport_resp_alloc(&mors->transport, sizeof(*rsp_get_capabs));
+
+    ret = morsectrl_send_command(&mors->transport, MORSE_COMMAND_GET_CAPABILITIES,
+                                 cmd_get_tbuff, rsp_get_tbuff);
+    if (!ret)
+    {
+        rsp_get_capabs = TBUFF_TO_RSP(rsp_get_tbuff, struct command_get_capabilities_cfm);
+        *supported = !!(le32toh(rsp_get_capabs->capabilities.flags[flag / 32]) &
+                        BIT(flag % 32));
+    }
+
+    morsectrl_transport_buff_free(cmd_get_tbuff);
+    morsectrl_transport_buff_free(rsp_get_tbuff);
+
+    return ret;
+}
@@ -54,6 +54,35 @@ struct PACKED response
     uint8_t data[0];
 };
 
+#define S1G_CAPABILITY_FLAGS_WIDTH 4
+
+struct PACKED mm_capabilities
+{
+    /** Capability flags */
+    uint32_t flags[S1G_CAPABILITY_FLAGS_WIDTH];
+    /** The minimum A-MPDU start spacing required by firmware.*/
+    uint8_t ampdu_mss;
+    /** The beamformee STS capability value */
+    uint8_t beamformee_sts_capability;
+    /** Number of sounding dimensions */
+    uint8_t number_sounding_dimensions;
+    /** The maximum A-MPDU length. This is the exponent value such that
+     * (2^(13 + exponent) - 1) is the length
+     */
+    uint8_t maximum_ampdu_length_exponent;
+};
+
+struct PACKED command_get_capabilities_req
+{
+};
+
+struct PACKED command_get_capabilities_cfm
+{
+    struct mm_capabilities capabilities;
+    /** Morse custom MMSS (Minimum MPDU Start Spacing) offset */
+    uint8_t morse_mmss_offset;
+};
+
 /**
  *  Host to firmware/driver messages
  *
@@ -172,3 +201,40 @@ int morsectrl_send_command(struct morsectrl_transport *transport,
                            int message_id,
                            struct morsectrl_transport_buff *cmd,
                            struct morsectrl_transport_buff *resp);
+
+#ifdef ENABLE_STATS_PAGED
+/**
+ * Capability flag of firmware that can return the stats of a core over several pages. A
+ * placeholder until firmware allocates the flag, so only built with CONFIG_MORSE_STATS_PAGED.
+ */
+#define MORSE_CAPAB_STATS_PAGED     (127)
+#endif
+
+/**
+ * @brief Check whether the firmware reports a capability.
+ *
+ * @param mors          Morsectrl context.
+ * @param flag          Index of the capability flag, out of the 128 reported.
+ * @param supported     Filled with whether the flag is set.
+ * @return              0 on success otherwise relevant error.
+ */
+int morsectrl_capability_supported(struct morsectrl *mors, unsigned int flag, bool *supported);
+
+/**
+ * @brief Send several commands, all in flight at once where the transport allows.
+ *
+ * @param transport     Transport to send the commands on.
+ * @param message_ids   Message ID of each command.
+ * @param cmds          Buffer of each command, each with its own buffer.
+ * @param resps         Buffer to receive the response to each command into.
+ * @param rets          Filled with the result of each command, 0 on success, its status or a
+ *                      transport error.
+ * @param count         Number of commands.
+ * @return              0 if the commands were sent, otherwise relevant error.
+ */
+int morsectrl_send_commands(struct morsectrl_transport *transport,
+                            const int *message_ids,
+                            struct morsectrl_transport_buff **cmds,
+                            struct morsectrl_transport_buff **resps,
+                            int *rets,
+                            size_t count);
@@ -12,8 +12,20 @@
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <sys/stat.h>
 #include <libgen.h>
+#include <inttypes.h>
+#include <errno.h>
+#ifdef ENABLE_TRANS_FTDI_SPI
+#include <pthread.h>
+#endif
+#ifdef ENABLE_GZIP
+#include <zlib.h>
+#endif
+#ifndef MORSE_WIN_BUILD
+#include <sys/mman.h>
+#endif
 
 #include "portable_endian.h"
 #include "elf_file.h"
@@ -25,6 +37,174 @@
 
 #define LOAD_BCF_SECTION_TOT    (2) /* board_config section plus regdom section */
 
+#define ELF_VIEW_GZIP_MAGIC         "\x1f\x8b"
+#define ELF_VIEW_ZSTD_MAGIC         "\x28\xb5\x2f\xfd"
+#define ELF_VIEW_GZIP_BUFFER        (128 * 1024)
+
+/** Manifest of what was last written to a board, suffixed with the FTDI serial number. */
+#define ELF_MANIFEST_FILE_PREFIX    ".morsectrl_elf_manifest_"
+#define ELF_MANIFEST_PATH_LEN       (512)
+#define ELF_MANIFEST_LINE_LEN       (64)
+/** Granularity at which segments are compared with what is already on the chip. */
+#define ELF_MANIFEST_CHUNK_SIZE     (4096)
+/** Largest part of a blob handled as a single job, a multiple of the manifest chunk size. */
+#define ELF_LOAD_JOB_MAX            (16 * ELF_MANIFEST_CHUNK_SIZE)
+
+#define FNV1A_64_OFFSET_BASIS       (0xcbf29ce484222325ULL)
+#define FNV1A_64_PRIME              (0x100000001b3ULL)
+
+/**
+ * Read only view of an ELF32 file. Uncompressed files are mapped rather than read, so headers,
+ * sections and segments are used in place from the page cache. Where files can't be mapped only
+ * the parts needed are read. Compressed files are decompressed as they are read.
+ */
+struct elf_view
+{
+    /** Start of the file contents, NULL if the file is compressed or could not be mapped. */
+    const uint8_t *data;
+    /** The file, when it is read rather than mapped. */
+    FILE *file;
+    /** Size of the (decompressed) file. */
+    size_t size;
+    /** File header, in host byte order. */
+    Elf32_Ehdr ehdr;
+    /** Section header string table, once loaded. */
+    const char *strs;
+    size_t strs_len;
+#ifdef ENABLE_GZIP
+    /** Stream of a gzip compressed file. */
+    gzFile gz;
+#endif
+};
+
+/** Part of a blob written to the chip. */
+struct elf_manifest_chunk
+{
+    uint32_t addr;
+    uint32_t len;
+    uint64_t hash;
+    /** Whether the chunk is from a read only segment, which the firmware will not change. */
+    bool stable;
+};
+
+/** Chunks written to a board. */
+struct elf_manifest
+{
+    struct elf_manifest_chunk *chunks;
+    size_t count;
+    size_t capacity;
+};
+
+/** Kinds of @ref elf_load_job. */
+enum elf_load_job_type
+{
+    /** Note a blob that is not loaded. */
+    ELF_LOAD_JOB_UNLOADABLE,
+    /** Write part of a blob. */
+    ELF_LOAD_JOB_WRITE,
+    /** Skip part of a blob already on the chip (reading it back first if asked to). */
+    ELF_LOAD_JOB_SKIP,
+    /** Read back part of a blob and compare it with the file. */
+    ELF_LOAD_JOB_VERIFY,
+};
+
+/** Part of a blob, prepared by the reader stage for the transport stage. */
+struct elf_load_job
+{
+    enum elf_load_job_type type;
+    /** Index of the blob. */
+    int idx;
+    /** Size of the whole blob, for the progress message of its first job. */
+    Elf32_Word blob_size;
+    /** Whether this is the first job of the blob. */
+    bool first;
+    /** Whether the blob is from a read only segment. */
+    bool stable;
+    /** Whether this is the first @ref ELF_LOAD_JOB_SKIP of the blob, which is sampled. */
+    bool sample;
+    Elf32_Addr addr;
+    /** Data expected on the chip, in the file mapping unless it had to be copied. */
+    const uint8_t *data;
+    /** Size of the transfer. */
+    size_t len;
+    /** Number of octets to compare for @ref ELF_LOAD_JOB_VERIFY (the rest is past the file). */
+    size_t cmp_len;
+    /** Copy of a blob that runs past the end of the file, freed once the job has run. */
+    struct morsectrl_transport_buff *copy;
+};
+
+struct elf_load_pipeline;
+
+/** State of a single load of an ELF or BCF file. */
+struct elf_load
+{
+    struct morsectrl *mors;
+    struct elf_view view;
+    /** BCF country code, or NULL when loading a firmware ELF. */
+    const char *country;
+    /** MORSE_ELF_LOAD_* flags. */
+    unsigned int flags;
+    /** Queue between the reader and transport stages, NULL if they run in turn. */
+    struct elf_load_pipeline *pipeline;
+    /** Manifest file of the board, empty if the board can't be identified. */
+    char manifest_path[ELF_MANIFEST_PATH_LEN];
+    /** Stable chunks on the chip before this load, sorted by address. */
+    struct elf_manifest before;
+    /** Chunks written (or found already on the chip) by this load. */
+    struct elf_manifest after;
+    /** Octets of read only segments written. */
+    size_t written;
+    /** Octets of read only segments skipped as they were already on the chip. */
+    size_t skipped;
+    /** Piece of a blob read from the file when it can't be used in place, owned by the reader. */
+    uint8_t *staging;
+    /** Octets read back to check writes, with MORSE_ELF_LOAD_VERIFY_WRITES. */
+    size_t verified;
+    /** Octets written that the checks cover. */
+    size_t verify_written;
+    /** Writes read back in full because they needed transfer retries. */
+    unsigned int verify_retried;
+    /** Time spent reading back writes in microseconds. */
+    uint64_t verify_us;
+    /** Picks the chunk of each write to read back, moving on with every write. */
+    size_t verify_seq;
+    /** Whether a sampled chunk was not on the chip, so nothing more is skipped. */
+    bool manifest_stale;
+};
+
+#ifdef ENABLE_TRANS_FTDI_SPI
+/* Threads are only linked in with the transports that use them. */
+#define ELF_LOAD_PIPELINE
+#endif
+
+#ifdef ELF_LOAD_PIPELINE
+/** Jobs the reader stage may prepare ahead of the transport stage. */
+#define ELF_LOAD_QUEUE_LEN          (8)
+
+/** Bounded queue between a reader thread preparing jobs and the transport writing them. */
+struct elf_load_pipeline
+{
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct elf_load_job jobs[ELF_LOAD_QUEUE_LEN];
+    /** Number of jobs queued and taken, the difference is the queue depth. */
+    unsigned int queued;
+    unsigned int taken;
+    /** Set when the reader has prepared every job. */
+    bool done;
+    /** Set when the transport stage fails, so the reader stops. */
+    bool abort;
+    int reader_ret;
+    /** Time each stage spent working rather than waiting on the other. */
+    uint64_t reader_busy_us;
+    uint64_t writer_busy_us;
+};
+#endif
+
+static void elf_view_close(struct elf_view *view);
+static int elf_view_read(const struct elf_view *view, size_t offset, void *buf, size_t size);
+
 /**
  * @brief Get the ELF32 file header
  *
@@ -69,246 +249,528 @@ static int get_file_header(const uint8_t *data, Elf32_Ehdr *ehdr)
 }
 
 
-/*
-* Get the ii-th section header and fill in the details in shdr
-*/
-static int get_section_header(const uint8_t *data, const Elf32_Ehdr *ehdr, Elf32_Shdr *shdr, int ii)
+/**
+ * @brief Open a gzip compressed ELF32 file. The decompressed size is taken from the gzip trailer.
+ *
+ * @param view  View to initialise.
+ * @param path  Path of the compressed ELF file.
+ * @param file  The file, open at any position.
+ * @return      0 on success otherwise relevant error.
+ */
+static int elf_view_open_gzip(struct elf_view *view, const char *path, FILE *file)
 {
-    Elf32_Shdr *p = (Elf32_Shdr *)(data + ehdr->e_shoff +
-                       (ii * ehdr->e_shentsize));
+#ifdef ENABLE_GZIP
+    uint8_t isize[sizeof(uint32_t)];
+
+    if (fseek(file, -(long)sizeof(isize), SEEK_END) ||
+        (fread(isize, 1, sizeof(isize), file) != sizeof(isize)))
+        return -1;
 
-    shdr->sh_name = le32toh(p->sh_name);
-    shdr->sh_type = le32toh(p->sh_type);
-    shdr->sh_offset = le32toh(p->sh_offset);
-    shdr->sh_addr = le32toh(p->sh_addr);
-    shdr->sh_size = le32toh(p->sh_size);
-    shdr->sh_flags = le32toh(p->sh_flags);
+    view->size = isize[0] | (isize[1] << 8) | (isize[2] << 16) | ((uint32_t)isize[3] << 24);
+
+    view->gz = gzopen(path, "rb");
+    if (!view->gz)
+    {
+        mctrl_err("Failed to open %s\n", path);
+        return -1;
+    }
+    gzbuffer(view->gz, ELF_VIEW_GZIP_BUFFER);
 
     return 0;
+#else
+    mctrl_err("%s is gzip compressed, which needs a build with CONFIG_MORSE_GZIP=1\n", path);
+    return -1;
+#endif
 }
 
 /**
- * @brief Load an arbitray section of an ELF file into memory.
- *
- * @note This is useful for loading program/section headers or the sections themselves.
+ * @brief Open an ELF32 file. Uncompressed files are mapped into memory where possible, otherwise
+ *        they are read a part at a time. Compressed files are decompressed as they are read.
  *
- * @param infile    The ELF file to load data from.
- * @param offset    Offset from the start of the ELF file.
- * @param size      Size of the data to read into memory.
- * @param buf       Pointer to buffer to read memory into. If the buffer is NULL then one will be
- *                  allocated.
- * @return          0 on success otherwise relevant error.
+ * @param view  View to initialise.
+ * @param path  Path of the ELF file.
+ * @return      0 on success otherwise relevant error.
  */
-static int elf_file_load_binary_data(FILE *infile, Elf32_Off offset, size_t size, uint8_t **buf)
+static int elf_view_open(struct elf_view *view, const char *path)
 {
-    size_t octets_read = 0;
+    uint8_t ehdr[sizeof(Elf32_Ehdr)];
+    uint8_t magic[sizeof(uint32_t)] = { 0 };
     struct stat file_stats;
-    size_t filesize;
-    bool mallocd = false;
-
-    if (!buf || !infile || fstat(fileno(infile), &file_stats))
-        return -1;
+    FILE *file;
+    uint8_t *data = NULL;
+    int ret = -1;
 
-    filesize = file_stats.st_size;
+    memset(view, 0, sizeof(*view));
 
-    if (fseek(infile, offset, SEEK_SET))
+    file = fopen(path, "rb");
+    if (!file)
+    {
+        mctrl_err("Failed to open %s\n", path);
         return -1;
+    }
 
-    if (!*buf)
+    if (fstat(fileno(file), &file_stats) ||
+        (fread(magic, 1, sizeof(magic), file) != sizeof(magic)))
     {
-        *buf = malloc(size);
-        mallocd = true;
+        mctrl_err("%s is too small to be an ELF file\n", path);
+        goto exit;
     }
 
-    if (!*buf)
+    if (!memcmp(magic, ELF_VIEW_GZIP_MAGIC, strlen(ELF_VIEW_GZIP_MAGIC)))
     {
-        return -1;
+        ret = elf_view_open_gzip(view, path, file);
+        goto exit;
     }
 
-    if ((filesize - offset) < size)
+    if (!memcmp(magic, ELF_VIEW_ZSTD_MAGIC, strlen(ELF_VIEW_ZSTD_MAGIC)))
     {
-        mctrl_err("Error file read size greater than remaining file size (%d < %d)\n",
-               (int) (filesize - offset), (int) size);
-        mctrl_err("File size, offset, read size: 0x%08x, 0x%08x, 0x%08x\n",
-               (int) filesize, offset, (int) size);
+        mctrl_err("%s is zstd compressed, which is not supported (use gzip)\n", path);
+        goto exit;
     }
 
-    while ((octets_read < (filesize - offset)) && (octets_read < size))
+#ifndef MORSE_WIN_BUILD
+    data = mmap(NULL, file_stats.st_size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+    if (data == MAP_FAILED)
+        data = NULL;
+    else
+        madvise(data, file_stats.st_size, MADV_SEQUENTIAL);
+#endif
+
+    /* Without a mapping the file is kept open and only the parts needed are read. */
+    view->data = data;
+    if (!data)
     {
-        octets_read += fread(*buf + octets_read, sizeof(uint8_t),  size - octets_read, infile);
-        if (ferror(infile))
-        {
-            mctrl_err("Error reading file\n");
-            if (mallocd)
-            {
-                free(*buf);
-                *buf = NULL;
-            }
+        view->file = file;
+        file = NULL;
+    }
+    view->size = file_stats.st_size;
+    ret = 0;
 
-            return -1;
-        }
+exit:
+    if (file)
+        fclose(file);
+
+    if (ret)
+        return ret;
+
+    if (elf_view_read(view, 0, ehdr, sizeof(ehdr)) || get_file_header(ehdr, &view->ehdr))
+    {
+        mctrl_err("%s is not a valid ELF file\n", path);
+        elf_view_close(view);
+        return -1;
     }
 
     return 0;
 }
 
 /**
- * @brief Get the program headers from an ELF32 file.
+ * @brief Close an ELF32 file opened with elf_view_open().
  *
- * @param infile    The ELF file to get program headers from.
- * @param offset    The offset from the start of the ELF file the program headers are located.
- * @param count     The number of program headers to get.
- * @return          a pointer to a dynamically allocated array of program headers on success,
- *                  otherwise NULL.
+ * @param view  View to close.
  */
-static Elf32_Phdr *elf_file_load_program_headers(FILE *infile, Elf32_Off offset, Elf32_Half count)
+static void elf_view_close(struct elf_view *view)
 {
-    Elf32_Phdr *phdr = NULL;
-    int ii;
+#ifndef MORSE_WIN_BUILD
+    if (view->data)
+        munmap((void *)view->data, view->size);
+#endif
+    if (view->file)
+        fclose(view->file);
+    view->file = NULL;
+#ifdef ENABLE_GZIP
+    if (view->gz)
+        gzclose(view->gz);
+    view->gz = NULL;
+#endif
+    if (!view->data)
+        free((void *)view->strs);
+    view->strs = NULL;
+    view->data = NULL;
+    view->size = 0;
+}
+
+/**
+ * @brief Check part of an ELF file lies within the file.
+ *
+ * @param view      View of the ELF file.
+ * @param offset    Offset from the start of the file.
+ * @param size      Size of the part.
+ * @return          true if the part is within the file.
+ */
+static bool elf_view_contains(const struct elf_view *view, size_t offset, size_t size)
+{
+    return (offset <= view->size) && (size <= view->size - offset);
+}
 
-    if (elf_file_load_binary_data(infile, offset, sizeof(*phdr) * count, (uint8_t **)(&phdr)))
+/**
+ * @brief Get a pointer to part of a mapped ELF file, checking it lies within the file.
+ *
+ * @param view      View of the ELF file.
+ * @param offset    Offset from the start of the file.
+ * @param size      Size of the part.
+ * @return          Pointer into the mapping, or NULL if the part runs past the end of the file or
+ *                  the file is compressed.
+ */
+static const uint8_t *elf_view_ptr(const struct elf_view *view, size_t offset, size_t size)
+{
+    if (!view->data || !elf_view_contains(view, offset, size))
         return NULL;
 
-    /* Fix endianess. */
-    for (ii = 0; ii < count; ii++)
+    return view->data + offset;
+}
+
+/**
+ * @brief Copy part of an ELF file. Compressed files can only be read forwards, so reading at
+ *        lower offsets than before decompresses the file again from the start.
+ *
+ * @param view      View of the ELF file.
+ * @param offset    Offset from the start of the file.
+ * @param buf       Buffer to copy into.
+ * @param size      Size of the part.
+ * @return          0 on success, otherwise relevant error (including running past the file).
+ */
+static int elf_view_read(const struct elf_view *view, size_t offset, void *buf, size_t size)
+{
+    if (!elf_view_contains(view, offset, size))
+        return -1;
+
+    if (view->data)
     {
-        phdr[ii].p_type = le32toh(phdr[ii].p_type);
-        phdr[ii].p_offset = le32toh(phdr[ii].p_offset);
-        phdr[ii].p_vaddr = le32toh(phdr[ii].p_vaddr);
-        phdr[ii].p_paddr = le32toh(phdr[ii].p_paddr);
-        phdr[ii].p_filesz = le32toh(phdr[ii].p_filesz);
-        phdr[ii].p_memsz = le32toh(phdr[ii].p_memsz);
-        phdr[ii].p_align = le32toh(phdr[ii].p_align);
+        memcpy(buf, view->data + offset, size);
+        return 0;
+    }
+
+    if (view->file)
+    {
+        return (fseek(view->file, offset, SEEK_SET) ||
+                (fread(buf, 1, size, view->file) != size)) ? -1 : 0;
+    }
+
+#ifdef ENABLE_GZIP
+    if (view->gz && (gzseek(view->gz, offset, SEEK_SET) == offset))
+    {
+        while (size)
+        {
+            int octets = gzread(view->gz, buf, MIN(size, (size_t)ELF_VIEW_GZIP_BUFFER));
+
+            if (octets <= 0)
+                return -1;
+
+            buf = (uint8_t *)buf + octets;
+            size -= octets;
+        }
+
+        return 0;
     }
+#endif
 
-    return phdr;
+    return -1;
 }
 
 /**
- * @brief Get the section headers from an ELF32 file.
+ * @brief Copy part of an ELF file, zeroing any of it that runs past the end of the file.
  *
- * @param infile    The ELF file to get section headers from.
- * @param offset    The offset from the start of the ELF file the section headers are located.
- * @param count     The number of program headers to get.
- * @return          a pointer to a dynamically allocated array of section headers on success,
- *                  otherwise NULL.
+ * @param view      View of the ELF file.
+ * @param offset    Offset from the start of the file.
+ * @param buf       Buffer to copy into.
+ * @param size      Size of the part.
+ * @return          0 on success otherwise relevant error.
  */
-Elf32_Shdr *elf_file_load_section_headers(FILE *infile, Elf32_Off offset, Elf32_Half count)
+static int elf_view_read_padded(const struct elf_view *view, size_t offset, uint8_t *buf,
+                                size_t size)
 {
-    Elf32_Shdr *shdr = NULL;
-    int ii;
+    size_t len = (offset < view->size) ? MIN(size, view->size - offset) : 0;
 
-    if (elf_file_load_binary_data(infile, offset, sizeof(*shdr) * count, (uint8_t **)(&shdr)))
-        return NULL;
+    memset(buf + len, 0, size - len);
 
-    /* Fix endianess. */
-    for (ii = 0; ii < count; ii++)
-    {
-        shdr[ii].sh_name = le32toh(shdr[ii].sh_name);
-        shdr[ii].sh_type = le32toh(shdr[ii].sh_type);
-        shdr[ii].sh_flags = le32toh(shdr[ii].sh_flags);
-        shdr[ii].sh_addr = le32toh(shdr[ii].sh_addr);
-        shdr[ii].sh_offset = le32toh(shdr[ii].sh_offset);
-        shdr[ii].sh_size = le32toh(shdr[ii].sh_size);
-        shdr[ii].sh_link = le32toh(shdr[ii].sh_link);
-        shdr[ii].sh_info = le32toh(shdr[ii].sh_info);
-        shdr[ii].sh_addralign = le32toh(shdr[ii].sh_addralign);
-        shdr[ii].sh_entsize = le32toh(shdr[ii].sh_entsize);
-    }
+    return len ? elf_view_read(view, offset, buf, len) : 0;
+}
+
+/**
+ * @brief Get the ii-th program header of an ELF file.
+ *
+ * @param view  View of the ELF file.
+ * @param ii    Index of the program header.
+ * @param phdr  Program header to fill in, in host byte order.
+ * @return      0 on success otherwise relevant error.
+ */
+static int elf_view_phdr(const struct elf_view *view, int ii, Elf32_Phdr *phdr)
+{
+    Elf32_Phdr p;
 
-    return shdr;
+    if ((ii >= view->ehdr.e_phnum) || (view->ehdr.e_phentsize < sizeof(p)))
+        return -1;
+
+    if (elf_view_read(view, view->ehdr.e_phoff + (size_t)ii * view->ehdr.e_phentsize,
+                      &p, sizeof(p)))
+        return -1;
+
+    phdr->p_type = le32toh(p.p_type);
+    phdr->p_offset = le32toh(p.p_offset);
+    phdr->p_vaddr = le32toh(p.p_vaddr);
+    phdr->p_paddr = le32toh(p.p_paddr);
+    phdr->p_filesz = le32toh(p.p_filesz);
+    phdr->p_memsz = le32toh(p.p_memsz);
+    phdr->p_flags = le32toh(p.p_flags);
+    phdr->p_align = le32toh(p.p_align);
+
+    return 0;
 }
 
 /**
- * @brief Load the ELF32 header into a given struct.
+ * @brief Get the ii-th section header of an ELF file.
  *
- * @param infile    The ELF file to load the header from.
- * @param ehdr      Pointer to the ELF header structure to populate.
- * @return          0 on success, otherwise relevant error.
+ * @param view  View of the ELF file.
+ * @param ii    Index of the section header.
+ * @param shdr  Section header to fill in, in host byte order.
+ * @return      0 on success otherwise relevant error.
  */
-static int load_file_header(FILE *infile, Elf32_Ehdr *ehdr)
+static int elf_view_shdr(const struct elf_view *view, int ii, Elf32_Shdr *shdr)
 {
-    uint8_t *data = NULL;
+    Elf32_Shdr p;
+
+    if ((ii >= view->ehdr.e_shnum) || (view->ehdr.e_shentsize < sizeof(p)))
+        return -1;
+
+    if (elf_view_read(view, view->ehdr.e_shoff + (size_t)ii * view->ehdr.e_shentsize,
+                      &p, sizeof(p)))
+        return -1;
+
+    shdr->sh_name = le32toh(p.sh_name);
+    shdr->sh_type = le32toh(p.sh_type);
+    shdr->sh_flags = le32toh(p.sh_flags);
+    shdr->sh_addr = le32toh(p.sh_addr);
+    shdr->sh_offset = le32toh(p.sh_offset);
+    shdr->sh_size = le32toh(p.sh_size);
+    shdr->sh_link = le32toh(p.sh_link);
+    shdr->sh_info = le32toh(p.sh_info);
+    shdr->sh_addralign = le32toh(p.sh_addralign);
+    shdr->sh_entsize = le32toh(p.sh_entsize);
+
+    return 0;
+}
 
-    if (elf_file_load_binary_data(infile, 0, sizeof(*ehdr), &data))
+/**
+ * @brief Get the section header string table ready for elf_view_section_name(). It is used in
+ *        place when the file is mapped, otherwise it is copied.
+ *
+ * @param view  View of the ELF file.
+ * @return      0 on success otherwise relevant error.
+ */
+static int elf_view_load_section_names(struct elf_view *view)
+{
+    Elf32_Shdr strtab;
+    char *strs;
+
+    if (elf_view_shdr(view, view->ehdr.e_shstrndx, &strtab) ||
+        !elf_view_contains(view, strtab.sh_offset, strtab.sh_size))
         return -1;
 
-    if (get_file_header(data, ehdr))
+    view->strs_len = strtab.sh_size;
+    if (view->data)
+    {
+        view->strs = (const char *)view->data + strtab.sh_offset;
+        return 0;
+    }
+
+    strs = malloc(strtab.sh_size);
+    if (!strs)
+        return -ENOMEM;
+
+    if (elf_view_read(view, strtab.sh_offset, strs, strtab.sh_size))
     {
-        free(data);
+        free(strs);
         return -1;
     }
 
-    free(data);
+    view->strs = strs;
 
     return 0;
 }
 
+/**
+ * @brief Get the name of a section of an ELF file.
+ *
+ * @param view      View of the ELF file, with the section names loaded.
+ * @param shdr      Section header to get the name of.
+ * @return          The name, or NULL if it is not terminated within the string table.
+ */
+static const char *elf_view_section_name(const struct elf_view *view, const Elf32_Shdr *shdr)
+{
+    if (!view->strs || (shdr->sh_name >= view->strs_len) ||
+        !memchr(view->strs + shdr->sh_name, '\0', view->strs_len - shdr->sh_name))
+        return NULL;
+
+    return view->strs + shdr->sh_name;
+}
+
 /*
- * Load the offchip statistics from an ELF data structure.
+ * Load the offchip statistics from an ELF file, which may be compressed.
  *
  * An array of n_rec struct statistics_offchip_data elements is allocated in the stats_handle.
  * It is the caller's responsibility to free the array.
  */
 int morse_stats_load(struct statistics_offchip_data **stats_handle, size_t *n_rec,
-                     const uint8_t *data)
+                     const char *path, void **map, size_t *map_len)
 {
+    struct elf_view view;
+    size_t total_stats_size = 0;
+    size_t offset = 0;
+    Elf32_Shdr *sections = NULL;
+    int n_sections = 0;
+    uint8_t *blob;
+    Elf32_Shdr shdr;
+    const char *name;
+    bool in_place;
     int ii;
     int ret = 0;
-    Elf32_Ehdr ehdr;
-    Elf32_Shdr shdr;
-    Elf32_Shdr sh_strtab;
-    const char *sh_strs;
 
-    if (get_file_header((const uint8_t *)data, &ehdr) != 0) {
-        mctrl_err("Wrong file format\n");
+    *stats_handle = NULL;
+    *n_rec = 0;
+    *map = NULL;
+    *map_len = 0;
+
+    if (elf_view_open(&view, path))
         return -1;
-    }
 
-    if (get_section_header(data, &ehdr, &sh_strtab, ehdr.e_shstrndx) != 0) {
+    if (elf_view_load_section_names(&view))
+    {
         mctrl_err("Invalid firmware - missing string table\n");
-        return -1;
+        ret = -1;
+        goto exit;
     }
 
-    sh_strs = (const char *)data + sh_strtab.sh_offset;
+    sections = calloc(MAX(view.ehdr.e_shnum, 1), sizeof(*sections));
+    if (!sections)
+    {
+        ret = -ENOMEM;
+        goto exit;
+    }
 
-    /* first run through the ELF file to get the total size of the stats */
-    size_t total_stats_size = 0;
-    for (ii = 0; ii < ehdr.e_shnum; ii++)
+    /* Find the stats sections and their total size in one pass over the section headers. */
+    for (ii = 0; ii < view.ehdr.e_shnum; ii++)
     {
-        if (get_section_header(data, &ehdr, &shdr, ii) != 0)
+        if (elf_view_shdr(&view, ii, &shdr) != 0)
             continue;
 
-        if (strstr(sh_strs + shdr.sh_name, "_offchip_"))
+        name = elf_view_section_name(&view, &shdr);
+        if (name && strstr(name, "_offchip_"))
         {
+            sections[n_sections++] = shdr;
             total_stats_size += shdr.sh_size;
         }
     }
-    void *blob =  malloc(total_stats_size);
-    memset(blob, 0, total_stats_size);
-    *n_rec = 0;
-    if (blob)
+
+    /*
+     * The stats sections are normally laid out back to back, so when the file is mapped the
+     * records are used where they are rather than copied. Only the pages holding them are read.
+     */
+    in_place = view.data && (n_sections > 0) &&
+               elf_view_contains(&view, sections[0].sh_offset, total_stats_size);
+    for (ii = 0; in_place && (ii < n_sections); ii++)
     {
-        int offset = 0;
-        for (ii = 0; ii < ehdr.e_shnum; ii++)
-        {
-            if (get_section_header(data, &ehdr, &shdr, ii) != 0)
-                continue;
+        in_place = !(sections[ii].sh_size % sizeof(struct statistics_offchip_data)) &&
+                   ((ii == 0) || (sections[ii].sh_offset ==
+                                  sections[ii - 1].sh_offset + sections[ii - 1].sh_size));
+    }
 
-            if (strstr(sh_strs + shdr.sh_name, "_offchip_"))
-            {
-                memcpy(blob + offset, data + shdr.sh_offset, shdr.sh_size);
-                offset += shdr.sh_size;
-                *n_rec += shdr.sh_size / sizeof(struct statistics_offchip_data);
-            }
+    if (in_place)
+    {
+        *stats_handle = (struct statistics_offchip_data *)(view.data + sections[0].sh_offset);
+        *n_rec = total_stats_size / sizeof(struct statistics_offchip_data);
+        *map = (void *)view.data;
+        *map_len = view.size;
+
+        /* Hand the mapping over to the caller, the section names are in it too. */
+        view.data = NULL;
+        view.strs = NULL;
+        goto exit;
+    }
+
+    blob = calloc(1, MAX(total_stats_size, 1));
+    if (!blob)
+    {
+        ret = -ENOMEM;
+        goto exit;
+    }
+
+    for (ii = 0; ii < n_sections; ii++)
+    {
+        if (elf_view_read(&view, sections[ii].sh_offset, blob + offset, sections[ii].sh_size))
+        {
+            mctrl_err("Invalid firmware - section %s runs past the end of the file\n",
+                      elf_view_section_name(&view, &sections[ii]));
+            free(blob);
+            ret = -1;
+            goto exit;
         }
-        *stats_handle = blob;
+
+        offset += sections[ii].sh_size;
+        *n_rec += sections[ii].sh_size / sizeof(struct statistics_offchip_data);
     }
-    else
+
+    *stats_handle = (struct statistics_offchip_data *)blob;
+
+exit:
+    free(sections);
+    elf_view_close(&view);
+
+    return ret;
+}
+
+int morse_elf_build_id(const char *path, uint8_t *build_id, size_t size, size_t *len)
+{
+    struct elf_view view;
+    Elf32_Shdr shdr;
+    const char *name;
+    int ii;
+    int ret = -1;
+
+    *len = 0;
+
+    if (elf_view_open(&view, path))
+        return -1;
+
+    /* Finding the section headers of a compressed file means decompressing all of it. */
+    if (!view.data || elf_view_load_section_names(&view))
+        goto exit;
+
+    for (ii = 0; ii < view.ehdr.e_shnum; ii++)
     {
-        *stats_handle = 0;
-        ret = -1;
+        const uint8_t *note;
+        uint32_t namesz;
+        uint32_t descsz;
+        size_t desc_offset;
+
+        if (elf_view_shdr(&view, ii, &shdr) || (shdr.sh_type != SHT_NOTE))
+            continue;
+
+        name = elf_view_section_name(&view, &shdr);
+        if (!name || strcmp(name, ".note.gnu.build-id"))
+            continue;
+
+        /* Note header of name size, descriptor size and type, then the padded name. */
+        note = elf_view_ptr(&view, shdr.sh_offset, shdr.sh_size);
+        if (!note || (shdr.sh_size < 3 * sizeof(uint32_t)))
+            break;
+
+        memcpy(&namesz, note, sizeof(namesz));
+        memcpy(&descsz, note + sizeof(namesz), sizeof(descsz));
+        namesz = le32toh(namesz);
+        descsz = le32toh(descsz);
+        desc_offset = 3 * sizeof(uint32_t) + ALIGN_SIZE((size_t)namesz, sizeof(uint32_t));
+        if ((desc_offset > shdr.sh_size) || (descsz > shdr.sh_size - desc_offset))
+            break;
+
+        *len = MIN((size_t)descsz, size);
+        memcpy(build_id, note + desc_offset, *len);
+        ret = 0;
+        break;
     }
+
+exit:
+    elf_view_close(&view);
+
     return ret;
 }
 
@@ -316,8 +778,17 @@ static void usage(struct morsectrl *mors)
 {
     mctrl_print("\tload_elf [options] -f <filename>\n");
     mctrl_print("\t\t\t\tread an ELF file and load it onto a chip\n");
+#ifdef ENABLE_GZIP
+    mctrl_print("\t\t\t\tthe file may be gzip compressed\n");
+#endif
     mctrl_print("\t\t-b\t\tload a BCF (Board Configuration File)\n");
     mctrl_print("\t\t-c <country>\tBCF country code\n");
+    mctrl_print("\t\t-i\t\tonly write the parts of read only segments that changed since the\n");
+    mctrl_print("\t\t\t\tlast load to this board (ftdi_spi only), after reading back one\n");
+    mctrl_print("\t\t\t\tchunk of each segment to check the board still holds them\n");
+    mctrl_print("\t\t-k\t\twith -i, read back the parts skipped to check they are on the chip\n");
+    mctrl_print("\t\t-v, --verify\tread back part of every write, and all of any write that\n");
+    mctrl_print("\t\t\t\tneeded transfer retries, to check the load\n");
 }
 
 static void print_ehdr(Elf32_Ehdr *ehdr)
@@ -366,94 +837,710 @@ void print_shdr(Elf32_Shdr *shdr)
     mctrl_print("\tsh_entsize:   0x%08x\n", shdr->sh_entsize);
 }
 
-int load_elf_blob(FILE *firmware, struct morsectrl_transport *transport,
-    int idx, Elf32_Off offset, Elf32_Word size, Elf32_Addr addr)
+static uint64_t elf_hash(const uint8_t *data, size_t len)
 {
-    struct morsectrl_transport_buff *write;
+    uint64_t hash = FNV1A_64_OFFSET_BASIS;
+    size_t ii;
 
-    mctrl_print("Loading ELF blob %d size 0x%08x into chip addr 0x%08x\n",
-           idx, size, addr);
-
-    write = morsectrl_transport_raw_write_alloc(transport, size);
-    if (!write)
+    for (ii = 0; ii < len; ii++)
     {
-        mctrl_err("Transport write alloc failed\n");
-        return -1;
+        hash ^= data[ii];
+        hash *= FNV1A_64_PRIME;
     }
 
-    /* Load binary blob directly into a transport buffer. */
-    if (elf_file_load_binary_data(firmware, offset, size, &write->data))
-    {
-        mctrl_err("Load binary failed\n");
-        morsectrl_transport_buff_free(write);
-        return -1;
-    }
+    return hash;
+}
 
-    if (morsectrl_transport_mem_write(transport, write, addr) != 0)
+static int elf_manifest_add(struct elf_manifest *manifest, const struct elf_manifest_chunk *chunk)
+{
+    if (manifest->count == manifest->capacity)
     {
-        mctrl_err("Mem write failed\n");
-        morsectrl_transport_buff_free(write);
-        return -1;
+        size_t capacity = manifest->capacity ? (manifest->capacity * 2) : 64;
+        struct elf_manifest_chunk *chunks;
+
+        chunks = realloc(manifest->chunks, capacity * sizeof(*chunks));
+        if (!chunks)
+            return -ENOMEM;
+
+        manifest->chunks = chunks;
+        manifest->capacity = capacity;
     }
 
+    manifest->chunks[manifest->count++] = *chunk;
+
     return 0;
 }
 
-/*
- * Load a BCF file onto a device.
- * Only the general (board_config) and regdom section for the
- * specified Regulatory domain ('country') are loaded.
- */
-static int load_bcf_sections(struct morsectrl *mors, FILE *firmware, Elf32_Ehdr *ehdr,
-    const char *country)
+static int elf_manifest_chunk_cmp(const void *a, const void *b)
 {
-    struct morsectrl_transport *transport = &mors->transport;
-    Elf32_Off sh_offset[LOAD_BCF_SECTION_TOT] = { 0 };
-    Elf32_Word sh_size[LOAD_BCF_SECTION_TOT] = { 0 };
-    Elf32_Addr addr = 0;
-    Elf32_Shdr sh_strtab;
-    const char *sh_strs;
-    uint8_t *data;
-    int ii;
-
-    mctrl_print("Trying to load BCF file using country %s\n", country);
+    const struct elf_manifest_chunk *chunk_a = a;
+    const struct elf_manifest_chunk *chunk_b = b;
 
-    load_file(firmware, &data);
-    if (data == NULL)
-    {
-        mctrl_err("Load file failed\n");
-        return -1;
-    }
+    return (chunk_a->addr > chunk_b->addr) - (chunk_a->addr < chunk_b->addr);
+}
 
-    if (get_section_header(data, ehdr, &sh_strtab, ehdr->e_shstrndx) != 0) {
-        mctrl_err("Invalid firmware - missing string table\n");
-        return -1;
-    }
+static bool elf_manifest_overlaps(const struct elf_manifest_chunk *a,
+                                  const struct elf_manifest_chunk *b)
+{
+    return ((uint64_t)a->addr < (uint64_t)b->addr + b->len) &&
+           ((uint64_t)b->addr < (uint64_t)a->addr + a->len);
+}
 
-    sh_strs = (const char *)data + sh_strtab.sh_offset;
+/**
+ * @brief Check whether the manifest says a chunk is already on the chip.
+ *
+ * @param manifest  Manifest sorted by address.
+ * @param chunk     Chunk to look for.
+ * @return          true if a chunk at the same address with the same length and hash was written.
+ */
+static bool elf_manifest_contains(const struct elf_manifest *manifest,
+                                  const struct elf_manifest_chunk *chunk)
+{
+    const struct elf_manifest_chunk *found;
 
-    /* Find the required headers */
-    for (ii = 0; ii < ehdr->e_shnum; ii++)
-    {
-        Elf32_Shdr shdr;
+    if (!manifest->count)
+        return false;
 
-        if (get_section_header(data, ehdr, &shdr, ii) != 0)
-            continue;
+    found = bsearch(chunk, manifest->chunks, manifest->count, sizeof(*chunk),
+                    elf_manifest_chunk_cmp);
 
-        if (strcmp(sh_strs + shdr.sh_name, ".board_config") == 0)
-        {
-            if (mors->debug)
-                mctrl_print("Found section header %s\n", sh_strs + shdr.sh_name);
+    return found && (found->len == chunk->len) && (found->hash == chunk->hash);
+}
+
+/**
+ * @brief Find the manifest file of the board being loaded. Boards are identified by the serial
+ *        number of their FTDI channel, so other transports have no manifest.
+ *
+ * @param load  Load to set the manifest path of.
+ */
+static void elf_manifest_find(struct elf_load *load)
+{
+#ifdef ENABLE_TRANS_FTDI_SPI
+    struct morsectrl_transport *transport = &load->mors->transport;
+    const char *home = getenv("HOME");
+
+#if MORSE_WIN_BUILD
+    if (!home)
+        home = getenv("USERPROFILE");
+#endif
+
+    if ((transport->type != MORSECTRL_TRANSPORT_FTDI_SPI) ||
+        !transport->state.ftdi_spi.serial_num[0] || !home)
+        return;
+
+    if (snprintf(load->manifest_path, sizeof(load->manifest_path), "%s/%s%s", home,
+                 ELF_MANIFEST_FILE_PREFIX, transport->state.ftdi_spi.serial_num) >=
+        sizeof(load->manifest_path))
+        load->manifest_path[0] = '\0';
+#endif
+}
+
+void morse_elf_manifest_forget(struct morsectrl *mors)
+{
+    struct elf_load load = {
+        .mors = mors,
+    };
+
+    elf_manifest_find(&load);
+    if (load.manifest_path[0])
+        remove(load.manifest_path);
+}
+
+/**
+ * @brief Read the manifest of the board. A missing or unreadable manifest is treated as empty.
+ *
+ * @param load  Load to fill in the chunks already on the chip of.
+ */
+static void elf_manifest_read(struct elf_load *load)
+{
+    char line[ELF_MANIFEST_LINE_LEN];
+    FILE *file = fopen(load->manifest_path, "r");
+
+    if (!file)
+        return;
+
+    while (fgets(line, sizeof(line), file))
+    {
+        struct elf_manifest_chunk chunk = {
+            .stable = true,
+        };
+
+        if ((sscanf(line, "%" SCNx32 " %" SCNx32 " %" SCNx64,
+                    &chunk.addr, &chunk.len, &chunk.hash) != 3) || !chunk.len)
+            continue;
+
+        if (elf_manifest_add(&load->before, &chunk))
+            break;
+    }
+
+    fclose(file);
+
+    qsort(load->before.chunks, load->before.count, sizeof(*load->before.chunks),
+          elf_manifest_chunk_cmp);
+}
+
+/**
+ * @brief Write the manifest of the board after a successful load. Chunks from earlier loads are
+ *        kept unless this load wrote over them or found the manifest stale, and only stable
+ *        chunks are recorded.
+ *
+ * @param load  Load that has finished.
+ */
+static void elf_manifest_write(struct elf_load *load)
+{
+    struct elf_manifest merged = { 0 };
+    char tmp_path[ELF_MANIFEST_PATH_LEN + 4];
+    FILE *file;
+    size_t ii;
+    size_t jj;
+
+    /* A stale manifest says nothing about the chunks this load didn't write. */
+    for (ii = 0; !load->manifest_stale && (ii < load->before.count); ii++)
+    {
+        for (jj = 0; jj < load->after.count; jj++)
+        {
+            if (elf_manifest_overlaps(&load->before.chunks[ii], &load->after.chunks[jj]))
+                break;
+        }
+
+        if ((jj == load->after.count) && elf_manifest_add(&merged, &load->before.chunks[ii]))
+            goto exit;
+    }
+
+    for (jj = 0; jj < load->after.count; jj++)
+    {
+        if (load->after.chunks[jj].stable && elf_manifest_add(&merged, &load->after.chunks[jj]))
+            goto exit;
+    }
+
+    qsort(merged.chunks, merged.count, sizeof(*merged.chunks), elf_manifest_chunk_cmp);
+
+    /* Write a copy and rename it over the manifest, so it is never left half written. */
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", load->manifest_path);
+    file = fopen(tmp_path, "w");
+    if (!file)
+        goto exit;
+
+    for (ii = 0; ii < merged.count; ii++)
+    {
+        fprintf(file, "%08" PRIx32 " %" PRIx32 " %016" PRIx64 "\n",
+                merged.chunks[ii].addr, merged.chunks[ii].len, merged.chunks[ii].hash);
+    }
+
+    if (fclose(file) || rename(tmp_path, load->manifest_path))
+        remove(tmp_path);
+
+exit:
+    free(merged.chunks);
+}
+
+/**
+ * @brief Copy part of a blob into a transport buffer of its own, for when it can't be written in
+ *        place from the file mapping.
+ *
+ * @param load  Load the blob is part of.
+ * @param data  Data to copy.
+ * @param len   Length of the data.
+ * @return      Transport buffer holding the copy, or NULL on failure.
+ */
+static struct morsectrl_transport_buff *elf_blob_copy(struct elf_load *load,
+    const uint8_t *data, size_t len)
+{
+    struct morsectrl_transport_buff *write;
+
+    write = morsectrl_transport_raw_write_alloc(&load->mors->transport, len);
+    if (write)
+        memcpy(write->data, data, len);
+
+    return write;
+}
+
+/**
+ * @brief Read back part of a blob and compare it with the file.
+ *
+ * @param load      Load the blob is part of.
+ * @param idx       Index of the blob, for reporting.
+ * @param addr      Chip address to read from.
+ * @param data      Data expected on the chip.
+ * @param len       Length to read.
+ * @param cmp_len   Length to compare, the rest is past the end of the file.
+ * @return          0 if the chip holds the data otherwise relevant error.
+ */
+static int elf_blob_compare(struct elf_load *load, int idx, size_t addr, const uint8_t *data,
+    size_t len, size_t cmp_len)
+{
+    struct morsectrl_transport *transport = &load->mors->transport;
+    struct morsectrl_transport_buff *read;
+    size_t ii;
+    int ret;
+
+    read = morsectrl_transport_raw_read_alloc(transport, len);
+    if (!read)
+    {
+        mctrl_err("Transport read alloc failed\n");
+        return -1;
+    }
+
+    ret = morsectrl_transport_mem_read(transport, read, addr);
+    if (ret)
+        mctrl_err("Mem read failed\n");
+
+    for (ii = 0; !ret && (ii < cmp_len); ii++)
+    {
+        if (read->data[ii] != data[ii])
+        {
+            mctrl_err("ELF blob %d mismatch at chip addr 0x%08zx (0x%02x != 0x%02x)\n",
+                      idx, addr + ii, read->data[ii], data[ii]);
+            ret = -1;
+        }
+    }
+
+    morsectrl_transport_buff_free(read);
+
+    return ret;
+}
+
+/**
+ * @brief Check a write reached the chip. A write that needed transfer retries is read back in
+ *        full. Otherwise one chunk is read back, a different one from write to write, which
+ *        catches writes that were lost or went to the wrong place.
+ *
+ * @param load      Load the write is part of.
+ * @param job       Job that was written.
+ * @param retries   Transfer retries the write needed.
+ * @return          0 if the chip holds the data otherwise relevant error.
+ */
+static int elf_blob_write_check(struct elf_load *load, const struct elf_load_job *job,
+    uint32_t retries)
+{
+    size_t chunks = (job->len + ELF_MANIFEST_CHUNK_SIZE - 1) / ELF_MANIFEST_CHUNK_SIZE;
+    size_t offset = 0;
+    size_t len = job->len;
+    uint64_t start_us = time_now_us();
+    int ret;
+
+    if (retries)
+    {
+        load->verify_retried++;
+    }
+    else
+    {
+        offset = (load->verify_seq++ % chunks) * ELF_MANIFEST_CHUNK_SIZE;
+        len = MIN((size_t)ELF_MANIFEST_CHUNK_SIZE, job->len - offset);
+    }
+
+    ret = elf_blob_compare(load, job->idx, job->addr + offset, job->data + offset, len,
+                           (offset < job->cmp_len) ? MIN(len, job->cmp_len - offset) : 0);
+
+    load->verified += len;
+    load->verify_written += job->len;
+    load->verify_us += time_now_us() - start_us;
+
+    return ret;
+}
+
+/**
+ * @brief Write part of a blob to the chip, checking it with MORSE_ELF_LOAD_VERIFY_WRITES.
+ *
+ * @param load  Load the blob is part of.
+ * @param job   Job to write.
+ * @return      0 on success otherwise relevant error.
+ */
+static int elf_blob_write(struct elf_load *load, const struct elf_load_job *job)
+{
+    struct morsectrl_transport *transport = &load->mors->transport;
+    struct morsectrl_transport_buff *write = job->copy;
+    int ret;
+
+    if (!write)
+        write = morsectrl_transport_raw_write_wrap(transport, job->data, job->len);
+
+    if (!write)
+    {
+        mctrl_err("Transport write alloc failed\n");
+        return -1;
+    }
+
+    ret = morsectrl_transport_mem_write(transport, write, job->addr);
+    if (ret)
+        mctrl_err("Mem write failed\n");
+    else if (load->flags & MORSE_ELF_LOAD_VERIFY_WRITES)
+        ret = elf_blob_write_check(load, job, morsectrl_transport_mem_retries(transport));
+
+    /* A copy holds the job's data, so is freed with the job. */
+    if (write != job->copy)
+        morsectrl_transport_buff_free(write);
+
+    return ret;
+}
+
+/**
+ * @brief Read back part of a blob the manifest says is already on the chip.
+ *
+ * @param load  Load the blob is part of.
+ * @param data  Data expected on the chip.
+ * @param len   Length of the data.
+ * @param addr  Chip address of the data.
+ * @return      true if the chip holds the data.
+ */
+static bool elf_blob_on_chip(struct elf_load *load, const uint8_t *data, size_t len,
+    Elf32_Addr addr)
+{
+    struct morsectrl_transport *transport = &load->mors->transport;
+    struct morsectrl_transport_buff *read = morsectrl_transport_raw_read_alloc(transport, len);
+    bool matches;
+
+    if (!read)
+        return false;
+
+    matches = !morsectrl_transport_mem_read(transport, read, addr) &&
+              !memcmp(read->data, data, len);
+
+    morsectrl_transport_buff_free(read);
+
+    return matches;
+}
+
+/**
+ * @brief Read back one chunk of a part of a blob the manifest says is already on the chip. The
+ *        chip may have been reset or power cycled since the manifest was written, which a
+ *        single chunk of each segment is enough to notice.
+ *
+ * @param load  Load the blob is part of.
+ * @param job   Job skipping the part of the blob.
+ * @return      true if the chip holds the chunk.
+ */
+static bool elf_blob_sample_on_chip(struct elf_load *load, const struct elf_load_job *job)
+{
+    size_t chunks = (job->len + ELF_MANIFEST_CHUNK_SIZE - 1) / ELF_MANIFEST_CHUNK_SIZE;
+    size_t offset = (load->verify_seq++ % chunks) * ELF_MANIFEST_CHUNK_SIZE;
+
+    return elf_blob_on_chip(load, job->data + offset,
+                            MIN((size_t)ELF_MANIFEST_CHUNK_SIZE, job->len - offset),
+                            job->addr + offset);
+}
+
+/**
+ * @brief Run a job in the transport stage.
+ *
+ * @param load  Load the job is part of.
+ * @param job   Job to run.
+ * @return      0 on success otherwise relevant error.
+ */
+static int elf_load_job_run(struct elf_load *load, struct elf_load_job *job)
+{
+    int ret = 0;
+
+    if (job->first && !load->mors->quiet)
+    {
+        if (job->type == ELF_LOAD_JOB_UNLOADABLE)
+            mctrl_print("Loading ELF blob %d - unloadable, skipping\n", job->idx);
+        else if (job->type == ELF_LOAD_JOB_VERIFY)
+            mctrl_print("Verifying ELF blob %d size 0x%08x at chip addr 0x%08x\n",
+                        job->idx, job->blob_size, job->addr);
+        else
+            mctrl_print("Loading ELF blob %d size 0x%08x into chip addr 0x%08x\n",
+                        job->idx, job->blob_size, job->addr);
+    }
+
+    switch (job->type)
+    {
+    case ELF_LOAD_JOB_UNLOADABLE:
+        break;
+
+    case ELF_LOAD_JOB_SKIP:
+        if (load->manifest_stale)
+        {
+            ret = elf_blob_write(load, job);
+            if (!ret)
+                load->written += job->len;
+            break;
+        }
+
+        if ((load->flags & MORSE_ELF_LOAD_CHECK) ?
+            elf_blob_on_chip(load, job->data, job->len, job->addr) :
+            (!job->sample || elf_blob_sample_on_chip(load, job)))
+        {
+            load->skipped += job->len;
+            break;
+        }
+
+        if (!load->mors->quiet)
+            mctrl_print("Chip memory at 0x%08zx differs from the manifest, rewriting\n",
+                        job->addr);
+
+        /* Without -k only a sample is checked, so the rest of the manifest can't be trusted. */
+        if (!(load->flags & MORSE_ELF_LOAD_CHECK))
+            load->manifest_stale = true;
+        /* fall through */
+
+    case ELF_LOAD_JOB_WRITE:
+        ret = elf_blob_write(load, job);
+        if (!ret && job->stable)
+            load->written += job->len;
+        break;
+
+    case ELF_LOAD_JOB_VERIFY:
+        ret = elf_blob_compare(load, job->idx, job->addr, job->data, job->len, job->cmp_len);
+        break;
+    }
+
+    return ret;
+}
+
+static void elf_load_job_free(struct elf_load_job *job)
+{
+    if (job->copy)
+        morsectrl_transport_buff_free(job->copy);
+    job->copy = NULL;
+}
+
+#ifdef ELF_LOAD_PIPELINE
+/**
+ * @brief Queue a job for the transport stage, waiting for room if the queue is full.
+ *
+ * @param pipeline  Pipeline to queue the job on.
+ * @param job       Job to queue, which the pipeline takes ownership of.
+ * @return          0 on success, or -ECANCELED if the transport stage has failed.
+ */
+static int elf_load_pipeline_push(struct elf_load_pipeline *pipeline, struct elf_load_job *job)
+{
+    uint64_t wait_start_us = time_now_us();
+
+    pthread_mutex_lock(&pipeline->lock);
+    while (!pipeline->abort && (pipeline->queued - pipeline->taken == ELF_LOAD_QUEUE_LEN))
+        pthread_cond_wait(&pipeline->cond, &pipeline->lock);
+
+    if (pipeline->abort)
+    {
+        pthread_mutex_unlock(&pipeline->lock);
+        elf_load_job_free(job);
+        return -ECANCELED;
+    }
+
+    pipeline->jobs[pipeline->queued % ELF_LOAD_QUEUE_LEN] = *job;
+    pipeline->queued++;
+    pthread_cond_broadcast(&pipeline->cond);
+    pthread_mutex_unlock(&pipeline->lock);
+
+    /* Waiting for room is not work, take it off the reader's busy time. */
+    pipeline->reader_busy_us -= time_now_us() - wait_start_us;
+
+    return 0;
+}
+#endif
+
+/**
+ * @brief Hand a prepared job to the transport stage.
+ *
+ * @param load  Load the job is part of.
+ * @param job   Job to hand over, which is taken ownership of.
+ * @return      0 on success otherwise relevant error.
+ */
+static int elf_load_job_push(struct elf_load *load, struct elf_load_job *job)
+{
+    int ret;
+
+#ifdef ELF_LOAD_PIPELINE
+    if (load->pipeline)
+        return elf_load_pipeline_push(load->pipeline, job);
+#endif
+
+    ret = elf_load_job_run(load, job);
+    elf_load_job_free(job);
+
+    return ret;
+}
+
+/**
+ * @brief Fault in the pages of part of the file mapping, so the transport stage doesn't wait on
+ *        file I/O.
+ *
+ * @param data  Start of the data.
+ * @param len   Length of the data.
+ */
+static void elf_load_prefetch(const uint8_t *data, size_t len)
+{
+    volatile uint8_t sink = 0;
+    size_t ii;
+
+    for (ii = 0; ii < len; ii += ELF_MANIFEST_CHUNK_SIZE)
+        sink ^= data[ii];
+    if (len)
+        sink ^= data[len - 1];
+    (void)sink;
+}
+
+/*
+ * Prepare the jobs for a blob. Blobs are written straight from the file mapping. Blobs of
+ * compressed files, or that run past the end of the file, are decompressed or zero padded a piece
+ * at a time into a staging buffer and each job gets a copy. When the board has a manifest the blob
+ * is hashed in chunks, and an incremental load skips runs of chunks of read only segments already
+ * on the chip.
+ */
+static int elf_blob_plan(struct elf_load *load, int idx, Elf32_Off offset,
+    Elf32_Word size, Elf32_Addr addr, bool stable)
+{
+    const struct elf_view *view = &load->view;
+    bool incremental = stable && (load->flags & MORSE_ELF_LOAD_INCREMENTAL);
+    bool verify = load->flags & MORSE_ELF_LOAD_VERIFY;
+    struct elf_load_job job = {
+        .idx = idx,
+        .blob_size = size,
+        .first = true,
+        .stable = stable,
+    };
+    const uint8_t *mapped;
+    size_t in_file = (offset < view->size) ? MIN((size_t)size, view->size - offset) : 0;
+    size_t piece;
+    size_t pos = 0;
+    bool sampled = false;
+    int ret;
+
+    /* The transport may read up to the next word boundary. */
+    mapped = elf_view_ptr(view, offset, ALIGN_SIZE(size, sizeof(uint32_t)));
+    if (!mapped && !load->staging)
+    {
+        load->staging = malloc(ELF_LOAD_JOB_MAX);
+        if (!load->staging)
+            return -ENOMEM;
+    }
+
+    for (piece = 0; piece < size; piece = pos)
+    {
+        size_t piece_len = MIN((size_t)ELF_LOAD_JOB_MAX, size - piece);
+        const uint8_t *data;
+
+        if (mapped)
+        {
+            data = mapped + piece;
+        }
+        else
+        {
+            data = load->staging;
+            if (elf_view_read_padded(view, offset + piece, load->staging, piece_len))
+            {
+                mctrl_err("Failed to read ELF blob %d\n", idx);
+                return -1;
+            }
+        }
+
+        while (pos < piece + piece_len)
+        {
+            size_t run = pos;
+            bool skip = false;
+
+            /* Gather a run of chunks that are either all changed or all on the chip already. */
+            while (pos < piece + piece_len)
+            {
+                struct elf_manifest_chunk chunk = {
+                    .addr = addr + pos,
+                    .len = MIN((size_t)ELF_MANIFEST_CHUNK_SIZE, piece + piece_len - pos),
+                    .stable = stable,
+                };
+                bool unchanged = false;
+
+                if (load->manifest_path[0])
+                {
+                    chunk.hash = elf_hash(data + pos - piece, chunk.len);
+                    unchanged = incremental && elf_manifest_contains(&load->before, &chunk);
+                    if ((pos > run) && (unchanged != skip))
+                        break;
+
+                    ret = elf_manifest_add(&load->after, &chunk);
+                    if (ret)
+                        return ret;
+                }
+                else if (mapped)
+                {
+                    elf_load_prefetch(data + pos - piece, chunk.len);
+                }
+
+                skip = unchanged;
+                pos += chunk.len;
+            }
+
+            job.type = verify ? ELF_LOAD_JOB_VERIFY :
+                       (skip ? ELF_LOAD_JOB_SKIP : ELF_LOAD_JOB_WRITE);
+            job.sample = skip && !sampled;
+            sampled |= skip;
+            job.addr = addr + run;
+            job.data = data + run - piece;
+            job.len = pos - run;
+            job.cmp_len = (run < in_file) ? MIN(job.len, in_file - run) : 0;
+
+            if (!mapped)
+            {
+                job.copy = elf_blob_copy(load, job.data, job.len);
+                if (!job.copy)
+                {
+                    mctrl_err("Transport write alloc failed\n");
+                    return -1;
+                }
+                job.data = job.copy->data;
+            }
+
+            ret = elf_load_job_push(load, &job);
+            if (ret)
+                return ret;
+
+            job.first = false;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Load a BCF file onto a device.
+ * Only the general (board_config) and regdom section for the
+ * specified Regulatory domain ('country') are loaded.
+ */
+static int load_bcf_sections(struct elf_load *load)
+{
+    struct morsectrl *mors = load->mors;
+    const struct elf_view *view = &load->view;
+    const char *country = load->country;
+    Elf32_Off sh_offset[LOAD_BCF_SECTION_TOT] = { 0 };
+    Elf32_Word sh_size[LOAD_BCF_SECTION_TOT] = { 0 };
+    Elf32_Addr addr = 0;
+    int ii;
+
+    if (!mors->quiet)
+        mctrl_print("Trying to load BCF file using country %s\n", country);
+
+    if (elf_view_load_section_names(&load->view) != 0) {
+        mctrl_err("Invalid firmware - missing string table\n");
+        return -1;
+    }
+
+    /* Find the required headers */
+    for (ii = 0; ii < view->ehdr.e_shnum; ii++)
+    {
+        Elf32_Shdr shdr;
+        const char *name;
+
+        if (elf_view_shdr(view, ii, &shdr) != 0)
+            continue;
+
+        name = elf_view_section_name(view, &shdr);
+        if (!name)
+            continue;
+
+        if (strcmp(name, ".board_config") == 0)
+        {
+            if (mors->debug)
+                mctrl_print("Found section header %s\n", name);
 
             addr = shdr.sh_addr;
             sh_offset[0] = shdr.sh_offset;
             sh_size[0] = shdr.sh_size;
         }
-        else if ((strncmp(sh_strs + shdr.sh_name, ".regdom_", strlen(".regdom_")) == 0) &&
-                 (strcmp(sh_strs + shdr.sh_name + strlen(".regdom_"), country) == 0))
+        else if ((strncmp(name, ".regdom_", strlen(".regdom_")) == 0) &&
+                 (strcmp(name + strlen(".regdom_"), country) == 0))
         {
             if (mors->debug)
-                mctrl_print("Found section header %s\n", sh_strs + shdr.sh_name);
+                mctrl_print("Found section header %s\n", name);
 
             sh_offset[1] = shdr.sh_offset;
             sh_size[1] = shdr.sh_size;
@@ -480,7 +1567,15 @@ static int load_bcf_sections(struct morsectrl *mors, FILE *firmware, Elf32_Ehdr
 
     for (ii = 0; ii < LOAD_BCF_SECTION_TOT; ii++)
     {
-        int ret = load_elf_blob(firmware, transport, ii, sh_offset[ii], sh_size[ii], addr);
+        int ret;
+
+        if (!elf_view_contains(view, sh_offset[ii], sh_size[ii]))
+        {
+            mctrl_err("BCF section %d runs past the end of the file\n", ii);
+            return -1;
+        }
+
+        ret = elf_blob_plan(load, ii, sh_offset[ii], sh_size[ii], addr, false);
         if (ret < 0)
         {
             return ret;
@@ -494,60 +1589,271 @@ static int load_bcf_sections(struct morsectrl *mors, FILE *firmware, Elf32_Ehdr
 /*
  * Load ELF program sections onto a device.
  */
-static int load_blobs(struct morsectrl *mors, FILE *firmware, Elf32_Ehdr *ehdr)
+static int load_blobs(struct elf_load *load)
 {
-    struct morsectrl_transport *transport = &mors->transport;
-    Elf32_Phdr *phdr = NULL;
+    struct morsectrl *mors = load->mors;
+    const struct elf_view *view = &load->view;
+    Elf32_Phdr *phdrs;
+    Elf32_Phdr phdr;
     int ii;
-    int ret;
+    int ret = 0;
+
+    if (!mors->quiet)
+        mctrl_print("%d blobs to try to load\n", view->ehdr.e_phnum);
 
-    mctrl_print("%d blobs to try to load\n", ehdr->e_phnum);
+    /* Read all the headers first, so a compressed file is streamed through once. */
+    phdrs = calloc(MAX(view->ehdr.e_phnum, 1), sizeof(*phdrs));
+    if (!phdrs)
+        return -ENOMEM;
 
-    phdr = elf_file_load_program_headers(firmware, ehdr->e_phoff, ehdr->e_phentsize *ehdr->e_phnum);
-    if (!phdr)
+    for (ii = 0; ii < view->ehdr.e_phnum; ii++)
     {
-        return -1;
+        if (elf_view_phdr(view, ii, &phdrs[ii]))
+        {
+            mctrl_err("Program header %d runs past the end of the file\n", ii);
+            ret = -1;
+            goto exit;
+        }
     }
 
-    for (ii = 0; ii < ehdr->e_phnum; ii++)
+    for (ii = 0; ii < view->ehdr.e_phnum; ii++)
     {
+        phdr = phdrs[ii];
+
         if (mors->debug)
-            print_phdr(&phdr[ii]);
+            print_phdr(&phdr);
 
         /* Skip empty or unloadable blobs. Filter out external flash. */
-        if ((phdr[ii].p_type != PT_LOAD) ||
-            (phdr[ii].p_memsz == 0) ||
-            !(phdr[ii].p_flags & (PF_X | PF_W | PF_R)) ||
-            ((phdr[ii].p_paddr & HOST_FLASH_BASE_MASK) == HOST_IFLASH_BASE_ADDR) ||
-            ((phdr[ii].p_paddr & HOST_FLASH_BASE_MASK) == HOST_DFLASH_BASE_ADDR))
+        if ((phdr.p_type != PT_LOAD) ||
+            (phdr.p_memsz == 0) ||
+            !(phdr.p_flags & (PF_X | PF_W | PF_R)) ||
+            ((phdr.p_paddr & HOST_FLASH_BASE_MASK) == HOST_IFLASH_BASE_ADDR) ||
+            ((phdr.p_paddr & HOST_FLASH_BASE_MASK) == HOST_DFLASH_BASE_ADDR))
         {
-            mctrl_print("Loading ELF blob %d - unloadable, skipping\n", ii);
+            struct elf_load_job job = {
+                .type = ELF_LOAD_JOB_UNLOADABLE,
+                .idx = ii,
+                .first = true,
+            };
+
+            ret = elf_load_job_push(load, &job);
+            if (ret)
+                goto exit;
             continue;
         }
 
-        ret = load_elf_blob(firmware, transport, ii, phdr[ii].p_offset,
-            ALIGN_SIZE(phdr[ii].p_memsz, phdr[ii].p_align), phdr[ii].p_paddr);
+        if (!elf_view_contains(view, phdr.p_offset, phdr.p_filesz))
+        {
+            mctrl_err("ELF blob %d runs past the end of the file\n", ii);
+            ret = -1;
+            goto exit;
+        }
+
+        /* Writable segments may have been changed by the firmware since they were loaded. */
+        ret = elf_blob_plan(load, ii, phdr.p_offset,
+            ALIGN_SIZE(phdr.p_memsz, phdr.p_align), phdr.p_paddr, !(phdr.p_flags & PF_W));
         if (ret < 0)
+            goto exit;
+    }
+
+exit:
+    free(phdrs);
+
+    return ret;
+}
+
+/* Prepare every job of the load, in order. */
+static int elf_load_plan(struct elf_load *load)
+{
+    if (load->country)
+        return load_bcf_sections(load);
+
+    return load_blobs(load);
+}
+
+#ifdef ELF_LOAD_PIPELINE
+static void *elf_load_reader(void *arg)
+{
+    struct elf_load *load = arg;
+    struct elf_load_pipeline *pipeline = load->pipeline;
+    uint64_t start_us = time_now_us();
+    int ret = elf_load_plan(load);
+
+    pipeline->reader_busy_us += time_now_us() - start_us;
+
+    pthread_mutex_lock(&pipeline->lock);
+    pipeline->reader_ret = ret;
+    pipeline->done = true;
+    pthread_cond_broadcast(&pipeline->cond);
+    pthread_mutex_unlock(&pipeline->lock);
+
+    return NULL;
+}
+
+/**
+ * @brief Run a load as a two stage pipeline. A reader thread walks the file, faulting in, hashing
+ *        and copying what is needed, while this thread runs the transport transfers.
+ *
+ * @param load  Load to run.
+ * @return      0 on success otherwise relevant error.
+ */
+static int elf_load_pipelined(struct elf_load *load)
+{
+    struct elf_load_pipeline pipeline = { 0 };
+    struct elf_load_job job;
+    uint64_t start_us = time_now_us();
+    uint64_t total_us;
+    int ret = 0;
+
+    pthread_mutex_init(&pipeline.lock, NULL);
+    pthread_cond_init(&pipeline.cond, NULL);
+
+    load->pipeline = &pipeline;
+    if (pthread_create(&pipeline.thread, NULL, elf_load_reader, load))
+    {
+        load->pipeline = NULL;
+        ret = elf_load_plan(load);
+        goto exit;
+    }
+
+    while (true)
+    {
+        pthread_mutex_lock(&pipeline.lock);
+        while ((pipeline.queued == pipeline.taken) && !pipeline.done)
+            pthread_cond_wait(&pipeline.cond, &pipeline.lock);
+
+        if (pipeline.queued == pipeline.taken)
         {
-            free(phdr);
-            return ret;
+            pthread_mutex_unlock(&pipeline.lock);
+            break;
+        }
+
+        job = pipeline.jobs[pipeline.taken % ELF_LOAD_QUEUE_LEN];
+        pipeline.taken++;
+        pthread_cond_broadcast(&pipeline.cond);
+        pthread_mutex_unlock(&pipeline.lock);
+
+        /* After a failure the remaining jobs are only freed. */
+        if (!ret)
+        {
+            uint64_t job_start_us = time_now_us();
+
+            ret = elf_load_job_run(load, &job);
+            pipeline.writer_busy_us += time_now_us() - job_start_us;
+
+            if (ret)
+            {
+                pthread_mutex_lock(&pipeline.lock);
+                pipeline.abort = true;
+                pthread_cond_broadcast(&pipeline.cond);
+                pthread_mutex_unlock(&pipeline.lock);
+            }
         }
+        elf_load_job_free(&job);
     }
 
-    free(phdr);
+    pthread_join(pipeline.thread, NULL);
+    load->pipeline = NULL;
 
-    return 0;
+    if (!ret)
+        ret = pipeline.reader_ret;
+
+    total_us = MAX(time_now_us() - start_us, 1);
+    if (!ret && !load->mors->quiet)
+    {
+        mctrl_print("Reader busy %lu ms (%lu%%), transport busy %lu ms (%lu%%) of %lu ms\n",
+                    (unsigned long)(pipeline.reader_busy_us / 1000),
+                    (unsigned long)(pipeline.reader_busy_us * 100 / total_us),
+                    (unsigned long)(pipeline.writer_busy_us / 1000),
+                    (unsigned long)(pipeline.writer_busy_us * 100 / total_us),
+                    (unsigned long)(total_us / 1000));
+    }
+
+exit:
+    pthread_cond_destroy(&pipeline.cond);
+    pthread_mutex_destroy(&pipeline.lock);
+
+    return ret;
+}
+#endif
+
+int morse_elf_load(struct morsectrl *mors, const char *path, const char *country,
+                   unsigned int flags)
+{
+    struct elf_load load = {
+        .mors = mors,
+        .country = country,
+        .flags = flags,
+        /* Start reading back at a different chunk of each write from load to load. */
+        .verify_seq = time_now_us(),
+    };
+    int ret;
+
+    if (!(flags & MORSE_ELF_LOAD_VERIFY))
+        elf_manifest_find(&load);
+
+    if ((flags & MORSE_ELF_LOAD_INCREMENTAL) && !load.manifest_path[0])
+    {
+        mctrl_err("Incremental loads need a board identified by its FTDI serial number\n");
+        return -1;
+    }
+
+    if (elf_view_open(&load.view, path))
+        return -1;
+
+    if (mors->debug)
+        print_ehdr(&load.view.ehdr);
+
+    if (load.manifest_path[0])
+        elf_manifest_read(&load);
+
+#ifdef ELF_LOAD_PIPELINE
+    ret = elf_load_pipelined(&load);
+#else
+    ret = elf_load_plan(&load);
+#endif
+
+    if (load.manifest_path[0])
+    {
+        /* After a failure it is unknown what is on the chip. */
+        if (ret)
+            remove(load.manifest_path);
+        else
+            elf_manifest_write(&load);
+    }
+
+    if (!ret && (flags & MORSE_ELF_LOAD_INCREMENTAL) && !mors->quiet)
+        mctrl_print("Wrote %zu octets of read only segments, skipped %zu already on the chip\n",
+                    load.written, load.skipped);
+
+    if (!ret && (flags & MORSE_ELF_LOAD_VERIFY_WRITES) && !mors->quiet)
+    {
+        mctrl_print("Verified %zu of %zu octets written (%zu%%, %u writes with retries read back "
+                    "in full) in %lu ms\n", load.verified, load.verify_written,
+                    load.verified * 100 / MAX(load.verify_written, (size_t)1), load.verify_retried,
+                    (unsigned long)(load.verify_us / 1000));
+    }
+
+    free(load.before.chunks);
+    free(load.after.chunks);
+    free(load.staging);
+    elf_view_close(&load.view);
+
+    return ret;
 }
 
 int load_elf(struct morsectrl *mors, int argc, char *argv[])
 {
-    FILE *firmware;
     int option;
     char *path = NULL;
-    Elf32_Ehdr ehdr;
     int ret = 0;
     const char *country = NULL;
     bool load_bcf = false;
+    unsigned int flags = 0;
+    static const struct option long_options[] = {
+        {"verify", no_argument, NULL, 'v'},
+        {NULL, 0, NULL, 0},
+    };
 
     if (argc < 1)
     {
@@ -555,13 +1861,22 @@ int load_elf(struct morsectrl *mors, int argc, char *argv[])
         return -1;
     }
 
-    while ((option = getopt(argc, argv, "f:drbc:")) != -1)
+    while ((option = getopt_long(argc, argv, "f:drbc:ikv", long_options, NULL)) != -1)
     {
         switch (option)
         {
+        case 'v':
+            flags |= MORSE_ELF_LOAD_VERIFY_WRITES;
+            break;
         case 'f':
             path = optarg;
             break;
+        case 'i':
+            flags |= MORSE_ELF_LOAD_INCREMENTAL;
+            break;
+        case 'k':
+            flags |= MORSE_ELF_LOAD_CHECK;
+            break;
         case 'b':
             load_bcf = true;
             break;
@@ -580,43 +1895,25 @@ int load_elf(struct morsectrl *mors, int argc, char *argv[])
         return -1;
     }
 
-    firmware = fopen(path, "rb");
-    if (!firmware)
+    if (load_bcf && (country == NULL))
     {
-        mctrl_err("Failed to open %s\n", path);
+        mctrl_err("Country code must be specified for BCF load\n");
         return -1;
     }
 
-    if (load_file_header(firmware, &ehdr))
+    if (!load_bcf && (country != NULL))
     {
-        ret = -1;
-        goto exit;
+        mctrl_err("Country code can only be specified for BCF load\n");
+        return -1;
     }
 
-    if (mors->debug)
-        print_ehdr(&ehdr);
-
-    if (load_bcf)
+    if ((flags & MORSE_ELF_LOAD_CHECK) && !(flags & MORSE_ELF_LOAD_INCREMENTAL))
     {
-        if (country == NULL)
-        {
-            mctrl_err("Country code must be specified for BCF load\n");
-            return -1;
-        }
-        ret = load_bcf_sections(mors, firmware, &ehdr, country);
-    }
-    else
-    {
-        if (country != NULL)
-        {
-            mctrl_err("Country code can only be specified for BCF load\n");
-            return -1;
-        }
-        ret = load_blobs(mors, firmware, &ehdr);
+        mctrl_err("Checking skipped chunks needs an incremental load\n");
+        return -1;
     }
 
-exit:
-    fclose(firmware);
+    ret = morse_elf_load(mors, path, country, flags);
 
     if (!ret)
         mctrl_print("ELF successfully loaded\n");
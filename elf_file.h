@@ -8,10 +8,75 @@
 #include <stddef.h>
 #include <stdio.h>
 #include "offchip_statistics.h"
+#include "utilities.h"
 #include "transport/transport.h"
 
+/**
+ * @brief Load the stats metadata records from the _offchip_ sections of a firmware ELF. Only the
+ *        headers and those sections are read.
+ *
+ * @param stats_handle  Filled with the records.
+ * @param n_rec         Filled with the number of records.
+ * @param path          Path of the firmware ELF.
+ * @param map           Filled with the mapping of the file the records are referenced in place
+ *                      from, which the caller must unmap, or NULL if the records were copied to
+ *                      the heap for the caller to free.
+ * @param map_len       Filled with the length of the mapping.
+ * @return              0 on success otherwise relevant error.
+ */
 int morse_stats_load(struct statistics_offchip_data **stats_handle,
                      size_t *n_rec,
-                     const uint8_t *data);
+                     const char *path,
+                     void **map,
+                     size_t *map_len);
+
+/** Read back what would be loaded and compare it with the file, instead of loading it. */
+#define MORSE_ELF_LOAD_VERIFY       BIT(0)
+/**
+ * Skip the parts of read only segments that the board's manifest says are already on the chip.
+ * Every load over ftdi_spi records what it wrote in a manifest kept against the FTDI serial number.
+ * One chunk of each segment is read back before its skipped parts are trusted to be on the chip,
+ * and if it differs nothing more is skipped.
+ */
+#define MORSE_ELF_LOAD_INCREMENTAL  BIT(1)
+/** Read back the parts skipped by an incremental load, writing any that are not on the chip. */
+#define MORSE_ELF_LOAD_CHECK        BIT(2)
+/**
+ * Read back one chunk of every write, and all of any write that needed transfer retries. Much
+ * cheaper than MORSE_ELF_LOAD_VERIFY of the whole file after the load.
+ */
+#define MORSE_ELF_LOAD_VERIFY_WRITES BIT(3)
+
+/**
+ * @brief Load the program segments of a firmware ELF, or the board config and regdom sections of
+ *        a BCF, onto the chip.
+ *
+ * @param mors      Morsectrl context with an initialised transport.
+ * @param path      Path of the ELF or BCF file.
+ * @param country   BCF country code, or NULL to load a firmware ELF.
+ * @param flags     MORSE_ELF_LOAD_* flags.
+ * @return          0 on success otherwise relevant error.
+ */
+int morse_elf_load(struct morsectrl *mors, const char *path, const char *country,
+                   unsigned int flags);
+
+/**
+ * @brief Forget what the manifest says is on the board, after the chip has been reset.
+ *
+ * @param mors      Morsectrl context with an initialised transport.
+ */
+void morse_elf_manifest_forget(struct morsectrl *mors);
+
+/**
+ * @brief Get the GNU build ID of an ELF file.
+ *
+ * @param path      Path of the ELF file.
+ * @param build_id  Buffer to copy the build ID into.
+ * @param size      Size of the buffer. Longer build IDs are truncated.
+ * @param len       Filled with the length of the build ID copied.
+ * @return          0 on success, otherwise -1 if the file has no build ID or is compressed (as
+ *                  finding it would mean decompressing the whole file).
+ */
+int morse_elf_build_id(const char *path, uint8_t *build_id, size_t size, size_t *len);
 
 int load_elf(struct morsectrl *mors, int argc, char *argv[]);
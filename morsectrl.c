@@ -37,6 +37,8 @@ struct command_handler commands[] =
 #endif
 #if !defined(MORSE_CLIENT) || defined(ENABLE_CMD_STATS)
     {"stats", stats, true, true},
+    {"stats_decode", stats_decode, false, true},
+    {"stats_query", stats_query, false, true},
 #endif
 #if !defined(MORSE_CLIENT) || defined(ENABLE_CMD_CHANNEL)
     {"channel", channel, true, true},
@@ -197,6 +199,9 @@ struct command_handler commands[] =
 #if !defined(MORSE_CLIENT) || defined(ENABLE_CMD_TRANSRAW)
     {"transraw",  transraw,  true, true},
 #endif
+#if defined(ENABLE_TRANS_FTDI_SPI) && (!defined(MORSE_CLIENT) || defined(ENABLE_CMD_PROGRAM))
+    {"program", program, false, true},
+#endif
 #if !defined(MORSE_CLIENT) || defined(ENABLE_CMD_OTP)
     {"otp", otp, true, true},
 #endif
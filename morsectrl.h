@@ -18,9 +18,14 @@ typedef struct statistics_offchip_data offchip_stats_t; /* typedef reqd for circ
 
 struct morsectrl {
     bool debug;
+    /* Only report errors, e.g. while several chips are handled at once. */
+    bool quiet;
     struct morsectrl_transport transport;
+    /* Stats metadata records, only held while the metadata is being loaded. */
     offchip_stats_t *stats;
     size_t n_stats;
+    /* Stats metadata indexed by tag, built from the records once they are loaded. */
+    struct statistics_offchip_index *stats_index;
 };
 
 /**
@@ -47,6 +52,8 @@ int version(struct morsectrl *mors, int argc, char *argv[]);
 int hw_version(struct morsectrl *mors, int argc, char *argv[]);
 int reset(struct morsectrl *mors, int argc, char *argv[]);
 int stats(struct morsectrl *mors, int argc, char *argv[]);
+int stats_decode(struct morsectrl *mors, int argc, char *argv[]);
+int stats_query(struct morsectrl *mors, int argc, char *argv[]);
 int channel(struct morsectrl *mors, int argc, char *argv[]);
 int bsscolor(struct morsectrl *mors, int argc, char *argv[]);
 int ampdu(struct morsectrl *mors, int argc, char *argv[]);
@@ -98,6 +105,7 @@ int tdc_pg_disable(struct morsectrl *mors, int argc, char *argv[]);
 int capabilities(struct morsectrl *mors, int argc, char *argv[]);
 int load_elf(struct morsectrl *mors, int argc, char *argv[]);
 int transraw(struct morsectrl *mors, int argc, char *argv[]);
+int program(struct morsectrl *mors, int argc, char *argv[]);
 int otp(struct morsectrl *mors, int argc, char *argv[]);
 int hwkeydump(struct morsectrl *mors, int argc, char *argv[]);
 int twt(struct morsectrl *mors, int argc, char *argv[]);
@@ -45,6 +45,10 @@ MORSECTRL_SRCS += physm_watchdog.c
 MORSECTRL_SRCS += mesh_config.c
 MORSECTRL_SRCS += mbca.c
 
+ifeq ($(CONFIG_MORSE_TRANS_FTDI_SPI),1)
+MORSECTRL_SRCS += program.c
+endif
+
 MORSECTRL_WIN_SRCS := $(WIN_SRCS)
 
 MORSECTRL_LINUX_SRCS := $(LINUX_SRCS)
@@ -3,34 +3,191 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <inttypes.h>
 #include <string.h>
+#include <errno.h>
+#ifndef MORSE_WIN_BUILD
+#include <sys/mman.h>
+#endif
 #include "offchip_statistics.h"
 #include "command.h"
 
 
+/*
+ * Resolve the format a stat is printed with. Decimal stats of unsigned types are printed unsigned,
+ * and formats this version doesn't know are printed raw.
+ */
+static enum morse_statistics_format stats_offchip_format(const struct statistics_offchip_data *data)
+{
+    enum morse_statistics_format format = data->format;
+
+    if ((format == MORSE_STATS_FMT_DEC) && !strncmp(data->type_str, "uint", 4))
+        format = MORSE_STATS_FMT_U_DEC;
+
+    if (format > MORSE_STATS_FMT_LAST)
+        format = MORSE_STATS_FMT_LAST;
+
+    return format;
+}
+
+/* Types of stats with a fixed size. */
+static const struct
+{
+    const char *type;
+    uint8_t width;
+} stats_offchip_widths[] = {
+    { "int8_t", 1 }, { "uint8_t", 1 }, { "bool", 1 }, { "char", 1 },
+    { "int16_t", 2 }, { "uint16_t", 2 },
+    { "int32_t", 4 }, { "uint32_t", 4 },
+    { "int64_t", 8 }, { "uint64_t", 8 },
+};
+
+/*
+ * Get the size of a stat's value from its type, or 0 if the type has no fixed size.
+ */
+static uint8_t stats_offchip_width(const struct statistics_offchip_data *data)
+{
+    size_t type_len = strnlen(data->type_str, sizeof(data->type_str));
+    size_t ii;
+
+    for (ii = 0; ii < MORSE_ARRAY_SIZE(stats_offchip_widths); ii++)
+    {
+        if ((strlen(stats_offchip_widths[ii].type) == type_len) &&
+            !memcmp(stats_offchip_widths[ii].type, data->type_str, type_len))
+            return stats_offchip_widths[ii].width;
+    }
+
+    return 0;
+}
+
+/*
+ * Release the records the index is built from.
+ */
+static void stats_offchip_release_records(struct morsectrl *mors, void *map, size_t map_len)
+{
+    if (map)
+        stats_offchip_unmap(map, map_len);
+    else
+        free(mors->stats);
+
+    mors->stats = NULL;
+    mors->n_stats = 0;
+}
+
+int stats_offchip_index_build(struct morsectrl *mors, void *map, size_t map_len)
+{
+    struct statistics_offchip_index *index;
+    struct statistics_offchip_entry *entries;
+    uint32_t *slots;
+    char *strings;
+    size_t max_tag = 0;
+    size_t max_strings_len = 0;
+    size_t ii;
+
+    stats_offchip_free(mors);
+
+    for (ii = 0; ii < mors->n_stats; ii++)
+    {
+        max_tag = MAX(max_tag, (size_t)mors->stats[ii].tag);
+        max_strings_len += strnlen(mors->stats[ii].key, sizeof(mors->stats[ii].key)) + 1;
+    }
+
+    /* The slots, entries and string pool are allocated along with the index. */
+    index = calloc(1, sizeof(*index) + ((max_tag + 1) * sizeof(*index->slots)) +
+                   (mors->n_stats * sizeof(*index->entries)) + max_strings_len);
+    if (!index)
+    {
+        stats_offchip_release_records(mors, map, map_len);
+        return -ENOMEM;
+    }
+
+    slots = (uint32_t *)(index + 1);
+    entries = (struct statistics_offchip_entry *)(slots + max_tag + 1);
+    strings = (char *)(entries + mors->n_stats);
+    index->slots = slots;
+    index->n_slots = max_tag + 1;
+    index->entries = entries;
+    index->strings = strings;
+
+    for (ii = 0; ii < mors->n_stats; ii++)
+    {
+        const struct statistics_offchip_data *data = &mors->stats[ii];
+        struct statistics_offchip_entry *entry = &entries[index->n_entries];
+        size_t key_len = strnlen(data->key, sizeof(data->key));
+
+        if (slots[data->tag])
+            continue;
+
+        entry->tag = data->tag;
+        entry->format = stats_offchip_format(data);
+        entry->width = stats_offchip_width(data);
+        entry->key_offset = index->strings_len;
+        memcpy(&strings[index->strings_len], data->key, key_len);
+        index->strings_len += key_len + 1;
+        slots[data->tag] = ++index->n_entries;
+    }
+
+    stats_offchip_release_records(mors, map, map_len);
+    mors->stats_index = index;
+
+    return 0;
+}
+
+void stats_offchip_unmap(void *map, size_t map_len)
+{
+#ifndef MORSE_WIN_BUILD
+    munmap(map, map_len);
+#endif
+}
+
+void stats_offchip_free(struct morsectrl *mors)
+{
+    struct statistics_offchip_index *index = mors->stats_index;
+
+    if (index && index->map)
+        stats_offchip_unmap(index->map, index->map_len);
+    free(index);
+
+    mors->stats_index = NULL;
+}
+
 /*
 * Get the offchip data for this tag,
 * or NULL if none can be found.
 */
-struct statistics_offchip_data *get_stats_offchip(const struct morsectrl *mors, stats_tlv_tag_t tag)
+const struct statistics_offchip_entry *get_stats_offchip(const struct morsectrl *mors,
+                                                         stats_tlv_tag_t tag)
+{
+    const struct statistics_offchip_index *index = mors->stats_index;
+
+    if (!index || (tag >= index->n_slots) || !index->slots[tag])
+        return NULL;
+
+    return &index->entries[index->slots[tag] - 1];
+}
+
+bool stats_tlv_next(const uint8_t **buf, int *remaining, struct stats_tlv *tlv)
 {
-#ifdef ENABLE_TRANS_NL80211
-    struct statistics_offchip_data *res = NULL;
-    for (int i = 0; i < mors->n_stats; i++)
+    if (*remaining <= (int)STATS_TLV_OVERHEAD)
+        return false;
+
+    memcpy(&tlv->tag, *buf, sizeof(tlv->tag));
+    memcpy(&tlv->len, *buf + sizeof(tlv->tag), sizeof(tlv->len));
+
+    if ((tlv->len > *remaining - (int)STATS_TLV_OVERHEAD) || (tlv->len == 0))
     {
-        if (mors->stats[i].tag == tag)
-        {
-            res = mors->stats + i;
-            break;
-        }
+        mctrl_err("error: malformed TLV (tag %d/0x%x, len %u/0x%x, size %d)\n",
+                  tlv->tag, tlv->tag, tlv->len, tlv->len, *remaining);
+        return false;
     }
-    return res;
-#else
-    return NULL;
-#endif
-}
 
+    tlv->value = *buf + STATS_TLV_OVERHEAD;
+    *buf += STATS_TLV_OVERHEAD + tlv->len;
+    *remaining -= STATS_TLV_OVERHEAD + tlv->len;
+
+    return true;
+}
 
 int64_t get_signed_value_as_int64(const uint8_t *buf, uint32_t size)
 {
@@ -49,7 +49,106 @@ struct __attribute__((packed)) statistics_offchip_data {
 
 #define OLD_STATS_COMMAND_MASK 0xDF
 
-struct statistics_offchip_data *get_stats_offchip(const struct morsectrl *mors,
-                                                    stats_tlv_tag_t tag);
+/**
+ * Metadata of a stat, as kept once the metadata is loaded. Only what decoding needs is kept, with
+ * the key in the index's string pool. Entries hold no pointers, so an index can be stored in and
+ * mapped from the stats metadata cache.
+ */
+struct statistics_offchip_entry
+{
+    stats_tlv_tag_t tag;
+    /** Format to print the stat with (enum morse_statistics_format), resolved from the format
+     *  and type in the metadata. */
+    uint8_t format;
+    /** Size of the value in octets, from its type, or 0 if the type has no fixed size. */
+    uint8_t width;
+    /** Offset of the terminated key in the string pool. */
+    uint32_t key_offset;
+};
+
+/** Stats metadata indexed directly by tag. */
+struct statistics_offchip_index
+{
+    const struct statistics_offchip_entry *entries;
+    size_t n_entries;
+    /** For each tag up to n_slots - 1, one more than its entry or 0 if it has no metadata. */
+    const uint32_t *slots;
+    size_t n_slots;
+    /** Keys of the entries, each terminated, one after another. */
+    const char *strings;
+    size_t strings_len;
+    /** Cache file the index is mapped from, NULL if it was built in memory. */
+    void *map;
+    size_t map_len;
+};
+
+/**
+ * @brief Index the stats metadata records loaded in mors->stats by tag, then release the records.
+ *        Where tags are repeated the first record is used.
+ *
+ * @param mors      Morsectrl context holding the records.
+ * @param map       File mapping mors->stats is referenced in place from, or NULL if mors->stats
+ *                  is on the heap.
+ * @param map_len   Length of the mapping.
+ * @return          0 on success otherwise relevant error.
+ */
+int stats_offchip_index_build(struct morsectrl *mors, void *map, size_t map_len);
+
+/**
+ * @brief Unmap a file mapping stats metadata is referenced in place from.
+ *
+ * @param map       Start of the mapping.
+ * @param map_len   Length of the mapping.
+ */
+void stats_offchip_unmap(void *map, size_t map_len);
+
+/**
+ * @brief Free the indexed stats metadata.
+ *
+ * @param mors  Morsectrl context holding the metadata.
+ */
+void stats_offchip_free(struct morsectrl *mors);
+
+/**
+ * @brief Get the metadata of a stat.
+ *
+ * @param mors  Morsectrl context holding the indexed metadata.
+ * @param tag   Tag of the stat.
+ * @return      The metadata or NULL if there is none for the tag.
+ */
+const struct statistics_offchip_entry *get_stats_offchip(const struct morsectrl *mors,
+                                                         stats_tlv_tag_t tag);
+
+/** A TLV of a stats response. */
+struct stats_tlv
+{
+    stats_tlv_tag_t tag;
+    stats_tlv_len_t len;
+    const uint8_t *value;
+};
+
+/**
+ * @brief Take the next TLV from a stats response.
+ *
+ * @param buf       Position in the response, moved past the TLV.
+ * @param remaining Octets left in the response, reduced by the TLV.
+ * @param tlv       Filled with the TLV, which points into the response.
+ * @return          true if a TLV was taken, false at the end of the response or if the next TLV is
+ *                  malformed, which is reported.
+ */
+bool stats_tlv_next(const uint8_t **buf, int *remaining, struct stats_tlv *tlv);
+
+/**
+ * @brief Get the key of a stat.
+ *
+ * @param mors  Morsectrl context holding the indexed metadata.
+ * @param entry Metadata of the stat, from get_stats_offchip().
+ * @return      The terminated key.
+ */
+static inline const char *stats_offchip_key(const struct morsectrl *mors,
+                                            const struct statistics_offchip_entry *entry)
+{
+    return &mors->stats_index->strings[entry->key_offset];
+}
 int64_t get_signed_value_as_int64(const uint8_t *buf, uint32_t size);
 uint64_t get_unsigned_value_as_uint64(const uint8_t *buf, uint32_t size);
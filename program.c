@@ -0,0 +1,376 @@
+/*
+ * Copyright 2023 Morse Micro
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "morsectrl.h"
+#include "elf_file.h"
+#include "transport/transport.h"
+#include "utilities.h"
+
+/** Prefix of a target given as the location ID of the SPI channel rather than a serial number. */
+#define PROGRAM_LOC_ID_PREFIX   "loc_id="
+
+/** Stages each board goes through, in order. */
+enum program_stage
+{
+    PROGRAM_STAGE_INIT,
+    PROGRAM_STAGE_RESET,
+    PROGRAM_STAGE_FIRMWARE,
+    PROGRAM_STAGE_BCF,
+    PROGRAM_STAGE_VERIFY,
+    PROGRAM_STAGE_COUNT,
+};
+
+static const char *program_stage_names[PROGRAM_STAGE_COUNT] = {
+    [PROGRAM_STAGE_INIT] = "init",
+    [PROGRAM_STAGE_RESET] = "reset",
+    [PROGRAM_STAGE_FIRMWARE] = "firmware",
+    [PROGRAM_STAGE_BCF] = "bcf",
+    [PROGRAM_STAGE_VERIFY] = "verify",
+};
+
+/** Files to program, shared by all boards. */
+struct program_args
+{
+    const char *firmware;
+    const char *bcf;
+    const char *country;
+    bool reset;
+};
+
+/** A board being programmed. */
+struct program_board
+{
+    /** Serial number (prefix) or location ID selecting the board, as given by the user. */
+    const char *target;
+    /** Context for the board, with its own transport. */
+    struct morsectrl mors;
+    const struct program_args *args;
+    bool initialised;
+    pthread_t thread;
+    bool thread_started;
+    /** Stage that failed, PROGRAM_STAGE_COUNT if none has. */
+    enum program_stage failed;
+    int ret;
+    /** Time taken by each stage in microseconds, 0 for stages not run. */
+    uint64_t stage_us[PROGRAM_STAGE_COUNT];
+};
+
+static void usage(struct morsectrl *mors)
+{
+    mctrl_print("\tprogram [-n] -f <firmware> [-b <bcf> -c <country>] <target> [<target> ...]\n");
+    mctrl_print("\t\t\t\treset, load and verify several boards at once\n");
+    mctrl_print("\t\t\t\teach target is a serial number or %s<location ID>\n",
+                PROGRAM_LOC_ID_PREFIX);
+    mctrl_print("\t\t-f <firmware>\tfirmware ELF file\n");
+    mctrl_print("\t\t-b <bcf>\tBCF (Board Configuration File)\n");
+    mctrl_print("\t\t-c <country>\tBCF country code\n");
+    mctrl_print("\t\t-n\t\tdo not hard reset the boards first\n");
+}
+
+/**
+ * @brief Point a transport configuration at one board.
+ *
+ * @param transport Transport of the board.
+ * @param target    Serial number (prefix) or location ID of the board.
+ * @return          0 on success otherwise -1.
+ */
+static int program_set_target(struct morsectrl_transport *transport, const char *target)
+{
+    struct morsectrl_ftdi_spi_cfg *config = &transport->config.ftdi_spi;
+
+    if (!strncmp(target, PROGRAM_LOC_ID_PREFIX, strlen(PROGRAM_LOC_ID_PREFIX)))
+    {
+        config->serial_num[0] = '\0';
+        if (str_to_uint32(target + strlen(PROGRAM_LOC_ID_PREFIX), &config->loc_id) ||
+            !config->loc_id)
+        {
+            mctrl_err("Invalid location ID %s\n", target);
+            return -1;
+        }
+        return 0;
+    }
+
+    if (!target[0] || (strlen(target) >= sizeof(config->serial_num)))
+    {
+        mctrl_err("Invalid serial number %s\n", target);
+        return -1;
+    }
+
+    config->loc_id = 0;
+    snprintf(config->serial_num, sizeof(config->serial_num), "%s", target);
+
+    return 0;
+}
+
+/**
+ * @brief Record the end of a stage on a board.
+ *
+ * @param board     Board the stage ran on.
+ * @param stage     Stage that ran. A stage may run more than once, its times add up.
+ * @param start_us  Time the stage started.
+ * @param ret       Result of the stage.
+ * @return          Result of the stage.
+ */
+static int program_stage_end(struct program_board *board, enum program_stage stage,
+                             uint64_t start_us, int ret)
+{
+    board->stage_us[stage] += time_now_us() - start_us;
+    if (ret)
+    {
+        board->failed = stage;
+        board->ret = ret;
+    }
+
+    return ret;
+}
+
+/**
+ * @brief Worker programming a single board. Transport init and deinit are left to the main
+ *        thread, as opening and closing FTDI channels is not thread safe. Boards are reset in
+ *        parallel, but the transport sets up the link after a reset one board at a time.
+ *
+ * @param arg   Board to program.
+ * @return      NULL.
+ */
+static void *program_worker(void *arg)
+{
+    struct program_board *board = arg;
+    struct morsectrl *mors = &board->mors;
+    const struct program_args *args = board->args;
+    uint64_t start_us;
+
+    if (args->reset)
+    {
+        morse_elf_manifest_forget(mors);
+        start_us = time_now_us();
+        if (program_stage_end(board, PROGRAM_STAGE_RESET, start_us,
+                              morsectrl_transport_reset_device(&mors->transport)))
+            return NULL;
+    }
+
+    start_us = time_now_us();
+    if (program_stage_end(board, PROGRAM_STAGE_FIRMWARE, start_us,
+                          morse_elf_load(mors, args->firmware, NULL, 0)))
+        return NULL;
+
+    if (args->bcf)
+    {
+        start_us = time_now_us();
+        if (program_stage_end(board, PROGRAM_STAGE_BCF, start_us,
+                              morse_elf_load(mors, args->bcf, args->country, 0)))
+            return NULL;
+    }
+
+    start_us = time_now_us();
+    if (program_stage_end(board, PROGRAM_STAGE_VERIFY, start_us,
+                          morse_elf_load(mors, args->firmware, NULL, MORSE_ELF_LOAD_VERIFY)))
+        return NULL;
+
+    if (args->bcf)
+    {
+        start_us = time_now_us();
+        program_stage_end(board, PROGRAM_STAGE_VERIFY, start_us,
+                          morse_elf_load(mors, args->bcf, args->country, MORSE_ELF_LOAD_VERIFY));
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Print the timing and result of each board.
+ *
+ * @param boards        Boards programmed.
+ * @param num_boards    Number of boards.
+ * @param total_us      Wall clock time taken for all boards.
+ * @return              Number of boards that failed.
+ */
+static int program_report(struct program_board *boards, int num_boards, uint64_t total_us)
+{
+    int failures = 0;
+    int ii;
+    int jj;
+
+    mctrl_print("%-24s", "Board");
+    for (jj = 0; jj < PROGRAM_STAGE_COUNT; jj++)
+        mctrl_print(" %9s", program_stage_names[jj]);
+    mctrl_print(" %9s  %s\n", "total", "result");
+
+    for (ii = 0; ii < num_boards; ii++)
+    {
+        struct program_board *board = &boards[ii];
+        uint64_t board_us = 0;
+
+        mctrl_print("%-24s", board->target);
+        for (jj = 0; jj < PROGRAM_STAGE_COUNT; jj++)
+        {
+            board_us += board->stage_us[jj];
+            if (board->stage_us[jj])
+                mctrl_print(" %6lu ms", (unsigned long)(board->stage_us[jj] / 1000));
+            else
+                mctrl_print(" %9s", "-");
+        }
+        mctrl_print(" %6lu ms  ", (unsigned long)(board_us / 1000));
+
+        if (board->failed == PROGRAM_STAGE_COUNT)
+        {
+            mctrl_print("ok\n");
+        }
+        else
+        {
+            mctrl_print("failed %s (%d)\n", program_stage_names[board->failed], board->ret);
+            failures++;
+        }
+    }
+
+    mctrl_print("Programmed %d of %d boards in %lu ms\n", num_boards - failures, num_boards,
+                (unsigned long)(total_us / 1000));
+
+    return failures;
+}
+
+int program(struct morsectrl *mors, int argc, char *argv[])
+{
+    struct program_args args = {
+        .reset = true,
+    };
+    struct program_board *boards;
+    uint64_t start_us;
+    int num_boards;
+    int option;
+    int ret;
+    int ii;
+
+    if (argc < 1)
+    {
+        usage(mors);
+        return -1;
+    }
+
+    while ((option = getopt(argc, argv, "f:b:c:n")) != -1)
+    {
+        switch (option)
+        {
+        case 'f':
+            args.firmware = optarg;
+            break;
+        case 'b':
+            args.bcf = optarg;
+            break;
+        case 'c':
+            args.country = optarg;
+            break;
+        case 'n':
+            args.reset = false;
+            break;
+        default:
+            usage(mors);
+            return -1;
+        }
+    }
+
+    num_boards = argc - optind;
+    if (!args.firmware || (num_boards < 1))
+    {
+        usage(mors);
+        return -1;
+    }
+
+    if (!args.bcf != !args.country)
+    {
+        mctrl_err("A BCF and its country code must be given together\n");
+        return -1;
+    }
+
+    if (mors->transport.type != MORSECTRL_TRANSPORT_FTDI_SPI)
+    {
+        mctrl_err("program is only supported by the ftdi_spi transport\n");
+        return -1;
+    }
+
+    boards = calloc(num_boards, sizeof(*boards));
+    if (!boards)
+        return -ENOMEM;
+
+    for (ii = 0; ii < num_boards; ii++)
+    {
+        struct program_board *board = &boards[ii];
+
+        board->target = argv[optind + ii];
+        board->mors = *mors;
+        board->mors.quiet = true;
+        board->args = &args;
+        board->failed = PROGRAM_STAGE_COUNT;
+
+        if (program_set_target(&board->mors.transport, board->target))
+        {
+            ret = -1;
+            goto exit;
+        }
+    }
+
+    start_us = time_now_us();
+
+    /*
+     * libmpsse keeps its open channels in an unlocked list, added to by init and freed from by
+     * deinit, and walked on every transfer. So every board is initialised before any worker
+     * starts, and none is deinitialised until all the workers have finished.
+     */
+    for (ii = 0; ii < num_boards; ii++)
+    {
+        struct program_board *board = &boards[ii];
+        uint64_t init_us = time_now_us();
+
+        if (program_stage_end(board, PROGRAM_STAGE_INIT, init_us,
+                              morsectrl_transport_init(&board->mors.transport)))
+            continue;
+        board->initialised = true;
+    }
+
+    for (ii = 0; ii < num_boards; ii++)
+    {
+        struct program_board *board = &boards[ii];
+
+        if (!board->initialised)
+            continue;
+
+        if (pthread_create(&board->thread, NULL, program_worker, board))
+        {
+            mctrl_err("Failed to start worker for %s\n", board->target);
+            board->failed = PROGRAM_STAGE_INIT;
+            board->ret = -1;
+            continue;
+        }
+        board->thread_started = true;
+    }
+
+    for (ii = 0; ii < num_boards; ii++)
+    {
+        struct program_board *board = &boards[ii];
+
+        if (board->thread_started)
+            pthread_join(board->thread, NULL);
+    }
+
+    for (ii = 0; ii < num_boards; ii++)
+    {
+        if (boards[ii].initialised)
+            morsectrl_transport_deinit(&boards[ii].mors.transport);
+    }
+
+    ret = program_report(boards, num_boards, time_now_us() - start_us) ? -1 : 0;
+
+exit:
+    free(boards);
+
+    return ret;
+}
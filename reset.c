@@ -13,6 +13,7 @@
 #include "transport/transport.h"
 #include "utilities.h"
 #include "command.h"
+#include "elf_file.h"
 #ifndef MORSE_WIN_BUILD
 #include "gpioctrl.h"
 #endif
@@ -102,8 +103,13 @@ static int soft_reset(struct morsectrl *mors)
     struct morsectrl_transport *transport = &mors->transport;
     int ret;
     int idx;
-    uint32_t address = MM610X_REG_AON_ADDR;
     uint32_t latch;
+    struct morsectrl_transport_reg aon_regs[MM610X_REG_AON_COUNT];
+    struct morsectrl_transport_reg boot_regs[] = {
+        { MM610X_REG_MAC_BOOT_ADDR, MM610X_REG_MAC_BOOT_VALUE },
+        { MM610X_REG_CLK_CTRL_ADDR, MM610X_REG_CLK_CTRL_VALUE },
+        { MM610X_HOST_INTERRUPT_ADDR, MM610X_HOST_INTERRUPT_VAL },
+    };
 
     if (!transport || !transport->tops || !transport->tops->reg_write)
     {
@@ -111,16 +117,18 @@ static int soft_reset(struct morsectrl *mors)
                                   "Transport doesn't support soft reset (rebooting)\n");
     }
 
-    /* Clear AON. */
-    for (idx = 0; idx < MM610X_REG_AON_COUNT; idx++, address += 4)
+    /* Clear AON in case there are any latched sleeps. */
+    for (idx = 0; idx < MM610X_REG_AON_COUNT; idx++)
     {
-        /* clear AON in case there is any latched sleeps */
-        ret = morsectrl_transport_reg_write(transport, address, 0);
-        if (ret)
-        {
-            transport->error_function("Soft Reset", -ETRANSERR, "Failed to write clk ctrl reg\n");
-            return ret;
-        }
+        aon_regs[idx].addr = MM610X_REG_AON_ADDR + (idx * sizeof(uint32_t));
+        aon_regs[idx].value = 0;
+    }
+
+    ret = morsectrl_transport_reg_write_many(transport, aon_regs, MM610X_REG_AON_COUNT);
+    if (ret)
+    {
+        transport->error_function("Soft Reset", -ETRANSERR, "Failed to clear aon regs\n");
+        return ret;
     }
 
     /* invoke AON latch procedure */
@@ -159,27 +167,10 @@ static int soft_reset(struct morsectrl *mors)
     sleep_ms(AON_DELAY_MS);
 
     /* Boot chip. */
-    ret = morsectrl_transport_reg_write(transport, MM610X_REG_MAC_BOOT_ADDR,
-                                        MM610X_REG_MAC_BOOT_VALUE);
-    if (ret)
-    {
-        transport->error_function("Soft Reset", -ETRANSERR, "Failed to write MAC boot reg\n");
-        return ret;
-    }
-
-    ret = morsectrl_transport_reg_write(transport, MM610X_REG_CLK_CTRL_ADDR,
-                                        MM610X_REG_CLK_CTRL_VALUE);
+    ret = morsectrl_transport_reg_write_many(transport, boot_regs, MORSE_ARRAY_SIZE(boot_regs));
     if (ret)
     {
-        transport->error_function("Soft Reset", -ETRANSERR, "Failed to write clk ctrl reg\n");
-        return ret;
-    }
-
-    ret = morsectrl_transport_reg_write(transport, MM610X_HOST_INTERRUPT_ADDR,
-                                        MM610X_HOST_INTERRUPT_VAL);
-    if (ret)
-    {
-        transport->error_function("Soft Reset", -ETRANSERR, "Failed to write host interrupt reg\n");
+        transport->error_function("Soft Reset", -ETRANSERR, "Failed to write boot regs\n");
         return ret;
     }
 
@@ -267,6 +258,9 @@ int reset(struct morsectrl *mors, int argc, char *argv[])
 
 
 exit:
+    /* Even a failed reset may have cleared what the manifest says is loaded. */
+    morse_elf_manifest_forget(mors);
+
     if (ret < 0)
     {
         mctrl_err("Failed to reset chip\n");
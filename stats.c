@@ -5,14 +5,20 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <unistd.h>
 #include <inttypes.h>
+#include <errno.h>
+#include <getopt.h>
 
 #include "portable_endian.h"
 #include "command.h"
 #include "elf_file.h"
 #include "offchip_statistics.h"
 #include "stats_format.h"
+#include "stats_cache.h"
+#include "stats_snapshot.h"
+#include "stats_record.h"
 #include "utilities.h"
 #include "transport/transport.h"
 
@@ -80,36 +86,77 @@ static void get_override_firmware_path(struct morsectrl *mors, char *firmware_fu
     }
 }
 
+/* Get the path of the firmware ELF, the running firmware's if none was given. */
+static const char *get_firmware_path(struct morsectrl *mors, const char *filename,
+                                     char *firmware_path, size_t n)
+{
+    if (filename)
+        return filename;
+
+    snprintf(firmware_path, n, "/lib/firmware/morse/mm6108.bin");
+    get_override_firmware_path(mors, firmware_path, n);
+    return firmware_path;
+}
+
 static int load_offchip_statistics(struct morsectrl *mors, const char *filename)
 {
     FILE *infile;
-    char firmware_path[MAX_PATH] = "/lib/firmware/morse/mm6108.bin";
+    void *map;
+    size_t map_len;
+    char firmware_path[MAX_PATH];
+    int ret;
 
-    if (!filename)
-    {
-        filename = firmware_path;
-        get_override_firmware_path(mors, firmware_path, sizeof(firmware_path));
-    }
+    filename = get_firmware_path(mors, filename, firmware_path, sizeof(firmware_path));
 
-    infile = fopen(filename, "rb");
-    if (infile)
-    {
-        uint8_t *buf = NULL;
+    if (!stats_cache_load(mors, filename))
+        return 0;
 
-        load_file(infile, &buf);
-        if (buf)
-        {
-            morse_stats_load(&mors->stats, &mors->n_stats, buf);
-            free(buf);
-        }
-        fclose(infile);
-    }
-    else
+    /* A missing file is the usual failure, report it plainly. */
+    infile = fopen(filename, "rb");
+    if (!infile)
     {
         mctrl_err("Error - could not open %s to read stats metadata\n", filename);
         return -1;
     }
-    return 0;
+    fclose(infile);
+
+    if (morse_stats_load(&mors->stats, &mors->n_stats, filename, &map, &map_len))
+        return stats_offchip_index_build(mors, NULL, 0);
+
+    ret = stats_offchip_index_build(mors, map, map_len);
+    if (!ret)
+        stats_cache_store(mors, filename);
+
+    return ret;
+}
+
+/* Name of the core a stats log command reads, as used in labels. */
+static const char *stats_core_name(int cmd)
+{
+    switch (cmd)
+    {
+        case MORSE_COMMAND_APP_STATS_LOG:
+            return "app";
+        case MORSE_COMMAND_MAC_STATS_LOG:
+            return "mac";
+        case MORSE_COMMAND_UPHY_STATS_LOG:
+            return "uphy";
+        default:
+            return "unknown";
+    }
+}
+
+/* Name of the interface or device the stats are read from, as used in labels. */
+static const char *stats_interface_name(struct morsectrl *mors)
+{
+    const char *ifname = morsectrl_transport_get_ifname(&mors->transport);
+
+#ifdef ENABLE_TRANS_FTDI_SPI
+    if (!ifname && (mors->transport.type == MORSECTRL_TRANSPORT_FTDI_SPI))
+        ifname = mors->transport.state.ftdi_spi.serial_num;
+#endif
+
+    return ifname ? ifname : "";
 }
 
 static void usage(struct morsectrl *mors)
@@ -120,18 +167,375 @@ static void usage(struct morsectrl *mors)
     mctrl_print("\t\t-u\t\tUphy core\n");
     mctrl_print("\t\t-j\t\toutputs stats in a json format\n");
     mctrl_print("\t\t-p\t\toutputs stats in a human-readable json format\n");
+    mctrl_print("\t\t-O\t\toutputs stats in the Prometheus text format\n");
+    mctrl_print("\t\t-o <file>\twrites stats in the Prometheus text format to a file,\n"
+                "\t\t\t\treplacing it atomically, e.g. for the node_exporter textfile\n"
+                "\t\t\t\tcollector\n");
     mctrl_print("\t\t-r\t\tresets stats for mentioned cores (resets all if none were mentioned)\n");
     mctrl_print("\t\t-f \"key\"\tfilters stats according to the given key (case sensetive)\n");
     mctrl_print("\t\t-s filename\tthe location of the firmware ELF\n");
+    mctrl_print("\t\t-T\t\tprints the time taken to load the metadata and decode each response\n");
+    mctrl_print("\t\t-w <interval_ms>\tsamples the stats every interval, printing the change in\n"
+                "\t\t\t\teach counter and its rate since the previous sample\n");
+    mctrl_print("\t\t-n <count>\twith -w, stops after count samples (default until interrupted)\n");
+    mctrl_print("\t\t--raw-out <file>\twrites the undecoded responses to a snapshot file, to be\n"
+                "\t\t\t\tdecoded later with stats_decode\n");
+    mctrl_print("\t\t--record <file>\tsamples the numeric stats every interval (-w, default\n"
+                "\t\t\t\t1000 ms) into a fixed size history file, to be read with\n"
+                "\t\t\t\tstats_query\n");
+    mctrl_print("\t\t--record-size <KiB>\tsize of the history file if it is created (default %u)\n",
+                STATS_RECORD_DEFAULT_SIZE_KIB);
+}
+
+static void decode_usage(struct morsectrl *mors)
+{
+    mctrl_print("\tstats_decode [options] <snapshot>\n"
+                "\t\t\t\tdecodes a snapshot written by stats --raw-out\n");
+    mctrl_print("\t\t-a\t\tApp core\n");
+    mctrl_print("\t\t-m\t\tMac core\n");
+    mctrl_print("\t\t-u\t\tUphy core\n");
+    mctrl_print("\t\t-j\t\toutputs stats in a json format\n");
+    mctrl_print("\t\t-p\t\toutputs stats in a human-readable json format\n");
+    mctrl_print("\t\t-O\t\toutputs stats in the Prometheus text format\n");
+    mctrl_print("\t\t-f \"key\"\tfilters stats according to the given key (case sensetive)\n");
+    mctrl_print("\t\t-s filename\tthe location of the firmware ELF the snapshot was taken with\n");
+    mctrl_print("\t\t--diff <snapshot2>\tprints the change in each counter and its rate from\n"
+                "\t\t\t\tsnapshot to snapshot2\n");
+}
+
+static void query_usage(struct morsectrl *mors)
+{
+    mctrl_print("\tstats_query [options] <file>\n"
+                "\t\t\t\tprints stats history recorded by stats --record as CSV\n");
+    mctrl_print("\t\t-b <time>\tstart of the range, in seconds since the epoch\n");
+    mctrl_print("\t\t-e <time>\tend of the range, in seconds since the epoch\n");
+    mctrl_print("\t\t-l <seconds>\tstarts the range this long ago\n");
+    mctrl_print("\t\t-t <tier>\treads a tier (0: every sample, 1: every 10th, 2: every 60th)\n"
+                "\t\t\t\trather than the finest one reaching back to the start\n");
+    mctrl_print("\t\t-j\t\toutputs history in a json format\n");
+    mctrl_print("\t\t-f \"key\"\tfilters stats according to the given key (case sensetive)\n");
+}
+
+
+/* Decode and print the TLVs of a stats log response. */
+static int stats_print_response(struct morsectrl *mors, int cmd, const uint8_t *stats,
+                                int resp_sz, const char *filter_string,
+                                enum format_type format_val, bool timed,
+                                const char *interface)
+{
+    unsigned int n_tlvs = 0;
+    uint64_t decode_start_us;
+    const struct format_table *table;
+    const uint8_t *buf = stats;
+    struct stats_tlv tlv;
+
+    switch (format_val)
+    {
+        case FORMAT_REGULAR:
+        {
+            table = stats_format_regular_get_formatter_table();
+            break;
+        }
+        case FORMAT_JSON_PPRINT:
+        {
+            stats_format_json_set_pprint(true);
+            /* fall through */
+        }
+        case FORMAT_JSON:
+        {
+            table = stats_format_json_get_formatter_table();
+            break;
+        }
+        case FORMAT_OPENMETRICS:
+        {
+            table = stats_format_openmetrics_get_formatter_table();
+            stats_format_openmetrics_set_labels(stats_core_name(cmd), interface);
+            break;
+        }
+        default:
+            return -1;
+    }
+
+    decode_start_us = time_now_us();
+
+    while (stats_tlv_next(&buf, &resp_sz, &tlv))
+    {
+        const struct statistics_offchip_entry *offchip = get_stats_offchip(mors, tlv.tag);
+        if (offchip)
+        {
+            const char *key = stats_offchip_key(mors, offchip);
+
+            if (!filter_string || !strcmp(key, filter_string))
+            {
+                if (format_val == FORMAT_JSON || format_val == FORMAT_JSON_PPRINT)
+                {
+                    stats_format_json_init();
+                }
+
+                table->format_func[offchip->format](key, tlv.value, tlv.len);
+            }
+        }
+        else
+        {
+            mctrl_err("UNKOWN KEY for tag %d: ", tlv.tag);
+            /* The dump goes to stdout, where it would break the exposition. */
+            if (format_val != FORMAT_OPENMETRICS)
+                hexdump(tlv.value, tlv.len);
+            mctrl_err("\n");
+        }
+        n_tlvs++;
+    }
+
+    if (timed)
+    {
+        mctrl_err("Decoded %u TLVs (%zu octets) of response 0x%04x in %" PRIu64 " us\n",
+                  n_tlvs, (size_t)(buf - stats), cmd, time_now_us() - decode_start_us);
+    }
+
+    return 0;
 }
 
+int stats_fetch_init(struct morsectrl *mors, struct stats_fetch *fetch, const int *cmds,
+                     size_t n_cmds)
+{
+    size_t ii;
+
+    memset(fetch, 0, sizeof(*fetch));
+    if (n_cmds > STATS_MAX_CORES)
+        return -EINVAL;
+
+#ifdef ENABLE_STATS_PAGED
+    /* Firmware that can't say is asked for the stats in a single shot. */
+    if (morsectrl_capability_supported(mors, MORSE_CAPAB_STATS_PAGED, &fetch->paged))
+        fetch->paged = false;
+#endif
+
+    fetch->n_cmds = n_cmds;
+    for (ii = 0; ii < n_cmds; ii++)
+    {
+        fetch->cmds[ii] = cmds[ii];
+        /* Each command has its own buffer, as they are all sent before any is answered. */
+        fetch->cmd_tbuffs[ii] = morsectrl_transport_cmd_alloc(&mors->transport,
+            fetch->paged ? sizeof(struct stats_page_request) : 0);
+        fetch->rsp_tbuffs[ii] = morsectrl_transport_resp_alloc(&mors->transport,
+            MAX(sizeof(struct stats_response), sizeof(struct stats_page_response)));
+        if (!fetch->cmd_tbuffs[ii] || !fetch->rsp_tbuffs[ii])
+            return -ENOMEM;
+        fetch->rsp_len = fetch->rsp_tbuffs[ii]->data_len;
+    }
+
+    return 0;
+}
+
+#ifdef ENABLE_STATS_PAGED
+/**
+ * Append a page of the stats of a core to its TLVs.
+ *
+ * @param fetch     Buffers the page was read into.
+ * @param core      Index of the core.
+ * @param offset    Offset the page was requested at, updated to that of the next page.
+ * @param more      Filled with whether there is a next page.
+ * @return          0 on success otherwise relevant error.
+ */
+static int stats_fetch_page_append(struct stats_fetch *fetch, size_t core, uint32_t *offset,
+                                   bool *more)
+{
+    const struct morsectrl_transport_buff *rsp_tbuff = fetch->rsp_tbuffs[core];
+    const struct stats_page_response *page =
+        TBUFF_TO_RSP(rsp_tbuff, struct stats_page_response);
+    const size_t hdr_len = sizeof(struct response) + offsetof(struct stats_page_response, stats);
+    uint32_t next_offset;
+    uint8_t *tlvs;
+    size_t len;
+
+    if (rsp_tbuff->data_len < hdr_len)
+        goto invalid;
+
+    len = rsp_tbuff->data_len - hdr_len;
+    next_offset = le32toh(page->next_offset);
+    *more = !!(le32toh(page->flags) & STATS_PAGE_FLAG_MORE);
+
+    /* A page must move on, or the stats would be read forever. */
+    if ((fetch->tlvs_len[core] + len > STATS_TLVS_MAX_LEN) || (*more && (next_offset <= *offset)))
+        goto invalid;
+
+    tlvs = realloc(fetch->tlvs[core], MAX(fetch->tlvs_len[core] + len, 1));
+    if (!tlvs)
+        return -ENOMEM;
+
+    memcpy(tlvs + fetch->tlvs_len[core], page->stats, len);
+    fetch->tlvs[core] = tlvs;
+    fetch->tlvs_len[core] += len;
+    *offset = next_offset;
+
+    return 0;
+
+invalid:
+    mctrl_err("Invalid stats page 0x%04x at offset %u\n", fetch->cmds[core], *offset);
+    return -EINVAL;
+}
+
+/* Read the stats of every core a page at a time, reassembling the TLVs of each. */
+static int stats_fetch_paged(struct morsectrl *mors, struct stats_fetch *fetch)
+{
+    uint32_t offsets[STATS_MAX_CORES] = { 0 };
+    bool more[STATS_MAX_CORES];
+    size_t ii;
+    int ret;
+
+    for (ii = 0; ii < fetch->n_cmds; ii++)
+    {
+        fetch->tlvs_len[ii] = 0;
+        fetch->rets[ii] = 0;
+        more[ii] = true;
+    }
+
+    while (true)
+    {
+        /* The cores with pages left to read, all requested together. */
+        struct morsectrl_transport_buff *cmd_tbuffs[STATS_MAX_CORES];
+        struct morsectrl_transport_buff *rsp_tbuffs[STATS_MAX_CORES];
+        size_t cores[STATS_MAX_CORES];
+        int cmds[STATS_MAX_CORES];
+        int rets[STATS_MAX_CORES];
+        size_t n_pending = 0;
+
+        for (ii = 0; ii < fetch->n_cmds; ii++)
+        {
+            if (!more[ii])
+                continue;
+
+            TBUFF_TO_CMD(fetch->cmd_tbuffs[ii], struct stats_page_request)->offset =
+                htole32(offsets[ii]);
+            cores[n_pending] = ii;
+            cmds[n_pending] = fetch->cmds[ii];
+            cmd_tbuffs[n_pending] = fetch->cmd_tbuffs[ii];
+            rsp_tbuffs[n_pending] = fetch->rsp_tbuffs[ii];
+            rsp_tbuffs[n_pending]->data_len = fetch->rsp_len;
+            n_pending++;
+        }
+
+        if (!n_pending)
+            break;
+
+        ret = morsectrl_send_commands(&mors->transport, cmds, cmd_tbuffs, rsp_tbuffs, rets,
+                                      n_pending);
+        if (ret)
+            return ret;
+
+        for (ii = 0; ii < n_pending; ii++)
+        {
+            const size_t core = cores[ii];
+
+            fetch->rets[core] = rets[ii];
+            if (!fetch->rets[core])
+            {
+                fetch->rets[core] = stats_fetch_page_append(fetch, core, &offsets[core],
+                                                            &more[core]);
+            }
+
+            if (fetch->rets[core])
+                more[core] = false;
+        }
+    }
+
+    return 0;
+}
+#endif
+
+int stats_fetch(struct morsectrl *mors, struct stats_fetch *fetch, bool report)
+{
+    size_t ii;
+    int ret;
+
+#ifdef ENABLE_STATS_PAGED
+    if (fetch->paged)
+    {
+        ret = stats_fetch_paged(mors, fetch);
+    }
+    else
+#endif
+    {
+        for (ii = 0; ii < fetch->n_cmds; ii++)
+            fetch->rsp_tbuffs[ii]->data_len = fetch->rsp_len;
+
+        ret = morsectrl_send_commands(&mors->transport, fetch->cmds, fetch->cmd_tbuffs,
+                                      fetch->rsp_tbuffs, fetch->rets, fetch->n_cmds);
+    }
+
+    for (ii = 0; report && !ret && (ii < fetch->n_cmds); ii++)
+    {
+        ret = fetch->rets[ii];
+        if (ret)
+            mctrl_err("Failed to read stats 0x%04x (%d)\n", fetch->cmds[ii], ret);
+    }
+
+    return ret;
+}
+
+void stats_fetch_free(struct stats_fetch *fetch)
+{
+    size_t ii;
+
+    for (ii = 0; ii < fetch->n_cmds; ii++)
+    {
+        morsectrl_transport_buff_free(fetch->cmd_tbuffs[ii]);
+        morsectrl_transport_buff_free(fetch->rsp_tbuffs[ii]);
+        free(fetch->tlvs[ii]);
+    }
+    memset(fetch, 0, sizeof(*fetch));
+}
+
+const uint8_t *stats_fetch_tlvs(const struct stats_fetch *fetch, size_t core, int *len)
+{
+    if (fetch->paged)
+    {
+        *len = fetch->tlvs_len[core];
+        return fetch->tlvs[core];
+    }
+
+    *len = fetch->rsp_tbuffs[core]->data_len - sizeof(struct response);
+    return TBUFF_TO_RSP(fetch->rsp_tbuffs[core], struct stats_response)->stats;
+}
+
+/* Read (or reset) the stats of a core with the deprecated command, which answers in text. */
+static int stats_deprecated_cmd(struct morsectrl *mors, int cmd, int reset,
+                                struct morsectrl_transport_buff *cmd_tbuff,
+                                struct morsectrl_transport_buff *rsp_tbuff)
+{
+    int ret = morsectrl_send_command(&mors->transport, OLD_STATS_COMMAND_MASK & cmd,
+                                     cmd_tbuff, rsp_tbuff);
+
+    if (!reset && !ret)
+    {
+        mctrl_print("%s", TBUFF_TO_RSP(rsp_tbuff, struct stats_response)->stats);
+    }
+
+    return ret;
+}
+
+/* Read the stats of a core with the deprecated command, in buffers of its own. */
+static int stats_deprecated_fallback(struct morsectrl *mors, int cmd)
+{
+    struct morsectrl_transport_buff *cmd_tbuff =
+        morsectrl_transport_cmd_alloc(&mors->transport, 0);
+    struct morsectrl_transport_buff *rsp_tbuff =
+        morsectrl_transport_resp_alloc(&mors->transport, sizeof(struct stats_response));
+    int ret = -ENOMEM;
+
+    if (cmd_tbuff && rsp_tbuff)
+        ret = stats_deprecated_cmd(mors, cmd, false, cmd_tbuff, rsp_tbuff);
+
+    morsectrl_transport_buff_free(cmd_tbuff);
+    morsectrl_transport_buff_free(rsp_tbuff);
+    return ret;
+}
 
 int morsectrl_stats_cmd(struct morsectrl *mors, int cmd, int reset,
-                            const char *filter_string, enum format_type format_val)
+                            const char *filter_string, enum format_type format_val, bool timed)
 {
     int ret = -1;
     int resp_sz;
-    const struct format_table *table;
     struct stats_response *resp;
     struct morsectrl_transport_buff *cmd_tbuff =
         morsectrl_transport_cmd_alloc(&mors->transport, 0);
@@ -152,110 +556,152 @@ int morsectrl_stats_cmd(struct morsectrl *mors, int cmd, int reset,
     if (ret)
     {
         /* Try the deprecated command */
-        ret = morsectrl_send_command(&mors->transport, OLD_STATS_COMMAND_MASK & cmd,
-                                     cmd_tbuff, rsp_tbuff);
-        resp_sz = rsp_tbuff->data_len - sizeof(struct response);
-        if (!reset && !ret)
-        {
-            mctrl_print("%s", resp->stats);
-        }
+        ret = stats_deprecated_cmd(mors, cmd, reset, cmd_tbuff, rsp_tbuff);
         goto exit;
     }
 
     if (!reset && !ret)
     {
-        uint8_t *buf = (uint8_t *)resp->stats;
+        ret = stats_print_response(mors, cmd, resp->stats, resp_sz, filter_string, format_val,
+                                   timed, stats_interface_name(mors));
+    }
+exit:
+    morsectrl_transport_buff_free(cmd_tbuff);
+    morsectrl_transport_buff_free(rsp_tbuff);
+    return ret;
+}
+
+/* Read and print the stats of some cores, with the requests for all of them sent together. */
+static int morsectrl_stats_cmds(struct morsectrl *mors, const int *cmds, size_t n_cmds,
+                                const char *filter_string, enum format_type format_val,
+                                bool timed)
+{
+    struct stats_fetch fetch;
+    uint64_t fetch_start_us;
+    size_t ii;
+    int ret;
+
+    ret = stats_fetch_init(mors, &fetch, cmds, n_cmds);
+    if (ret)
+        goto exit;
+
+    fetch_start_us = time_now_us();
+    ret = stats_fetch(mors, &fetch, false);
+    if (ret)
+        goto exit;
+
+    if (timed)
+    {
+        mctrl_err("Fetched %zu stats responses in %" PRIu64 " us\n",
+                  n_cmds, time_now_us() - fetch_start_us);
+    }
 
-        switch (format_val)
+    for (ii = 0; ii < n_cmds; ii++)
+    {
+        const uint8_t *tlvs;
+        int tlvs_len;
+
+        if (fetch.rets[ii])
         {
-            case FORMAT_REGULAR:
-            {
-                table = stats_format_regular_get_formatter_table();
-                break;
-            }
-            case FORMAT_JSON_PPRINT:
-            {
-                stats_format_json_set_pprint(true);
-                /* fall through */
-            }
-            case FORMAT_JSON:
-            {
-                table = stats_format_json_get_formatter_table();
-                break;
-            }
-            default:
-                ret = -1;
-                goto exit;
+            /* Try the deprecated command, which takes no page request. */
+            ret = stats_deprecated_fallback(mors, cmds[ii]);
         }
-
-        while (resp_sz > STATS_TLV_OVERHEAD )
+        else
         {
-            stats_tlv_tag_t tag =  *((stats_tlv_tag_t *)buf);
-            buf += sizeof(stats_tlv_tag_t);
+            tlvs = stats_fetch_tlvs(&fetch, ii, &tlvs_len);
+            ret = stats_print_response(mors, cmds[ii], tlvs, tlvs_len, filter_string,
+                                       format_val, timed, stats_interface_name(mors));
+        }
 
-            stats_tlv_len_t len =  *((stats_tlv_len_t *)buf);
-            buf += sizeof(stats_tlv_len_t);
+        if (ret)
+            break;
+    }
 
-            if ((len > resp_sz) || (len == 0))
-            {
-                mctrl_err("error: malformed TLV (tag %d/0x%x, len %u/0x%x, size %u)\n",
-                        tag, tag, len, len, resp_sz);
-                break;
-            }
+exit:
+    stats_fetch_free(&fetch);
+    return ret;
+}
 
-            struct statistics_offchip_data *offchip = get_stats_offchip(mors, tag);
-            if (offchip)
-            {
-                if ((offchip->format == MORSE_STATS_FMT_DEC) &&
-                        !strncmp(offchip->type_str, "uint", 4))
-                {
-                    offchip->format = MORSE_STATS_FMT_U_DEC;
-                }
+/* Read the responses of some cores into a snapshot file without decoding them. */
+static int stats_raw_out(struct morsectrl *mors, const int *cmds, size_t n_cmds,
+                         const char *firmware_path, const char *path)
+{
+    struct stats_snapshot snapshot;
+    struct stats_fetch fetch;
+    size_t ii;
+    int ret;
 
-                if (!filter_string || !strcmp(offchip->key, filter_string))
-                {
-                    if (format_val == FORMAT_JSON || format_val == FORMAT_JSON_PPRINT)
-                    {
-                        stats_format_json_init();
-                    }
-
-                    if (offchip->format > MORSE_STATS_FMT_LAST)
-                    {
-                        offchip->format = MORSE_STATS_FMT_LAST;
-                    }
-
-                    table->format_func[offchip->format]((const char *) offchip->key,
-                                                                (const uint8_t *)buf, len);
-                }
-            }
-            else
-            {
-                mctrl_err("UNKOWN KEY for tag %d: ", tag);
-                hexdump(buf, len);
-                mctrl_err("\n");
-            }
-            buf += len;
+    stats_snapshot_init(&snapshot, stats_interface_name(mors), firmware_path);
+
+    ret = stats_fetch_init(mors, &fetch, cmds, n_cmds);
+    if (!ret)
+        ret = stats_fetch(mors, &fetch, true);
+    if (ret)
+        goto exit;
 
-            resp_sz -= (STATS_TLV_OVERHEAD + len);
+    for (ii = 0; ii < n_cmds; ii++)
+    {
+        struct stats_snapshot_core *core = &snapshot.cores[ii];
+        const uint8_t *tlvs;
+        int tlvs_len;
+
+        tlvs = stats_fetch_tlvs(&fetch, ii, &tlvs_len);
+        core->cmd = cmds[ii];
+        core->len = tlvs_len;
+        core->data = malloc(MAX(core->len, 1));
+        if (!core->data)
+        {
+            ret = -ENOMEM;
+            goto exit;
         }
+        memcpy(core->data, tlvs, core->len);
+        snapshot.n_cores++;
     }
+
+    ret = stats_snapshot_write(path, &snapshot);
+
 exit:
-    morsectrl_transport_buff_free(cmd_tbuff);
-    morsectrl_transport_buff_free(rsp_tbuff);
+    stats_snapshot_free(&snapshot);
+    stats_fetch_free(&fetch);
     return ret;
 }
 
 static void dump_stats_types(struct morsectrl *mors)
 {
-    int ii;
+    const struct statistics_offchip_index *index = mors->stats_index;
+    size_t ii;
 
     mctrl_print("Stats types\n");
-    for (ii = 0; ii < mors->n_stats; ii++)
+    for (ii = 0; ii < index->n_entries; ii++)
+    {
+        mctrl_print("Tag: 0x%04x\n", index->entries[ii].tag);
+        mctrl_print("Format: %u\n", index->entries[ii].format);
+        mctrl_print("Width: %u\n", index->entries[ii].width);
+        mctrl_print("Key: %s\n\n", stats_offchip_key(mors, &index->entries[ii]));
+    }
+}
+
+/* Get the stats log commands of the selected cores, or of all cores if none were selected. */
+static size_t stats_select_cores(bool app_c, bool mac_c, bool uph_c,
+                                 int cmds[STATS_MAX_CORES])
+{
+    size_t n_cmds = 0;
+
+    if ((!app_c) && (!mac_c) && (!uph_c))
     {
-        mctrl_print("Type: %s\n", mors->stats[ii].type_str);
-        mctrl_print("Name: %s\n", mors->stats[ii].name);
-        mctrl_print("Key: %s\n\n", mors->stats[ii].key);
+        app_c = true;
+        mac_c = true;
+        uph_c = true;
     }
+
+    if (app_c)
+        cmds[n_cmds++] = MORSE_COMMAND_APP_STATS_LOG;
+    if (mac_c)
+        cmds[n_cmds++] = MORSE_COMMAND_MAC_STATS_LOG;
+    if (uph_c)
+        cmds[n_cmds++] = MORSE_COMMAND_UPHY_STATS_LOG;
+
+    return n_cmds;
 }
 
 int stats(struct morsectrl *mors, int argc, char *argv[])
@@ -265,7 +711,27 @@ int stats(struct morsectrl *mors, int argc, char *argv[])
     bool reset = false, app_c = false, mac_c = false, uph_c = false;
     const char *filter_string = NULL;
     const char *firmware_path = NULL;
+    const char *textfile = NULL;
+    char textfile_tmp[MAX_PATH + 32];
+    FILE *textfile_out = NULL;
     enum format_type format = FORMAT_REGULAR;
+    bool timed = false;
+    uint64_t load_start_us;
+    uint32_t watch_interval_ms = 0;
+    uint32_t watch_count = 0;
+    bool watch_count_set = false;
+    const char *raw_out = NULL;
+    const char *record = NULL;
+    uint32_t record_size_kib = STATS_RECORD_DEFAULT_SIZE_KIB;
+    int cmds[STATS_MAX_CORES];
+    size_t n_cmds;
+    size_t ii;
+    static const struct option long_options[] = {
+        {"raw-out", required_argument, NULL, 'R'},
+        {"record", required_argument, NULL, 'H'},
+        {"record-size", required_argument, NULL, 'S'},
+        {NULL, 0, NULL, 0},
+    };
 
     if (argc == 0)
     {
@@ -273,7 +739,7 @@ int stats(struct morsectrl *mors, int argc, char *argv[])
         return 0;
     }
 
-    while ((option = getopt(argc, argv, "amurjpf:s:")) != -1)
+    while ((option = getopt_long(argc, argv, "amurjpOo:f:s:Tw:n:", long_options, NULL)) != -1)
     {
         switch (option)
         {
@@ -295,12 +761,49 @@ int stats(struct morsectrl *mors, int argc, char *argv[])
             case 'p' :
                 format = FORMAT_JSON_PPRINT;
                 break;
+            case 'o' :
+                textfile = optarg;
+                /* fall through */
+            case 'O' :
+                format = FORMAT_OPENMETRICS;
+                break;
             case 'f' :
                 filter_string = optarg;
                 break;
             case 's' :
                 firmware_path = optarg;
                 break;
+            case 'T' :
+                timed = true;
+                break;
+            case 'w' :
+                if (str_to_uint32_range(optarg, &watch_interval_ms, 1, UINT32_MAX / 1000))
+                {
+                    mctrl_err("Invalid watch interval %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'n' :
+                if (str_to_uint32_range(optarg, &watch_count, 1, UINT32_MAX))
+                {
+                    mctrl_err("Invalid sample count %s\n", optarg);
+                    return -1;
+                }
+                watch_count_set = true;
+                break;
+            case 'R' :
+                raw_out = optarg;
+                break;
+            case 'H' :
+                record = optarg;
+                break;
+            case 'S' :
+                if (str_to_uint32_range(optarg, &record_size_kib, 64, UINT32_MAX / 1024))
+                {
+                    mctrl_err("Invalid record file size %s\n", optarg);
+                    return -1;
+                }
+                break;
             default :
                 usage(mors);
                 return -1;
@@ -313,6 +816,42 @@ int stats(struct morsectrl *mors, int argc, char *argv[])
         return -1;
     }
 
+    if (watch_count_set && !watch_interval_ms && !record)
+    {
+        mctrl_err("A sample count is only used with -w or --record\n");
+        return -1;
+    }
+
+    if (record && (reset || raw_out || filter_string || (format != FORMAT_REGULAR)))
+    {
+        mctrl_err("--record can't be used with -r, -f, -j, -p, -O, -o or --raw-out\n");
+        return -1;
+    }
+
+    if (watch_interval_ms && !record && (reset || (format != FORMAT_REGULAR)))
+    {
+        mctrl_err("-w can't be used with -r, -j, -p, -O or -o\n");
+        return -1;
+    }
+
+    if (raw_out && (reset || watch_interval_ms || filter_string || (format != FORMAT_REGULAR)))
+    {
+        mctrl_err("--raw-out can't be used with -r, -w, -f, -j, -p, -O or -o\n");
+        return -1;
+    }
+
+    n_cmds = stats_select_cores(app_c, mac_c, uph_c, cmds);
+
+    if (raw_out)
+    {
+        char path[MAX_PATH];
+
+        /* The responses are stored as they are, so the metadata is not needed. */
+        return stats_raw_out(mors, cmds, n_cmds,
+                             get_firmware_path(mors, firmware_path, path, sizeof(path)), raw_out);
+    }
+
+    load_start_us = time_now_us();
     ret = load_offchip_statistics(mors, firmware_path);
 
     if (ret)
@@ -320,15 +859,26 @@ int stats(struct morsectrl *mors, int argc, char *argv[])
         goto exit_stats;
     }
 
+    if (timed)
+    {
+        mctrl_err("Loaded %zu stats metadata records in %" PRIu64 " us\n",
+                  mors->stats_index->n_entries, time_now_us() - load_start_us);
+    }
+
     if (mors->debug)
         dump_stats_types(mors);
 
-    /* If no core selected then enable all. */
-    if ((!app_c) && (!mac_c) && (!uph_c))
+    if (record)
     {
-        app_c = true;
-        mac_c = true;
-        uph_c = true;
+        ret = stats_record(mors, cmds, n_cmds, record, record_size_kib,
+                           watch_interval_ms ? watch_interval_ms : 1000, watch_count);
+        goto exit_stats;
+    }
+
+    if (watch_interval_ms)
+    {
+        ret = stats_watch(mors, cmds, n_cmds, filter_string, watch_interval_ms, watch_count);
+        goto exit_stats;
     }
 
     if (format == FORMAT_JSON)
@@ -340,22 +890,31 @@ int stats(struct morsectrl *mors, int argc, char *argv[])
         mctrl_print("{\n");
     }
 
-    if (app_c)
+    if (textfile)
     {
-        ret = morsectrl_stats_cmd(mors, MORSE_COMMAND_APP_STATS_LOG, reset,
-            filter_string, format);
-        if (ret) goto exit_stats;
+        /* Write a copy and rename it over the file, so a collector never reads it half written. */
+        snprintf(textfile_tmp, sizeof(textfile_tmp), "%s.%ld.tmp", textfile, (long)getpid());
+        textfile_out = fopen(textfile_tmp, "w");
+        if (!textfile_out)
+        {
+            mctrl_err("Failed to open %s\n", textfile_tmp);
+            ret = -1;
+            goto exit_stats;
+        }
+        stats_format_openmetrics_set_output(textfile_out);
     }
-    if (mac_c)
+
+    if (reset)
     {
-        ret = morsectrl_stats_cmd(mors, MORSE_COMMAND_MAC_STATS_LOG, reset,
-            filter_string, format);
-        if (ret) goto exit_stats;
+        for (ii = 0; ii < n_cmds; ii++)
+        {
+            ret = morsectrl_stats_cmd(mors, cmds[ii], reset, filter_string, format, timed);
+            if (ret) goto exit_stats;
+        }
     }
-    if (uph_c)
+    else
     {
-        ret = morsectrl_stats_cmd(mors, MORSE_COMMAND_UPHY_STATS_LOG, reset,
-            filter_string, format);
+        ret = morsectrl_stats_cmds(mors, cmds, n_cmds, filter_string, format, timed);
         if (ret) goto exit_stats;
     }
 
@@ -367,8 +926,28 @@ int stats(struct morsectrl *mors, int argc, char *argv[])
     {
         mctrl_print("\n}\n");
     }
+    else if (format == FORMAT_OPENMETRICS)
+    {
+        stats_format_openmetrics_end();
+    }
 
 exit_stats:
+    if (textfile_out)
+    {
+        stats_format_openmetrics_set_output(NULL);
+        if (fclose(textfile_out) || ret || rename(textfile_tmp, textfile))
+        {
+            if (!ret)
+            {
+                mctrl_err("Failed to write %s\n", textfile);
+                ret = -1;
+            }
+            remove(textfile_tmp);
+        }
+    }
+
+    stats_offchip_free(mors);
+
     if (ret < 0)
     {
         mctrl_err("Command stats error (%d)\n", ret);
@@ -376,3 +955,282 @@ exit_stats:
 
     return ret;
 }
+
+/* Print the change in each counter of every core in a snapshot since an earlier snapshot. */
+static int stats_decode_diff(struct morsectrl *mors, const struct stats_snapshot *prev,
+                             const struct stats_snapshot *cur, const int *cmds, size_t n_cmds,
+                             const char *filter_string)
+{
+    uint64_t interval_us = (cur->timestamp_us > prev->timestamp_us) ?
+                           (cur->timestamp_us - prev->timestamp_us) : 0;
+    size_t ii;
+    size_t jj;
+    int ret = 0;
+
+    mctrl_print("Interval %" PRIu64 ".%03" PRIu64 " s\n",
+                interval_us / 1000000, (interval_us / 1000) % 1000);
+
+    for (ii = 0; (ii < cur->n_cores) && !ret; ii++)
+    {
+        const struct stats_snapshot_core *core = &cur->cores[ii];
+        const struct stats_snapshot_core *prev_core = NULL;
+
+        for (jj = 0; jj < n_cmds; jj++)
+        {
+            if (cmds[jj] == core->cmd)
+                break;
+        }
+        if (jj == n_cmds)
+            continue;
+
+        for (jj = 0; jj < prev->n_cores; jj++)
+        {
+            if (prev->cores[jj].cmd == core->cmd)
+                prev_core = &prev->cores[jj];
+        }
+        if (!prev_core)
+            mctrl_err("%s stats are not in the first snapshot\n", stats_core_name(core->cmd));
+
+        ret = stats_delta_print(mors, prev_core ? prev_core->data : NULL,
+                                prev_core ? prev_core->len : 0, core->data, core->len,
+                                interval_us, filter_string);
+    }
+
+    return ret;
+}
+
+int stats_decode(struct morsectrl *mors, int argc, char *argv[])
+{
+    int option;
+    int ret = 0;
+    bool app_c = false, mac_c = false, uph_c = false;
+    const char *filter_string = NULL;
+    const char *firmware_path = NULL;
+    const char *diff_path = NULL;
+    char path[MAX_PATH];
+    enum format_type format = FORMAT_REGULAR;
+    struct stats_snapshot snapshot;
+    struct stats_snapshot diff_snapshot;
+    uint8_t build_id[STATS_SNAPSHOT_BUILD_ID_MAX];
+    size_t build_id_len;
+    int cmds[STATS_MAX_CORES];
+    size_t n_cmds;
+    size_t ii;
+    size_t jj;
+    static const struct option long_options[] = {
+        {"diff", required_argument, NULL, 'D'},
+        {NULL, 0, NULL, 0},
+    };
+
+    if (argc == 0)
+    {
+        decode_usage(mors);
+        return 0;
+    }
+
+    while ((option = getopt_long(argc, argv, "amujpOf:s:", long_options, NULL)) != -1)
+    {
+        switch (option)
+        {
+            case 'a' :
+                app_c = true;
+                break;
+            case 'm' :
+                mac_c = true;
+                break;
+            case 'u' :
+                uph_c = true;
+                break;
+            case 'j' :
+                format = FORMAT_JSON;
+                break;
+            case 'p' :
+                format = FORMAT_JSON_PPRINT;
+                break;
+            case 'O' :
+                format = FORMAT_OPENMETRICS;
+                break;
+            case 'f' :
+                filter_string = optarg;
+                break;
+            case 's' :
+                firmware_path = optarg;
+                break;
+            case 'D' :
+                diff_path = optarg;
+                break;
+            default :
+                decode_usage(mors);
+                return -1;
+        }
+    }
+    if (argc != optind + 1)
+    {
+        mctrl_err("A snapshot file is required\n");
+        decode_usage(mors);
+        return -1;
+    }
+
+    if (diff_path && (format != FORMAT_REGULAR))
+    {
+        mctrl_err("--diff can't be used with -j, -p or -O\n");
+        return -1;
+    }
+
+    memset(&diff_snapshot, 0, sizeof(diff_snapshot));
+    if (stats_snapshot_read(argv[optind], &snapshot))
+        return -1;
+
+    if (diff_path && stats_snapshot_read(diff_path, &diff_snapshot))
+    {
+        ret = -1;
+        goto exit;
+    }
+
+    firmware_path = get_firmware_path(mors, firmware_path, path, sizeof(path));
+    ret = load_offchip_statistics(mors, firmware_path);
+    if (ret)
+        goto exit;
+
+    /* Decoding with other metadata would silently give the wrong keys. */
+    if (snapshot.build_id_len &&
+        !morse_elf_build_id(firmware_path, build_id, sizeof(build_id), &build_id_len) &&
+        ((build_id_len != snapshot.build_id_len) ||
+         memcmp(build_id, snapshot.build_id, build_id_len)))
+    {
+        mctrl_err("Warning - %s is not the firmware the snapshot was taken with (%s)\n",
+                  firmware_path, snapshot.fw_name);
+    }
+
+    n_cmds = stats_select_cores(app_c, mac_c, uph_c, cmds);
+
+    if (diff_path)
+    {
+        ret = stats_decode_diff(mors, &snapshot, &diff_snapshot, cmds, n_cmds, filter_string);
+        goto exit;
+    }
+
+    if (format == FORMAT_JSON)
+    {
+        mctrl_print("{");
+    }
+    else if (format == FORMAT_JSON_PPRINT)
+    {
+        mctrl_print("{\n");
+    }
+
+    for (ii = 0; ii < n_cmds; ii++)
+    {
+        for (jj = 0; jj < snapshot.n_cores; jj++)
+        {
+            const struct stats_snapshot_core *core = &snapshot.cores[jj];
+
+            if (core->cmd != cmds[ii])
+                continue;
+
+            ret = stats_print_response(mors, core->cmd, core->data, core->len, filter_string,
+                                       format, false, snapshot.interface);
+            if (ret)
+                goto exit;
+        }
+    }
+
+    if (format == FORMAT_JSON)
+    {
+        mctrl_print("}\n");
+    }
+    else if (format == FORMAT_JSON_PPRINT)
+    {
+        mctrl_print("\n}\n");
+    }
+    else if (format == FORMAT_OPENMETRICS)
+    {
+        stats_format_openmetrics_end();
+    }
+
+exit:
+    stats_snapshot_free(&snapshot);
+    stats_snapshot_free(&diff_snapshot);
+    stats_offchip_free(mors);
+
+    if (ret < 0)
+    {
+        mctrl_err("Command stats_decode error (%d)\n", ret);
+    }
+
+    return ret;
+}
+
+int stats_query(struct morsectrl *mors, int argc, char *argv[])
+{
+    int option;
+    int ret;
+    const char *filter_string = NULL;
+    uint32_t start_s = 0;
+    uint32_t end_s = UINT32_MAX;
+    uint32_t last_s = 0;
+    uint32_t tier;
+    int tier_idx = -1;
+    bool json = false;
+    uint64_t start_ms;
+
+    if (argc == 0)
+    {
+        query_usage(mors);
+        return 0;
+    }
+
+    while ((option = getopt(argc, argv, "b:e:l:t:jf:")) != -1)
+    {
+        switch (option)
+        {
+            case 'b' :
+            case 'e' :
+            case 'l' :
+                if (str_to_uint32_range(optarg, (option == 'b') ? &start_s :
+                                                (option == 'e') ? &end_s : &last_s,
+                                        0, UINT32_MAX))
+                {
+                    mctrl_err("Invalid time %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case 't' :
+                if (str_to_uint32_range(optarg, &tier, 0, 2))
+                {
+                    mctrl_err("Invalid tier %s\n", optarg);
+                    return -1;
+                }
+                tier_idx = tier;
+                break;
+            case 'j' :
+                json = true;
+                break;
+            case 'f' :
+                filter_string = optarg;
+                break;
+            default :
+                query_usage(mors);
+                return -1;
+        }
+    }
+    if (argc != optind + 1)
+    {
+        mctrl_err("A record file is required\n");
+        query_usage(mors);
+        return -1;
+    }
+
+    start_ms = (uint64_t)start_s * 1000;
+    if (last_s)
+        start_ms = MAX(start_ms, (time_wall_us() / 1000) - ((uint64_t)last_s * 1000));
+
+    ret = stats_record_query(argv[optind], start_ms, ((uint64_t)end_s * 1000) + 999, tier_idx,
+                             filter_string, json);
+    if (ret < 0)
+    {
+        mctrl_err("Command stats_query error (%d)\n", ret);
+    }
+
+    return ret;
+}
@@ -0,0 +1,315 @@
+/*
+ * Copyright 2023 Morse Micro
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifndef MORSE_WIN_BUILD
+#include <sys/mman.h>
+#endif
+
+#include "stats_cache.h"
+#include "offchip_statistics.h"
+#include "elf_file.h"
+#include "utilities.h"
+
+#ifndef MORSE_WIN_BUILD
+
+#define STATS_CACHE_MAGIC           "MMSTATC"
+#define STATS_CACHE_VERSION         (2)
+#define STATS_CACHE_PATH_MAX        (1024)
+#define STATS_CACHE_BUILD_ID_MAX    (32)
+
+/* Directories the cache may be kept in, in order of preference. */
+static const char *stats_cache_dirs[] = {
+    "/var/cache/morsectrl",
+    "/run/morsectrl",
+};
+
+/** What a cache is checked against to tell whether the firmware has changed. */
+struct stats_cache_fw_id
+{
+    uint64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint32_t build_id_len;
+    uint8_t build_id[STATS_CACHE_BUILD_ID_MAX];
+};
+
+/**
+ * Start of a cache file. It is followed by n_entries struct statistics_offchip_entry, n_slots
+ * uint32_t tag slots and the strings_len octet string pool.
+ */
+struct stats_cache_header
+{
+    char magic[8];
+    uint32_t version;
+    /** Size of an entry, in case the metadata layout changes. */
+    uint32_t entry_size;
+    struct stats_cache_fw_id fw;
+    uint32_t n_entries;
+    uint32_t n_slots;
+    uint32_t strings_len;
+    uint32_t pad;
+    /** Canonical path of the firmware, as the file name is only a hash of it. */
+    char fw_path[STATS_CACHE_PATH_MAX];
+};
+
+/**
+ * @brief Identify a firmware by its canonical path, size, modification time and build ID.
+ *
+ * @param fw_path   Path of the firmware.
+ * @param path      Filled with the canonical path.
+ * @param id        Filled with the identity of the firmware.
+ * @return          0 on success, otherwise -1 if the firmware can't be found.
+ */
+static int stats_cache_fw_id(const char *fw_path, char path[STATS_CACHE_PATH_MAX],
+                             struct stats_cache_fw_id *id)
+{
+    char resolved[PATH_MAX];
+    struct stat fw_stats;
+    size_t build_id_len;
+
+    /* Zero any padding too, as identities are compared whole. */
+    memset(id, 0, sizeof(*id));
+    memset(path, 0, STATS_CACHE_PATH_MAX);
+
+    if (stat(fw_path, &fw_stats))
+        return -1;
+
+    if (!realpath(fw_path, resolved))
+        snprintf(resolved, sizeof(resolved), "%s", fw_path);
+
+    if (strlen(resolved) >= STATS_CACHE_PATH_MAX)
+        return -1;
+    strcpy(path, resolved);
+
+    id->size = fw_stats.st_size;
+    id->mtime_sec = fw_stats.st_mtim.tv_sec;
+    id->mtime_nsec = fw_stats.st_mtim.tv_nsec;
+    if (!morse_elf_build_id(path, id->build_id, sizeof(id->build_id), &build_id_len))
+        id->build_id_len = build_id_len;
+
+    return 0;
+}
+
+/**
+ * @brief Get the path of the cache for a firmware in one of the cache directories.
+ *
+ * @param dir       Cache directory.
+ * @param fw_path   Canonical path of the firmware.
+ * @param buf       Buffer for the path.
+ * @param size      Size of the buffer.
+ */
+static void stats_cache_path(const char *dir, const char *fw_path, char *buf, size_t size)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    const char *c;
+
+    /* FNV-1a of the firmware path. */
+    for (c = fw_path; *c; c++)
+        hash = (hash ^ (uint8_t)*c) * 0x100000001b3ULL;
+
+    snprintf(buf, size, "%s/stats-%016" PRIx64 ".cache", dir, hash);
+}
+
+/**
+ * @brief Check a mapped cache file is whole and belongs to the firmware.
+ *
+ * @param map       Start of the mapping.
+ * @param len       Length of the mapping.
+ * @param path      Canonical path of the firmware.
+ * @param id        Identity of the firmware.
+ * @return          true if the cache can be used.
+ */
+static bool stats_cache_valid(const uint8_t *map, size_t len, const char *path,
+                              const struct stats_cache_fw_id *id)
+{
+    const struct stats_cache_header *hdr = (const struct stats_cache_header *)map;
+    const struct statistics_offchip_entry *entries;
+    const uint32_t *slots;
+    const char *strings;
+    uint64_t expected;
+    uint32_t ii;
+
+    if ((len < sizeof(*hdr)) ||
+        memcmp(hdr->magic, STATS_CACHE_MAGIC, sizeof(hdr->magic)) ||
+        (hdr->version != STATS_CACHE_VERSION) ||
+        (hdr->entry_size != sizeof(struct statistics_offchip_entry)) ||
+        memcmp(&hdr->fw, id, sizeof(*id)) ||
+        strncmp(hdr->fw_path, path, sizeof(hdr->fw_path)))
+        return false;
+
+    expected = sizeof(*hdr) +
+               (uint64_t)hdr->n_entries * sizeof(struct statistics_offchip_entry) +
+               (uint64_t)hdr->n_slots * sizeof(uint32_t) +
+               hdr->strings_len;
+    if ((expected != len) || (hdr->n_slots > BIT(8 * sizeof(stats_tlv_tag_t))))
+        return false;
+
+    /* Everything the index refers to must be within the file, and every key terminated. */
+    entries = (const struct statistics_offchip_entry *)(hdr + 1);
+    slots = (const uint32_t *)(entries + hdr->n_entries);
+    strings = (const char *)(slots + hdr->n_slots);
+    if (hdr->strings_len && strings[hdr->strings_len - 1])
+        return false;
+
+    for (ii = 0; ii < hdr->n_entries; ii++)
+    {
+        if ((entries[ii].key_offset >= hdr->strings_len) ||
+            (entries[ii].format > MORSE_STATS_FMT_LAST) ||
+            (entries[ii].tag >= hdr->n_slots))
+            return false;
+    }
+
+    for (ii = 0; ii < hdr->n_slots; ii++)
+    {
+        if (slots[ii] > hdr->n_entries)
+            return false;
+    }
+
+    return true;
+}
+
+int stats_cache_load(struct morsectrl *mors, const char *fw_path)
+{
+    char path[STATS_CACHE_PATH_MAX];
+    char cache_path[STATS_CACHE_PATH_MAX + 64];
+    struct stats_cache_fw_id id;
+    size_t ii;
+
+    if (stats_cache_fw_id(fw_path, path, &id))
+        return -1;
+
+    for (ii = 0; ii < MORSE_ARRAY_SIZE(stats_cache_dirs); ii++)
+    {
+        const struct stats_cache_header *hdr;
+        struct statistics_offchip_index *index;
+        struct stat cache_stats;
+        uint8_t *map;
+        FILE *file;
+
+        stats_cache_path(stats_cache_dirs[ii], path, cache_path, sizeof(cache_path));
+
+        file = fopen(cache_path, "rb");
+        if (!file)
+            continue;
+
+        map = NULL;
+        if (!fstat(fileno(file), &cache_stats) && (cache_stats.st_size >= sizeof(*hdr)))
+        {
+            map = mmap(NULL, cache_stats.st_size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+            if (map == MAP_FAILED)
+                map = NULL;
+        }
+        fclose(file);
+
+        if (!map)
+            continue;
+
+        index = calloc(1, sizeof(*index));
+        if (!index || !stats_cache_valid(map, cache_stats.st_size, path, &id))
+        {
+            free(index);
+            munmap(map, cache_stats.st_size);
+            continue;
+        }
+
+        hdr = (const struct stats_cache_header *)map;
+        index->entries = (const struct statistics_offchip_entry *)(hdr + 1);
+        index->n_entries = hdr->n_entries;
+        index->slots = (const uint32_t *)(index->entries + hdr->n_entries);
+        index->n_slots = hdr->n_slots;
+        index->strings = (const char *)(index->slots + hdr->n_slots);
+        index->strings_len = hdr->strings_len;
+        index->map = map;
+        index->map_len = cache_stats.st_size;
+
+        /* The index is only read, so is used straight from the read only mapping. */
+        stats_offchip_free(mors);
+        mors->stats_index = index;
+
+        if (mors->debug)
+            mctrl_print("Stats metadata mapped from %s\n", cache_path);
+
+        return 0;
+    }
+
+    return -1;
+}
+
+void stats_cache_store(const struct morsectrl *mors, const char *fw_path)
+{
+    const struct statistics_offchip_index *index = mors->stats_index;
+    struct stats_cache_header hdr;
+    char cache_path[STATS_CACHE_PATH_MAX + 64];
+    char tmp_path[STATS_CACHE_PATH_MAX + 96];
+    size_t ii;
+
+    if (!index || index->map)
+        return;
+
+    memset(&hdr, 0, sizeof(hdr));
+    if (stats_cache_fw_id(fw_path, hdr.fw_path, &hdr.fw))
+        return;
+
+    memcpy(hdr.magic, STATS_CACHE_MAGIC, sizeof(hdr.magic));
+    hdr.version = STATS_CACHE_VERSION;
+    hdr.entry_size = sizeof(struct statistics_offchip_entry);
+    hdr.n_entries = index->n_entries;
+    hdr.n_slots = index->n_slots;
+    hdr.strings_len = index->strings_len;
+
+    for (ii = 0; ii < MORSE_ARRAY_SIZE(stats_cache_dirs); ii++)
+    {
+        FILE *file;
+        bool written;
+
+        mkdir(stats_cache_dirs[ii], 0755);
+
+        stats_cache_path(stats_cache_dirs[ii], hdr.fw_path, cache_path, sizeof(cache_path));
+        snprintf(tmp_path, sizeof(tmp_path), "%s.%ld.tmp", cache_path, (long)getpid());
+
+        file = fopen(tmp_path, "wb");
+        if (!file)
+            continue;
+
+        /* Write a copy and rename it over the cache, so it is never seen half written. */
+        written = (fwrite(&hdr, sizeof(hdr), 1, file) == 1) &&
+                  (fwrite(index->entries, sizeof(*index->entries), index->n_entries, file) ==
+                   index->n_entries) &&
+                  (fwrite(index->slots, sizeof(*index->slots), index->n_slots, file) ==
+                   index->n_slots) &&
+                  (fwrite(index->strings, 1, index->strings_len, file) == index->strings_len);
+
+        if (fclose(file) || !written || rename(tmp_path, cache_path))
+        {
+            remove(tmp_path);
+            continue;
+        }
+
+        if (mors->debug)
+            mctrl_print("Stats metadata cached in %s\n", cache_path);
+
+        return;
+    }
+}
+
+#else
+
+int stats_cache_load(struct morsectrl *mors, const char *fw_path)
+{
+    return -1;
+}
+
+void stats_cache_store(const struct morsectrl *mors, const char *fw_path)
+{
+}
+
+#endif
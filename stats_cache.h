@@ -0,0 +1,33 @@
+/*
+ * Copyright 2023 Morse Micro
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include "morsectrl.h"
+
+/*
+ * Compiled stats metadata cache. The tag index, entries and key string pool built from a firmware
+ * ELF are stored in a file that later calls map instead of parsing the firmware. The
+ * cache is keyed by the firmware path and checked against its size, modification time and GNU
+ * build ID, so it is rebuilt whenever the firmware changes.
+ */
+
+/**
+ * @brief Map the indexed stats metadata of a firmware from the cache into mors->stats_index.
+ *
+ * @param mors      Morsectrl context to fill in.
+ * @param fw_path   Path of the firmware ELF.
+ * @return          0 on success, otherwise -1 if there is no valid cache for the firmware.
+ */
+int stats_cache_load(struct morsectrl *mors, const char *fw_path);
+
+/**
+ * @brief Store the indexed stats metadata of a firmware in the cache. Failures are ignored, the
+ *        metadata is just parsed again next time.
+ *
+ * @param mors      Morsectrl context holding the indexed metadata.
+ * @param fw_path   Path of the firmware ELF the metadata came from.
+ */
+void stats_cache_store(const struct morsectrl *mors, const char *fw_path);
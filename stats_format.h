@@ -7,6 +7,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include "offchip_statistics.h"
 
 /**
@@ -128,6 +129,94 @@ struct PACKED stats_response
     uint8_t stats[2048];
 };
 
+/** Most octets of TLVs read from a core, across all the pages of a paged response. */
+#define STATS_TLVS_MAX_LEN (UINT16_MAX)
+
+/** Flag of a stats page with more TLVs to read after it. */
+#define STATS_PAGE_FLAG_MORE BIT(0)
+
+/**
+ * Request for a page of the stats of a core, only sent to firmware reporting
+ * MORSE_CAPAB_STATS_PAGED. Older firmware takes a request with no payload and answers with a
+ * struct stats_response.
+ */
+struct PACKED stats_page_request
+{
+    /** Offset in the core's TLVs to start the page at, 0 or the next_offset of the last page. */
+    uint32_t offset;
+};
+
+/** A page of the stats of a core, holding only whole TLVs. */
+struct PACKED stats_page_response
+{
+    /** STATS_PAGE_FLAG_* */
+    uint32_t flags;
+    /** Offset to request the next page at. */
+    uint32_t next_offset;
+    /** The TLVs, in no more octets than a single shot response. */
+    uint8_t stats[sizeof(struct stats_response) - 2 * sizeof(uint32_t)];
+};
+
+/** Number of cores with stats: app, mac and uphy. */
+#define STATS_MAX_CORES (3)
+
+/** Buffers to read the stats of several cores with, the requests for all sent together. */
+struct stats_fetch
+{
+    size_t n_cmds;
+    /** Stats log command of each core. */
+    int cmds[STATS_MAX_CORES];
+    struct morsectrl_transport_buff *cmd_tbuffs[STATS_MAX_CORES];
+    struct morsectrl_transport_buff *rsp_tbuffs[STATS_MAX_CORES];
+    /** Size of the response buffers, restored before each request as responses shrink them. */
+    size_t rsp_len;
+    /** Result of each command of the last fetch, 0 on success. */
+    int rets[STATS_MAX_CORES];
+    /** Whether the firmware returns the stats in pages. */
+    bool paged;
+    /** TLVs of each core reassembled from its pages, only used when paged. */
+    uint8_t *tlvs[STATS_MAX_CORES];
+    size_t tlvs_len[STATS_MAX_CORES];
+};
+
+/**
+ * @brief Allocate the buffers to read the stats of some cores with, paging the responses if the
+ *        firmware supports it.
+ *
+ * @param mors      Morsectrl context.
+ * @param fetch     Buffers to allocate, freed with stats_fetch_free() even on failure.
+ * @param cmds      Stats log commands of the cores.
+ * @param n_cmds    Number of cores, up to STATS_MAX_CORES.
+ * @return          0 on success otherwise relevant error.
+ */
+int stats_fetch_init(struct morsectrl *mors, struct stats_fetch *fetch, const int *cmds,
+                     size_t n_cmds);
+
+/**
+ * @brief Read the stats of every core, issuing all the requests before waiting for any response.
+ *        Paged responses are read a page of every core at a time until all are complete, so
+ *        the pages of a core are read at slightly different times.
+ *
+ * @param mors      Morsectrl context.
+ * @param fetch     Buffers from stats_fetch_init(), filled with the responses and their results.
+ * @param report    true to report, and return, the first command that failed.
+ * @return          0 on success otherwise relevant error.
+ */
+int stats_fetch(struct morsectrl *mors, struct stats_fetch *fetch, bool report);
+
+/** Free the buffers of stats_fetch_init(). */
+void stats_fetch_free(struct stats_fetch *fetch);
+
+/**
+ * @brief Get the TLVs of a core read by stats_fetch().
+ *
+ * @param fetch     Buffers read into.
+ * @param core      Index of the core.
+ * @param len       Filled with the length of the TLVs.
+ * @return          The TLVs.
+ */
+const uint8_t *stats_fetch_tlvs(const struct stats_fetch *fetch, size_t core, int *len);
+
 
 /** Enum type for printing format  */
 enum format_type
@@ -135,6 +224,7 @@ enum format_type
     FORMAT_REGULAR,
     FORMAT_JSON,
     FORMAT_JSON_PPRINT,
+    FORMAT_OPENMETRICS,
     /* Add additional formats here  */
 };
 
@@ -153,3 +243,47 @@ void hexdump(const uint8_t *buf, uint32_t len);
 const struct format_table* stats_format_json_get_formatter_table();
 void stats_format_json_init();
 void stats_format_json_set_pprint(bool pprint);
+
+/**
+ * Prometheus text exposition format (0.0.4) functions, as parsed by the node_exporter textfile
+ * collector. Samples are kept until stats_format_openmetrics_end(), which prints each family once.
+ */
+const struct format_table* stats_format_openmetrics_get_formatter_table();
+/** Write the exposition to a file rather than stdout, or back to stdout if NULL. */
+void stats_format_openmetrics_set_output(FILE *file);
+/** Set the core and interface labels of the series that follow. */
+void stats_format_openmetrics_set_labels(const char *core, const char *interface);
+/** Print the families gathered from every core, and forget them. */
+void stats_format_openmetrics_end();
+
+/**
+ * @brief Print the stats of a response along with how each counter changed since an earlier
+ *        response of the same core.
+ *
+ * @param mors          Morsectrl context holding the indexed metadata.
+ * @param prev          TLVs of the earlier response, or NULL to print the stats as they are.
+ * @param prev_len      Length of the earlier response.
+ * @param cur           TLVs of the response.
+ * @param cur_len       Length of the response.
+ * @param interval_us   Time between the responses.
+ * @param filter_string Key of the only stat to print, or NULL for all.
+ * @return              0 on success otherwise relevant error.
+ */
+int stats_delta_print(struct morsectrl *mors, const uint8_t *prev, int prev_len,
+                      const uint8_t *cur, int cur_len, uint64_t interval_us,
+                      const char *filter_string);
+
+/**
+ * @brief Sample the stats of some cores periodically, keeping the transport and metadata loaded,
+ *        and print the change in each counter and its rate since the previous sample.
+ *
+ * @param mors          Morsectrl context holding the indexed metadata.
+ * @param cmds          Stats log commands of the cores to sample.
+ * @param n_cmds        Number of cores.
+ * @param filter_string Key of the only stat to print, or NULL for all.
+ * @param interval_ms   Time between samples.
+ * @param count         Number of samples to take, 0 to sample until interrupted.
+ * @return              0 on success otherwise relevant error.
+ */
+int stats_watch(struct morsectrl *mors, const int *cmds, size_t n_cmds,
+                const char *filter_string, uint32_t interval_ms, uint32_t count);
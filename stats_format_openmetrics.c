@@ -0,0 +1,566 @@
+/*
+ * Copyright 2023 Morse Micro
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <inttypes.h>
+
+#include "portable_endian.h"
+#include "command.h"
+#include "offchip_statistics.h"
+#include "stats_format.h"
+#include "utilities.h"
+
+#define METRIC_PREFIX "morse_"
+#define METRIC_NAME_LEN (sizeof(METRIC_PREFIX) + STATS_OFFCHIP_STRING_KEY_MAX + 64)
+/** Room left in a name for a number and _total after the key and suffix. */
+#define METRIC_NAME_EXTRA (24)
+
+/**
+ * A metric family, with the samples of every core printed so far. The exposition format wants
+ * each family given once with all its samples together, while stats arrive a core at a time, so
+ * samples are kept until the end.
+ */
+struct metric_family
+{
+    char name[METRIC_NAME_LEN];
+    bool counter;
+    /** Key and suffix of the stat named after, as different keys can sanitise alike. */
+    char *key;
+    char *suffix;
+    char *samples;
+    size_t samples_len;
+    size_t samples_size;
+};
+
+/** Where the exposition is written, stdout if NULL. */
+static FILE *output;
+/** Labels every series gets, without the braces. */
+static char base_labels[256];
+/** Families in the order they were first seen. */
+static struct metric_family *families;
+static size_t n_families;
+static size_t families_size;
+/** Open addressed table of one more than the index of each family, by a hash of its name. */
+static uint32_t *family_slots;
+static size_t n_family_slots;
+/** Family samples are being added to, NULL if it could not be allocated. */
+static struct metric_family *family;
+/** Whether samples were left out for lack of memory. */
+static bool out_of_memory;
+
+
+static FILE *out(void)
+{
+    return output ? output : stdout;
+}
+
+static uint32_t family_hash(const char *name)
+{
+    uint32_t hash = 2166136261u;
+
+    for (; *name; name++)
+        hash = (hash ^ (uint8_t)*name) * 16777619u;
+
+    return hash;
+}
+
+/** Find the slot of a family name, which is empty if there is no family of that name. */
+static uint32_t *family_slot(const char *name)
+{
+    size_t mask = n_family_slots - 1;
+    size_t ii = family_hash(name) & mask;
+
+    while (family_slots[ii] && strcmp(families[family_slots[ii] - 1].name, name))
+        ii = (ii + 1) & mask;
+
+    return &family_slots[ii];
+}
+
+/** Make room for another family, keeping the slot table at most half full. */
+static int family_reserve(void)
+{
+    size_t ii;
+
+    if (n_families == families_size)
+    {
+        size_t size = families_size ? (families_size * 2) : 64;
+        struct metric_family *grown = realloc(families, size * sizeof(*grown));
+
+        if (!grown)
+            return -1;
+        families = grown;
+        families_size = size;
+    }
+
+    if ((n_families + 1) * 2 > n_family_slots)
+    {
+        size_t n_slots = n_family_slots ? (n_family_slots * 2) : 128;
+        uint32_t *slots = calloc(n_slots, sizeof(*slots));
+
+        if (!slots)
+            return -1;
+        free(family_slots);
+        family_slots = slots;
+        n_family_slots = n_slots;
+
+        for (ii = 0; ii < n_families; ii++)
+            *family_slot(families[ii].name) = ii + 1;
+    }
+
+    return 0;
+}
+
+/**
+ * Start adding samples to the metric family named after a stat's key, with characters not allowed
+ * in metric names replaced by underscores. Counters are named with a _total suffix, on the TYPE
+ * line as well as the samples, as the Prometheus text format expects both to match. Where
+ * different keys come out with the same name, the later ones are numbered to keep them apart.
+ */
+static void start_family(const char *key, const char *suffix, bool counter)
+{
+    char base[METRIC_NAME_LEN - METRIC_NAME_EXTRA];
+    char name[METRIC_NAME_LEN];
+    struct metric_family *found;
+    uint32_t *slot;
+    unsigned int n;
+    size_t i;
+
+    family = NULL;
+
+    snprintf(base, sizeof(base), METRIC_PREFIX "%s%s%s", key, suffix ? "_" : "",
+             suffix ? suffix : "");
+    for (i = strlen(METRIC_PREFIX); base[i]; i++)
+    {
+        if (!isalnum((unsigned char)base[i]) && (base[i] != '_'))
+            base[i] = '_';
+    }
+
+    if (family_reserve())
+    {
+        out_of_memory = true;
+        return;
+    }
+
+    for (n = 1; ; n++)
+    {
+        if (n == 1)
+            snprintf(name, sizeof(name), "%s%s", base, counter ? "_total" : "");
+        else
+            snprintf(name, sizeof(name), "%s_%u%s", base, n, counter ? "_total" : "");
+
+        slot = family_slot(name);
+        if (!*slot)
+            break;
+
+        found = &families[*slot - 1];
+        if ((found->counter == counter) && !strcmp(found->key, key) &&
+            !strcmp(found->suffix, suffix ? suffix : ""))
+        {
+            family = found;
+            return;
+        }
+    }
+
+    family = &families[n_families];
+    memset(family, 0, sizeof(*family));
+    snprintf(family->name, sizeof(family->name), "%s", name);
+    family->counter = counter;
+    family->key = strdup(key);
+    family->suffix = strdup(suffix ? suffix : "");
+    if (!family->key || !family->suffix)
+    {
+        free(family->key);
+        free(family->suffix);
+        family = NULL;
+        out_of_memory = true;
+        return;
+    }
+
+    *slot = ++n_families;
+}
+
+/** Add to the samples of the current family. */
+static void emit(const char *fmt, ...)
+{
+    va_list args;
+    int len;
+
+    if (!family)
+        return;
+
+    va_start(args, fmt);
+    len = vsnprintf(family->samples ? family->samples + family->samples_len : NULL,
+                    family->samples_size - family->samples_len, fmt, args);
+    va_end(args);
+    if (len < 0)
+        return;
+
+    if (family->samples_len + len >= family->samples_size)
+    {
+        size_t size = MAX(family->samples_size * 2, family->samples_len + len + 256);
+        char *grown = realloc(family->samples, size);
+
+        if (!grown)
+        {
+            out_of_memory = true;
+            return;
+        }
+        family->samples = grown;
+        family->samples_size = size;
+
+        va_start(args, fmt);
+        vsnprintf(family->samples + family->samples_len,
+                  family->samples_size - family->samples_len, fmt, args);
+        va_end(args);
+    }
+
+    family->samples_len += len;
+}
+
+/** Add the name and labels of a series of the current family, with an optional extra label. */
+static void print_series(const char *label, const char *label_value)
+{
+    if (!family)
+        return;
+
+    emit("%s{%s", family->name, base_labels);
+    if (label)
+        emit(",%s=\"%s\"", label, label_value);
+    emit("} ");
+}
+
+static void print_u64(const char *label, const char *label_value, uint64_t value)
+{
+    print_series(label, label_value);
+    emit("%" PRIu64 "\n", value);
+}
+
+static void print_u64_indexed(const char *label, int index, uint64_t value)
+{
+    char label_value[16];
+
+    snprintf(label_value, sizeof(label_value), "%d", index);
+    print_u64(label, label_value, value);
+}
+
+
+/** OpenMetrics formatting functions for morsectrl statistics */
+static void print_dec(const char *key, const uint8_t *buf, uint32_t len)
+{
+    start_family(key, NULL, false);
+    print_series(NULL, NULL);
+    emit("%" PRId64 "\n", get_signed_value_as_int64(buf, len));
+}
+
+
+static void print_udec(const char *key, const uint8_t *buf, uint32_t len)
+{
+    start_family(key, NULL, true);
+    print_u64(NULL, NULL, get_unsigned_value_as_uint64(buf, len));
+}
+
+
+static void print_hex(const char *key, const uint8_t *buf, uint32_t len)
+{
+    start_family(key, NULL, false);
+    print_u64(NULL, NULL, get_unsigned_value_as_uint64(buf, len));
+}
+
+
+static void print_ampdu_aggregates(const char *key, const uint8_t *buf, uint32_t len)
+{
+    ampdu_count_t count;
+
+    if (len < sizeof(count))
+        return;
+    memcpy(&count, buf, sizeof(count));
+
+    start_family(key, NULL, true);
+    for (int i = 0; i < MORSE_ARRAY_SIZE(count.count); i++)
+        print_u64_indexed("aggregate", i, count.count[i]);
+}
+
+
+static void print_ampdu_bitmap(const char *key, const uint8_t *buf, uint32_t len)
+{
+    ampdu_bitmap_t bitmap;
+
+    if (len < sizeof(bitmap))
+        return;
+    memcpy(&bitmap, buf, sizeof(bitmap));
+
+    start_family(key, NULL, true);
+    for (int i = 0; i < MORSE_ARRAY_SIZE(bitmap.bitmap); i++)
+        print_u64_indexed("position", i, bitmap.bitmap[i]);
+}
+
+
+static void print_txop(const char *key, const uint8_t *buf, uint32_t len)
+{
+    struct txop_statistics txop_stats;
+
+    if (len < sizeof(txop_stats))
+        return;
+    memcpy(&txop_stats, buf, sizeof(txop_stats));
+
+    start_family(key, "count", true);
+    print_u64(NULL, NULL, txop_stats.count);
+    start_family(key, "duration", true);
+    print_u64(NULL, NULL, txop_stats.duration);
+    start_family(key, "pkts", true);
+    print_u64(NULL, NULL, txop_stats.pkts);
+    start_family(key, "max_pkts_in_txop", false);
+    print_u64(NULL, NULL, txop_stats.max_pkts_in_txop);
+    start_family(key, "lost_beacons", true);
+    print_u64(NULL, NULL, txop_stats.lost_beacons);
+}
+
+
+static void print_pageset(const char *key, const uint8_t *buf, uint32_t len)
+{
+    struct pageset_stats pageset;
+
+    if (len < sizeof(pageset))
+        return;
+    memcpy(&pageset, buf, sizeof(pageset));
+
+    start_family(key, "allocated", false);
+    for (int i = 0; i < NUM_PAGESETS; i++)
+        print_u64_indexed("pageset", i, pageset.pages_allocated[i]);
+
+    start_family(key, "total", false);
+    for (int i = 0; i < NUM_PAGESETS; i++)
+        print_u64_indexed("pageset", i, pageset.pages_to_allocate[i]);
+}
+
+
+static void print_retries(const char *key, const uint8_t *buf, uint32_t len)
+{
+    struct retry_stats retries;
+
+    if (len < sizeof(retries))
+        return;
+    memcpy(&retries, buf, sizeof(retries));
+
+    start_family(key, "count", true);
+    for (int i = 0; i < APP_STATS_COUNT; i++)
+        print_u64_indexed("retry", i, retries.count[i]);
+
+    start_family(key, "time", true);
+    for (int i = 0; i < APP_STATS_COUNT; i++)
+        print_u64_indexed("retry", i, retries.sum[i]);
+}
+
+
+static void print_raw(const char *key, const uint8_t *buf, uint32_t len)
+{
+    raw_stats_t raw_stats;
+
+    if (len < sizeof(raw_stats))
+        return;
+    memcpy(&raw_stats, buf, sizeof(raw_stats));
+
+    start_family(key, "assignments", true);
+    for (int i = 0; i < MORSE_ARRAY_SIZE(raw_stats.assignments); i++)
+        print_u64_indexed("assignment", i, raw_stats.assignments[i]);
+
+    start_family(key, "invalid_assignments", true);
+    print_u64("reason", "truncated_by_tbtt", raw_stats.assignments_truncated_from_tbtt);
+    print_u64("reason", "invalid", raw_stats.invalid_assignments);
+    print_u64("reason", "already_past", raw_stats.already_past_assignment);
+
+    start_family(key, "frames_delayed", true);
+    print_u64("reason", "aci_queue", raw_stats.aci_frames_delayed);
+    print_u64("reason", "bc_mc_queue", raw_stats.bc_mc_frames_delayed);
+    print_u64("reason", "abs_time_queue", raw_stats.abs_frames_delayed);
+    print_u64("reason", "crosses_slot", raw_stats.frame_crosses_slot_delayed);
+}
+
+
+static void print_calibration(const char *key, const uint8_t *buf, uint32_t len)
+{
+    managed_calibration_stats_t calib_stats;
+
+    if (len < sizeof(calib_stats))
+        return;
+    memcpy(&calib_stats, buf, sizeof(calib_stats));
+
+    start_family(key, NULL, true);
+    print_u64("event", "quiet_granted", calib_stats.quiet_calibration_granted);
+    print_u64("event", "quiet_rejected", calib_stats.quiet_calibration_rejected);
+    print_u64("event", "quiet_cancelled", calib_stats.quiet_calibration_cancelled);
+    print_u64("event", "non_quiet_granted", calib_stats.non_quiet_calibration_granted);
+    print_u64("event", "complete", calib_stats.calibration_complete);
+}
+
+
+static void print_duty_cycle(const char *key, const uint8_t *buf, uint32_t len)
+{
+    duty_cycle_stats_t duty_cycle_stats;
+
+    if (len < sizeof(duty_cycle_stats))
+        return;
+    memcpy(&duty_cycle_stats, buf, sizeof(duty_cycle_stats));
+
+    /* The target is in 100ths of a percent, exposed as a ratio. */
+    start_family(key, "target_ratio", false);
+    print_series(NULL, NULL);
+    emit("%u.%04u\n", duty_cycle_stats.target_duty_cycle / 10000,
+         duty_cycle_stats.target_duty_cycle % 10000);
+    start_family(key, "tx_on_us", true);
+    print_u64(NULL, NULL, duty_cycle_stats.total_t_air);
+    start_family(key, "tx_off_us", true);
+    print_u64(NULL, NULL, duty_cycle_stats.total_t_off);
+    start_family(key, "max_t_off_us", false);
+    print_u64(NULL, NULL, duty_cycle_stats.max_t_off);
+    start_family(key, "early_frames", true);
+    print_u64(NULL, NULL, duty_cycle_stats.num_early);
+}
+
+
+static void print_mac_state(const char *key, const uint8_t *buf, uint32_t len)
+{
+    uint64_t mac_state;
+
+    if (len < sizeof(mac_state))
+        return;
+    memcpy(&mac_state, buf, sizeof(mac_state));
+
+    start_family(key, NULL, false);
+    print_u64("field", "rx_state", BMGET(mac_state, ENCODE_MAC_STATE_RX_STATE));
+    print_u64("field", "tx_state", BMGET(mac_state, ENCODE_MAC_STATE_TX_STATE));
+    print_u64("field", "channel_config", BMGET(mac_state, ENCODE_MAC_STATE_CHANNEL_CONFIG));
+    print_u64("field", "managed_calibration_state",
+              BMGET(mac_state, ENCODE_MAC_STATE_MGD_CALIB_STATE));
+    print_u64("field", "powersave_enabled", BMGET(mac_state, ENCODE_MAC_STATE_PS_EN));
+    print_u64("field", "dynamic_powersave_offload_enabled",
+              BMGET(mac_state, ENCODE_MAC_STATE_DYN_PS_OFFLOAD_EN));
+    print_u64("field", "sta_ps_state", BMGET(mac_state, ENCODE_MAC_STATE_STA_PS_STATE));
+    print_u64("field", "waiting_on_dynamic_powersave",
+              BMGET(mac_state, ENCODE_MAC_STATE_WAITING_ON_DYN_PS));
+    print_u64("field", "tx_blocked", BMGET(mac_state, ENCODE_MAC_STATE_TX_BLOCKED));
+    print_u64("field", "waiting_for_medium_sync",
+              BMGET(mac_state, ENCODE_MAC_STATE_WAITING_MED_SYNC));
+    print_u64("field", "packets_in_queues", BMGET(mac_state, ENCODE_MAC_STATE_N_PKTS_IN_QUEUES));
+}
+
+
+static void print_default(const char *key, const uint8_t *buf, uint32_t len)
+{
+    /* Opaque values have no numeric representation, so are left out. */
+}
+
+
+/**
+ * Array of function pointers indexed by the TLV format key.
+ *
+ * Unsigned decimal stats are exposed as counters and everything else numeric as gauges.
+ */
+static const struct format_table table = {
+    .format_func = {
+        [MORSE_STATS_FMT_DEC] = print_dec,
+        [MORSE_STATS_FMT_U_DEC] = print_udec,
+        [MORSE_STATS_FMT_HEX] = print_hex,
+        [MORSE_STATS_FMT_0_HEX] = print_hex,
+        [MORSE_STATS_FMT_AMPDU_AGGREGATES] = print_ampdu_aggregates,
+        [MORSE_STATS_FMT_AMPDU_BITMAP] = print_ampdu_bitmap,
+        [MORSE_STATS_FMT_TXOP] =  print_txop,
+        [MORSE_STATS_FMT_PAGESET] = print_pageset,
+        [MORSE_STATS_FMT_RETRIES] = print_retries,
+        [MORSE_STATS_FMT_RAW] = print_raw,
+        [MORSE_STATS_FMT_CALIBRATION] = print_calibration,
+        [MORSE_STATS_FMT_DUTY_CYCLE] = print_duty_cycle,
+        [MORSE_STATS_FMT_MAC_STATE] = print_mac_state,
+        /* Add new function pointers here */
+        /* [MORSE_STATS_NEW_TLV_FORMAT] = print_new_format */
+
+        [MORSE_STATS_FMT_LAST] = print_default,
+    }
+};
+
+
+const struct format_table* stats_format_openmetrics_get_formatter_table()
+{
+    return &table;
+}
+
+
+void stats_format_openmetrics_set_output(FILE *file)
+{
+    output = file;
+}
+
+
+/** Append a label to the base labels, escaping its value. */
+static void append_label(size_t *used, const char *name, const char *value)
+{
+    size_t n = *used;
+
+    n += snprintf(base_labels + n, sizeof(base_labels) - n, "%s%s=\"", n ? "," : "", name);
+    for (; *value && (n + 3 < sizeof(base_labels)); value++)
+    {
+        if ((*value == '\\') || (*value == '"'))
+            base_labels[n++] = '\\';
+        if (*value == '\n')
+        {
+            base_labels[n++] = '\\';
+            base_labels[n++] = 'n';
+            continue;
+        }
+        base_labels[n++] = *value;
+    }
+    base_labels[n++] = '"';
+    base_labels[n] = '\0';
+
+    *used = n;
+}
+
+
+void stats_format_openmetrics_set_labels(const char *core, const char *interface)
+{
+    size_t used = 0;
+
+    append_label(&used, "core", core);
+    append_label(&used, "interface", interface);
+}
+
+
+void stats_format_openmetrics_end()
+{
+    size_t ii;
+
+    for (ii = 0; ii < n_families; ii++)
+    {
+        struct metric_family *done = &families[ii];
+
+        if (done->samples_len)
+        {
+            fprintf(out(), "# TYPE %s %s\n", done->name, done->counter ? "counter" : "gauge");
+            fwrite(done->samples, 1, done->samples_len, out());
+        }
+
+        free(done->key);
+        free(done->suffix);
+        free(done->samples);
+    }
+
+    if (out_of_memory)
+        mctrl_err("Out of memory, some stats were left out\n");
+
+    free(families);
+    free(family_slots);
+    families = NULL;
+    family_slots = NULL;
+    n_families = 0;
+    families_size = 0;
+    n_family_slots = 0;
+    family = NULL;
+    out_of_memory = false;
+}
@@ -0,0 +1,930 @@
+/*
+ * Copyright 2023 Morse Micro
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifndef MORSE_WIN_BUILD
+#include <sys/mman.h>
+#endif
+
+#include "command.h"
+#include "offchip_statistics.h"
+#include "stats_format.h"
+#include "stats_record.h"
+#include "utilities.h"
+#include "transport/transport.h"
+
+#ifndef MORSE_WIN_BUILD
+
+#define STATS_RECORD_MAGIC      "MMSTREC"
+#define STATS_RECORD_VERSION    (1)
+#define STATS_RECORD_N_TIERS    (3)
+#define STATS_RECORD_PATH_MAX   (1024)
+/** Longest encoding of a 64 bit varint. */
+#define VARINT_MAX              (10)
+
+/**
+ * Samples per record of each tier, and its nominal number of records at which it covers its
+ * span. The file is shared out between the tiers in proportion to their nominal records.
+ */
+static const struct
+{
+    uint32_t step;
+    uint32_t records;
+} stats_record_tiers[STATS_RECORD_N_TIERS] = {
+    { 1, 600 },
+    { 10, 2160 },
+    { 60, 10080 },
+};
+
+/**
+ * A tier of a record file. Its records are kept in a ring of octets, each framed by its length
+ * (uint16_t) at both ends so the ring can be walked either way:
+ *
+ *   len | zigzag varint ms since the previous record | varint number of changed stats |
+ *   (varint series index gap, zigzag varint delta) for each changed stat | len
+ *
+ * Only the values at the newest record are kept whole, older ones are found by walking back.
+ */
+struct stats_record_tier
+{
+    uint32_t step;
+    uint32_t pad;
+    /** Offset of the values of every series at the newest record. */
+    uint64_t values_offset;
+    /** Offset of the ring in the file. */
+    uint64_t ring_offset;
+    uint64_t ring_size;
+    /** Position of the oldest record in the ring. */
+    uint64_t tail;
+    /** Octets of the ring in use. */
+    uint64_t used;
+    uint64_t n_records;
+    /** Time of the newest record, in ms since the epoch. */
+    uint64_t time_ms;
+};
+
+/** A stat recorded. */
+struct stats_record_series
+{
+    uint8_t format;
+    uint8_t width;
+    uint16_t pad;
+    uint32_t key_offset;
+};
+
+/**
+ * Start of a record file. It is followed by n_series struct stats_record_series and the
+ * strings_len octet key string pool, then the values and ring of each tier.
+ */
+struct stats_record_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t n_series;
+    uint32_t strings_len;
+    uint32_t pad;
+    uint64_t size;
+    /** Samples taken, so the coarser tiers keep in step across runs. */
+    uint64_t n_samples;
+    struct stats_record_tier tiers[STATS_RECORD_N_TIERS];
+};
+
+/** A record file mapped into memory. */
+struct stats_record_file
+{
+    uint8_t *map;
+    size_t len;
+    struct stats_record_header *hdr;
+    const struct stats_record_series *series;
+    const char *strings;
+};
+
+
+static uint8_t *put_varint(uint8_t *buf, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        *buf++ = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    *buf++ = value;
+
+    return buf;
+}
+
+static bool get_varint(const uint8_t **buf, const uint8_t *end, uint64_t *value)
+{
+    int shift;
+
+    *value = 0;
+    for (shift = 0; (*buf < end) && (shift < 64); shift += 7)
+    {
+        uint8_t octet = *(*buf)++;
+
+        *value |= (uint64_t)(octet & 0x7f) << shift;
+        if (!(octet & 0x80))
+            return true;
+    }
+
+    return false;
+}
+
+static uint64_t zigzag(int64_t value)
+{
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static int64_t unzigzag(uint64_t value)
+{
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+/* Longest record of a file with n_series stats. */
+static size_t stats_record_max_len(uint32_t n_series)
+{
+    return (2 * sizeof(uint16_t)) + (2 * VARINT_MAX) + ((size_t)n_series * 2 * VARINT_MAX);
+}
+
+static uint64_t *stats_record_values(const struct stats_record_file *file,
+                                     const struct stats_record_tier *tier)
+{
+    return (uint64_t *)(file->map + tier->values_offset);
+}
+
+static void ring_write(const struct stats_record_file *file, const struct stats_record_tier *tier,
+                       uint64_t pos, const uint8_t *buf, size_t len)
+{
+    uint8_t *ring = file->map + tier->ring_offset;
+    size_t first = MIN(len, tier->ring_size - pos);
+
+    memcpy(ring + pos, buf, first);
+    memcpy(ring, buf + first, len - first);
+}
+
+static void ring_read(const struct stats_record_file *file, const struct stats_record_tier *tier,
+                      uint64_t pos, uint8_t *buf, size_t len)
+{
+    const uint8_t *ring = file->map + tier->ring_offset;
+    size_t first = MIN(len, tier->ring_size - pos);
+
+    memcpy(buf, ring + pos, first);
+    memcpy(buf + first, ring, len - first);
+}
+
+static uint16_t ring_read_len(const struct stats_record_file *file,
+                              const struct stats_record_tier *tier, uint64_t pos)
+{
+    uint16_t len;
+
+    ring_read(file, tier, pos % tier->ring_size, (uint8_t *)&len, sizeof(len));
+    return len;
+}
+
+/**
+ * @brief Check a mapped record file is whole and everything it refers to is within it.
+ *
+ * @param map       Start of the mapping.
+ * @param len       Length of the mapping.
+ * @return          true if the file can be used.
+ */
+static bool stats_record_valid(const uint8_t *map, size_t len)
+{
+    const struct stats_record_header *hdr = (const struct stats_record_header *)map;
+    const struct stats_record_series *series;
+    const char *strings;
+    uint64_t end;
+    uint32_t ii;
+
+    if ((len < sizeof(*hdr)) ||
+        memcmp(hdr->magic, STATS_RECORD_MAGIC, sizeof(hdr->magic)) ||
+        (hdr->version != STATS_RECORD_VERSION) ||
+        (hdr->size != len) ||
+        (hdr->n_series > len / sizeof(*series)))
+        return false;
+
+    end = sizeof(*hdr) + ((uint64_t)hdr->n_series * sizeof(*series)) + hdr->strings_len;
+    if (end > len)
+        return false;
+
+    series = (const struct stats_record_series *)(hdr + 1);
+    strings = (const char *)(series + hdr->n_series);
+    if (hdr->strings_len && strings[hdr->strings_len - 1])
+        return false;
+
+    for (ii = 0; ii < hdr->n_series; ii++)
+    {
+        if ((series[ii].key_offset >= hdr->strings_len) ||
+            (series[ii].format > MORSE_STATS_FMT_LAST))
+            return false;
+    }
+
+    for (ii = 0; ii < STATS_RECORD_N_TIERS; ii++)
+    {
+        const struct stats_record_tier *tier = &hdr->tiers[ii];
+
+        if (!tier->step ||
+            (tier->values_offset < end) ||
+            (tier->values_offset > len) ||
+            (tier->values_offset + ((uint64_t)hdr->n_series * sizeof(uint64_t)) > len) ||
+            (tier->values_offset % sizeof(uint64_t)) ||
+            (tier->ring_offset < end) ||
+            (tier->ring_offset > len) ||
+            (tier->ring_size > len) ||
+            (tier->ring_offset + tier->ring_size > len) ||
+            !tier->ring_size ||
+            (tier->tail >= tier->ring_size) ||
+            (tier->used > tier->ring_size) ||
+            (tier->n_records > tier->used))
+            return false;
+    }
+
+    return true;
+}
+
+static void stats_record_unmap(struct stats_record_file *file)
+{
+    if (file->map)
+        munmap(file->map, file->len);
+    file->map = NULL;
+}
+
+/**
+ * @brief Map a record file.
+ *
+ * @param path      Path of the file.
+ * @param writable  true to map it to record into.
+ * @param file      Filled with the mapping.
+ * @return          0 on success, -ENOENT if there is no file, otherwise -1 if it is not valid.
+ */
+static int stats_record_map(const char *path, bool writable, struct stats_record_file *file)
+{
+    struct stat file_stats;
+    uint8_t *map;
+    int fd;
+
+    memset(file, 0, sizeof(*file));
+
+    fd = open(path, writable ? O_RDWR : O_RDONLY);
+    if (fd < 0)
+        return -ENOENT;
+
+    map = NULL;
+    if (!fstat(fd, &file_stats) && (file_stats.st_size >= sizeof(struct stats_record_header)))
+    {
+        map = mmap(NULL, file_stats.st_size, writable ? (PROT_READ | PROT_WRITE) : PROT_READ,
+                   writable ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED)
+            map = NULL;
+    }
+    close(fd);
+
+    if (!map)
+        return -1;
+
+    file->map = map;
+    file->len = file_stats.st_size;
+    if (!stats_record_valid(map, file->len))
+    {
+        stats_record_unmap(file);
+        return -1;
+    }
+
+    file->hdr = (struct stats_record_header *)map;
+    file->series = (const struct stats_record_series *)(file->hdr + 1);
+    file->strings = (const char *)(file->series + file->hdr->n_series);
+
+    return 0;
+}
+
+/**
+ * @brief Check a record file holds the same stats as the metadata would record.
+ *
+ * @param file      Mapped record file.
+ * @param series    Stats to record.
+ * @param n_series  Number of stats.
+ * @param strings   Key string pool of the stats.
+ * @param strings_len   Length of the pool.
+ * @return          true if the file can be recorded into.
+ */
+static bool stats_record_compatible(const struct stats_record_file *file,
+                                    const struct stats_record_series *series, uint32_t n_series,
+                                    const char *strings, uint32_t strings_len)
+{
+    return (file->hdr->n_series == n_series) &&
+           (file->hdr->strings_len == strings_len) &&
+           !memcmp(file->series, series, n_series * sizeof(*series)) &&
+           !memcmp(file->strings, strings, strings_len);
+}
+
+/**
+ * @brief Create a record file, writing it aside and renaming it into place once laid out.
+ *
+ * @param path      Path of the file.
+ * @param size      Size of the file.
+ * @param series    Stats to record.
+ * @param n_series  Number of stats.
+ * @param strings   Key string pool of the stats.
+ * @param strings_len   Length of the pool.
+ * @return          0 on success, otherwise -1.
+ */
+static int stats_record_create(const char *path, uint64_t size,
+                               const struct stats_record_series *series, uint32_t n_series,
+                               const char *strings, uint32_t strings_len)
+{
+    char tmp_path[STATS_RECORD_PATH_MAX + 32];
+    struct stats_record_header hdr;
+    uint64_t records = 0;
+    uint64_t rings;
+    uint64_t offset;
+    bool written;
+    FILE *file;
+    size_t ii;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, STATS_RECORD_MAGIC, sizeof(hdr.magic));
+    hdr.version = STATS_RECORD_VERSION;
+    hdr.n_series = n_series;
+    hdr.strings_len = strings_len;
+    hdr.size = size;
+
+    offset = sizeof(hdr) + ((uint64_t)n_series * sizeof(*series)) + strings_len;
+    offset = ALIGN_SIZE(offset, sizeof(uint64_t));
+    for (ii = 0; ii < STATS_RECORD_N_TIERS; ii++)
+    {
+        hdr.tiers[ii].step = stats_record_tiers[ii].step;
+        hdr.tiers[ii].values_offset = offset;
+        offset += (uint64_t)n_series * sizeof(uint64_t);
+        records += stats_record_tiers[ii].records;
+    }
+
+    rings = (size > offset) ? (size - offset) : 0;
+    for (ii = 0; ii < STATS_RECORD_N_TIERS; ii++)
+    {
+        hdr.tiers[ii].ring_offset = offset;
+        hdr.tiers[ii].ring_size = rings * stats_record_tiers[ii].records / records;
+        offset += hdr.tiers[ii].ring_size;
+
+        /* Every tier must hold a few of even the longest records. */
+        if (hdr.tiers[ii].ring_size < 4 * stats_record_max_len(n_series))
+        {
+            mctrl_err("A record file of %" PRIu64 " KiB is too small for %u stats\n",
+                      size / 1024, n_series);
+            return -1;
+        }
+    }
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%ld.tmp", path, (long)getpid());
+    file = fopen(tmp_path, "wb");
+    if (!file)
+    {
+        mctrl_err("Failed to open %s\n", tmp_path);
+        return -1;
+    }
+
+    /* The rest of the file reads as zeros, i.e. no values or records yet. */
+    written = (fwrite(&hdr, sizeof(hdr), 1, file) == 1) &&
+              (fwrite(series, sizeof(*series), n_series, file) == n_series) &&
+              (fwrite(strings, 1, strings_len, file) == strings_len) &&
+              !ftruncate(fileno(file), size);
+
+    if (fclose(file) || !written || rename(tmp_path, path))
+    {
+        mctrl_err("Failed to create %s\n", path);
+        remove(tmp_path);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Append a sample to each tier it is due in, dropping the oldest records to make room.
+ *
+ * @param file      Record file mapped writable.
+ * @param values    Value of each series.
+ * @param time_ms   Time of the sample, in ms since the epoch.
+ * @param buf       Buffer for a record, of stats_record_max_len().
+ */
+static void stats_record_append(struct stats_record_file *file, const uint64_t *values,
+                                uint64_t time_ms, uint8_t *buf)
+{
+    struct stats_record_header *hdr = file->hdr;
+    size_t ii;
+
+    for (ii = 0; ii < STATS_RECORD_N_TIERS; ii++)
+    {
+        struct stats_record_tier *tier = &hdr->tiers[ii];
+        uint64_t *last = stats_record_values(file, tier);
+        uint32_t n_changed = 0;
+        uint32_t prev_idx = 0;
+        uint16_t len;
+        uint8_t *pos;
+        uint32_t jj;
+
+        if (hdr->n_samples % tier->step)
+            continue;
+
+        for (jj = 0; jj < hdr->n_series; jj++)
+            n_changed += (values[jj] != last[jj]);
+
+        pos = buf + sizeof(len);
+        pos = put_varint(pos, zigzag((int64_t)(time_ms - tier->time_ms)));
+        pos = put_varint(pos, n_changed);
+        for (jj = 0; jj < hdr->n_series; jj++)
+        {
+            if (values[jj] == last[jj])
+                continue;
+
+            pos = put_varint(pos, jj - prev_idx);
+            pos = put_varint(pos, zigzag((int64_t)(values[jj] - last[jj])));
+            prev_idx = jj;
+        }
+        len = pos - buf + sizeof(len);
+        memcpy(buf, &len, sizeof(len));
+        memcpy(pos, &len, sizeof(len));
+
+        while (tier->used + len > tier->ring_size)
+        {
+            uint16_t oldest = ring_read_len(file, tier, tier->tail);
+
+            tier->tail = (tier->tail + oldest) % tier->ring_size;
+            tier->used -= oldest;
+            tier->n_records--;
+        }
+
+        /* The record is written before it is accounted for. */
+        ring_write(file, tier, (tier->tail + tier->used) % tier->ring_size, buf, len);
+        memcpy(last, values, hdr->n_series * sizeof(*values));
+        tier->time_ms = time_ms;
+        tier->used += len;
+        tier->n_records++;
+    }
+
+    hdr->n_samples++;
+}
+
+int stats_record(struct morsectrl *mors, const int *cmds, size_t n_cmds, const char *path,
+                 uint32_t size_kib, uint32_t interval_ms, uint32_t count)
+{
+    const struct statistics_offchip_index *index = mors->stats_index;
+    struct stats_record_series *series = calloc(MAX(index->n_entries, 1), sizeof(*series));
+    uint32_t *series_of_entry = calloc(MAX(index->n_entries, 1), sizeof(*series_of_entry));
+    char *strings = NULL;
+    struct stats_record_file file;
+    struct stats_fetch fetch;
+    char old_path[STATS_RECORD_PATH_MAX + 8];
+    uint64_t *values = NULL;
+    uint8_t *buf = NULL;
+    uint32_t n_series = 0;
+    uint32_t strings_len = 0;
+    uint64_t next_us;
+    uint32_t sample;
+    size_t ii;
+    int ret = -ENOMEM;
+
+    memset(&file, 0, sizeof(file));
+
+    if (stats_fetch_init(mors, &fetch, cmds, n_cmds) || !series || !series_of_entry)
+        goto exit;
+
+    if (strlen(path) >= STATS_RECORD_PATH_MAX)
+    {
+        mctrl_err("Record file path %s is too long\n", path);
+        ret = -1;
+        goto exit;
+    }
+
+    /* Only plain numbers make a series, the structured stats are left to snapshots. */
+    for (ii = 0; ii < index->n_entries; ii++)
+    {
+        if ((index->entries[ii].format == MORSE_STATS_FMT_DEC) ||
+            (index->entries[ii].format == MORSE_STATS_FMT_U_DEC))
+            strings_len += strlen(stats_offchip_key(mors, &index->entries[ii])) + 1;
+    }
+
+    strings = malloc(MAX(strings_len, 1));
+    if (!strings)
+        goto exit;
+
+    strings_len = 0;
+    for (ii = 0; ii < index->n_entries; ii++)
+    {
+        const struct statistics_offchip_entry *entry = &index->entries[ii];
+        const char *key = stats_offchip_key(mors, entry);
+        size_t key_len = strlen(key) + 1;
+
+        if ((entry->format != MORSE_STATS_FMT_DEC) && (entry->format != MORSE_STATS_FMT_U_DEC))
+            continue;
+
+        series[n_series].format = entry->format;
+        series[n_series].width = entry->width;
+        series[n_series].key_offset = strings_len;
+        memcpy(strings + strings_len, key, key_len);
+        strings_len += key_len;
+        series_of_entry[ii] = ++n_series;
+    }
+
+    if (stats_record_max_len(n_series) > UINT16_MAX)
+    {
+        mctrl_err("Too many stats (%u) to record\n", n_series);
+        ret = -1;
+        goto exit;
+    }
+
+    values = calloc(MAX(n_series, 1), sizeof(*values));
+    buf = malloc(stats_record_max_len(n_series));
+    if (!values || !buf)
+        goto exit;
+
+    ret = stats_record_map(path, true, &file);
+    if (!ret && !stats_record_compatible(&file, series, n_series, strings, strings_len))
+    {
+        stats_record_unmap(&file);
+        ret = -1;
+    }
+
+    if (ret)
+    {
+        /* Keep a file that can't be recorded into, it may be the history being looked for. */
+        if (ret != -ENOENT)
+        {
+            snprintf(old_path, sizeof(old_path), "%s.old", path);
+            mctrl_err("%s was recorded with other stats metadata, moved to %s\n",
+                      path, old_path);
+            rename(path, old_path);
+        }
+
+        ret = stats_record_create(path, (uint64_t)size_kib * 1024,
+                                  series, n_series, strings, strings_len);
+        if (!ret && stats_record_map(path, true, &file))
+        {
+            mctrl_err("Failed to open record file %s\n", path);
+            ret = -1;
+        }
+        if (ret)
+            goto exit;
+    }
+
+    /* Stats missing from a sample keep their last value. */
+    memcpy(values, stats_record_values(&file, &file.hdr->tiers[0]), n_series * sizeof(*values));
+
+    next_us = time_now_us();
+    for (sample = 0; !count || (sample < count); sample++)
+    {
+        uint64_t now_us = time_now_us();
+
+        /* Samples are kept to the interval from the start, skipping any that were missed. */
+        if (next_us > now_us)
+            sleep_ms((next_us - now_us + 999) / 1000);
+        now_us = time_now_us();
+        next_us = MAX(next_us + (uint64_t)interval_ms * 1000, now_us);
+
+        /* A recorder outlives glitches, the sample is just left out. */
+        if (stats_fetch(mors, &fetch, true))
+            continue;
+
+        for (ii = 0; ii < n_cmds; ii++)
+        {
+            struct stats_tlv tlv;
+            int tlvs_len;
+            const uint8_t *tlvs = stats_fetch_tlvs(&fetch, ii, &tlvs_len);
+
+            while (stats_tlv_next(&tlvs, &tlvs_len, &tlv))
+            {
+                const struct statistics_offchip_entry *entry = get_stats_offchip(mors, tlv.tag);
+                uint32_t idx = entry ? series_of_entry[entry - index->entries] : 0;
+
+                if (!idx)
+                    continue;
+
+                values[idx - 1] = (entry->format == MORSE_STATS_FMT_DEC) ?
+                                  (uint64_t)get_signed_value_as_int64(tlv.value, tlv.len) :
+                                  get_unsigned_value_as_uint64(tlv.value, tlv.len);
+            }
+        }
+
+        stats_record_append(&file, values, time_wall_us() / 1000, buf);
+    }
+
+    ret = 0;
+
+exit:
+    stats_record_unmap(&file);
+    free(buf);
+    free(values);
+    free(strings);
+    free(series_of_entry);
+    free(series);
+    stats_fetch_free(&fetch);
+
+    return ret;
+}
+
+/**
+ * @brief Read a record of a tier into a buffer.
+ *
+ * @param file      Mapped record file.
+ * @param tier      Tier of the record.
+ * @param pos       Position of the record in the ring.
+ * @param buf       Buffer of stats_record_max_len().
+ * @param dt_ms     Filled with the time since the previous record.
+ * @param body      Filled with the start of the changed stats in the buffer.
+ * @param end       Filled with the end of the changed stats in the buffer.
+ * @return          Length of the record, or 0 if it is malformed.
+ */
+static uint16_t stats_record_read(const struct stats_record_file *file,
+                                  const struct stats_record_tier *tier, uint64_t pos,
+                                  uint8_t *buf, int64_t *dt_ms, const uint8_t **body,
+                                  const uint8_t **end)
+{
+    uint16_t len = ring_read_len(file, tier, pos);
+    uint64_t value;
+
+    if ((len < 2 * sizeof(len)) || (len > stats_record_max_len(file->hdr->n_series)))
+        return 0;
+
+    ring_read(file, tier, pos, buf, len);
+    *body = buf + sizeof(len);
+    *end = buf + len - sizeof(len);
+    if (!get_varint(body, *end, &value))
+        return 0;
+
+    *dt_ms = unzigzag(value);
+    return len;
+}
+
+/**
+ * @brief Apply the changed stats of a record to the values of every series.
+ *
+ * @param body      Changed stats, from stats_record_read().
+ * @param end       End of the changed stats.
+ * @param values    Values to change.
+ * @param n_series  Number of series.
+ * @param sign      1 to step forward over the record, -1 to step back.
+ * @return          true on success, false if the record is malformed.
+ */
+static bool stats_record_apply(const uint8_t *body, const uint8_t *end, uint64_t *values,
+                               uint32_t n_series, int sign)
+{
+    uint64_t n_changed;
+    uint64_t idx = 0;
+    uint64_t ii;
+
+    if (!get_varint(&body, end, &n_changed))
+        return false;
+
+    for (ii = 0; ii < n_changed; ii++)
+    {
+        uint64_t gap;
+        uint64_t delta;
+
+        if (!get_varint(&body, end, &gap) || !get_varint(&body, end, &delta))
+            return false;
+
+        idx += gap;
+        if (idx >= n_series)
+            return false;
+
+        values[idx] += (uint64_t)(sign * unzigzag(delta));
+    }
+
+    return true;
+}
+
+/**
+ * @brief Walk a tier back from its newest record to find the time and values of its oldest.
+ *
+ * @param file      Mapped record file.
+ * @param tier      Tier to walk.
+ * @param buf       Buffer of stats_record_max_len().
+ * @param values    Filled with the values at the oldest record, if not NULL.
+ * @param time_ms   Filled with the time of the oldest record.
+ * @return          true on success, false if the tier is malformed.
+ */
+static bool stats_record_oldest(const struct stats_record_file *file,
+                                const struct stats_record_tier *tier, uint8_t *buf,
+                                uint64_t *values, uint64_t *time_ms)
+{
+    uint64_t pos = tier->tail + tier->used;
+    uint64_t ii;
+
+    *time_ms = tier->time_ms;
+    if (values)
+        memcpy(values, stats_record_values(file, tier),
+               file->hdr->n_series * sizeof(*values));
+
+    /* The oldest record's own delta is from a record already dropped. */
+    for (ii = 1; ii < tier->n_records; ii++)
+    {
+        const uint8_t *body;
+        const uint8_t *end;
+        int64_t dt_ms;
+        uint16_t len = ring_read_len(file, tier, pos - sizeof(len));
+
+        if (len > pos - tier->tail)
+            return false;
+        pos -= len;
+
+        if (!stats_record_read(file, tier, pos % tier->ring_size, buf, &dt_ms, &body, &end) ||
+            (values && !stats_record_apply(body, end, values, file->hdr->n_series, -1)))
+            return false;
+
+        *time_ms -= dt_ms;
+    }
+
+    return true;
+}
+
+static void stats_record_print_row(const struct stats_record_file *file, uint64_t time_ms,
+                                   const uint64_t *values, int filter_idx, bool json,
+                                   bool first)
+{
+    uint32_t ii;
+
+    if (json)
+        mctrl_print("%s{\"time\": %" PRIu64 ".%03" PRIu64, first ? "" : ",\n",
+                    time_ms / 1000, time_ms % 1000);
+    else
+        mctrl_print("%" PRIu64 ".%03" PRIu64, time_ms / 1000, time_ms % 1000);
+
+    for (ii = 0; ii < file->hdr->n_series; ii++)
+    {
+        const struct stats_record_series *series = &file->series[ii];
+
+        if ((filter_idx >= 0) && (ii != filter_idx))
+            continue;
+
+        if (json)
+            mctrl_print(", \"%s\": ", &file->strings[series->key_offset]);
+        else
+            mctrl_print(",");
+
+        if (series->format == MORSE_STATS_FMT_DEC)
+            mctrl_print("%" PRId64, (int64_t)values[ii]);
+        else
+            mctrl_print("%" PRIu64, values[ii]);
+    }
+
+    mctrl_print(json ? "}" : "\n");
+}
+
+int stats_record_query(const char *path, uint64_t start_ms, uint64_t end_ms, int tier_idx,
+                       const char *filter_string, bool json)
+{
+    struct stats_record_file file;
+    const struct stats_record_tier *tier = NULL;
+    uint64_t *values = NULL;
+    uint8_t *buf = NULL;
+    uint64_t time_ms;
+    uint64_t pos;
+    uint64_t ii;
+    int filter_idx = -1;
+    bool first = true;
+    int ret;
+
+    ret = stats_record_map(path, false, &file);
+    if (ret)
+    {
+        mctrl_err("%s is not a valid stats record file\n", path);
+        return -1;
+    }
+
+    ret = -ENOMEM;
+    values = calloc(MAX(file.hdr->n_series, 1), sizeof(*values));
+    buf = malloc(stats_record_max_len(file.hdr->n_series));
+    if (!values || !buf)
+        goto exit;
+
+    if (filter_string)
+    {
+        for (ii = 0; ii < file.hdr->n_series; ii++)
+        {
+            if (!strcmp(&file.strings[file.series[ii].key_offset], filter_string))
+                filter_idx = ii;
+        }
+
+        if (filter_idx < 0)
+        {
+            mctrl_err("%s is not recorded in %s\n", filter_string, path);
+            ret = -1;
+            goto exit;
+        }
+    }
+
+    if (tier_idx >= STATS_RECORD_N_TIERS)
+    {
+        mctrl_err("Invalid tier %d, there are %d\n", tier_idx, STATS_RECORD_N_TIERS);
+        ret = -1;
+        goto exit;
+    }
+
+    if (tier_idx >= 0)
+        tier = &file.hdr->tiers[tier_idx];
+
+    /* Otherwise use the finest tier reaching back to the start, or the one reaching furthest. */
+    for (ii = 0; !tier && (ii < STATS_RECORD_N_TIERS); ii++)
+    {
+        const struct stats_record_tier *candidate = &file.hdr->tiers[ii];
+        uint64_t oldest_ms;
+
+        if (!candidate->n_records ||
+            !stats_record_oldest(&file, candidate, buf, NULL, &oldest_ms))
+            continue;
+
+        if ((oldest_ms <= start_ms) || (ii == STATS_RECORD_N_TIERS - 1))
+            tier = candidate;
+    }
+
+    if (!json)
+    {
+        mctrl_print("time");
+        for (ii = 0; ii < file.hdr->n_series; ii++)
+        {
+            if ((filter_idx < 0) || (ii == filter_idx))
+                mctrl_print(",%s", &file.strings[file.series[ii].key_offset]);
+        }
+        mctrl_print("\n");
+    }
+    else
+    {
+        mctrl_print("[");
+    }
+
+    if (tier && tier->n_records && !stats_record_oldest(&file, tier, buf, values, &time_ms))
+        goto invalid;
+
+    /* Step forward from the oldest record, applying the delta of each following one. */
+    pos = tier ? tier->tail : 0;
+    for (ii = 0; tier && (ii < tier->n_records); ii++)
+    {
+        const uint8_t *body;
+        const uint8_t *end;
+        int64_t dt_ms;
+        uint16_t len;
+
+        len = stats_record_read(&file, tier, pos % tier->ring_size, buf, &dt_ms, &body, &end);
+        if (!len)
+            goto invalid;
+        pos += len;
+
+        if (ii)
+        {
+            if (!stats_record_apply(body, end, values, file.hdr->n_series, 1))
+                goto invalid;
+            time_ms += dt_ms;
+        }
+
+        if (time_ms > end_ms)
+            break;
+
+        if (time_ms >= start_ms)
+        {
+            stats_record_print_row(&file, time_ms, values, filter_idx, json, first);
+            first = false;
+        }
+    }
+
+    if (json)
+        mctrl_print("]\n");
+
+    ret = 0;
+    goto exit;
+
+invalid:
+    mctrl_err("%s is corrupt\n", path);
+    ret = -1;
+
+exit:
+    free(buf);
+    free(values);
+    stats_record_unmap(&file);
+
+    return ret;
+}
+
+#else
+
+int stats_record(struct morsectrl *mors, const int *cmds, size_t n_cmds, const char *path,
+                 uint32_t size_kib, uint32_t interval_ms, uint32_t count)
+{
+    mctrl_err("Recording stats is not supported on this platform\n");
+    return -1;
+}
+
+int stats_record_query(const char *path, uint64_t start_ms, uint64_t end_ms, int tier,
+                       const char *filter_string, bool json)
+{
+    mctrl_err("Recording stats is not supported on this platform\n");
+    return -1;
+}
+
+#endif
@@ -0,0 +1,52 @@
+/*
+ * Copyright 2023 Morse Micro
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "morsectrl.h"
+
+/*
+ * Stats history recorder. The numeric stats of some cores are sampled periodically into a fixed
+ * size memory mapped ring file, kept in tiers of decreasing resolution: every sample for about
+ * 10 minutes, every 10th for about 6 hours and every 60th for about 7 days at a 1 s interval.
+ * Each record holds only the stats that changed since the previous record of its tier, as
+ * variable length deltas, so storage is bounded and each sample dirties only a few pages.
+ */
+
+/** Default size of a record file. */
+#define STATS_RECORD_DEFAULT_SIZE_KIB   (2048)
+
+/**
+ * @brief Sample the numeric stats of some cores periodically into a record file, creating it if
+ *        needed. A file recorded with other stats metadata is moved aside to "<path>.old".
+ *
+ * @param mors          Morsectrl context holding the indexed metadata.
+ * @param cmds          Stats log commands of the cores to sample.
+ * @param n_cmds        Number of cores.
+ * @param path          Path of the record file.
+ * @param size_kib      Size of the file if it is created.
+ * @param interval_ms   Time between samples.
+ * @param count         Number of samples to take, 0 to sample until interrupted.
+ * @return              0 on success otherwise relevant error.
+ */
+int stats_record(struct morsectrl *mors, const int *cmds, size_t n_cmds, const char *path,
+                 uint32_t size_kib, uint32_t interval_ms, uint32_t count);
+
+/**
+ * @brief Print the samples of a record file in a time range.
+ *
+ * @param path          Path of the record file.
+ * @param start_ms      Start of the range, in ms since the epoch.
+ * @param end_ms        End of the range, in ms since the epoch.
+ * @param tier          Tier to read, or -1 for the finest one holding the start of the range.
+ * @param filter_string Key of the only stat to print, or NULL for all.
+ * @param json          true to print JSON, false to print CSV.
+ * @return              0 on success otherwise relevant error.
+ */
+int stats_record_query(const char *path, uint64_t start_ms, uint64_t end_ms, int tier,
+                       const char *filter_string, bool json);
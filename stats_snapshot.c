@@ -0,0 +1,177 @@
+/*
+ * Copyright 2023 Morse Micro
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "portable_endian.h"
+#include "command.h"
+#include "stats_format.h"
+#include "stats_snapshot.h"
+#include "elf_file.h"
+#include "utilities.h"
+
+#define STATS_SNAPSHOT_MAGIC    "MMSTATS"
+#define STATS_SNAPSHOT_VERSION  (1)
+
+/** Start of a snapshot file, followed by n_cores struct stats_snapshot_file_core. */
+struct PACKED stats_snapshot_file_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t n_cores;
+    uint64_t timestamp_us;
+    char interface[STATS_SNAPSHOT_INTERFACE_MAX];
+    char fw_name[STATS_SNAPSHOT_FW_NAME_MAX];
+    uint32_t build_id_len;
+    uint8_t build_id[STATS_SNAPSHOT_BUILD_ID_MAX];
+};
+
+/** Response of a core in a snapshot file, followed by len octets of TLVs. */
+struct PACKED stats_snapshot_file_core
+{
+    uint32_t cmd;
+    uint32_t len;
+};
+
+void stats_snapshot_init(struct stats_snapshot *snapshot, const char *interface,
+                         const char *fw_path)
+{
+    const char *fw_name = strrchr(fw_path, '/');
+    size_t build_id_len;
+
+    memset(snapshot, 0, sizeof(*snapshot));
+    snapshot->timestamp_us = time_wall_us();
+    snprintf(snapshot->interface, sizeof(snapshot->interface), "%s", interface);
+    snprintf(snapshot->fw_name, sizeof(snapshot->fw_name), "%s", fw_name ? fw_name + 1 : fw_path);
+
+    if (!morse_elf_build_id(fw_path, snapshot->build_id, sizeof(snapshot->build_id),
+                            &build_id_len))
+        snapshot->build_id_len = build_id_len;
+}
+
+int stats_snapshot_write(const char *path, const struct stats_snapshot *snapshot)
+{
+    struct stats_snapshot_file_header hdr;
+    char tmp_path[1024];
+    bool written;
+    size_t ii;
+    FILE *file;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, STATS_SNAPSHOT_MAGIC, sizeof(hdr.magic));
+    hdr.version = htole32(STATS_SNAPSHOT_VERSION);
+    hdr.n_cores = htole32(snapshot->n_cores);
+    hdr.timestamp_us = htole64(snapshot->timestamp_us);
+    memcpy(hdr.interface, snapshot->interface, sizeof(hdr.interface));
+    memcpy(hdr.fw_name, snapshot->fw_name, sizeof(hdr.fw_name));
+    hdr.build_id_len = htole32(snapshot->build_id_len);
+    memcpy(hdr.build_id, snapshot->build_id, sizeof(hdr.build_id));
+
+    /* Write a copy and rename it over the file, so it is never seen half written. */
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%ld.tmp", path, (long)getpid());
+    file = fopen(tmp_path, "wb");
+    if (!file)
+    {
+        mctrl_err("Failed to open %s\n", tmp_path);
+        return -1;
+    }
+
+    written = (fwrite(&hdr, sizeof(hdr), 1, file) == 1);
+    for (ii = 0; written && (ii < snapshot->n_cores); ii++)
+    {
+        const struct stats_snapshot_core *core = &snapshot->cores[ii];
+        struct stats_snapshot_file_core core_hdr = {
+            .cmd = htole32(core->cmd),
+            .len = htole32(core->len),
+        };
+
+        written = (fwrite(&core_hdr, sizeof(core_hdr), 1, file) == 1) &&
+                  (fwrite(core->data, 1, core->len, file) == core->len);
+    }
+
+    if (fclose(file) || !written || rename(tmp_path, path))
+    {
+        mctrl_err("Failed to write %s\n", path);
+        remove(tmp_path);
+        return -1;
+    }
+
+    return 0;
+}
+
+int stats_snapshot_read(const char *path, struct stats_snapshot *snapshot)
+{
+    struct stats_snapshot_file_header hdr;
+    FILE *file;
+    size_t ii;
+
+    memset(snapshot, 0, sizeof(*snapshot));
+
+    file = fopen(path, "rb");
+    if (!file)
+    {
+        mctrl_err("Failed to open %s\n", path);
+        return -1;
+    }
+
+    if ((fread(&hdr, sizeof(hdr), 1, file) != 1) ||
+        memcmp(hdr.magic, STATS_SNAPSHOT_MAGIC, sizeof(hdr.magic)) ||
+        (le32toh(hdr.version) != STATS_SNAPSHOT_VERSION) ||
+        (le32toh(hdr.n_cores) > STATS_SNAPSHOT_MAX_CORES) ||
+        (le32toh(hdr.build_id_len) > STATS_SNAPSHOT_BUILD_ID_MAX))
+        goto invalid;
+
+    snapshot->timestamp_us = le64toh(hdr.timestamp_us);
+    memcpy(snapshot->interface, hdr.interface, sizeof(snapshot->interface));
+    snapshot->interface[sizeof(snapshot->interface) - 1] = '\0';
+    memcpy(snapshot->fw_name, hdr.fw_name, sizeof(snapshot->fw_name));
+    snapshot->fw_name[sizeof(snapshot->fw_name) - 1] = '\0';
+    snapshot->build_id_len = le32toh(hdr.build_id_len);
+    memcpy(snapshot->build_id, hdr.build_id, sizeof(snapshot->build_id));
+
+    for (ii = 0; ii < le32toh(hdr.n_cores); ii++)
+    {
+        struct stats_snapshot_core *core = &snapshot->cores[ii];
+        struct stats_snapshot_file_core core_hdr;
+
+        if (fread(&core_hdr, sizeof(core_hdr), 1, file) != 1)
+            goto invalid;
+
+        core->cmd = le32toh(core_hdr.cmd);
+        core->len = le32toh(core_hdr.len);
+        /* Responses are never larger than all the pages of a core's stats. */
+        if (core->len > STATS_TLVS_MAX_LEN)
+            goto invalid;
+
+        core->data = malloc(MAX(core->len, 1));
+        snapshot->n_cores++;
+        if (!core->data || (fread(core->data, 1, core->len, file) != core->len))
+            goto invalid;
+    }
+
+    fclose(file);
+    return 0;
+
+invalid:
+    mctrl_err("%s is not a valid stats snapshot\n", path);
+    fclose(file);
+    stats_snapshot_free(snapshot);
+    return -1;
+}
+
+void stats_snapshot_free(struct stats_snapshot *snapshot)
+{
+    size_t ii;
+
+    for (ii = 0; ii < snapshot->n_cores; ii++)
+    {
+        free(snapshot->cores[ii].data);
+        snapshot->cores[ii].data = NULL;
+    }
+    snapshot->n_cores = 0;
+}
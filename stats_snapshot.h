@@ -0,0 +1,80 @@
+/*
+ * Copyright 2023 Morse Micro
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Raw stats snapshots. The undecoded TLV payloads of the stats log responses of each core are
+ * stored along with when and where they were read and the identity of the firmware, so they can be
+ * decoded (or compared) later, elsewhere, with the firmware's stats metadata. All fields are stored
+ * little endian.
+ */
+
+#define STATS_SNAPSHOT_MAX_CORES        (3)
+#define STATS_SNAPSHOT_INTERFACE_MAX    (32)
+#define STATS_SNAPSHOT_FW_NAME_MAX      (128)
+#define STATS_SNAPSHOT_BUILD_ID_MAX     (32)
+
+/** Stats log response of a core. */
+struct stats_snapshot_core
+{
+    /** Stats log command the response is to. */
+    uint32_t cmd;
+    uint32_t len;
+    uint8_t *data;
+};
+
+/** A snapshot of the stats of some cores. */
+struct stats_snapshot
+{
+    /** Wall clock time the snapshot was taken, in us since the epoch. */
+    uint64_t timestamp_us;
+    /** Interface or device the stats were read from. */
+    char interface[STATS_SNAPSHOT_INTERFACE_MAX];
+    /** File name of the firmware, without its directory. */
+    char fw_name[STATS_SNAPSHOT_FW_NAME_MAX];
+    /** GNU build ID of the firmware, if it has one. */
+    uint8_t build_id[STATS_SNAPSHOT_BUILD_ID_MAX];
+    uint32_t build_id_len;
+    size_t n_cores;
+    struct stats_snapshot_core cores[STATS_SNAPSHOT_MAX_CORES];
+};
+
+/**
+ * @brief Fill in the time, interface and firmware identity of a snapshot.
+ *
+ * @param snapshot  Snapshot to fill in, with no cores yet.
+ * @param interface Interface or device the stats are read from.
+ * @param fw_path   Path of the firmware running, used to identify it.
+ */
+void stats_snapshot_init(struct stats_snapshot *snapshot, const char *interface,
+                         const char *fw_path);
+
+/**
+ * @brief Write a snapshot to a file, replacing it atomically.
+ *
+ * @param path      Path of the file.
+ * @param snapshot  Snapshot to write.
+ * @return          0 on success, otherwise -1.
+ */
+int stats_snapshot_write(const char *path, const struct stats_snapshot *snapshot);
+
+/**
+ * @brief Read a snapshot from a file.
+ *
+ * @param path      Path of the file.
+ * @param snapshot  Filled with the snapshot, to be freed with stats_snapshot_free().
+ * @return          0 on success, otherwise -1 if the file can't be read or is not a snapshot.
+ */
+int stats_snapshot_read(const char *path, struct stats_snapshot *snapshot);
+
+/**
+ * @brief Free the responses of a snapshot read from a file.
+ *
+ * @param snapshot  Snapshot read with stats_snapshot_read().
+ */
+void stats_snapshot_free(struct stats_snapshot *snapshot);
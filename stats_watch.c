@@ -0,0 +1,318 @@
+/*
+ * Copyright 2023 Morse Micro
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <errno.h>
+
+#include "command.h"
+#include "offchip_statistics.h"
+#include "stats_format.h"
+#include "utilities.h"
+#include "transport/transport.h"
+
+
+/** Watch mode for morsectrl statistics, printing the change in each stat between samples */
+
+/**
+ * Print the change in a stat between two samples.
+ *
+ * @param key           Key of the stat.
+ * @param prev          Value in the previous sample.
+ * @param cur           Value in this sample.
+ * @param len           Length of both values.
+ * @param interval_us   Time between the samples.
+ * @return              true if printed, false if the value is too short for the format.
+ */
+typedef bool (*delta_func_t)(const char *key, const uint8_t *prev, const uint8_t *cur,
+                             uint32_t len, uint64_t interval_us);
+
+struct delta_table {
+    delta_func_t delta_func[MORSE_STATS_FMT_LAST + 1];
+};
+
+/** Where a stat is in a response. */
+struct stats_delta_value
+{
+    /** Offset of the value in the response plus one, 0 if the stat is not in the response. */
+    uint32_t offset;
+    uint32_t len;
+};
+
+static double per_second(double delta, uint64_t interval_us)
+{
+    return interval_us ? (delta * 1000000.0 / interval_us) : 0.0;
+}
+
+
+static bool delta_dec(const char *key, const uint8_t *prev, const uint8_t *cur,
+                      uint32_t len, uint64_t interval_us)
+{
+    int64_t value = get_signed_value_as_int64(cur, len);
+    int64_t delta = value - get_signed_value_as_int64(prev, len);
+
+    mctrl_print("%s:%" PRId64 " (%+" PRId64 ", %.2f/s)\n", key, value, delta,
+                per_second(delta, interval_us));
+    return true;
+}
+
+
+static bool delta_udec(const char *key, const uint8_t *prev, const uint8_t *cur,
+                       uint32_t len, uint64_t interval_us)
+{
+    uint64_t value = get_unsigned_value_as_uint64(cur, len);
+    uint64_t delta = value - get_unsigned_value_as_uint64(prev, len);
+
+    /* Counters narrower than 64 bits wrap at their own width. */
+    if (len < sizeof(uint64_t))
+        delta &= BIT(8 * len) - 1;
+
+    mctrl_print("%s: %" PRIu64 " (+%" PRIu64 ", %.2f/s)\n", key, value, delta,
+                per_second(delta, interval_us));
+    return true;
+}
+
+
+static bool delta_txop(const char *key, const uint8_t *prev, const uint8_t *cur,
+                       uint32_t len, uint64_t interval_us)
+{
+    struct txop_statistics old_stats;
+    struct txop_statistics new_stats;
+    uint32_t count;
+
+    if (len < sizeof(new_stats))
+        return false;
+
+    memcpy(&old_stats, prev, sizeof(old_stats));
+    memcpy(&new_stats, cur, sizeof(new_stats));
+    count = new_stats.count - old_stats.count;
+
+    mctrl_print("%s: \n", key);
+    mctrl_print("TXOP count: %u (+%u, %.2f/s)\n", new_stats.count, count,
+                per_second(count, interval_us));
+    mctrl_print("Total TXOP time: %" PRIu64 " (+%" PRIu64 ")\n", new_stats.duration,
+                new_stats.duration - old_stats.duration);
+    mctrl_print("Average TXOP time: %u\n",
+                count ? (uint32_t)((new_stats.duration - old_stats.duration) / count) : 0);
+    mctrl_print("Total TXOP Tx packets: %u (+%u, %.2f/s)\n", new_stats.pkts,
+                new_stats.pkts - old_stats.pkts,
+                per_second(new_stats.pkts - old_stats.pkts, interval_us));
+    mctrl_print("Average TXOP Tx packets: %u\n",
+                count ? (new_stats.pkts - old_stats.pkts) / count : 0);
+    return true;
+}
+
+
+static bool delta_retries(const char *key, const uint8_t *prev, const uint8_t *cur,
+                          uint32_t len, uint64_t interval_us)
+{
+    struct retry_stats old_stats;
+    struct retry_stats new_stats;
+
+    if (len < sizeof(new_stats))
+        return false;
+
+    memcpy(&old_stats, prev, sizeof(old_stats));
+    memcpy(&new_stats, cur, sizeof(new_stats));
+
+    mctrl_print("%s: \n", key);
+    mctrl_print("Retry\tCount\tDelta\tRate/s\tAvg Time\n");
+    mctrl_print("=====\t=====\t=====\t======\t========\n");
+
+    for (int i = 0; i < APP_STATS_COUNT; i++)
+    {
+        uint32_t count = new_stats.count[i] - old_stats.count[i];
+
+        /* The average is of the retries in this interval only. */
+        mctrl_print("%d\t%u\t+%u\t%.2f\t%u\n", i, new_stats.count[i], count,
+                    per_second(count, interval_us),
+                    count ? (uint32_t)((new_stats.sum[i] - old_stats.sum[i]) / count) : 0);
+    }
+    return true;
+}
+
+
+static bool delta_duty_cycle(const char *key, const uint8_t *prev, const uint8_t *cur,
+                             uint32_t len, uint64_t interval_us)
+{
+    duty_cycle_stats_t old_stats;
+    duty_cycle_stats_t new_stats;
+    uint64_t t_air;
+
+    if (len < sizeof(new_stats))
+        return false;
+
+    memcpy(&old_stats, prev, sizeof(old_stats));
+    memcpy(&new_stats, cur, sizeof(new_stats));
+    t_air = new_stats.total_t_air - old_stats.total_t_air;
+
+    mctrl_print("%s: \n", key);
+    mctrl_print("Duty Cycle Target (%%): %d.%02d\n",
+            new_stats.target_duty_cycle / 100,
+            new_stats.target_duty_cycle % 100);
+    mctrl_print("Duty Cycle TX On (us): %" PRIu64 " (+%" PRIu64 ", %.2f%% of interval)\n",
+                new_stats.total_t_air, t_air,
+                interval_us ? (t_air * 100.0 / interval_us) : 0.0);
+    mctrl_print("Duty Cycle TX Off (Blocked) (us): %" PRIu64 " (+%" PRIu64 ")\n",
+                new_stats.total_t_off, new_stats.total_t_off - old_stats.total_t_off);
+    mctrl_print("Duty Cycle Max toff (us): %" PRIu64 "\n", new_stats.max_t_off);
+    mctrl_print("Duty Cycle Early Frames: %u (+%u)\n", new_stats.num_early,
+                new_stats.num_early - old_stats.num_early);
+    return true;
+}
+
+
+/**
+ * Array of function pointers indexed by the TLV format key. Formats without one are printed as
+ * they are in each sample.
+ */
+static const struct delta_table table = {
+    .delta_func = {
+        [MORSE_STATS_FMT_DEC] = delta_dec,
+        [MORSE_STATS_FMT_U_DEC] = delta_udec,
+        [MORSE_STATS_FMT_TXOP] = delta_txop,
+        [MORSE_STATS_FMT_RETRIES] = delta_retries,
+        [MORSE_STATS_FMT_DUTY_CYCLE] = delta_duty_cycle,
+        /* Add new function pointers here */
+    }
+};
+
+
+int stats_delta_print(struct morsectrl *mors, const uint8_t *prev, int prev_len,
+                      const uint8_t *cur, int cur_len, uint64_t interval_us,
+                      const char *filter_string)
+{
+    const struct format_table *regular = stats_format_regular_get_formatter_table();
+    const struct statistics_offchip_index *index = mors->stats_index;
+    struct stats_delta_value *values = NULL;
+    const uint8_t *buf;
+    struct stats_tlv tlv;
+
+    if (prev)
+    {
+        values = calloc(MAX(index->n_entries, 1), sizeof(*values));
+        if (!values)
+            return -ENOMEM;
+
+        /* Find where each stat is in the previous response first. */
+        buf = prev;
+        while (stats_tlv_next(&buf, &prev_len, &tlv))
+        {
+            const struct statistics_offchip_entry *offchip = get_stats_offchip(mors, tlv.tag);
+
+            if (offchip)
+            {
+                values[offchip - index->entries].offset = tlv.value - prev + 1;
+                values[offchip - index->entries].len = tlv.len;
+            }
+        }
+    }
+
+    buf = cur;
+    while (stats_tlv_next(&buf, &cur_len, &tlv))
+    {
+        const struct statistics_offchip_entry *offchip = get_stats_offchip(mors, tlv.tag);
+        const struct stats_delta_value *last;
+        delta_func_t delta_func;
+        const char *key;
+
+        if (!offchip)
+        {
+            /* Only report unknown stats once rather than every interval. */
+            if (!prev)
+                mctrl_err("UNKOWN KEY for tag %d\n", tlv.tag);
+            continue;
+        }
+
+        key = stats_offchip_key(mors, offchip);
+        if (filter_string && strcmp(key, filter_string))
+            continue;
+
+        delta_func = table.delta_func[offchip->format];
+        last = values ? &values[offchip - index->entries] : NULL;
+        if (last && last->offset && (last->len == tlv.len) && delta_func &&
+            delta_func(key, prev + last->offset - 1, tlv.value, tlv.len, interval_us))
+            continue;
+
+        regular->format_func[offchip->format](key, tlv.value, tlv.len);
+    }
+
+    free(values);
+
+    return 0;
+}
+
+
+int stats_watch(struct morsectrl *mors, const int *cmds, size_t n_cmds,
+                const char *filter_string, uint32_t interval_ms, uint32_t count)
+{
+    /* Responses of the previous and this sample, used alternately. */
+    struct stats_fetch fetch[2];
+    /* Time each sample was received. */
+    uint64_t time_us[2] = { 0 };
+    uint64_t start_us;
+    uint64_t next_us;
+    uint32_t sample;
+    size_t ii;
+    int ret;
+
+    memset(fetch, 0, sizeof(fetch));
+    ret = stats_fetch_init(mors, &fetch[0], cmds, n_cmds);
+    if (!ret)
+        ret = stats_fetch_init(mors, &fetch[1], cmds, n_cmds);
+    if (ret)
+        goto exit;
+
+    start_us = time_now_us();
+    next_us = start_us;
+
+    for (sample = 0; !count || (sample < count); sample++)
+    {
+        const int cur = sample & 1;
+        const int prev = !cur;
+        uint64_t now_us = time_now_us();
+        uint64_t elapsed_us;
+
+        /* Samples are kept to the interval from the start, skipping any that were missed. */
+        if (next_us > now_us)
+            sleep_ms((next_us - now_us + 999) / 1000);
+        now_us = time_now_us();
+        next_us = MAX(next_us + (uint64_t)interval_ms * 1000, now_us);
+
+        elapsed_us = now_us - start_us;
+        mctrl_print("Sample %u at %" PRIu64 ".%03" PRIu64 " s\n", sample,
+                    elapsed_us / 1000000, (elapsed_us / 1000) % 1000);
+
+        ret = stats_fetch(mors, &fetch[cur], true);
+        if (ret)
+            goto exit;
+        time_us[cur] = time_now_us();
+
+        for (ii = 0; ii < n_cmds; ii++)
+        {
+            const uint8_t *prev_tlvs;
+            const uint8_t *cur_tlvs;
+            int prev_len;
+            int cur_len;
+
+            prev_tlvs = stats_fetch_tlvs(&fetch[prev], ii, &prev_len);
+            cur_tlvs = stats_fetch_tlvs(&fetch[cur], ii, &cur_len);
+            ret = stats_delta_print(mors, sample ? prev_tlvs : NULL, prev_len,
+                                    cur_tlvs, cur_len, time_us[cur] - time_us[prev],
+                                    filter_string);
+            if (ret)
+                goto exit;
+        }
+    }
+
+    ret = 0;
+
+exit:
+    stats_fetch_free(&fetch[0]);
+    stats_fetch_free(&fetch[1]);
+
+    return ret;
+}
@@ -2,12 +2,15 @@
  * Copyright 2022 Morse Micro
  */
 
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "ftd2xx.h"
 #include "libmpsse_spi.h"
+#include "ftdi_mid.h"
 #include "transport.h"
 #include "sdio_over_spi.h"
 
@@ -29,7 +32,11 @@
 #define MMDEBUG_CPOL_DEFAULT            false
 #define MMDEBUG_CPHA_DEFAULT            false
 #define MMDEBUG_LATENCY_DEFAULT         (0)
-#define MMDEBUG_MAX_CHANNELS            (4UL)
+#define MMDEBUG_MAX_CHANNELS            (16UL)
+#define MMDEBUG_STREAM_DEFAULT          true
+#define MMDEBUG_LINK_TRAIN_DEFAULT      false
+#define MMDEBUG_CLOCK_STEP_DOWN_DEFAULT false
+#define MMDEBUG_USB_TUNE_DEFAULT        false
 
 #define FTDI_SPI_MIN_FREQ_KHZ           (1)
 #define FTDI_SPI_MAX_FREQ_KHZ           (30000)
@@ -57,6 +64,16 @@
 #define FTDI_SPI_STR_JTAGRST_PIN        "jtag_reset_pin_num"
 #define FTDI_SPI_STR_RESET_MS           "reset_ms"
 #define FTDI_SPI_STR_SERIAL_NUM         "serial_num"
+#define FTDI_SPI_STR_LOC_ID             "loc_id"
+#define FTDI_SPI_STR_STREAM             "stream"
+#define FTDI_SPI_STR_LINK_TRAIN         "link_train"
+#define FTDI_SPI_STR_CLOCK_STEP_DOWN    "clock_step_down"
+#define FTDI_SPI_STR_USB_IN             "usb_in"
+#define FTDI_SPI_STR_USB_OUT            "usb_out"
+#define FTDI_SPI_STR_BULK_USB_IN        "bulk_usb_in"
+#define FTDI_SPI_STR_BULK_USB_OUT       "bulk_usb_out"
+#define FTDI_SPI_STR_BULK_LAG           "bulk_latency"
+#define FTDI_SPI_STR_USB_TUNE           "usb_tune"
 #define FTDI_SPI_STR_HELP               "help"
 
 #define RESP_TIMEOUT_MS                 (3000)
@@ -73,7 +90,52 @@
 #define MM_CMD_ADDR_OFFSET              (16)
 #define MM_RESP_ADDR_OFFSET             (20)
 
+#define MM_CHIP_ID_ADDR                 (0x10054d20)
+
 #define FTDI_SPI_FREQ_KHZ_TO_HZ(freq_khz)  ((freq_khz) * 1000)
+#define FTDI_SPI_HZ_TO_FREQ_KHZ(hz)        ((hz) / 1000)
+
+/*
+ * Memory at the start of IMEM is overwritten to exercise the link. The firmware runs from it, so
+ * this is only done while the host manifest pointer reads 0: it is cleared on hard reset and only
+ * set by the firmware once it has booted.
+ */
+#define FTDI_SPI_SCRATCH_ADDR           (0x00100000)
+
+/*
+ * Link training steps the clock down through the divisors of the maximum clock, writing test
+ * patterns to the scratch memory. Its contents are saved and restored at the slowest clock.
+ */
+#define FTDI_SPI_LINK_TRAIN_MIN_KHZ     (1000)
+#define FTDI_SPI_LINK_TRAIN_SIZE        ((2 * 512) + 256)
+#define FTDI_SPI_LINK_TRAIN_ROUNDS      (4)
+#define FTDI_SPI_LINK_CACHE_FILE        ".morsectrl_ftdi_spi_link"
+
+/*
+ * USB transfer sizes must be a multiple of 64 octets. The small profile is applied for register
+ * and command traffic and the bulk profile for memory transfers of at least the threshold below.
+ */
+#define FTDI_SPI_USB_SIZE_MIN           (64)
+#define FTDI_SPI_USB_SIZE_MAX           (65536)
+#define FTDI_SPI_USB_SIZE_DEFAULT       FTDI_SPI_USB_SIZE_MAX
+#define FTDI_SPI_USB_BULK_THRESHOLD     (4096)
+#define FTDI_SPI_USB_TUNE_BULK_SIZE     (32 * 1024)
+#define FTDI_SPI_USB_TUNE_SMALL_ROUNDS  (32)
+#define FTDI_SPI_USB_CACHE_FILE         ".morsectrl_ftdi_spi_usb"
+#define FTDI_SPI_USB_CACHE_VALUES       (6)
+
+/* Results cached against a board serial number are kept one board per line in a file in $HOME. */
+#define FTDI_SPI_CACHE_PATH_LEN         (512)
+#define FTDI_SPI_CACHE_LINE_LEN         (128)
+#define FTDI_SPI_CACHE_MAX              (64)
+#define FTDI_SPI_CACHE_MAX_VALUES       (8)
+
+/*
+ * Boards programmed together are reset from their own threads. Only one sets up its link at a
+ * time, so the cache files aren't updated from two threads at once and USB tuning isn't timed
+ * alongside another board's training or tuning.
+ */
+static pthread_mutex_t ftdi_spi_link_lock = PTHREAD_MUTEX_INITIALIZER;
 
 /**
  * @brief Prints an error message if possible.
@@ -186,6 +248,18 @@ static bool ftdi_spi_get_string(const char *str, const char *key, char *val, int
     return false;
 }
 
+/**
+ * @brief Check a USB transfer size is one the D2XX driver accepts.
+ *
+ * @param size  Transfer size in octets.
+ * @return      true if valid, otherwise false.
+ */
+static bool ftdi_spi_usb_size_valid(uint32_t size)
+{
+    return (size >= FTDI_SPI_USB_SIZE_MIN) && (size <= FTDI_SPI_USB_SIZE_MAX) &&
+           !(size % FTDI_SPI_USB_SIZE_MIN);
+}
+
 static bool ftdi_spi_print_config_usage(const char *str, const char *key)
 {
     if (strncmp(str, key, strlen(key)))
@@ -211,6 +285,25 @@ static bool ftdi_spi_print_config_usage(const char *str, const char *key)
     mctrl_print("\t%s - Reset time (default %d)\n", FTDI_SPI_STR_RESET_MS,
                     MMDEBUG_RESET_MS_DEFAULT);
     mctrl_print("\t%s - Serial number to use\n", FTDI_SPI_STR_SERIAL_NUM);
+    mctrl_print("\t%s - Location ID of the SPI channel to use\n", FTDI_SPI_STR_LOC_ID);
+    mctrl_print("\t%s - Stream large memory transfers (default %d)\n", FTDI_SPI_STR_STREAM,
+                    MMDEBUG_STREAM_DEFAULT);
+    mctrl_print("\t%s - Train the clock at init, or use the result cached for the board "
+                "(default %d)\n", FTDI_SPI_STR_LINK_TRAIN, MMDEBUG_LINK_TRAIN_DEFAULT);
+    mctrl_print("\t%s - Step the clock down after repeated transfer errors (default %d)\n",
+                    FTDI_SPI_STR_CLOCK_STEP_DOWN, MMDEBUG_CLOCK_STEP_DOWN_DEFAULT);
+    mctrl_print("\t%s - USB IN transfer size for register traffic (default %d)\n",
+                    FTDI_SPI_STR_USB_IN, FTDI_SPI_USB_SIZE_DEFAULT);
+    mctrl_print("\t%s - USB OUT transfer size for register traffic (default %d)\n",
+                    FTDI_SPI_STR_USB_OUT, FTDI_SPI_USB_SIZE_DEFAULT);
+    mctrl_print("\t%s - USB IN transfer size for memory transfers (default %d)\n",
+                    FTDI_SPI_STR_BULK_USB_IN, FTDI_SPI_USB_SIZE_DEFAULT);
+    mctrl_print("\t%s - USB OUT transfer size for memory transfers (default %d)\n",
+                    FTDI_SPI_STR_BULK_USB_OUT, FTDI_SPI_USB_SIZE_DEFAULT);
+    mctrl_print("\t%s - Latency for memory transfers (default %d)\n", FTDI_SPI_STR_BULK_LAG,
+                    MMDEBUG_LATENCY_DEFAULT);
+    mctrl_print("\t%s - Tune the USB parameters at init, or use the results cached for the "
+                "board (default %d)\n", FTDI_SPI_STR_USB_TUNE, MMDEBUG_USB_TUNE_DEFAULT);
     mctrl_print("\t%s - Prints this message\n", FTDI_SPI_STR_HELP);
 
     return true;
@@ -247,6 +340,15 @@ static int ftdi_spi_parse(struct morsectrl_transport *transport,
     chan_config->Pin = 0xFFFFFFFF;
     chan_config->configOptions = 0;
     config->reset_ms = MMDEBUG_RESET_MS_DEFAULT;
+    config->stream = MMDEBUG_STREAM_DEFAULT;
+    config->link_train = MMDEBUG_LINK_TRAIN_DEFAULT;
+    config->clock_step_down = MMDEBUG_CLOCK_STEP_DOWN_DEFAULT;
+    config->usb_small.in_size = FTDI_SPI_USB_SIZE_DEFAULT;
+    config->usb_small.out_size = FTDI_SPI_USB_SIZE_DEFAULT;
+    config->usb_bulk.in_size = FTDI_SPI_USB_SIZE_DEFAULT;
+    config->usb_bulk.out_size = FTDI_SPI_USB_SIZE_DEFAULT;
+    config->usb_bulk.latency = MMDEBUG_LATENCY_DEFAULT;
+    config->usb_tune = MMDEBUG_USB_TUNE_DEFAULT;
 
     if (cfg_opts)
     {
@@ -275,6 +377,26 @@ static int ftdi_spi_parse(struct morsectrl_transport *transport,
             if (ftdi_spi_get_string(ptr, FTDI_SPI_STR_SERIAL_NUM, config->serial_num,
                                     sizeof(config->serial_num)))
                 continue;
+            if (ftdi_spi_get_uint32(ptr, FTDI_SPI_STR_LOC_ID, &config->loc_id))
+                continue;
+            if (ftdi_spi_get_bool(ptr, FTDI_SPI_STR_STREAM, &config->stream))
+                continue;
+            if (ftdi_spi_get_bool(ptr, FTDI_SPI_STR_LINK_TRAIN, &config->link_train))
+                continue;
+            if (ftdi_spi_get_bool(ptr, FTDI_SPI_STR_CLOCK_STEP_DOWN, &config->clock_step_down))
+                continue;
+            if (ftdi_spi_get_uint32(ptr, FTDI_SPI_STR_USB_IN, &config->usb_small.in_size))
+                continue;
+            if (ftdi_spi_get_uint32(ptr, FTDI_SPI_STR_USB_OUT, &config->usb_small.out_size))
+                continue;
+            if (ftdi_spi_get_uint32(ptr, FTDI_SPI_STR_BULK_USB_IN, &config->usb_bulk.in_size))
+                continue;
+            if (ftdi_spi_get_uint32(ptr, FTDI_SPI_STR_BULK_USB_OUT, &config->usb_bulk.out_size))
+                continue;
+            if (ftdi_spi_get_uint8(ptr, FTDI_SPI_STR_BULK_LAG, &config->usb_bulk.latency))
+                continue;
+            if (ftdi_spi_get_bool(ptr, FTDI_SPI_STR_USB_TUNE, &config->usb_tune))
+                continue;
             if (ftdi_spi_print_config_usage(ptr, FTDI_SPI_STR_HELP))
                 exit(ETRANSSUCC);
 
@@ -282,6 +404,18 @@ static int ftdi_spi_parse(struct morsectrl_transport *transport,
         }
     }
 
+    config->usb_small.latency = chan_config->LatencyTimer;
+
+    if (!ftdi_spi_usb_size_valid(config->usb_small.in_size) ||
+        !ftdi_spi_usb_size_valid(config->usb_small.out_size) ||
+        !ftdi_spi_usb_size_valid(config->usb_bulk.in_size) ||
+        !ftdi_spi_usb_size_valid(config->usb_bulk.out_size))
+    {
+        mctrl_err("USB transfer sizes must be a multiple of %d from %d to %d\n",
+                  FTDI_SPI_USB_SIZE_MIN, FTDI_SPI_USB_SIZE_MIN, FTDI_SPI_USB_SIZE_MAX);
+        config_error++;
+    }
+
     if (config_error)
     {
         mctrl_err("FTDI SPI configuration error\n");
@@ -304,64 +438,739 @@ static int ftdi_spi_parse(struct morsectrl_transport *transport,
             chan_config->configOptions |= SPI_CONFIG_OPTION_MODE3;
     }
 
-    if (freq_khz > FTDI_SPI_MAX_FREQ_KHZ)
-        chan_config->ClockRate = FTDI_SPI_FREQ_KHZ_TO_HZ(FTDI_SPI_MAX_FREQ_KHZ);
-    else if (freq_khz < FTDI_SPI_MIN_FREQ_KHZ)
-        chan_config->ClockRate = FTDI_SPI_FREQ_KHZ_TO_HZ(FTDI_SPI_MIN_FREQ_KHZ);
-    else
-        chan_config->ClockRate = FTDI_SPI_FREQ_KHZ_TO_HZ(freq_khz);
+    if (freq_khz > FTDI_SPI_MAX_FREQ_KHZ)
+        chan_config->ClockRate = FTDI_SPI_FREQ_KHZ_TO_HZ(FTDI_SPI_MAX_FREQ_KHZ);
+    else if (freq_khz < FTDI_SPI_MIN_FREQ_KHZ)
+        chan_config->ClockRate = FTDI_SPI_FREQ_KHZ_TO_HZ(FTDI_SPI_MIN_FREQ_KHZ);
+    else
+        chan_config->ClockRate = FTDI_SPI_FREQ_KHZ_TO_HZ(freq_khz);
+
+    if (cs_active_low)
+        chan_config->configOptions |= SPI_CONFIG_OPTION_CS_ACTIVELOW;
+    else
+        chan_config->configOptions |= SPI_CONFIG_OPTION_CS_ACTIVEHIGH;
+
+    switch (cs_pin)
+    {
+    case 3:
+        chan_config->configOptions |= SPI_CONFIG_OPTION_CS_DBUS3;
+        break;
+
+    case 4:
+        chan_config->configOptions |= SPI_CONFIG_OPTION_CS_DBUS4;
+        break;
+
+    case 5:
+        chan_config->configOptions |= SPI_CONFIG_OPTION_CS_DBUS5;
+        break;
+
+    case 6:
+        chan_config->configOptions |= SPI_CONFIG_OPTION_CS_DBUS6;
+        break;
+
+    case 7:
+        chan_config->configOptions |= SPI_CONFIG_OPTION_CS_DBUS7;
+        break;
+
+    default:
+        chan_config->configOptions |= SPI_CONFIG_OPTION_CS_DBUS3;
+        cs_pin = MMDEBUG_CS_PIN_DEFAULT;
+    }
+
+    config->jtag_reset_pin_num = BIT(jtag_reset_pin_num + FTDI_SPI_GPIO_OFFSET);
+    config->reset_pin_num = BIT(reset_pin_num + FTDI_SPI_GPIO_OFFSET);
+
+    if (transport->debug)
+    {
+        mctrl_print("Frequency       = %u Hz\n", chan_config->ClockRate);
+        mctrl_print("Latency         = %d Cycles\n", chan_config->LatencyTimer);
+        mctrl_print("CPOL            = %d\n", cpol ? 1 : 0);
+        mctrl_print("CPHA            = %d\n", cpha ? 1 : 0);
+        mctrl_print("CS Polarity     = Active %s\n", cs_active_low ? "low" : "high");
+        mctrl_print("CS Pin          = DBUS%d\n", cs_pin);
+        mctrl_print("Reset Pin       = %d\n", reset_pin_num);
+        mctrl_print("JTAG Reset Pin  = %d\n", jtag_reset_pin_num);
+        mctrl_print("Reset time (ms) = %u\n", config->reset_ms);
+        mctrl_print("Serial Number   = %s\n", strlen(config->serial_num) ?
+                                              config->serial_num : "N/A");
+        mctrl_print("Location ID     = 0x%08x\n", config->loc_id);
+        mctrl_print("Streaming       = %d\n", config->stream ? 1 : 0);
+        mctrl_print("Link training   = %d\n", config->link_train ? 1 : 0);
+        mctrl_print("Clock step down = %d\n", config->clock_step_down ? 1 : 0);
+        mctrl_print("USB small       = in %u, out %u, latency %u\n",
+                    config->usb_small.in_size, config->usb_small.out_size,
+                    config->usb_small.latency);
+        mctrl_print("USB bulk        = in %u, out %u, latency %u\n",
+                    config->usb_bulk.in_size, config->usb_bulk.out_size,
+                    config->usb_bulk.latency);
+        mctrl_print("USB tuning      = %d\n", config->usb_tune ? 1 : 0);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Change the SPI clock of an initialised channel.
+ *
+ * @param transport The transport structure.
+ * @param freq_khz  Clock frequency in kHz.
+ * @return          0 on success otherwise relevant error.
+ */
+static int ftdi_spi_set_clock(struct morsectrl_transport *transport, uint32_t freq_khz)
+{
+    struct morsectrl_ftdi_spi_state *state = &transport->state.ftdi_spi;
+    struct morsectrl_ftdi_spi_cfg *config = &transport->config.ftdi_spi;
+    FT_DEVICE ft_device;
+    FT_STATUS status;
+
+    status = Mid_GetFtDeviceType(state->handle, &ft_device);
+    if (status == FT_OK)
+        status = Mid_SetClock(state->handle, ft_device, FTDI_SPI_FREQ_KHZ_TO_HZ(freq_khz));
+
+    if (status != FT_OK)
+    {
+        ftdi_spi_error(transport, status, "Failed to set SPI clock");
+        return -ETRANSFTDISPIERR;
+    }
+
+    config->channel.ClockRate = FTDI_SPI_FREQ_KHZ_TO_HZ(freq_khz);
+
+    return ETRANSSUCC;
+}
+
+/**
+ * @brief Slow the SPI clock down to the next divisor after repeated transfer errors.
+ *
+ * @param transport The transport structure.
+ * @return          0 on success otherwise relevant error (including already at the slowest clock).
+ */
+static int ftdi_spi_step_down_clock(struct morsectrl_transport *transport)
+{
+    struct morsectrl_ftdi_spi_cfg *config = &transport->config.ftdi_spi;
+    uint32_t freq_khz = FTDI_SPI_HZ_TO_FREQ_KHZ(config->channel.ClockRate);
+    uint32_t divisor = (FTDI_SPI_MAX_FREQ_KHZ / freq_khz) - 1;
+    int ret;
+
+    freq_khz = FTDI_SPI_MAX_FREQ_KHZ / (divisor + 2);
+    if (freq_khz < FTDI_SPI_LINK_TRAIN_MIN_KHZ)
+        return -ETRANSFTDISPIERR;
+
+    ret = ftdi_spi_set_clock(transport, freq_khz);
+    if (!ret && transport->debug)
+        mctrl_print("SPI clock stepped down to %u kHz\n", freq_khz);
+
+    return ret;
+}
+
+/**
+ * @brief Turn CMD53 retries and clock step downs on or off. They are off while the link is being
+ *        measured, so a transfer that only gets through when retried fails, and the clock isn't
+ *        changed in the middle of a measurement.
+ *
+ * @param transport The transport structure.
+ * @param enable    Whether to retry as configured, otherwise never.
+ */
+static void ftdi_spi_retries_enable(struct morsectrl_transport *transport, bool enable)
+{
+    struct morsectrl_ftdi_spi_state *state = &transport->state.ftdi_spi;
+    struct morsectrl_ftdi_spi_cfg *config = &transport->config.ftdi_spi;
+
+    state->sdio.no_retries = !enable;
+    state->sdio.step_down_clock =
+        (enable && config->clock_step_down) ? ftdi_spi_step_down_clock : NULL;
+}
+
+/**
+ * @brief Get the path of a file caching per board results.
+ *
+ * @param name  File name, relative to the home directory.
+ * @param path  Buffer to fill with the path.
+ * @param len   Length of the buffer.
+ * @return      true if there is somewhere to cache results, otherwise false.
+ */
+static bool ftdi_spi_cache_path(const char *name, char *path, size_t len)
+{
+    const char *home = getenv("HOME");
+
+#if MORSE_WIN_BUILD
+    if (!home)
+        home = getenv("USERPROFILE");
+#endif
+
+    if (!home)
+        return false;
+
+    return (snprintf(path, len, "%s/%s", home, name) < len);
+}
+
+/**
+ * @brief Parse a cache line of a serial number followed by values.
+ *
+ * @param line      Line to parse.
+ * @param serial    Filled with the serial number, at least @ref MAX_SERIAL_NUMBER_LEN long.
+ * @param values    Filled with the values.
+ * @param num       Number of values expected.
+ * @return          true if the line held a serial number and all the values, otherwise false.
+ */
+static bool ftdi_spi_cache_parse(const char *line, char *serial, uint32_t *values, size_t num)
+{
+    const char *ptr;
+    char *end;
+    int consumed;
+    size_t ii;
+
+    if (sscanf(line, "%15s%n", serial, &consumed) != 1)
+        return false;
+
+    ptr = line + consumed;
+    for (ii = 0; ii < num; ii++)
+    {
+        values[ii] = strtoul(ptr, &end, 0);
+        if (end == ptr)
+            return false;
+        ptr = end;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Look up the results cached for a board.
+ *
+ * @param name          Cache file name, relative to the home directory.
+ * @param serial_num    Serial number of the SPI channel.
+ * @param values        Filled with the cached values.
+ * @param num           Number of values.
+ * @return              true if results were cached for the board, otherwise false.
+ */
+static bool ftdi_spi_cache_load(const char *name, const char *serial_num,
+                                uint32_t *values, size_t num)
+{
+    char path[FTDI_SPI_CACHE_PATH_LEN];
+    char line[FTDI_SPI_CACHE_LINE_LEN];
+    char serial[MAX_SERIAL_NUMBER_LEN];
+    uint32_t parsed[FTDI_SPI_CACHE_MAX_VALUES];
+    bool found = false;
+    FILE *file;
+
+    if ((num > FTDI_SPI_CACHE_MAX_VALUES) || !serial_num[0] ||
+        !ftdi_spi_cache_path(name, path, sizeof(path)))
+        return false;
+
+    file = fopen(path, "r");
+    if (!file)
+        return false;
+
+    while (fgets(line, sizeof(line), file))
+    {
+        if (ftdi_spi_cache_parse(line, serial, parsed, num) && !strcmp(serial, serial_num))
+        {
+            memcpy(values, parsed, num * sizeof(*values));
+            found = true;
+        }
+    }
+    fclose(file);
+
+    return found;
+}
+
+/**
+ * @brief Record the results for a board, replacing any earlier results.
+ *
+ * @param name          Cache file name, relative to the home directory.
+ * @param serial_num    Serial number of the SPI channel.
+ * @param values        Values to cache.
+ * @param num           Number of values.
+ */
+static void ftdi_spi_cache_save(const char *name, const char *serial_num,
+                                const uint32_t *values, size_t num)
+{
+    char path[FTDI_SPI_CACHE_PATH_LEN];
+    char tmp_path[FTDI_SPI_CACHE_PATH_LEN + 32];
+    char lines[FTDI_SPI_CACHE_MAX][FTDI_SPI_CACHE_LINE_LEN];
+    char serial[MAX_SERIAL_NUMBER_LEN];
+    bool written = true;
+    int count = 0;
+    int ii;
+    size_t jj;
+    FILE *file;
+
+    if (!serial_num[0] || !ftdi_spi_cache_path(name, path, sizeof(path)))
+        return;
+
+    file = fopen(path, "r");
+    if (file)
+    {
+        while ((count < FTDI_SPI_CACHE_MAX) && fgets(lines[count], sizeof(lines[count]), file))
+        {
+            if ((sscanf(lines[count], "%15s", serial) == 1) && strcmp(serial, serial_num))
+                count++;
+        }
+        fclose(file);
+    }
+
+    /* Write a copy and rename it over the cache, so it is never seen half written. */
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%ld.tmp", path, (long)getpid());
+    file = fopen(tmp_path, "w");
+    if (!file)
+        return;
+
+    for (ii = 0; ii < count; ii++)
+        written = written && (fputs(lines[ii], file) >= 0);
+    written = written && (fprintf(file, "%s", serial_num) >= 0);
+    for (jj = 0; jj < num; jj++)
+        written = written && (fprintf(file, " %u", values[jj]) >= 0);
+    written = written && (fprintf(file, "\n") >= 0);
+
+#if MORSE_WIN_BUILD
+    /* Windows won't rename over an existing file. */
+    if (written)
+        remove(path);
+#endif
+    if (fclose(file) || !written || rename(tmp_path, path))
+        remove(tmp_path);
+}
+
+/**
+ * @brief Check whether firmware may be running, so the scratch memory must be left alone.
+ *
+ * @param transport The transport structure.
+ * @return          true if firmware is running or the chip can't be read, otherwise false.
+ */
+static bool ftdi_spi_fw_running(struct morsectrl_transport *transport)
+{
+    uint32_t host_table_ptr;
+
+    return sdio_over_spi_read_reg_32bit(transport, MM_MANIFEST_ADDR, &host_table_ptr) ||
+           host_table_ptr;
+}
+
+/**
+ * @brief Exercise the link at the current clock with CRC checked register and memory accesses.
+ *
+ * @param transport The transport structure.
+ * @param chip_id   Chip ID read at a known good clock.
+ * @param write     Buffer to fill with the test pattern and write.
+ * @param read      Buffer to read the pattern back into.
+ * @return          true if every access succeeded and matched, otherwise false.
+ */
+static bool ftdi_spi_link_test(struct morsectrl_transport *transport,
+                               uint32_t chip_id,
+                               struct morsectrl_transport_buff *write,
+                               struct morsectrl_transport_buff *read)
+{
+    uint32_t value;
+    size_t ii;
+    int round;
+
+    for (round = 0; round < FTDI_SPI_LINK_TRAIN_ROUNDS; round++)
+    {
+        /* Vary the pattern and invert it every other round so each line sees both levels. */
+        for (ii = 0; ii < write->data_len; ii++)
+            write->data[ii] = (ii + (round * 0x5B)) ^ ((round & 1) ? 0xFF : 0x00);
+
+        if (sdio_over_spi_read_reg_32bit(transport, MM_CHIP_ID_ADDR, &value) ||
+            (value != chip_id))
+            return false;
+
+        if (sdio_over_spi_write_memblock(transport, write, FTDI_SPI_SCRATCH_ADDR) ||
+            sdio_over_spi_read_memblock(transport, read, FTDI_SPI_SCRATCH_ADDR))
+            return false;
+
+        if (memcmp(write->data, read->data, write->data_len))
+            return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Find the fastest clock the link is error free at, without retries, and then step down
+ *        one more divisor for margin unless nothing failed. The result is cached against the
+ *        board serial number. Refused while firmware is running, as the scratch memory is
+ *        overwritten.
+ *
+ * @param transport The transport structure.
+ * @param freq_khz  Filled with the clock chosen, in kHz.
+ * @return          0 on success otherwise relevant error.
+ */
+static int ftdi_spi_link_train(struct morsectrl_transport *transport, uint32_t *freq_khz)
+{
+    struct morsectrl_ftdi_spi_state *state = &transport->state.ftdi_spi;
+    struct morsectrl_ftdi_spi_cfg *config = &transport->config.ftdi_spi;
+    int (*error_function)(const char *prefix, int error_code, const char *error_msg) =
+        transport->error_function;
+    uint32_t start_khz = FTDI_SPI_HZ_TO_FREQ_KHZ(config->channel.ClockRate);
+    struct morsectrl_transport_buff *saved;
+    struct morsectrl_transport_buff *write;
+    struct morsectrl_transport_buff *read;
+    uint32_t chosen_khz = 0;
+    uint32_t passed_khz = 0;
+    uint32_t trial_khz;
+    uint32_t divisor;
+    uint32_t chip_id;
+    bool failed = false;
+    bool passed;
+    int restore_ret;
+    int ret;
+
+    saved = morsectrl_transport_raw_read_alloc(transport, FTDI_SPI_LINK_TRAIN_SIZE);
+    write = morsectrl_transport_raw_write_alloc(transport, FTDI_SPI_LINK_TRAIN_SIZE);
+    read = morsectrl_transport_raw_read_alloc(transport, FTDI_SPI_LINK_TRAIN_SIZE);
+    if (!saved || !write || !read)
+    {
+        ret = -ETRANSERR;
+        goto exit;
+    }
+
+    /* Save the memory used for the pattern at a clock that should always work. */
+    ret = ftdi_spi_set_clock(transport, FTDI_SPI_LINK_TRAIN_MIN_KHZ);
+    if (!ret)
+        ret = sdio_over_spi_read_reg_32bit(transport, MM_CHIP_ID_ADDR, &chip_id);
+    if (ret)
+    {
+        ftdi_spi_error(transport, ret, "No response from chip at the slowest training clock");
+        ftdi_spi_set_clock(transport, start_khz);
+        goto exit;
+    }
+
+    if (ftdi_spi_fw_running(transport))
+    {
+        ret = -ETRANSFTDISPIERR;
+        ftdi_spi_error(transport, ret, "Firmware is running, hard reset the chip to train");
+        ftdi_spi_set_clock(transport, start_khz);
+        goto exit;
+    }
+
+    ret = sdio_over_spi_read_memblock(transport, saved, FTDI_SPI_SCRATCH_ADDR);
+    if (ret)
+    {
+        ftdi_spi_error(transport, ret, "Failed to save the training memory");
+        ftdi_spi_set_clock(transport, start_khz);
+        goto exit;
+    }
+
+    /*
+     * Failures are expected while training, don't report each of them. A clock must pass
+     * without retries, and is never stepped down in the middle of a trial.
+     */
+    transport->error_function = NULL;
+    ftdi_spi_retries_enable(transport, false);
+
+    for (divisor = 0; ; divisor++)
+    {
+        trial_khz = FTDI_SPI_MAX_FREQ_KHZ / (divisor + 1);
+        if (trial_khz < FTDI_SPI_LINK_TRAIN_MIN_KHZ)
+            break;
+
+        ret = ftdi_spi_set_clock(transport, trial_khz);
+        if (ret)
+            break;
+
+        passed = ftdi_spi_link_test(transport, chip_id, write, read);
+        if (transport->debug)
+            mctrl_print("SPI link at %5u kHz - %s\n", trial_khz, passed ? "Pass" : "Fail");
+
+        if (!passed)
+        {
+            failed = true;
+            passed_khz = 0;
+            continue;
+        }
+
+        if (!failed || passed_khz)
+        {
+            chosen_khz = trial_khz;
+            break;
+        }
+
+        passed_khz = trial_khz;
+    }
+
+    transport->error_function = error_function;
+    ftdi_spi_retries_enable(transport, true);
+
+    /* The slowest clock has no margin below it, but is still the best there is. */
+    if (!chosen_khz)
+        chosen_khz = passed_khz;
+
+    /* Restore the memory used for the pattern, however the training ended. */
+    restore_ret = ftdi_spi_set_clock(transport, FTDI_SPI_LINK_TRAIN_MIN_KHZ);
+    if (!restore_ret)
+        restore_ret = sdio_over_spi_write_memblock(transport, saved, FTDI_SPI_SCRATCH_ADDR);
+    if (!ret)
+        ret = restore_ret;
+    if (ret)
+    {
+        ftdi_spi_set_clock(transport, start_khz);
+        goto exit;
+    }
+
+    if (!chosen_khz)
+    {
+        ftdi_spi_error(transport, -ETRANSFTDISPIERR, "No reliable SPI clock found");
+        ftdi_spi_set_clock(transport, start_khz);
+        ret = -ETRANSFTDISPIERR;
+        goto exit;
+    }
+
+    ret = ftdi_spi_set_clock(transport, chosen_khz);
+    if (ret)
+        goto exit;
+
+    ftdi_spi_cache_save(FTDI_SPI_LINK_CACHE_FILE, state->serial_num, &chosen_khz, 1);
+    *freq_khz = chosen_khz;
+
+exit:
+    morsectrl_transport_buff_free(saved);
+    morsectrl_transport_buff_free(write);
+    morsectrl_transport_buff_free(read);
+
+    return ret;
+}
+
+/** Transfer sizes and latency timers tried when tuning the USB profiles. */
+static const uint32_t ftdi_spi_usb_tune_sizes[] = {4096, 16384, 65536};
+static const uint8_t ftdi_spi_usb_tune_latencies[] = {0, 1, 2, 4, 16};
+
+/**
+ * @brief Check whether two USB profiles are the same.
+ *
+ * @param a First profile.
+ * @param b Second profile.
+ * @return  true if they are the same, otherwise false.
+ */
+static bool ftdi_spi_usb_profile_equal(const struct morsectrl_ftdi_spi_usb_profile *a,
+                                       const struct morsectrl_ftdi_spi_usb_profile *b)
+{
+    return (a->in_size == b->in_size) && (a->out_size == b->out_size) &&
+           (a->latency == b->latency);
+}
+
+/**
+ * @brief Apply USB transfer sizes and the latency timer to the SPI channel.
+ *
+ * @note Data buffered in the driver is lost, so this must only be done between transfers.
+ *
+ * @param transport The transport structure.
+ * @param profile   USB parameters to apply.
+ * @return          0 on success otherwise relevant error.
+ */
+static int ftdi_spi_usb_apply(struct morsectrl_transport *transport,
+                              const struct morsectrl_ftdi_spi_usb_profile *profile)
+{
+    FT_HANDLE handle = transport->state.ftdi_spi.handle;
+    FT_STATUS status;
+
+    status = Mid_SetUSBParameters(handle, profile->in_size, profile->out_size);
+    if (status == FT_OK)
+        status = Mid_SetLatencyTimer(handle, profile->latency);
+
+    if (status != FT_OK)
+    {
+        ftdi_spi_error(transport, status, "Failed to set USB parameters");
+        return -ETRANSFTDISPIERR;
+    }
+
+    return ETRANSSUCC;
+}
+
+/**
+ * @brief Switch the SPI channel to the USB profile for the coming traffic if it isn't applied.
+ *
+ * @param transport The transport structure.
+ * @param bulk      Whether a large memory transfer is coming, otherwise register or command
+ *                  traffic.
+ * @return          0 on success otherwise relevant error.
+ */
+static int ftdi_spi_usb_select(struct morsectrl_transport *transport, bool bulk)
+{
+    struct morsectrl_ftdi_spi_state *state = &transport->state.ftdi_spi;
+    struct morsectrl_ftdi_spi_cfg *config = &transport->config.ftdi_spi;
+
+    if (state->usb_bulk == bulk)
+        return ETRANSSUCC;
+
+    state->usb_bulk = bulk;
+    if (ftdi_spi_usb_profile_equal(&config->usb_small, &config->usb_bulk))
+        return ETRANSSUCC;
+
+    return ftdi_spi_usb_apply(transport, bulk ? &config->usb_bulk : &config->usb_small);
+}
+
+/**
+ * @brief Time register reads with a USB profile applied.
+ *
+ * @param transport The transport structure.
+ * @param profile   USB parameters to try.
+ * @return          Time taken in us, or UINT64_MAX if the profile could not be used.
+ */
+static uint64_t ftdi_spi_usb_time_small(struct morsectrl_transport *transport,
+                                        const struct morsectrl_ftdi_spi_usb_profile *profile)
+{
+    uint64_t start;
+    uint32_t value;
+    int ii;
+
+    if (ftdi_spi_usb_apply(transport, profile))
+        return UINT64_MAX;
+
+    start = time_now_us();
+    for (ii = 0; ii < FTDI_SPI_USB_TUNE_SMALL_ROUNDS; ii++)
+    {
+        if (sdio_over_spi_read_reg_32bit(transport, MM_CHIP_ID_ADDR, &value))
+            return UINT64_MAX;
+    }
+
+    return time_now_us() - start;
+}
+
+/**
+ * @brief Time a memory read and a write of the same data back with a USB profile applied. Only
+ *        done while no firmware is running, so nothing changes the scratch memory in between.
+ *
+ * @param transport The transport structure.
+ * @param profile   USB parameters to try.
+ * @param buff      Buffer to read into and write from.
+ * @return          Time taken in us, or UINT64_MAX if the profile could not be used.
+ */
+static uint64_t ftdi_spi_usb_time_bulk(struct morsectrl_transport *transport,
+                                       const struct morsectrl_ftdi_spi_usb_profile *profile,
+                                       struct morsectrl_transport_buff *buff)
+{
+    uint64_t start;
+
+    if (ftdi_spi_usb_apply(transport, profile))
+        return UINT64_MAX;
+
+    start = time_now_us();
+    if (sdio_over_spi_read_memblock(transport, buff, FTDI_SPI_SCRATCH_ADDR) ||
+        sdio_over_spi_write_memblock(transport, buff, FTDI_SPI_SCRATCH_ADDR))
+        return UINT64_MAX;
+
+    return time_now_us() - start;
+}
+
+/**
+ * @brief Try each combination of transfer size and latency timer on register traffic and on
+ *        memory transfers, and keep the fastest for each profile. The results are cached against
+ *        the board serial number.
+ *
+ * @param transport The transport structure.
+ * @return          0 on success otherwise relevant error.
+ */
+static int ftdi_spi_usb_tune(struct morsectrl_transport *transport)
+{
+    struct morsectrl_ftdi_spi_state *state = &transport->state.ftdi_spi;
+    struct morsectrl_ftdi_spi_cfg *config = &transport->config.ftdi_spi;
+    int (*error_function)(const char *prefix, int error_code, const char *error_msg) =
+        transport->error_function;
+    struct morsectrl_ftdi_spi_usb_profile trial;
+    struct morsectrl_ftdi_spi_usb_profile best_small = config->usb_small;
+    struct morsectrl_ftdi_spi_usb_profile best_bulk = config->usb_bulk;
+    struct morsectrl_transport_buff *buff;
+    uint64_t small_us = UINT64_MAX;
+    uint64_t bulk_us = UINT64_MAX;
+    uint64_t elapsed;
+    uint32_t cache[FTDI_SPI_USB_CACHE_VALUES];
+    size_t ii;
+    size_t jj;
+
+    buff = morsectrl_transport_raw_read_alloc(transport, FTDI_SPI_USB_TUNE_BULK_SIZE);
+    if (!buff)
+        return -ETRANSERR;
+
+    /*
+     * Profiles the driver or board can't use are skipped, don't report each of them. A profile
+     * whose transfers only get through when retried, or at a stepped down clock, is skipped too
+     * rather than timed.
+     */
+    transport->error_function = NULL;
+    ftdi_spi_retries_enable(transport, false);
 
-    if (cs_active_low)
-        chan_config->configOptions |= SPI_CONFIG_OPTION_CS_ACTIVELOW;
-    else
-        chan_config->configOptions |= SPI_CONFIG_OPTION_CS_ACTIVEHIGH;
+    for (ii = 0; ii < MORSE_ARRAY_SIZE(ftdi_spi_usb_tune_sizes); ii++)
+    {
+        for (jj = 0; jj < MORSE_ARRAY_SIZE(ftdi_spi_usb_tune_latencies); jj++)
+        {
+            trial.in_size = ftdi_spi_usb_tune_sizes[ii];
+            trial.out_size = ftdi_spi_usb_tune_sizes[ii];
+            trial.latency = ftdi_spi_usb_tune_latencies[jj];
+
+            elapsed = ftdi_spi_usb_time_small(transport, &trial);
+            if (transport->debug)
+                mctrl_print("USB small in %5u out %5u latency %3u - %" PRIu64 " us\n",
+                            trial.in_size, trial.out_size, trial.latency, elapsed);
+            if (elapsed < small_us)
+            {
+                small_us = elapsed;
+                best_small = trial;
+            }
 
-    switch (cs_pin)
+            elapsed = ftdi_spi_usb_time_bulk(transport, &trial, buff);
+            if (transport->debug)
+                mctrl_print("USB bulk  in %5u out %5u latency %3u - %" PRIu64 " us\n",
+                            trial.in_size, trial.out_size, trial.latency, elapsed);
+            if (elapsed < bulk_us)
+            {
+                bulk_us = elapsed;
+                best_bulk = trial;
+            }
+        }
+    }
+
+    transport->error_function = error_function;
+    ftdi_spi_retries_enable(transport, true);
+    morsectrl_transport_buff_free(buff);
+
+    if ((small_us == UINT64_MAX) || (bulk_us == UINT64_MAX))
     {
-    case 3:
-        chan_config->configOptions |= SPI_CONFIG_OPTION_CS_DBUS3;
-        break;
+        ftdi_spi_error(transport, -ETRANSFTDISPIERR, "No usable USB parameters found");
+        ftdi_spi_usb_apply(transport, &config->usb_small);
+        return -ETRANSFTDISPIERR;
+    }
 
-    case 4:
-        chan_config->configOptions |= SPI_CONFIG_OPTION_CS_DBUS4;
-        break;
+    config->usb_small = best_small;
+    config->usb_bulk = best_bulk;
 
-    case 5:
-        chan_config->configOptions |= SPI_CONFIG_OPTION_CS_DBUS5;
-        break;
+    cache[0] = best_small.in_size;
+    cache[1] = best_small.out_size;
+    cache[2] = best_small.latency;
+    cache[3] = best_bulk.in_size;
+    cache[4] = best_bulk.out_size;
+    cache[5] = best_bulk.latency;
+    ftdi_spi_cache_save(FTDI_SPI_USB_CACHE_FILE, state->serial_num, cache, MORSE_ARRAY_SIZE(cache));
 
-    case 6:
-        chan_config->configOptions |= SPI_CONFIG_OPTION_CS_DBUS6;
-        break;
+    return ETRANSSUCC;
+}
 
-    case 7:
-        chan_config->configOptions |= SPI_CONFIG_OPTION_CS_DBUS7;
-        break;
+/**
+ * @brief Set the USB profiles from the results cached for the board.
+ *
+ * @param transport The transport structure.
+ * @return          true if results were cached for the board, otherwise false.
+ */
+static bool ftdi_spi_usb_cache_load(struct morsectrl_transport *transport)
+{
+    struct morsectrl_ftdi_spi_state *state = &transport->state.ftdi_spi;
+    struct morsectrl_ftdi_spi_cfg *config = &transport->config.ftdi_spi;
+    uint32_t cache[FTDI_SPI_USB_CACHE_VALUES];
 
-    default:
-        chan_config->configOptions |= SPI_CONFIG_OPTION_CS_DBUS3;
-        cs_pin = MMDEBUG_CS_PIN_DEFAULT;
-    }
+    if (!ftdi_spi_cache_load(FTDI_SPI_USB_CACHE_FILE, state->serial_num,
+                             cache, MORSE_ARRAY_SIZE(cache)))
+        return false;
 
-    config->jtag_reset_pin_num = BIT(jtag_reset_pin_num + FTDI_SPI_GPIO_OFFSET);
-    config->reset_pin_num = BIT(reset_pin_num + FTDI_SPI_GPIO_OFFSET);
+    if (!ftdi_spi_usb_size_valid(cache[0]) || !ftdi_spi_usb_size_valid(cache[1]) ||
+        !ftdi_spi_usb_size_valid(cache[3]) || !ftdi_spi_usb_size_valid(cache[4]))
+        return false;
 
-    if (transport->debug)
-    {
-        mctrl_print("Frequency       = %u Hz\n", chan_config->ClockRate);
-        mctrl_print("Latency         = %d Cycles\n", chan_config->LatencyTimer);
-        mctrl_print("CPOL            = %d\n", cpol ? 1 : 0);
-        mctrl_print("CPHA            = %d\n", cpha ? 1 : 0);
-        mctrl_print("CS Polarity     = Active %s\n", cs_active_low ? "low" : "high");
-        mctrl_print("CS Pin          = DBUS%d\n", cs_pin);
-        mctrl_print("Reset Pin       = %d\n", reset_pin_num);
-        mctrl_print("JTAG Reset Pin  = %d\n", jtag_reset_pin_num);
-        mctrl_print("Reset time (ms) = %u\n", config->reset_ms);
-        mctrl_print("Serial Number   = %s\n", strlen(config->serial_num) ?
-                                              config->serial_num : "N/A");
-    }
+    config->usb_small.in_size = cache[0];
+    config->usb_small.out_size = cache[1];
+    config->usb_small.latency = cache[2];
+    config->usb_bulk.in_size = cache[3];
+    config->usb_bulk.out_size = cache[4];
+    config->usb_bulk.latency = cache[5];
 
-    return 0;
+    return true;
 }
 
 /**
@@ -390,6 +1199,96 @@ static void ftdi_spi_set_spi_and_reset_chan(DWORD loc_id,
     }
 }
 
+/**
+ * @brief Set the SPI clock and USB profiles from the results cached for the board, training the
+ *        link and tuning USB if nothing is cached and no firmware is running. Otherwise they are
+ *        left for the next hard reset, before the firmware is loaded.
+ *
+ * @note Called with ftdi_spi_link_lock held.
+ *
+ * @param transport The transport structure.
+ * @return          0 on success otherwise relevant error.
+ */
+static int ftdi_spi_link_setup_locked(struct morsectrl_transport *transport)
+{
+    struct morsectrl_ftdi_spi_state *state = &transport->state.ftdi_spi;
+    struct morsectrl_ftdi_spi_cfg *config = &transport->config.ftdi_spi;
+
+    if (config->link_train)
+    {
+        uint32_t freq_khz;
+        int ret;
+
+        if (ftdi_spi_cache_load(FTDI_SPI_LINK_CACHE_FILE, state->serial_num, &freq_khz, 1))
+        {
+            ret = ftdi_spi_set_clock(transport, freq_khz);
+        }
+        else if (ftdi_spi_fw_running(transport))
+        {
+            if (transport->debug)
+                mctrl_print("Firmware running, SPI link training left for the next reset\n");
+            freq_khz = FTDI_SPI_HZ_TO_FREQ_KHZ(config->channel.ClockRate);
+            ret = ETRANSSUCC;
+        }
+        else
+        {
+            ret = ftdi_spi_link_train(transport, &freq_khz);
+        }
+
+        /* Carry on at the configured clock, the chip may need a reset before it responds. */
+        if (ret)
+            mctrl_err("SPI link training failed, using %u kHz\n",
+                      FTDI_SPI_HZ_TO_FREQ_KHZ(config->channel.ClockRate));
+        else if (transport->debug)
+            mctrl_print("SPI link clock %u kHz\n", freq_khz);
+    }
+
+    if (config->usb_tune && !ftdi_spi_usb_cache_load(transport))
+    {
+        if (ftdi_spi_fw_running(transport))
+        {
+            if (transport->debug)
+                mctrl_print("Firmware running, USB tuning left for the next reset\n");
+        }
+        else if (ftdi_spi_usb_tune(transport))
+        {
+            mctrl_err("USB tuning failed, using the configured parameters\n");
+        }
+    }
+
+    if (transport->debug && config->usb_tune)
+    {
+        mctrl_print("USB small in %u out %u latency %u, bulk in %u out %u latency %u\n",
+                    config->usb_small.in_size, config->usb_small.out_size,
+                    config->usb_small.latency, config->usb_bulk.in_size,
+                    config->usb_bulk.out_size, config->usb_bulk.latency);
+    }
+
+    /* Register traffic comes first, memory transfers switch to the bulk profile as needed. */
+    state->usb_bulk = false;
+    if (ftdi_spi_usb_apply(transport, &config->usb_small))
+        return -ETRANSFTDISPIERR;
+
+    return ETRANSSUCC;
+}
+
+/**
+ * @brief Set up the SPI clock and USB profiles, one board at a time.
+ *
+ * @param transport The transport structure.
+ * @return          0 on success otherwise relevant error.
+ */
+static int ftdi_spi_link_setup(struct morsectrl_transport *transport)
+{
+    int ret;
+
+    pthread_mutex_lock(&ftdi_spi_link_lock);
+    ret = ftdi_spi_link_setup_locked(transport);
+    pthread_mutex_unlock(&ftdi_spi_link_lock);
+
+    return ret;
+}
+
 /**
  * @brief Initalise an FTDI SPI interface.
  *
@@ -414,6 +1313,7 @@ static int ftdi_spi_init(struct morsectrl_transport *transport)
     DWORD verMPSSE;
     DWORD verD2XX;
     unsigned int ii;
+    bool matches;
     char serial_num_list[MMDEBUG_MAX_CHANNELS][MAX_SERIAL_NUMBER_LEN] = {"\0"};
 
     Init_libMPSSE();
@@ -446,15 +1346,16 @@ static int ftdi_spi_init(struct morsectrl_transport *transport)
         status = SPI_GetChannelInfo(ii, &device_node);
         strncpy(serial_num_list[ii], device_node.SerialNumber, MAX_SERIAL_NUMBER_LEN);
 
+        /* A requested location ID selects the SPI channel and the reset channel following it. */
+        matches = !config->loc_id || (device_node.LocId == config->loc_id) ||
+                  (device_node.LocId == config->loc_id + 1);
+
         if (config->serial_num[0])
-        {
-            if (!strncmp(config->serial_num, device_node.SerialNumber, strlen(config->serial_num)))
-                ftdi_spi_set_spi_and_reset_chan(device_node.LocId, ii, &spi_chan_info);
-        }
-        else
-        {
+            matches &= !strncmp(config->serial_num, device_node.SerialNumber,
+                                strlen(config->serial_num));
+
+        if (matches)
             ftdi_spi_set_spi_and_reset_chan(device_node.LocId, ii, &spi_chan_info);
-        }
 
         if (transport->debug)
         {
@@ -491,6 +1392,9 @@ static int ftdi_spi_init(struct morsectrl_transport *transport)
         return -ETRANSFTDISPIERR;
     }
 
+    snprintf(state->serial_num, sizeof(state->serial_num), "%.*s",
+             (int)sizeof(state->serial_num) - 1, serial_num_list[spi_chan_info.spi_loc_id_ch]);
+
     status = SPI_OpenChannel(spi_chan_info.spi_loc_id_ch, &state->handle);
     if (status != FT_OK)
     {
@@ -519,12 +1423,18 @@ static int ftdi_spi_init(struct morsectrl_transport *transport)
         return -ETRANSFTDISPIERR;
     }
 
+    state->mbox_valid = false;
+    state->sdio.stream = config->stream;
+    state->sdio.block_size_valid = false;
+    state->sdio.total_retries = 0;
+    ftdi_spi_retries_enable(transport, true);
+
     /* Set all GPIO as High Inputs except for reset pins (High Outputs). */
     FT_WriteGPIOL(state->reset_handle,
                   config->jtag_reset_pin_num | config->reset_pin_num,
                   FTDI_SPI_GPIOL_MASK);
 
-    return ETRANSSUCC;
+    return ftdi_spi_link_setup(transport);
 }
 
 /**
@@ -604,6 +1514,72 @@ static struct morsectrl_transport_buff *ftdi_spi_read_alloc(
     return ftdi_spi_alloc(transport, size);
 }
 
+/**
+ * @brief Forget the cached command and response mailbox addresses.
+ *
+ * @note These only change when firmware is (re)loaded or the chip is reset, so they are cached
+ *       between commands and must be invalidated whenever that may have happened.
+ *
+ * @param transport The transport structure.
+ */
+static void ftdi_spi_mbox_invalidate(struct morsectrl_transport *transport)
+{
+    transport->state.ftdi_spi.mbox_valid = false;
+}
+
+/**
+ * @brief Locate the command and response mailboxes, using the cached addresses if valid.
+ *
+ * @param transport The transport structure.
+ * @return          0 on success otherwise relevant error.
+ */
+static int ftdi_spi_get_mbox(struct morsectrl_transport *transport)
+{
+    struct morsectrl_ftdi_spi_state *state = &transport->state.ftdi_spi;
+    uint32_t host_table_ptr;
+    uint32_t cmd_addr;
+    uint32_t resp_addr;
+    int ret;
+
+    if (state->mbox_valid)
+        return ETRANSSUCC;
+
+    ret = sdio_over_spi_read_reg_32bit(transport, MM_MANIFEST_ADDR, &host_table_ptr);
+    if (ret)
+        return ret;
+    if (transport->debug)
+        mctrl_print("\nHost table ptr: 0x%08x\n\n", host_table_ptr);
+
+    ret = sdio_over_spi_read_reg_32bit(transport, host_table_ptr + MM_CMD_ADDR_OFFSET, &cmd_addr);
+    if (ret)
+        return ret;
+    if (transport->debug)
+        mctrl_print("\nCommand addr: 0x%08x\n\n", cmd_addr);
+
+    /* For production firmware which doesn't support memcmd, the address supplied to write commands
+     * is 0.
+     */
+    if (!cmd_addr)
+    {
+        ftdi_spi_error(transport, cmd_addr,
+                       "This transport is not supported for production firmware");
+        return -ETRANSFTDISPIERR;
+    }
+
+    ret = sdio_over_spi_read_reg_32bit(transport, host_table_ptr + MM_RESP_ADDR_OFFSET,
+                                       &resp_addr);
+    if (ret)
+        return ret;
+    if (transport->debug)
+        mctrl_print("\nResponse addr: 0x%08x\n\n", resp_addr);
+
+    state->cmd_addr = cmd_addr;
+    state->resp_addr = resp_addr;
+    state->mbox_valid = true;
+
+    return ETRANSSUCC;
+}
+
 /**
  * @brief Read a 32bit register.
  *
@@ -617,6 +1593,11 @@ static struct morsectrl_transport_buff *ftdi_spi_read_alloc(
 static int ftdi_spi_reg_read(struct morsectrl_transport *transport,
                              uint32_t addr, uint32_t *value)
 {
+    int ret = ftdi_spi_usb_select(transport, false);
+
+    if (ret)
+        return ret;
+
     return sdio_over_spi_read_reg_32bit(transport, addr, value);
 }
 
@@ -633,9 +1614,57 @@ static int ftdi_spi_reg_read(struct morsectrl_transport *transport,
 static int ftdi_spi_reg_write(struct morsectrl_transport *transport,
                               uint32_t addr, uint32_t value)
 {
+    int ret = ftdi_spi_usb_select(transport, false);
+
+    if (ret)
+        return ret;
+
+    /* A direct register write may reboot the chip (e.g. soft reset), so forget the mailbox. */
+    ftdi_spi_mbox_invalidate(transport);
+
     return sdio_over_spi_write_reg_32bit(transport, addr, value);
 }
 
+/**
+ * @brief Read several 32bit registers in a single SPI transfer.
+ *
+ * @param transport The transport structure.
+ * @param regs      Registers to read, the value of each entry is filled in.
+ * @param count     Number of entries in @p regs.
+ * @return          0 on success otherwise relevant error.
+ */
+static int ftdi_spi_reg_read_many(struct morsectrl_transport *transport,
+                                  struct morsectrl_transport_reg *regs, size_t count)
+{
+    int ret = ftdi_spi_usb_select(transport, false);
+
+    if (ret)
+        return ret;
+
+    return sdio_over_spi_read_regs(transport, regs, count);
+}
+
+/**
+ * @brief Write several 32bit registers in a single SPI transfer.
+ *
+ * @param transport The transport structure.
+ * @param regs      Registers and the values to write, written in order.
+ * @param count     Number of entries in @p regs.
+ * @return          0 on success otherwise relevant error.
+ */
+static int ftdi_spi_reg_write_many(struct morsectrl_transport *transport,
+                                   struct morsectrl_transport_reg *regs, size_t count)
+{
+    int ret = ftdi_spi_usb_select(transport, false);
+
+    if (ret)
+        return ret;
+
+    ftdi_spi_mbox_invalidate(transport);
+
+    return sdio_over_spi_write_regs(transport, regs, count);
+}
+
 /**
  * @brief Read a block of memory.
  *
@@ -650,6 +1679,11 @@ static int ftdi_spi_mem_read(struct morsectrl_transport *transport,
                              struct morsectrl_transport_buff *read,
                              uint32_t addr)
 {
+    int ret = ftdi_spi_usb_select(transport, read->data_len >= FTDI_SPI_USB_BULK_THRESHOLD);
+
+    if (ret)
+        return ret;
+
     return sdio_over_spi_read_memblock(transport, read, addr);
 }
 
@@ -667,6 +1701,14 @@ static int ftdi_spi_mem_write(struct morsectrl_transport *transport,
                               struct morsectrl_transport_buff *write,
                               uint32_t addr)
 {
+    int ret = ftdi_spi_usb_select(transport, write->data_len >= FTDI_SPI_USB_BULK_THRESHOLD);
+
+    if (ret)
+        return ret;
+
+    /* Direct memory writes are used to load firmware, which moves the mailbox. */
+    ftdi_spi_mbox_invalidate(transport);
+
     return sdio_over_spi_write_memblock(transport, write, addr);
 }
 
@@ -861,60 +1903,32 @@ static int ftdi_spi_send(struct morsectrl_transport *transport,
                          struct morsectrl_transport_buff *cmd,
                          struct morsectrl_transport_buff *resp)
 {
-    const struct morsectrl_transport_ops *tops = transport->tops;
+    struct morsectrl_ftdi_spi_state *state;
     struct response *response;
-    uint32_t host_table_ptr;
-    uint32_t cmd_addr;
-    uint32_t resp_addr;
     uint32_t status;
     int ii;
     int ret;
 
-    if (!transport || !transport->tops ||
-        !transport->tops->reg_read || !transport->tops->reg_write ||
-        !transport->tops->mem_read || !transport->tops->mem_write ||
-        !cmd || !resp)
+    if (!transport || !cmd || !resp)
     {
         return -ETRANSFTDISPIERR;
     }
 
-    /* Locate command and response memory locations. */
-    ret = tops->reg_read(transport, MM_MANIFEST_ADDR, &host_table_ptr);
-    if (ret)
-        goto fail;
-    if (transport->debug)
-        mctrl_print("\nHost table ptr: 0x%08x\n\n", host_table_ptr);
+    state = &transport->state.ftdi_spi;
 
-    ret = tops->reg_read(transport, host_table_ptr + MM_CMD_ADDR_OFFSET, &cmd_addr);
-    /* For production firmware which doesn't support memcmd, the address supplied to write commands
-     * is 0.
-     */
+    ret = ftdi_spi_usb_select(transport, false);
     if (ret)
-    {
         goto fail;
-    }
-    if (transport->debug)
-    {
-        mctrl_print("\nCommand addr: 0x%08x\n\n", cmd_addr);
-    }
-    if (!cmd_addr)
-    {
-        ftdi_spi_error(transport, cmd_addr,
-                       "This transport is not supported for production firmware");
-        return -ETRANSFTDISPIERR;
-    }
 
-    ret = tops->reg_read(transport, host_table_ptr + MM_RESP_ADDR_OFFSET, &resp_addr);
+    /* Locate command and response memory locations. */
+    ret = ftdi_spi_get_mbox(transport);
     if (ret)
     {
         goto fail;
     }
-    if (transport->debug)
-    {
-        mctrl_print("\nResponse addr: 0x%08x\n\n", resp_addr);
-    }
 
-    ret = tops->reg_write(transport, MM_STATUS_CLR_ADDR, MM_CMD_MASK);
+    /* The mailbox writes below go straight to SDIO so they don't invalidate the cache. */
+    ret = sdio_over_spi_write_reg_32bit(transport, MM_STATUS_CLR_ADDR, MM_CMD_MASK);
     if (ret)
     {
         goto fail;
@@ -924,7 +1938,7 @@ static int ftdi_spi_send(struct morsectrl_transport *transport,
         mctrl_print("\nCleared status\n\n");
     }
 
-    ret = tops->mem_write(transport, cmd, cmd_addr);
+    ret = sdio_over_spi_write_memblock(transport, cmd, state->cmd_addr);
     if (ret)
     {
         goto fail;
@@ -934,7 +1948,7 @@ static int ftdi_spi_send(struct morsectrl_transport *transport,
         mctrl_print("\nWrote command\n\n");
     }
 
-    ret = tops->reg_write(transport, MM_TRIGGER_ADDR, MM_CMD_MASK);
+    ret = sdio_over_spi_write_reg_32bit(transport, MM_TRIGGER_ADDR, MM_CMD_MASK);
     if (ret)
     {
         goto fail;
@@ -947,7 +1961,7 @@ static int ftdi_spi_send(struct morsectrl_transport *transport,
     /* Poll for reponse. */
     for (ii = 0; ii < RESP_TIMEOUT_MS; ii += RESP_POLL_INTERVAL_MS)
     {
-        ret = tops->reg_read(transport, MM_STATUS_ADDR, &status);
+        ret = sdio_over_spi_read_reg_32bit(transport, MM_STATUS_ADDR, &status);
         if (ret)
             goto fail;
 
@@ -963,11 +1977,12 @@ static int ftdi_spi_send(struct morsectrl_transport *transport,
 
     if (ii >= RESP_TIMEOUT_MS)
     {
+        ret = -ETRANSFTDISPIERR;
         goto fail;
     }
 
     /* Read in response. */
-    ret = tops->mem_read(transport, resp, resp_addr);
+    ret = sdio_over_spi_read_memblock(transport, resp, state->resp_addr);
     if (ret)
     {
         goto fail;
@@ -978,19 +1993,24 @@ static int ftdi_spi_send(struct morsectrl_transport *transport,
     }
 
     /* Clear status. */
-    tops->reg_write(transport, MM_STATUS_CLR_ADDR, MM_CMD_MASK);
+    sdio_over_spi_write_reg_32bit(transport, MM_STATUS_CLR_ADDR, MM_CMD_MASK);
     if (transport->debug)
     {
         mctrl_print("\nCleared status\n\n");
     }
 
-    /* Trim response length (required for variable length responses). */
+    /*
+     * Trim response length (required for variable length responses). The header is included, as
+     * it is in responses over nl80211.
+     */
     response = (struct response *)resp->data;
-    resp->data_len = response->hdr.len - sizeof(response->status);
+    resp->data_len = MIN(resp->data_len, sizeof(response->hdr) + le16toh(response->hdr.len));
 
     return ETRANSSUCC;
 
 fail:
+    /* The firmware may have been reloaded or crashed, rediscover the mailbox next time. */
+    ftdi_spi_mbox_invalidate(transport);
     ftdi_spi_error(transport, ret, "Failed to send command");
     return ret;
 }
@@ -1008,6 +2028,8 @@ static int ftdi_spi_reset(struct morsectrl_transport *transport)
     UCHAR dir;
     int ret;
 
+    ftdi_spi_mbox_invalidate(transport);
+
     status = SPI_GetChannelConfig(state->reset_handle, &channel_cfg);
     if (status != FT_OK)
     {
@@ -1063,9 +2085,24 @@ static int ftdi_spi_reset(struct morsectrl_transport *transport)
     /* Use this to send the CMD63 to enter SPI mode. */
     ret = sdio_over_spi_post_hard_reset(transport);
 
+    /* No firmware runs until it is loaded again, so any training left from init can be done. */
+    if (!ret)
+        ret = ftdi_spi_link_setup(transport);
+
     return ret;
 }
 
+/**
+ * @brief Get the number of CMD53 retries the last memory transfer needed.
+ *
+ * @param transport The transport structure.
+ * @return          Number of retries.
+ */
+static uint32_t ftdi_spi_mem_retries(struct morsectrl_transport *transport)
+{
+    return transport->state.ftdi_spi.sdio.xfer_retries;
+}
+
 const struct morsectrl_transport_ops ftdi_spi_ops = {
     .parse = ftdi_spi_parse,
     .init = ftdi_spi_init,
@@ -1073,12 +2110,17 @@ const struct morsectrl_transport_ops ftdi_spi_ops = {
     .write_alloc = ftdi_spi_write_alloc,
     .read_alloc = ftdi_spi_read_alloc,
     .send = ftdi_spi_send,
+    .send_many = NULL,
     .reg_read = ftdi_spi_reg_read,
     .reg_write = ftdi_spi_reg_write,
+    .reg_read_many = ftdi_spi_reg_read_many,
+    .reg_write_many = ftdi_spi_reg_write_many,
     .mem_read = ftdi_spi_mem_read,
     .mem_write = ftdi_spi_mem_write,
     .raw_read = ftdi_spi_raw_read,
     .raw_write = ftdi_spi_raw_write,
     .raw_read_write = ftdi_spi_raw_read_write,
     .reset_device = ftdi_spi_reset,
+    .link_train = ftdi_spi_link_train,
+    .mem_retries = ftdi_spi_mem_retries,
 };
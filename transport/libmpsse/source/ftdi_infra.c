@@ -232,7 +232,12 @@ FTDIMPSSE_API void Init_libMPSSE(void)
 
 /* Load D2XX dynamic library */
 #ifndef _WIN32
+#ifdef ENABLE_FTDI_SIM
+	/* D2XX API is provided by the simulator linked into the executable */
+	hdll_d2xx = dlopen(NULL, RTLD_LAZY);
+#else
 	hdll_d2xx = dlopen("libftd2xx.so", RTLD_LAZY);
+#endif
 	if (!hdll_d2xx)
 	{
 		fprintf(stderr, "dlopen failed: %s\n", dlerror());
@@ -391,12 +391,17 @@ const struct morsectrl_transport_ops nl80211_ops = {
     .write_alloc = morsectrl_nl80211_write_alloc,
     .read_alloc = morsectrl_nl80211_read_alloc,
     .send = morsectrl_nl80211_send,
+    .send_many = NULL,
     .reg_read = NULL,
     .reg_write = NULL,
+    .reg_read_many = NULL,
+    .reg_write_many = NULL,
     .mem_read = NULL,
     .mem_write = NULL,
     .raw_read = NULL,
     .raw_write = NULL,
     .raw_read_write = NULL,
     .reset_device = NULL,
+    .link_train = NULL,
+    .mem_retries = NULL,
 };
@@ -7,6 +7,7 @@
 #include <stdbool.h>
 #include <string.h>
 #include <stdio.h>
+#include <pthread.h>
 
 #include "../utilities.h"
 #include "transport.h"
@@ -27,6 +28,7 @@
 
 #define SDIO_CMD_HDR_EXTRA_LEN          (13)
 #define SDIO_CMD_HDR_LEN                (7)
+#define SDIO_CMD52_LEN                  (SDIO_CMD_HDR_LEN + SDIO_CMD_HDR_EXTRA_LEN)
 
 #define SDIO_KEYHOLE_SIZE               (2)
 
@@ -50,6 +52,9 @@
 
 #define SDIO_CMD53_ADDR_MASK            (0xFFFF)
 #define SDIO_CMD53_RESP_SIZE            (4)
+#define SDIO_CMD53_MAX_BLOCK_COUNT      (511)
+/* A byte count of 0 encodes 512 octets. */
+#define SDIO_CMD53_MAX_BYTE_COUNT       (512)
 
 #define SDIO_STOP_BIT                   BIT(0)
 #define SDIO_DIR_BIT                    BIT(6)
@@ -94,8 +99,142 @@
 #define MM610X_REG_CHIP_ID_ADDR         (0x10054d20)
 #define MM610X_REG_HOST_MAN_PTR_ADDR    (0x10054d40)
 
+/* Function 0 (CIA) register space: FBRs and CIS. */
+#define SDIO_FUNC_CIA                   (0)
+#define SDIO_FBR_ADDR(func)             ((func) * 0x100)
+#define SDIO_FBR_CIS_PTR_OFFSET         (0x09)
+#define SDIO_FBR_CIS_PTR_LEN            (3)
+#define SDIO_FBR_BLOCK_SIZE_OFFSET      (0x10)
+#define SDIO_CIS_AREA_START             (0x1000)
+#define SDIO_CIS_AREA_END               (0x17FFF)
+#define SDIO_CIS_MAX_TUPLES             (64)
+#define SDIO_CISTPL_NULL                (0x00)
+#define SDIO_CISTPL_FUNCE               (0x22)
+#define SDIO_CISTPL_END                 (0xFF)
+#define SDIO_CISTPL_FUNCE_TYPE_FUNC     (0x01)
+#define SDIO_CISTPL_FUNCE_MAX_BLK_SIZE  (0x0C)
+#define SDIO_MAX_BLOCK_SIZE             (2048)
+
+/* Number of transactions that can be in flight (framed, on the bus or being verified). */
+#define SDIO_STREAM_RING_SIZE           (3)
+/* Octets per streamed CMD53, small enough that a single 64k window is still pipelined. */
+#define SDIO_STREAM_CHUNK_SIZE          (16384)
+
+/* Consecutive failures of a CMD53 (without any blocks getting through) before giving up. */
+#define SDIO_CMD53_MAX_RETRIES          (4)
+/* Consecutive failures of a CMD53 before asking the transport to slow the link down. */
+#define SDIO_CMD53_STEP_DOWN_FAILURES   (2)
+/* Failed CMD53s a streaming transfer can hold for retrying once the stream has drained. */
+#define SDIO_STREAM_MAX_FAILED          (16)
+
+/* Worst case transactions in a register burst: both keyhole windows change for every register. */
+#define SDIO_BURST_MAX_OPS(count)       ((3 * (count)) + 1)
+
 static uint32_t fn_max_block_size[] = { 4, 8, 512 };
 
+/** Layout and buffers of a single framed CMD53 transaction. */
+struct sdio_over_spi_cmd53_xfer
+{
+    /** Complete transaction sent on the bus (CMD, data tokens, data, CRCs and delays). */
+    struct morsectrl_transport_buff *full_trans;
+    /** Octets clocked in during the transaction. */
+    struct morsectrl_transport_buff *resp;
+    /** Caller data to write from or read into. */
+    uint8_t *data;
+    bool write;
+    uint8_t func;
+    bool block_mode;
+    uint32_t addr;
+    /** Number of blocks in block mode, otherwise number of octets. */
+    uint16_t count;
+    uint32_t block_size;
+    uint16_t post_block_delay_bytes;
+    size_t total_block_size;
+    uint16_t loop_count;
+    /** Offset of the first data block (or its token) in the transaction. */
+    size_t offset;
+    size_t full_trans_size;
+    /** Leading blocks that were acknowledged or passed their CRC check, set when parsing. */
+    uint16_t blocks_done;
+};
+
+/** A single CMD53 of a memory transfer, as split up by sdio_over_spi_memblock_split(). */
+struct sdio_over_spi_cmd53_op
+{
+    /** Data to write from or read into. */
+    uint8_t *data;
+    bool write;
+    bool block_mode;
+    uint32_t addr;
+    /** Number of blocks in block mode, otherwise number of octets (word aligned). */
+    uint16_t count;
+    /** Whether the keyhole registers must be set first (first CMD53 of a 64k window). */
+    bool set_keyhole;
+};
+
+/** A transaction of a register burst, at an offset into a single SPI transfer. */
+struct sdio_over_spi_burst_op
+{
+    /** Whether this is a CMD53 register access, otherwise it is a keyhole CMD52 write. */
+    bool cmd53;
+    size_t offset;
+    /** Keyhole register and value for a CMD52. */
+    uint32_t addr;
+    uint8_t value;
+    /** Register access for a CMD53, framed into the views of the burst buffers. */
+    struct sdio_over_spi_cmd53_xfer xfer;
+    struct morsectrl_transport_buff tx_view;
+    struct morsectrl_transport_buff rx_view;
+};
+
+/** Performs or queues a CMD53 of a memory transfer. */
+typedef int (*sdio_over_spi_cmd53_op_fn)(struct morsectrl_transport *transport, void *ctx,
+                                         const struct sdio_over_spi_cmd53_op *op);
+
+/** A slot in the ring of transactions used for streaming transfers. */
+struct sdio_over_spi_stream_slot
+{
+    struct sdio_over_spi_cmd53_xfer xfer;
+    /** Whether the keyhole registers must be set before sending (first chunk of a window). */
+    bool set_keyhole;
+    /** Result of the bus transfer. */
+    int ret;
+};
+
+/** A CMD53 of a streaming transfer that failed, retried once the stream has drained. */
+struct sdio_over_spi_stream_failed
+{
+    struct sdio_over_spi_cmd53_op op;
+    /** Leading blocks of the CMD53 that got through. */
+    uint16_t blocks_done;
+};
+
+/**
+ * Streaming transfer state. Slots are framed, transferred and verified in order; the counters are
+ * free running and index the ring modulo @ref SDIO_STREAM_RING_SIZE.
+ */
+struct sdio_over_spi_stream
+{
+    struct morsectrl_transport *transport;
+    struct sdio_over_spi_stream_slot slots[SDIO_STREAM_RING_SIZE];
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    /** Slots handed to the bus thread. */
+    unsigned int framed;
+    /** Slots the bus thread has finished with. */
+    unsigned int transferred;
+    /** Slots checked and free for reuse. */
+    unsigned int verified;
+    /** No more slots will be framed. */
+    bool done;
+    /** An error occurred, skip any remaining transfers. */
+    bool abort;
+    /** CMD53s that failed verification, to be retried. */
+    struct sdio_over_spi_stream_failed failed[SDIO_STREAM_MAX_FAILED];
+    unsigned int num_failed;
+};
+
 /**
  * @brief Prints an error message if possible.
  *
@@ -112,6 +251,18 @@ static int sdio_over_spi_error(struct morsectrl_transport *transport,
     return 0;
 }
 
+/**
+ * @brief Get the SDIO over SPI state of a transport.
+ *
+ * @param transport The transport structure.
+ * @return          Pointer to the state.
+ */
+static struct morsectrl_sdio_over_spi_state *sdio_over_spi_get_state(
+    struct morsectrl_transport *transport)
+{
+    return &transport->state.ftdi_spi.sdio;
+}
+
 /**
  * @brief Allocate a memory buffer for an SDIO over SPI command.
  *
@@ -188,13 +339,10 @@ static uint8_t sdio_over_spi_calc_cmd_crc_octet(uint8_t *data)
 static uint8_t *sdio_over_spi_cmd_find_resp(struct morsectrl_transport *transport,
                                             uint8_t *data, uint32_t size)
 {
-    uint32_t ii;
+    uint32_t ii = mem_find_not(data, size - 1, SDIO_JUNK_TOKEN, SDIO_CMD_RESP_EARLY_TRANS);
 
-    for (ii = 0; ii < (size - 1); ii++)
+    if (ii < (size - 1))
     {
-        if ((data[ii] == SDIO_JUNK_TOKEN) || (data[ii] == SDIO_CMD_RESP_EARLY_TRANS))
-            continue;
-
         /* If we find the token return the start of the data. */
         if ((data[ii] & SDIO_CMD_RESP_TOKEN_MASK) == SDIO_CMD_RESP_TOKEN_SUCC)
         {
@@ -331,6 +479,84 @@ exit:
  * Data is included in the command (8-bit value).
  */
 
+/**
+ * @brief Frame an SDIO CMD52.
+ *
+ * @param transport The transport structure.
+ * @param frame     Where to frame the command, @ref SDIO_CMD52_LEN octets.
+ * @param write     Whether this command is a write (otherwise it is a read).
+ * @param func      The function to perform the CMD52 on.
+ * @param addr      The address to write to or read from.
+ * @param data      The value to write (ignored for reads).
+ */
+static void sdio_over_spi_cmd52_frame(struct morsectrl_transport *transport,
+                                      uint8_t *frame,
+                                      bool write,
+                                      uint8_t func,
+                                      uint32_t addr,
+                                      uint8_t data)
+{
+    sdio_over_spi_prep_cmd(52, frame);
+    frame[2] = (func << SDIO_FUNC_OFFSET);
+    frame[2] |= (addr >> SDIO_ADDR2_OFFSET);
+    frame[3] = (addr >> SDIO_ADDR1_OFFSET);
+    frame[4] = (addr << SDIO_ADDR0_OFFSET);
+    frame[5] = data;
+
+    if (write)
+    {
+        if (transport->debug)
+            mctrl_print("CMD52 Write 0x%02x to 0x%08x\n", data, addr);
+
+        frame[2] |= SDIO_RW_BIT;
+    }
+    else
+    {
+        if (transport->debug)
+            mctrl_print("CMD52 Read from 0x%08x\n", addr);
+    }
+
+    frame[6] = sdio_over_spi_calc_cmd_crc_octet(&frame[1]);
+    memset(&frame[SDIO_CMD_HDR_LEN], SDIO_JUNK_TOKEN, SDIO_CMD_HDR_EXTRA_LEN);
+}
+
+/**
+ * @brief Check the response to an SDIO CMD52.
+ *
+ * @param transport The transport structure.
+ * @param resp      Octets received while the command was sent, @ref SDIO_CMD52_LEN octets.
+ * @param write     Whether the command was a write (otherwise it was a read).
+ * @param data      Filled with the value read (unused for writes).
+ * @return          0 on success otherwise relevant error.
+ */
+static int sdio_over_spi_cmd52_parse(struct morsectrl_transport *transport,
+                                     uint8_t *resp,
+                                     bool write,
+                                     uint8_t *data)
+{
+    uint8_t *r5 = &resp[SDIO_CMD_HDR_LEN];
+
+    if (!sdio_over_spi_cmd_find_resp(transport, r5, SDIO_CMD_HDR_EXTRA_LEN))
+    {
+        sdio_over_spi_error(transport, -ETRANSERR, "Failed to find CMD52 response");
+        return -ETRANSERR;
+    }
+
+    if (!write)
+    {
+        size_t ii = mem_find_not(r5, SDIO_CMD_HDR_EXTRA_LEN - 1,
+                                 SDIO_JUNK_TOKEN, SDIO_CMD_RESP_EARLY_TRANS);
+
+        /* The R5 response is a status octet (already checked above) followed by the data. */
+        *data = r5[ii + 1];
+
+        if (transport->debug)
+            mctrl_print("CMD52 Read 0x%02x\n", *data);
+    }
+
+    return ETRANSSUCC;
+}
+
 /**
  * @brief Send an SDIO CMD52. This allows reading and writing of an 8-bit data value in the SDIO
  *        memory space (17-bit). If the upper address bit is set then the read/write is from/to a
@@ -352,7 +578,7 @@ static int sdio_over_spi_cmd52(struct morsectrl_transport *transport,
     int ret = ETRANSSUCC;
     struct morsectrl_transport_buff *cmd_buff = sdio_over_spi_alloc_cmd(transport, 52);
     struct morsectrl_transport_buff *resp_buff =
-        transport->tops->read_alloc(transport, cmd_buff->data_len);
+        transport->tops->read_alloc(transport, SDIO_CMD52_LEN);
 
     if (!cmd_buff || !resp_buff)
     {
@@ -360,48 +586,196 @@ static int sdio_over_spi_cmd52(struct morsectrl_transport *transport,
         goto exit;
     }
 
-    sdio_over_spi_prep_cmd(52, cmd_buff->data);
-    cmd_buff->data[2] = (func << SDIO_FUNC_OFFSET);
-    cmd_buff->data[2] |= (addr >> SDIO_ADDR2_OFFSET);
-    cmd_buff->data[3] = (addr >> SDIO_ADDR1_OFFSET);
-    cmd_buff->data[4] = (addr << SDIO_ADDR0_OFFSET);
-    cmd_buff->data[5] = *data;
+    sdio_over_spi_cmd52_frame(transport, cmd_buff->data, write, func, addr, *data);
 
-    if (write)
+    ret = transport->tops->raw_read_write(transport, resp_buff, cmd_buff, true, true);
+    if (ret)
     {
-        if (transport->debug)
-            mctrl_print("CMD52 Write 0x%02x to 0x%08x\n", *data, addr);
+        sdio_over_spi_error(transport, ret, "Failed to perform CMD52 transaction");
+        goto exit;
+    }
+
+    ret = sdio_over_spi_cmd52_parse(transport, resp_buff->data, write, data);
+
+exit:
+    morsectrl_transport_buff_free(cmd_buff);
+    morsectrl_transport_buff_free(resp_buff);
+    return ret;
+}
+
+/**
+ * @brief Get the block size to use for CMD53 block mode transfers on a function.
+ *
+ * @param transport The transport structure.
+ * @param func      The function.
+ * @return          Block size in octets.
+ */
+static uint32_t sdio_over_spi_fn_block_size(struct morsectrl_transport *transport, uint8_t func)
+{
+    struct morsectrl_sdio_over_spi_state *state = sdio_over_spi_get_state(transport);
+
+    if ((func == SDIO_FUNC_MEM_BLOCK) && state->block_size_valid)
+        return state->mem_block_size;
+
+    return fn_max_block_size[func];
+}
+
+/**
+ * @brief Read the maximum block size of a function from its CIS function extension tuple.
+ *
+ * @param transport     The transport structure.
+ * @param func          The function.
+ * @param max_size      Filled with the maximum block size.
+ * @return              0 on success otherwise relevant error.
+ */
+static int sdio_over_spi_read_max_block_size(struct morsectrl_transport *transport,
+                                             uint8_t func, uint32_t *max_size)
+{
+    uint32_t cis_ptr = 0;
+    uint8_t code;
+    uint8_t link;
+    uint8_t lo;
+    uint8_t hi;
+    uint8_t type;
+    int ii;
+    int ret;
 
-        cmd_buff->data[2] |= SDIO_RW_BIT;
+    for (ii = 0; ii < SDIO_FBR_CIS_PTR_LEN; ii++)
+    {
+        uint8_t octet = 0;
+
+        ret = sdio_over_spi_cmd52(transport, false, SDIO_FUNC_CIA,
+                                  SDIO_FBR_ADDR(func) + SDIO_FBR_CIS_PTR_OFFSET + ii, &octet);
+        if (ret)
+            return ret;
+
+        cis_ptr |= octet << (8 * ii);
     }
-    else
+
+    /* Walk the tuple chain looking for the function extension. */
+    for (ii = 0; ii < SDIO_CIS_MAX_TUPLES; ii++)
     {
-        if (transport->debug)
-            mctrl_print("CMD52 Read from 0x%08x\n", addr);
+        if ((cis_ptr < SDIO_CIS_AREA_START) || (cis_ptr > SDIO_CIS_AREA_END))
+            break;
+
+        ret = sdio_over_spi_cmd52(transport, false, SDIO_FUNC_CIA, cis_ptr, &code);
+        if (ret)
+            return ret;
+
+        if (code == SDIO_CISTPL_END)
+            break;
+
+        if (code == SDIO_CISTPL_NULL)
+        {
+            cis_ptr++;
+            continue;
+        }
+
+        ret = sdio_over_spi_cmd52(transport, false, SDIO_FUNC_CIA, cis_ptr + 1, &link);
+        if (ret)
+            return ret;
+
+        if ((code == SDIO_CISTPL_FUNCE) && (link > SDIO_CISTPL_FUNCE_MAX_BLK_SIZE + 1))
+        {
+            ret = sdio_over_spi_cmd52(transport, false, SDIO_FUNC_CIA, cis_ptr + 2, &type);
+            if (ret)
+                return ret;
+
+            if (type == SDIO_CISTPL_FUNCE_TYPE_FUNC)
+            {
+                ret = sdio_over_spi_cmd52(transport, false, SDIO_FUNC_CIA,
+                                          cis_ptr + 2 + SDIO_CISTPL_FUNCE_MAX_BLK_SIZE, &lo);
+                if (!ret)
+                    ret = sdio_over_spi_cmd52(transport, false, SDIO_FUNC_CIA,
+                                              cis_ptr + 3 + SDIO_CISTPL_FUNCE_MAX_BLK_SIZE, &hi);
+                if (ret)
+                    return ret;
+
+                *max_size = lo | (hi << 8);
+                return ETRANSSUCC;
+            }
+        }
+
+        if (link == SDIO_CISTPL_END)
+            break;
+
+        cis_ptr += 2 + link;
     }
 
-    cmd_buff->data[6] = sdio_over_spi_calc_cmd_crc_octet(&cmd_buff->data[1]);
-    memset(&cmd_buff->data[SDIO_CMD_HDR_LEN], SDIO_JUNK_TOKEN, SDIO_CMD_HDR_EXTRA_LEN);
+    return -ETRANSERR;
+}
 
-    ret = transport->tops->raw_read_write(transport, resp_buff, cmd_buff, true, true);
+/**
+ * @brief Write the block size register of a function and read it back.
+ *
+ * @param transport     The transport structure.
+ * @param func          The function.
+ * @param block_size    The block size to program.
+ * @return              0 if the chip accepted the block size otherwise relevant error.
+ */
+static int sdio_over_spi_set_block_size(struct morsectrl_transport *transport,
+                                        uint8_t func, uint32_t block_size)
+{
+    uint32_t addr = SDIO_FBR_ADDR(func) + SDIO_FBR_BLOCK_SIZE_OFFSET;
+    uint8_t lo = block_size & 0xFF;
+    uint8_t hi = (block_size >> 8) & 0xFF;
+    int ret;
+
+    ret = sdio_over_spi_cmd52(transport, true, SDIO_FUNC_CIA, addr, &lo);
+    if (!ret)
+        ret = sdio_over_spi_cmd52(transport, true, SDIO_FUNC_CIA, addr + 1, &hi);
+    if (!ret)
+        ret = sdio_over_spi_cmd52(transport, false, SDIO_FUNC_CIA, addr, &lo);
+    if (!ret)
+        ret = sdio_over_spi_cmd52(transport, false, SDIO_FUNC_CIA, addr + 1, &hi);
     if (ret)
+        return ret;
+
+    if ((lo | (hi << 8)) != block_size)
+        return -ETRANSERR;
+
+    return ETRANSSUCC;
+}
+
+/**
+ * @brief Negotiate the largest block size the memory function supports. Fewer, larger blocks
+ *        carry less token, CRC and interblock padding overhead per octet.
+ *
+ * @note Falls back to the default block size if the chip doesn't advertise or accept a larger one.
+ *
+ * @param transport The transport structure.
+ */
+static void sdio_over_spi_negotiate_block_size(struct morsectrl_transport *transport)
+{
+    struct morsectrl_sdio_over_spi_state *state = sdio_over_spi_get_state(transport);
+    uint32_t default_size = fn_max_block_size[SDIO_FUNC_MEM_BLOCK];
+    uint32_t max_size = default_size;
+
+    /* Don't retry on every transfer if anything below fails. */
+    state->block_size_valid = true;
+    state->mem_block_size = default_size;
+
+    if (sdio_over_spi_read_max_block_size(transport, SDIO_FUNC_MEM_BLOCK, &max_size))
     {
-        sdio_over_spi_error(transport, ret, "Failed to perform CMD52 transaction");
-        goto exit;
+        if (transport->debug)
+            mctrl_print("No max block size advertised, using %u\n", default_size);
+        return;
     }
 
-    if (!sdio_over_spi_cmd_find_resp(transport,
-                                     &resp_buff->data[SDIO_CMD_HDR_LEN],
-                                     SDIO_CMD_HDR_EXTRA_LEN))
+    /* Keep blocks word aligned. */
+    max_size = MIN(max_size, SDIO_MAX_BLOCK_SIZE) & ~(sizeof(uint32_t) - 1);
+    if (!max_size)
+        return;
+
+    if (sdio_over_spi_set_block_size(transport, SDIO_FUNC_MEM_BLOCK, max_size))
     {
-        ret = -ETRANSERR;
-        sdio_over_spi_error(transport, ret, "Failed to find CMD52 response");
+        sdio_over_spi_set_block_size(transport, SDIO_FUNC_MEM_BLOCK, default_size);
+        return;
     }
 
-exit:
-    morsectrl_transport_buff_free(cmd_buff);
-    morsectrl_transport_buff_free(resp_buff);
-    return ret;
+    state->mem_block_size = max_size;
+    if (transport->debug)
+        mctrl_print("Function %d block size %u\n", SDIO_FUNC_MEM_BLOCK, max_size);
 }
 
 /*
@@ -433,13 +807,10 @@ exit:
 static uint8_t *sdio_over_spi_cmd53_find_token(struct morsectrl_transport *transport,
                                                uint8_t *data, uint32_t size)
 {
-    uint32_t ii;
+    uint32_t ii = mem_find_not(data, size - 1, SDIO_JUNK_TOKEN, SDIO_JUNK_TOKEN);
 
-    for (ii = 0; ii < (size - 1); ii++)
+    if (ii < (size - 1))
     {
-        if (data[ii] == SDIO_JUNK_TOKEN)
-            continue;
-
         /* If we find the token return the start of the data. */
         if ((data[ii] == SDIO_MULTI_BLOCK_START_TOKEN) || (data[ii] == SDIO_SINGLE_START_TOKEN))
             return &data[ii + 1];
@@ -464,15 +835,10 @@ static uint8_t *sdio_over_spi_cmd53_find_token(struct morsectrl_transport *trans
 static uint8_t *sdio_over_spi_cmd53_find_ack(struct morsectrl_transport *transport,
                                              uint8_t *data, uint32_t size)
 {
-    uint32_t ii;
+    uint32_t ii = mem_find_not(data, size - 1, SDIO_JUNK_TOKEN, SDIO_JUNK_TOKEN);
 
-    for (ii = 0; ii < (size - 1); ii++)
+    if (ii < (size - 1))
     {
-        if (data[ii] == SDIO_JUNK_TOKEN)
-        {
-            continue;
-        }
-
         /* If we find the token return the start of the data. */
         if (((data[ii] & SDIO_DATA_RESP_TOKEN_VALID_MASK) == SDIO_DATA_RESP_TOKEN_VALID) &&
             ((data[ii] & SDIO_DATA_RESP_TOKEN_MASK) == SDIO_DATA_RESP_TOKEN_ACPT))
@@ -496,122 +862,104 @@ static uint8_t *sdio_over_spi_cmd53_find_ack(struct morsectrl_transport *transpo
 }
 
 /**
- * @brief Perform an SDIO CMD53. Read/writes word aligned data from/to a 32-bit chip memory address.
+ * @brief Compute the layout of an SDIO CMD53 transaction (sizes and offsets of the framing).
  *
- * @note The upper 16-bits of the address must be set using CMD52 to write the keyhole registers
- *       first.
+ * @note The write, func, block_mode and count members of @p xfer must be set beforehand.
  *
- * @param transport     The transport structure.
- * @param data          Buffer to read data from or write data into.
- * @param write         Whether this command is a write (otherwise it is a read).
- * @param func          Function to perform the command on.
- * @param block_mode    Whether transaction uses block mode.
- * @param addr          Address to write to or read from.
- * @param count         Number of blocks in block mode, otherwise number of octets (word aligned).
- * @return              0 on success otherwise relevant error.
+ * @param transport The transport structure.
+ * @param xfer      The transaction to lay out.
  */
-static int sdio_over_spi_cmd53(struct morsectrl_transport *transport,
-                               struct morsectrl_transport_buff *data,
-                               bool write,
-                               uint8_t func,
-                               bool block_mode,
-                               uint32_t addr,
-                               uint16_t count)
+static void sdio_over_spi_cmd53_layout(struct morsectrl_transport *transport,
+                                       struct sdio_over_spi_cmd53_xfer *xfer)
 {
-    const struct morsectrl_transport_ops *tops = transport->tops;
-    struct morsectrl_transport_buff *full_trans;
-    struct morsectrl_transport_buff *resp;
-    uint8_t *cmd_hdr;
-    size_t full_trans_size;
-    uint32_t block_size = block_mode ? fn_max_block_size[func] : count;
-    uint16_t post_block_delay_bytes;
-    size_t total_block_size;
-    uint16_t loop_count = block_mode ? count : 1;
-    int ii;
-    uint8_t offset;
-    int ret;
-    uint16_t crc16;
+    xfer->block_size = xfer->block_mode ?
+                       sdio_over_spi_fn_block_size(transport, xfer->func) : xfer->count;
+    xfer->loop_count = xfer->block_mode ? xfer->count : 1;
 
     /* Constuct a complete transaction with CMD, CMD response, Read/Write. */
-    if (write)
+    if (xfer->write)
     {
-        post_block_delay_bytes =
-            block_mode ? SDIO_INTERBLOCK_DELAY_OCTETS : SDIO_POST_BYTE_DELAY_OCTETS;
-        total_block_size = SDIO_TOKEN_LEN + block_size + SDIO_CRC_OCTETS + post_block_delay_bytes;
-        if (!block_mode)
-        {
-            full_trans_size = SDIO_CMD_HDR_LEN +
-                              SDIO_CMD53_RESP_SIZE +
-                              SDIO_POST_CMD53_DELAY_OCTETS +
-                              total_block_size;
-        }
-        else
-        {
-            full_trans_size = SDIO_CMD_HDR_LEN +
-                              SDIO_CMD53_RESP_SIZE +
-                              SDIO_POST_CMD53_DELAY_OCTETS +
-                              (count * total_block_size);
-        }
+        xfer->post_block_delay_bytes =
+            xfer->block_mode ? SDIO_INTERBLOCK_DELAY_OCTETS : SDIO_POST_BYTE_DELAY_OCTETS;
+        xfer->total_block_size = SDIO_TOKEN_LEN +
+                                 xfer->block_size +
+                                 SDIO_CRC_OCTETS +
+                                 xfer->post_block_delay_bytes;
+        xfer->offset = SDIO_CMD_HDR_LEN + SDIO_CMD53_RESP_SIZE + SDIO_POST_CMD53_DELAY_OCTETS;
+        xfer->full_trans_size = xfer->offset + (xfer->loop_count * xfer->total_block_size);
     }
     else /* Read */
     {
-        if (!block_mode)
+        xfer->offset = SDIO_CMD_HDR_LEN + SDIO_CMD53_RESP_SIZE;
+        if (!xfer->block_mode)
         {
             /* Interblock delay is timing based so scale with size when less than a full block.
              * TODO optimise this value.
              */
-            post_block_delay_bytes =
+            xfer->post_block_delay_bytes =
                 SDIO_INTERBLOCK_DELAY_OCTETS;
 
-            total_block_size = SDIO_TOKEN_BYTE_READ_LEN +
-                               block_size +
-                               SDIO_CRC_READ_OCTETS +
-                               post_block_delay_bytes;
+            xfer->total_block_size = SDIO_TOKEN_BYTE_READ_LEN +
+                                     xfer->block_size +
+                                     SDIO_CRC_READ_OCTETS +
+                                     xfer->post_block_delay_bytes;
 
-            full_trans_size = SDIO_CMD_HDR_LEN + SDIO_POST_CMD53_DELAY_OCTETS + total_block_size;
+            xfer->full_trans_size = SDIO_CMD_HDR_LEN +
+                                    SDIO_POST_CMD53_DELAY_OCTETS +
+                                    xfer->total_block_size;
         }
         else
         {
-            post_block_delay_bytes = SDIO_POST_BYTE_DELAY_OCTETS;
-            total_block_size = SDIO_TOKEN_BLOCK_READ_LEN +
-                               block_size +
-                               post_block_delay_bytes;
-
-            full_trans_size = SDIO_CMD_HDR_LEN +
-                              SDIO_CMD53_RESP_SIZE +
-                              SDIO_POST_CMD53_DELAY_OCTETS +
-                              (total_block_size * count);
+            xfer->post_block_delay_bytes = SDIO_POST_BYTE_DELAY_OCTETS;
+            xfer->total_block_size = SDIO_TOKEN_BLOCK_READ_LEN +
+                                     xfer->block_size +
+                                     xfer->post_block_delay_bytes;
+
+            xfer->full_trans_size = SDIO_CMD_HDR_LEN +
+                                    SDIO_CMD53_RESP_SIZE +
+                                    SDIO_POST_CMD53_DELAY_OCTETS +
+                                    (xfer->total_block_size * xfer->count);
         }
     }
+}
+
+/**
+ * @brief Frame an SDIO CMD53 transaction (command, data tokens, data and CRCs) ready to be sent.
+ *
+ * @note The transaction must have been laid out and its buffers must be large enough to hold
+ *       full_trans_size octets.
+ *
+ * @param transport The transport structure.
+ * @param xfer      The transaction to frame.
+ */
+static void sdio_over_spi_cmd53_frame(struct morsectrl_transport *transport,
+                                      struct sdio_over_spi_cmd53_xfer *xfer)
+{
+    struct morsectrl_transport_buff *full_trans = xfer->full_trans;
+    uint8_t *cmd_hdr = full_trans->data;
+    uint32_t addr = xfer->addr;
+    uint16_t count = xfer->count;
+    uint16_t crc16;
+    int ii;
 
     if (transport->debug)
     {
-        mctrl_print("block_mode: %s\n", block_mode ? "true" : "false");
-        mctrl_print("post_block_delay_bytes: %u\n", post_block_delay_bytes);
-        mctrl_print("total_block_size: %zu\n", total_block_size);
-        mctrl_print("block_size: %u\n", block_size);
-        mctrl_print("full_trans_size: %zu\n", full_trans_size);
-        mctrl_print("loop_count: %u\n", loop_count);
+        mctrl_print("block_mode: %s\n", xfer->block_mode ? "true" : "false");
+        mctrl_print("post_block_delay_bytes: %u\n", xfer->post_block_delay_bytes);
+        mctrl_print("total_block_size: %zu\n", xfer->total_block_size);
+        mctrl_print("block_size: %u\n", xfer->block_size);
+        mctrl_print("full_trans_size: %zu\n", xfer->full_trans_size);
+        mctrl_print("loop_count: %u\n", xfer->loop_count);
     }
 
-    /* Allocate some buffers. */
-    full_trans = morsectrl_transport_raw_write_alloc(transport, full_trans_size);
-    resp = morsectrl_transport_raw_read_alloc(transport, full_trans_size);
-    if (!full_trans || !resp)
-    {
-        ret = -ETRANSERR;
-        sdio_over_spi_error(transport, ret, "CMD53 failed to allocate buffers");
-        morsectrl_transport_buff_free(full_trans);
-        morsectrl_transport_buff_free(resp);
-        return ret;
-    }
+    full_trans->data_len = xfer->full_trans_size;
+    xfer->resp->data_len = xfer->full_trans_size;
 
-    cmd_hdr = full_trans->data;
     sdio_over_spi_prep_cmd(53, cmd_hdr);
 
-    cmd_hdr[2] = (func << SDIO_FUNC_OFFSET);
-    cmd_hdr[2] |= write ? SDIO_RW_BIT : 0;
-    cmd_hdr[2] |= block_mode ? SDIO_BLOCK_BIT : 0;
+    cmd_hdr[2] = (xfer->func << SDIO_FUNC_OFFSET);
+    cmd_hdr[2] |= xfer->write ? SDIO_RW_BIT : 0;
+    cmd_hdr[2] |= xfer->block_mode ? SDIO_BLOCK_BIT : 0;
     cmd_hdr[2] |= SDIO_OP_BIT;
     cmd_hdr[2] |= ((addr & SDIO_CMD53_ADDR_MASK) >> SDIO_ADDR2_OFFSET);
     cmd_hdr[3] = ((addr & SDIO_CMD53_ADDR_MASK) >> SDIO_ADDR1_OFFSET);
@@ -620,115 +968,187 @@ static int sdio_over_spi_cmd53(struct morsectrl_transport *transport,
     cmd_hdr[5] = (uint8_t)count;
     cmd_hdr[6] = sdio_over_spi_calc_cmd_crc_octet(&cmd_hdr[1]);
 
-    if (write)
+    if (xfer->write)
     {
-        offset = SDIO_CMD_HDR_LEN + SDIO_CMD53_RESP_SIZE + SDIO_POST_CMD53_DELAY_OCTETS;
-        memset(&full_trans->data[SDIO_CMD_HDR_LEN], SDIO_JUNK_TOKEN, offset - SDIO_CMD_HDR_LEN);
+        memset(&full_trans->data[SDIO_CMD_HDR_LEN], SDIO_JUNK_TOKEN,
+               xfer->offset - SDIO_CMD_HDR_LEN);
 
-        for (ii = 0; ii < loop_count; ii++)
+        for (ii = 0; ii < xfer->loop_count; ii++)
         {
-            size_t token_offset = offset + (ii * total_block_size);
+            size_t token_offset = xfer->offset + (ii * xfer->total_block_size);
             size_t block_offset = token_offset + SDIO_TOKEN_LEN;
-            size_t crc_offset = block_offset + block_size;
+            size_t crc_offset = block_offset + xfer->block_size;
             size_t interblock_offset = crc_offset + SDIO_CRC_OCTETS;
 
             /* Write the start token. */
-            if (block_mode)
+            if (xfer->block_mode)
                 full_trans->data[token_offset] = SDIO_MULTI_BLOCK_START_TOKEN;
             else
                 full_trans->data[token_offset] = SDIO_SINGLE_START_TOKEN;
 
             /* Copy a data block. */
             memcpy(&full_trans->data[block_offset],
-                   &data->data[ii * block_size],
-                   block_size);
+                   &xfer->data[ii * xfer->block_size],
+                   xfer->block_size);
 
-            crc16 = crc16_gen(&data->data[ii * block_size], block_size);
+            crc16 = crc16_gen(&xfer->data[ii * xfer->block_size], xfer->block_size);
             full_trans->data[crc_offset] = crc16 >> 8;
             full_trans->data[crc_offset + 1] = crc16 & 0xFF;
 
             /* Copy 0xFF for interblock or post byte writing. */
             memset(&full_trans->data[interblock_offset],
                    SDIO_JUNK_TOKEN,
-                   post_block_delay_bytes);
+                   xfer->post_block_delay_bytes);
         }
     }
     else
     {
-        offset = SDIO_CMD_HDR_LEN + SDIO_CMD53_RESP_SIZE;
         memset(&full_trans->data[SDIO_CMD_HDR_LEN],
                SDIO_JUNK_TOKEN,
                full_trans->data_len - SDIO_CMD_HDR_LEN);
     }
+}
 
-    /* Send the entire command, including the data. */
-    ret = tops->raw_read_write(transport, resp, full_trans, true, true);
-    if (ret)
-    {
-        sdio_over_spi_error(transport, ret, "CMD53 Read/Write error");
-        goto exit;
-    }
+/**
+ * @brief Check the response to a completed SDIO CMD53 transaction. Write acknowledgements are
+ *        checked, read data is CRC checked and copied out to the caller's buffer.
+ *
+ * @param transport The transport structure.
+ * @param xfer      The transaction that was sent.
+ * @return          0 on success otherwise relevant error.
+ */
+static int sdio_over_spi_cmd53_parse(struct morsectrl_transport *transport,
+                                     struct sdio_over_spi_cmd53_xfer *xfer)
+{
+    struct morsectrl_transport_buff *resp = xfer->resp;
+    uint32_t block_size = xfer->block_size;
+    uint8_t *ptr = &resp->data[xfer->offset];
+    int ii;
+
+    xfer->blocks_done = 0;
 
     /* Check for command success. */
     if (!sdio_over_spi_cmd_find_resp(transport,
                                      &resp->data[SDIO_CMD_HDR_LEN],
                                      SDIO_CMD53_RESP_SIZE))
     {
-        ret = -ETRANSERR;
-        sdio_over_spi_error(transport, ret, "CMD53 Error");
-        goto exit;
+        sdio_over_spi_error(transport, -ETRANSERR, "CMD53 Error");
+        return -ETRANSERR;
     }
 
     /* Process write acks. */
-    if (write)
+    if (xfer->write)
     {
-        uint8_t *ptr = &resp->data[offset];
-
-        for (ii = 0; ii < loop_count; ii++)
+        for (ii = 0; ii < xfer->loop_count; ii++)
         {
-            size_t start_idx = ii * total_block_size;
+            size_t start_idx = ii * xfer->total_block_size;
             uint8_t *ack;
 
-            ack = sdio_over_spi_cmd53_find_ack(transport, &ptr[start_idx], total_block_size);
+            ack = sdio_over_spi_cmd53_find_ack(transport, &ptr[start_idx],
+                                               xfer->total_block_size);
             if (!ack)
             {
-                ret = -ETRANSERR;
-                sdio_over_spi_error(transport, ret, "CMD53 Write block ack error");
-                goto exit;
+                sdio_over_spi_error(transport, -ETRANSERR, "CMD53 Write block ack error");
+                return -ETRANSERR;
             }
+            xfer->blocks_done++;
         }
     }
     /* Process read. */
     else
     {
-        uint8_t *ptr = &resp->data[offset];
-
-        for (ii = 0; ii < loop_count; ii++)
+        for (ii = 0; ii < xfer->loop_count; ii++)
         {
-            ptr = sdio_over_spi_cmd53_find_token(transport, ptr, post_block_delay_bytes);
+            ptr = sdio_over_spi_cmd53_find_token(transport, ptr, xfer->post_block_delay_bytes);
 
             if (!ptr)
             {
-                ret = -ETRANSERR;
-                sdio_over_spi_error(transport, ret, "CMD53 Read start token missing.");
-                goto exit;
+                sdio_over_spi_error(transport, -ETRANSERR, "CMD53 Read start token missing.");
+                return -ETRANSERR;
             }
 
             if (!crc16_check(ptr, block_size, (ptr[block_size] << 8) + ptr[block_size + 1]))
             {
-                ret = -ETRANSERR;
-                sdio_over_spi_error(transport, ret, "CMD53 Read block CRC error");
-                goto exit;
+                sdio_over_spi_error(transport, -ETRANSERR, "CMD53 Read block CRC error");
+                return -ETRANSERR;
             }
 
-            memcpy(&data->data[ii * block_size], ptr, block_size);
+            memcpy(&xfer->data[ii * block_size], ptr, block_size);
             ptr += block_size + SDIO_CRC_READ_OCTETS;
+            xfer->blocks_done++;
         }
     }
 
-exit:
-    morsectrl_transport_buff_free(full_trans);
-    morsectrl_transport_buff_free(resp);
+    return ETRANSSUCC;
+}
+
+/**
+ * @brief Perform an SDIO CMD53. Read/writes word aligned data from/to a 32-bit chip memory address.
+ *
+ * @note The upper 16-bits of the address must be set using CMD52 to write the keyhole registers
+ *       first.
+ *
+ * @param transport     The transport structure.
+ * @param data          Buffer to read data from or write data into.
+ * @param write         Whether this command is a write (otherwise it is a read).
+ * @param func          Function to perform the command on.
+ * @param block_mode    Whether transaction uses block mode.
+ * @param addr          Address to write to or read from.
+ * @param count         Number of blocks in block mode, otherwise number of octets (word aligned).
+ * @param blocks_done   Filled with the number of leading blocks that got through, may be NULL.
+ * @return              0 on success otherwise relevant error.
+ */
+static int sdio_over_spi_cmd53(struct morsectrl_transport *transport,
+                               uint8_t *data,
+                               bool write,
+                               uint8_t func,
+                               bool block_mode,
+                               uint32_t addr,
+                               uint16_t count,
+                               uint16_t *blocks_done)
+{
+    const struct morsectrl_transport_ops *tops = transport->tops;
+    struct sdio_over_spi_cmd53_xfer xfer = {
+        .data = data,
+        .write = write,
+        .func = func,
+        .block_mode = block_mode,
+        .addr = addr,
+        .count = count,
+    };
+    int ret;
+
+    sdio_over_spi_cmd53_layout(transport, &xfer);
+
+    /* Allocate some buffers. */
+    xfer.full_trans = morsectrl_transport_raw_write_alloc(transport, xfer.full_trans_size);
+    xfer.resp = morsectrl_transport_raw_read_alloc(transport, xfer.full_trans_size);
+    if (!xfer.full_trans || !xfer.resp)
+    {
+        ret = -ETRANSERR;
+        sdio_over_spi_error(transport, ret, "CMD53 failed to allocate buffers");
+        morsectrl_transport_buff_free(xfer.full_trans);
+        morsectrl_transport_buff_free(xfer.resp);
+        return ret;
+    }
+
+    sdio_over_spi_cmd53_frame(transport, &xfer);
+
+    /* Send the entire command, including the data. */
+    ret = tops->raw_read_write(transport, xfer.resp, xfer.full_trans, true, true);
+    if (ret)
+    {
+        sdio_over_spi_error(transport, ret, "CMD53 Read/Write error");
+        goto exit;
+    }
+
+    ret = sdio_over_spi_cmd53_parse(transport, &xfer);
+
+exit:
+    if (blocks_done)
+        *blocks_done = xfer.blocks_done;
+    morsectrl_transport_buff_free(xfer.full_trans);
+    morsectrl_transport_buff_free(xfer.resp);
 
     return ret;
 }
@@ -815,93 +1235,551 @@ static int sdio_over_spi_setup_keyhole(struct morsectrl_transport *transport,
     return ret;
 }
 
-static int sdio_over_spi_memblock_common(struct morsectrl_transport *transport,
-                                  struct morsectrl_transport_buff *buff,
-                                  bool write,
-                                  uint32_t addr)
+/**
+ * @brief Bus side of a streaming transfer. Sends framed slots over SPI in order, programming the
+ *        keyhole registers when a slot starts a new 64k window.
+ *
+ * @param arg   The @ref sdio_over_spi_stream.
+ * @return      NULL
+ */
+static void *sdio_over_spi_stream_bus_thread(void *arg)
 {
-    int ret = ETRANSSUCC;
-    uint8_t *orig_data = buff->data;
-    size_t orig_data_len = buff->data_len;
-    size_t remaining_data_len = buff->data_len;
-    uint32_t chip_mem_addr = addr;
-    uint16_t num_blocks;
+    struct sdio_over_spi_stream *stream = arg;
+    struct morsectrl_transport *transport = stream->transport;
+    bool rekey = false;
 
-    if (transport->debug)
+    pthread_mutex_lock(&stream->lock);
+    while (true)
     {
-        mctrl_print("Total %s size 0x%08zX\n", write ? "write" : "read", orig_data_len);
-        mctrl_print("Start address for %s 0x%08" PRIX32 "\n", write ? "write" : "read", addr);
+        struct sdio_over_spi_stream_slot *slot;
+        bool aborted;
+        bool fatal = false;
+        int ret = ETRANSSUCC;
+
+        while ((stream->transferred == stream->framed) && !stream->done)
+            pthread_cond_wait(&stream->cond, &stream->lock);
+
+        if (stream->transferred == stream->framed)
+            break;
+
+        slot = &stream->slots[stream->transferred % SDIO_STREAM_RING_SIZE];
+        aborted = stream->abort;
+        pthread_mutex_unlock(&stream->lock);
+
+        if (aborted)
+        {
+            ret = -ETRANSERR;
+        }
+        else
+        {
+            if (slot->set_keyhole || rekey)
+            {
+                ret = sdio_over_spi_setup_keyhole(transport, slot->xfer.addr, SDIO_KEYHOLE_SIZE);
+                /* The slot is retried later, but the keyhole can't be trusted for the next. */
+                rekey = (ret != ETRANSSUCC);
+            }
+
+            if (!ret)
+            {
+                ret = transport->tops->raw_read_write(transport, slot->xfer.resp,
+                                                      slot->xfer.full_trans, true, true);
+                if (ret)
+                {
+                    sdio_over_spi_error(transport, ret, "CMD53 Read/Write error");
+                    fatal = true;
+                }
+            }
+        }
+
+        pthread_mutex_lock(&stream->lock);
+        slot->ret = ret;
+        if (fatal)
+            stream->abort = true;
+        stream->transferred++;
+        pthread_cond_broadcast(&stream->cond);
     }
+    pthread_mutex_unlock(&stream->lock);
 
-    /* Perform writes withing 64k boundaries. */
-    while (remaining_data_len)
+    return NULL;
+}
+
+
+/**
+ * @brief Verify the oldest transferred slot of a streaming transfer, freeing it for reuse.
+ *
+ * @param stream    The stream.
+ * @param wait      Whether to wait for the bus to finish with the slot, otherwise only verify it if
+ *                  it has already been transferred.
+ * @return          0 on success (or nothing to verify) otherwise relevant error.
+ */
+static int sdio_over_spi_stream_verify(struct sdio_over_spi_stream *stream, bool wait)
+{
+    struct sdio_over_spi_stream_slot *slot;
+    bool aborted;
+    int ret;
+
+    pthread_mutex_lock(&stream->lock);
+    while (wait && (stream->transferred == stream->verified))
+        pthread_cond_wait(&stream->cond, &stream->lock);
+
+    if (stream->transferred == stream->verified)
+    {
+        pthread_mutex_unlock(&stream->lock);
+        return ETRANSSUCC;
+    }
+    aborted = stream->abort;
+    pthread_mutex_unlock(&stream->lock);
+
+    slot = &stream->slots[stream->verified % SDIO_STREAM_RING_SIZE];
+    ret = slot->ret;
+    if (!ret && !aborted)
+        ret = sdio_over_spi_cmd53_parse(stream->transport, &slot->xfer);
+
+    /* Keep going and retry the failed blocks once the bus thread is finished with the link. */
+    if (ret && !aborted && (stream->num_failed < SDIO_STREAM_MAX_FAILED))
+    {
+        struct sdio_over_spi_stream_failed *failed = &stream->failed[stream->num_failed++];
+
+        failed->op.data = slot->xfer.data;
+        failed->op.write = slot->xfer.write;
+        failed->op.block_mode = slot->xfer.block_mode;
+        failed->op.addr = slot->xfer.addr;
+        failed->op.count = slot->xfer.count;
+        failed->op.set_keyhole = true;
+        failed->blocks_done = slot->xfer.blocks_done;
+        ret = ETRANSSUCC;
+    }
+
+    pthread_mutex_lock(&stream->lock);
+    if (ret)
+        stream->abort = true;
+    stream->verified++;
+    pthread_mutex_unlock(&stream->lock);
+
+    return ret;
+}
+
+/**
+ * @brief Frame a CMD53 into the next free slot and hand it to the bus thread. Waits for (and
+ *        verifies) the oldest slot if the ring is full.
+ *
+ * @param transport The transport structure.
+ * @param ctx       The @ref sdio_over_spi_stream.
+ * @param op        The CMD53 to queue.
+ * @return          0 on success otherwise relevant error.
+ */
+static int sdio_over_spi_stream_queue(struct morsectrl_transport *transport, void *ctx,
+                                      const struct sdio_over_spi_cmd53_op *op)
+{
+    struct sdio_over_spi_stream *stream = ctx;
+    struct sdio_over_spi_stream_slot *slot;
+    int ret;
+
+    /* Verify anything the bus has finished with so checking overlaps with the next transfer. */
+    do
+    {
+        ret = sdio_over_spi_stream_verify(stream,
+                                          stream->framed - stream->verified ==
+                                          SDIO_STREAM_RING_SIZE);
+        if (ret)
+            return ret;
+    } while (stream->framed - stream->verified == SDIO_STREAM_RING_SIZE);
+
+    slot = &stream->slots[stream->framed % SDIO_STREAM_RING_SIZE];
+    slot->xfer.data = op->data;
+    slot->xfer.write = op->write;
+    slot->xfer.func = SDIO_FUNC_MEM_BLOCK;
+    slot->xfer.block_mode = op->block_mode;
+    slot->xfer.addr = op->addr;
+    slot->xfer.count = op->count;
+    slot->set_keyhole = op->set_keyhole;
+    slot->ret = ETRANSSUCC;
+    slot->xfer.blocks_done = 0;
+
+    sdio_over_spi_cmd53_layout(transport, &slot->xfer);
+    sdio_over_spi_cmd53_frame(transport, &slot->xfer);
+
+    pthread_mutex_lock(&stream->lock);
+    stream->framed++;
+    pthread_cond_broadcast(&stream->cond);
+    pthread_mutex_unlock(&stream->lock);
+
+    return ETRANSSUCC;
+}
+
+/**
+ * @brief Number of blocks to put in each streamed CMD53.
+ *
+ * @param transport The transport structure.
+ * @return          Number of blocks.
+ */
+static uint16_t sdio_over_spi_stream_chunk_blocks(struct morsectrl_transport *transport)
+{
+    uint32_t block_size = sdio_over_spi_fn_block_size(transport, SDIO_FUNC_MEM_BLOCK);
+
+    return MIN(MAX(SDIO_STREAM_CHUNK_SIZE / block_size, 1), SDIO_CMD53_MAX_BLOCK_COUNT);
+}
+
+/**
+ * @brief Size of the buffers needed to hold any transaction queued by a streaming transfer.
+ *
+ * @param transport The transport structure.
+ * @return          Size in octets.
+ */
+static size_t sdio_over_spi_stream_slot_size(struct morsectrl_transport *transport)
+{
+    size_t size = 0;
+    int ii;
+
+    for (ii = 0; ii < 4; ii++)
+    {
+        struct sdio_over_spi_cmd53_xfer xfer = {
+            .write = (ii & 1),
+            .func = SDIO_FUNC_MEM_BLOCK,
+            .block_mode = (ii & 2),
+        };
+
+        /* Worst case of a full chunk of blocks and the largest byte mode transfer. */
+        xfer.count = xfer.block_mode ? sdio_over_spi_stream_chunk_blocks(transport) :
+                                       SDIO_CMD53_MAX_BYTE_COUNT;
+        sdio_over_spi_cmd53_layout(transport, &xfer);
+        size = MAX(size, xfer.full_trans_size);
+    }
+
+    return size;
+}
+
+/**
+ * @brief Split a memory transfer into CMD53s within 64k windows, whole blocks first and then the
+ *        octets left over in byte mode. A read never goes past the requested range, as memory
+ *        mapped registers may have read side effects and the range may end at an unmapped hole.
+ *
+ * @param transport     The transport structure.
+ * @param buff          Buffer to read memory into or write memory from.
+ * @param write         Whether this is a write (otherwise it is a read).
+ * @param addr          Address to read from or write to.
+ * @param max_blocks    Maximum number of blocks per CMD53.
+ * @param op_fn         Called to perform (or queue) each CMD53.
+ * @param ctx           Context passed to @p op_fn.
+ * @return              0 on success otherwise relevant error.
+ */
+static int sdio_over_spi_memblock_split(struct morsectrl_transport *transport,
+                                        struct morsectrl_transport_buff *buff,
+                                        bool write,
+                                        uint32_t addr,
+                                        uint16_t max_blocks,
+                                        sdio_over_spi_cmd53_op_fn op_fn,
+                                        void *ctx)
+{
+    uint32_t block_size = sdio_over_spi_fn_block_size(transport, SDIO_FUNC_MEM_BLOCK);
+    size_t remaining_data_len = buff->data_len;
+    uint32_t chip_mem_addr = addr;
+    uint8_t *data = buff->data;
+    int ret = ETRANSSUCC;
+
+    /* Perform transfers within 64k boundaries. */
+    while (remaining_data_len && !ret)
     {
         size_t current_section_end = (chip_mem_addr & MM_ADDR_BOUNDARY) + MM_ADDR_BOUNDARY_OFFSET;
         size_t current_size = MIN(current_section_end - chip_mem_addr, remaining_data_len);
-        uint32_t byte_mode_count;
+        size_t num_blocks = current_size / block_size;
+        size_t byte_mode_count = current_size % block_size;
+        struct sdio_over_spi_cmd53_op op = {
+            .write = write,
+            .set_keyhole = true,
+        };
 
         if (transport->debug)
         {
             mctrl_print("%s from 0x%08X to 0x%08zX\n", write ? "write" : "read",
                    chip_mem_addr, chip_mem_addr + current_size - 1);
+            mctrl_print("%zu blocks of %u, %zu octets 'cleanup'\n",
+                        num_blocks, block_size, byte_mode_count);
+        }
+
+        /* Read/write blocks first. */
+        while (num_blocks && !ret)
+        {
+            op.block_mode = true;
+            op.data = data;
+            op.addr = chip_mem_addr;
+            op.count = MIN(num_blocks, max_blocks);
+            ret = op_fn(transport, ctx, &op);
+
+            op.set_keyhole = false;
+            data += op.count * block_size;
+            chip_mem_addr += op.count * block_size;
+            num_blocks -= op.count;
         }
 
-        ret = sdio_over_spi_setup_keyhole(transport, chip_mem_addr, SDIO_KEYHOLE_SIZE);
+        /* Read/write octets to cleanup if required. */
+        while (byte_mode_count && !ret)
+        {
+            size_t count = MIN(byte_mode_count, SDIO_CMD53_MAX_BYTE_COUNT);
+
+            /* Align to words, extra octets can be garbage. Upper layers should have done the
+             * alignment already but enforce it here. */
+            op.block_mode = false;
+            op.data = data;
+            op.addr = chip_mem_addr;
+            op.count = ALIGN_SIZE(count, sizeof(uint32_t));
+            ret = op_fn(transport, ctx, &op);
+
+            op.set_keyhole = false;
+            data += count;
+            chip_mem_addr += count;
+            byte_mode_count -= count;
+        }
+
+        remaining_data_len -= current_size;
+    }
+
+    return ret;
+}
+
+/**
+ * @brief Perform a CMD53 of a memory transfer once.
+ *
+ * @param transport     The transport structure.
+ * @param op            The CMD53 to perform.
+ * @param blocks_done   Filled with the number of leading blocks that got through.
+ * @return              0 on success otherwise relevant error.
+ */
+static int sdio_over_spi_cmd53_op_once(struct morsectrl_transport *transport,
+                                       const struct sdio_over_spi_cmd53_op *op,
+                                       uint16_t *blocks_done)
+{
+    int ret;
+
+    *blocks_done = 0;
+
+    if (op->set_keyhole)
+    {
+        ret = sdio_over_spi_setup_keyhole(transport, op->addr, SDIO_KEYHOLE_SIZE);
         if (ret)
         {
             sdio_over_spi_error(transport, ret, "Failed to set keyhole registers");
             return ret;
         }
+    }
 
-        num_blocks = current_size / fn_max_block_size[SDIO_FUNC_MEM_BLOCK];
-        byte_mode_count = current_size % fn_max_block_size[SDIO_FUNC_MEM_BLOCK];
-        if (transport->debug)
-            mctrl_print("%d blocks\n", num_blocks);
+    ret = sdio_over_spi_cmd53(transport, op->data, op->write, SDIO_FUNC_MEM_BLOCK,
+                              op->block_mode, op->addr, op->count, blocks_done);
+
+    return ret;
+}
+
+/**
+ * @brief Retry a failed CMD53 of a memory transfer, re-issuing only the blocks from the first one
+ *        that failed. Gives up after @ref SDIO_CMD53_MAX_RETRIES consecutive failures that get no
+ *        blocks through, asking the transport to slow the link down along the way. Nothing is
+ *        retried while retries are turned off.
+ *
+ * @param transport     The transport structure.
+ * @param failed        The CMD53 that failed.
+ * @param blocks_done   Number of leading blocks of @p failed that got through.
+ * @return              0 on success otherwise relevant error.
+ */
+static int sdio_over_spi_cmd53_retry(struct morsectrl_transport *transport,
+                                     const struct sdio_over_spi_cmd53_op *failed,
+                                     uint16_t blocks_done)
+{
+    struct morsectrl_sdio_over_spi_state *state = sdio_over_spi_get_state(transport);
+    uint32_t block_size = sdio_over_spi_fn_block_size(transport, SDIO_FUNC_MEM_BLOCK);
+    struct sdio_over_spi_cmd53_op op = *failed;
+    int failures = 0;
+    int ret;
+
+    if (state->no_retries)
+        return -ETRANSERR;
+
+    do
+    {
+        failures = blocks_done ? 1 : (failures + 1);
+        if (failures > SDIO_CMD53_MAX_RETRIES)
+        {
+            sdio_over_spi_error(transport, -ETRANSERR, "CMD53 retries exhausted");
+            return -ETRANSERR;
+        }
 
-        if (current_size / fn_max_block_size[SDIO_FUNC_MEM_BLOCK])
+        /* Carry on after the blocks that got through, a byte mode transfer is all or nothing. */
+        if (op.block_mode)
         {
-            /* Read/write blocks first. */
-            ret = sdio_over_spi_cmd53(transport,
-                                      buff,
-                                      write,
-                                      SDIO_FUNC_MEM_BLOCK,
-                                      true,
-                                      chip_mem_addr,
-                                      current_size / fn_max_block_size[SDIO_FUNC_MEM_BLOCK]);
+            op.data += blocks_done * block_size;
+            op.addr += blocks_done * block_size;
+            op.count -= blocks_done;
         }
-        buff->data += (current_size - byte_mode_count);
+
+        if ((failures >= SDIO_CMD53_STEP_DOWN_FAILURES) && state->step_down_clock)
+            state->step_down_clock(transport);
+
+        /* The failure may have been in the keyhole writes, so always set them again. */
+        op.set_keyhole = true;
+        state->xfer_retries++;
+        state->total_retries++;
 
         if (transport->debug)
         {
-            mctrl_print("chip mem addr 0x%08x, currentsize %zu, byte_mode_count %u\n",
-                   chip_mem_addr, current_size, byte_mode_count);
-            mctrl_print("%d octets 'cleanup'\n", byte_mode_count);
+            mctrl_print("CMD53 retry %u of %u %s at 0x%08" PRIX32 "\n", failures,
+                        op.count, op.block_mode ? "blocks" : "octets", op.addr);
         }
 
-        /* Read/write octets to cleanup if required. */
-        if (byte_mode_count)
+        ret = sdio_over_spi_cmd53_op_once(transport, &op, &blocks_done);
+    } while (ret);
+
+    return ETRANSSUCC;
+}
+
+/**
+ * @brief Perform a CMD53 of a memory transfer synchronously, retrying failed blocks.
+ *
+ * @param transport The transport structure.
+ * @param ctx       Unused.
+ * @param op        The CMD53 to perform.
+ * @return          0 on success otherwise relevant error.
+ */
+static int sdio_over_spi_cmd53_op_sync(struct morsectrl_transport *transport, void *ctx,
+                                       const struct sdio_over_spi_cmd53_op *op)
+{
+    uint16_t blocks_done;
+    int ret;
+
+    ret = sdio_over_spi_cmd53_op_once(transport, op, &blocks_done);
+    if (ret)
+        ret = sdio_over_spi_cmd53_retry(transport, op, blocks_done);
+
+    return ret;
+}
+
+/**
+ * @brief Read/write a large block of memory with framing and verification overlapped with the
+ *        SPI transfers.
+ *
+ * A bus thread sends framed transactions from a small ring of preallocated buffers while this
+ * thread frames chunk N+1 and verifies chunk N-1, so the link is not left idle during CRC
+ * generation and checking.
+ *
+ * @param transport The transport structure.
+ * @param buff      Buffer to read memory into or write memory from.
+ * @param write     Whether this is a write (otherwise it is a read).
+ * @param addr      Address to read from or write to.
+ * @return          0 on success otherwise relevant error.
+ */
+static int sdio_over_spi_memblock_stream(struct morsectrl_transport *transport,
+                                         struct morsectrl_transport_buff *buff,
+                                         bool write,
+                                         uint32_t addr)
+{
+    struct sdio_over_spi_stream stream;
+    size_t slot_size = sdio_over_spi_stream_slot_size(transport);
+    int ret = ETRANSSUCC;
+    int verify_ret;
+    int ii;
+
+    memset(&stream, 0, sizeof(stream));
+    stream.transport = transport;
+
+    for (ii = 0; ii < SDIO_STREAM_RING_SIZE; ii++)
+    {
+        struct sdio_over_spi_stream_slot *slot = &stream.slots[ii];
+
+        slot->xfer.full_trans = morsectrl_transport_raw_write_alloc(transport, slot_size);
+        slot->xfer.resp = morsectrl_transport_raw_read_alloc(transport, slot_size);
+        if (!slot->xfer.full_trans || !slot->xfer.resp)
         {
-            /* Align to words, extra octets can be garbage. Upper layers should have done the
-             * alignment already but enforce it here. */
-            size_t aligned_count = ALIGN_SIZE(byte_mode_count, sizeof(uint32_t));
-
-            ret = sdio_over_spi_cmd53(transport,
-                                      buff,
-                                      write,
-                                      SDIO_FUNC_MEM_BLOCK,
-                                      false,
-                                      chip_mem_addr + current_size - byte_mode_count,
-                                      aligned_count);
+            ret = -ETRANSERR;
+            sdio_over_spi_error(transport, ret, "Failed to allocate stream buffers");
+            goto free_slots;
         }
+    }
 
-        chip_mem_addr += current_size;
-        buff->data += byte_mode_count;
-        remaining_data_len -= current_size;
+    pthread_mutex_init(&stream.lock, NULL);
+    pthread_cond_init(&stream.cond, NULL);
+    if (pthread_create(&stream.thread, NULL, sdio_over_spi_stream_bus_thread, &stream))
+    {
+        ret = -ETRANSERR;
+        sdio_over_spi_error(transport, ret, "Failed to start stream thread");
+        goto destroy;
+    }
+
+    if (transport->debug)
+    {
+        mctrl_print("Streaming %s of 0x%08zX from 0x%08" PRIX32 "\n",
+                    write ? "write" : "read", buff->data_len, addr);
+    }
+
+    ret = sdio_over_spi_memblock_split(transport, buff, write, addr,
+                                       sdio_over_spi_stream_chunk_blocks(transport),
+                                       sdio_over_spi_stream_queue, &stream);
+
+    pthread_mutex_lock(&stream.lock);
+    stream.done = true;
+    pthread_cond_broadcast(&stream.cond);
+    pthread_mutex_unlock(&stream.lock);
+
+    /* Drain whatever is still in flight. */
+    while (stream.verified != stream.framed)
+    {
+        verify_ret = sdio_over_spi_stream_verify(&stream, true);
+        if (!ret)
+            ret = verify_ret;
     }
 
-    /* Restore data pointer and length. */
-    buff->data = orig_data;
-    buff->data_len = orig_data_len;
+    pthread_join(stream.thread, NULL);
+
+    /* The link is free again, retry anything that failed verification. */
+    for (ii = 0; (ii < stream.num_failed) && !ret; ii++)
+        ret = sdio_over_spi_cmd53_retry(transport, &stream.failed[ii].op,
+                                        stream.failed[ii].blocks_done);
+
+destroy:
+    pthread_cond_destroy(&stream.cond);
+    pthread_mutex_destroy(&stream.lock);
+
+free_slots:
+    for (ii = 0; ii < SDIO_STREAM_RING_SIZE; ii++)
+    {
+        morsectrl_transport_buff_free(stream.slots[ii].xfer.full_trans);
+        morsectrl_transport_buff_free(stream.slots[ii].xfer.resp);
+    }
+
+    return ret;
+}
+
+static int sdio_over_spi_memblock_common(struct morsectrl_transport *transport,
+                                  struct morsectrl_transport_buff *buff,
+                                  bool write,
+                                  uint32_t addr)
+{
+    struct morsectrl_sdio_over_spi_state *state = sdio_over_spi_get_state(transport);
+    int ret;
+
+    /* Register sized accesses never use block mode so don't need the block size. */
+    if (!state->block_size_valid && (buff->data_len > sizeof(uint32_t)))
+        sdio_over_spi_negotiate_block_size(transport);
+
+    if (transport->debug)
+    {
+        mctrl_print("Total %s size 0x%08zX\n", write ? "write" : "read", buff->data_len);
+        mctrl_print("Start address for %s 0x%08" PRIX32 "\n", write ? "write" : "read", addr);
+    }
+
+    state->xfer_retries = 0;
+
+    /* Large transfers are pipelined so the link isn't idle while framing and checking CRCs. */
+    if (state->stream && (buff->data_len > SDIO_STREAM_CHUNK_SIZE))
+        ret = sdio_over_spi_memblock_stream(transport, buff, write, addr);
+    else
+        ret = sdio_over_spi_memblock_split(transport, buff, write, addr,
+                                           SDIO_CMD53_MAX_BLOCK_COUNT,
+                                           sdio_over_spi_cmd53_op_sync, NULL);
+
+    if (transport->debug && state->xfer_retries)
+    {
+        mctrl_print("%s of 0x%08zX needed %u CMD53 retries (%u in total)\n",
+                    write ? "Write" : "Read", buff->data_len,
+                    state->xfer_retries, state->total_retries);
+    }
 
     return ret;
 }
@@ -920,6 +1798,229 @@ int sdio_over_spi_write_memblock(struct morsectrl_transport *transport,
     return sdio_over_spi_memblock_common(transport, buff, true, addr);
 }
 
+/**
+ * @brief Plan the transactions of a register burst. Keyhole CMD52s are only added when the 64k
+ *        window changes and runs of contiguous registers within a window are merged into a single
+ *        byte mode CMD53.
+ *
+ * @param transport The transport structure.
+ * @param regs      The registers to access.
+ * @param count     Number of registers.
+ * @param write     Whether this is a write (otherwise it is a read).
+ * @param data      Little endian register values, one word per register.
+ * @param ops       Filled with the transactions, room for @ref SDIO_BURST_MAX_OPS(count).
+ * @return          Number of transactions planned.
+ */
+static size_t sdio_over_spi_burst_plan(struct morsectrl_transport *transport,
+                                       const struct morsectrl_transport_reg *regs,
+                                       size_t count,
+                                       bool write,
+                                       uint8_t *data,
+                                       struct sdio_over_spi_burst_op *ops)
+{
+    size_t num_ops = 0;
+    size_t offset = 0;
+    int key_win0 = -1;
+    int key_win1 = -1;
+    size_t ii = 0;
+
+    while (ii < count)
+    {
+        uint32_t addr = regs[ii].addr;
+        struct sdio_over_spi_burst_op *op;
+        size_t run = 1;
+
+        while ((ii + run < count) &&
+               (regs[ii + run].addr == addr + (run * sizeof(uint32_t))) &&
+               ((regs[ii + run].addr & MM_ADDR_BOUNDARY) == (addr & MM_ADDR_BOUNDARY)) &&
+               ((run + 1) * sizeof(uint32_t) <= SDIO_CMD53_MAX_BYTE_COUNT))
+            run++;
+
+        if (key_win0 != MM_ADDR_TO_KEYHOLE_WIN0(addr))
+        {
+            key_win0 = MM_ADDR_TO_KEYHOLE_WIN0(addr);
+            op = &ops[num_ops++];
+            op->cmd53 = false;
+            op->addr = MM_KEYHOLE_ADDR_WIN0;
+            op->value = key_win0;
+            op->offset = offset;
+            offset += SDIO_CMD52_LEN;
+        }
+        if (key_win1 != MM_ADDR_TO_KEYHOLE_WIN1(addr))
+        {
+            key_win1 = MM_ADDR_TO_KEYHOLE_WIN1(addr);
+            op = &ops[num_ops++];
+            op->cmd53 = false;
+            op->addr = MM_KEYHOLE_ADDR_WIN1;
+            op->value = key_win1;
+            op->offset = offset;
+            offset += SDIO_CMD52_LEN;
+        }
+        if (ii == 0)
+        {
+            /* The access size never changes so only needs setting once. */
+            op = &ops[num_ops++];
+            op->cmd53 = false;
+            op->addr = MM_KEYHOLE_ADDR_CFG;
+            op->value = MM_SIZE_TO_CFG(SDIO_KEYHOLE_SIZE);
+            op->offset = offset;
+            offset += SDIO_CMD52_LEN;
+        }
+
+        op = &ops[num_ops++];
+        memset(&op->xfer, 0, sizeof(op->xfer));
+        op->cmd53 = true;
+        op->xfer.data = &data[ii * sizeof(uint32_t)];
+        op->xfer.write = write;
+        op->xfer.func = SDIO_FUNC_MEM_BLOCK;
+        op->xfer.block_mode = false;
+        op->xfer.addr = addr;
+        op->xfer.count = run * sizeof(uint32_t);
+        sdio_over_spi_cmd53_layout(transport, &op->xfer);
+        op->offset = offset;
+        offset += op->xfer.full_trans_size;
+
+        ii += run;
+    }
+
+    return num_ops;
+}
+
+/**
+ * @brief Read or write a set of 32bit registers in a single SPI transfer.
+ *
+ * @param transport The transport structure.
+ * @param regs      The registers to access, values are filled in for reads.
+ * @param count     Number of registers.
+ * @param write     Whether this is a write (otherwise it is a read).
+ * @return          0 on success otherwise relevant error.
+ */
+static int sdio_over_spi_regs_burst(struct morsectrl_transport *transport,
+                                    struct morsectrl_transport_reg *regs,
+                                    size_t count,
+                                    bool write)
+{
+    struct morsectrl_transport_buff *tx = NULL;
+    struct morsectrl_transport_buff *rx = NULL;
+    struct sdio_over_spi_burst_op *ops;
+    uint8_t *data;
+    size_t num_ops;
+    size_t total;
+    size_t ii;
+    int ret = ETRANSSUCC;
+
+    if (!transport || !transport->tops || !transport->tops->raw_read_write)
+        return -ETRANSERR;
+
+    if (!count)
+        return ETRANSSUCC;
+
+    ops = calloc(SDIO_BURST_MAX_OPS(count), sizeof(*ops));
+    data = calloc(count, sizeof(uint32_t));
+    if (!ops || !data)
+    {
+        ret = -ETRANSERR;
+        goto exit;
+    }
+
+    for (ii = 0; ii < count; ii++)
+    {
+        uint32_t le_value = htole32(regs[ii].value);
+
+        memcpy(&data[ii * sizeof(uint32_t)], &le_value, sizeof(le_value));
+    }
+
+    num_ops = sdio_over_spi_burst_plan(transport, regs, count, write, data, ops);
+    total = ops[num_ops - 1].offset +
+            (ops[num_ops - 1].cmd53 ? ops[num_ops - 1].xfer.full_trans_size : SDIO_CMD52_LEN);
+
+    if (transport->debug)
+    {
+        mctrl_print("Register %s burst of %zu registers, %zu transactions, %zu octets\n",
+                    write ? "write" : "read", count, num_ops, total);
+    }
+
+    tx = morsectrl_transport_raw_write_alloc(transport, total);
+    rx = morsectrl_transport_raw_read_alloc(transport, total);
+    if (!tx || !rx)
+    {
+        ret = -ETRANSERR;
+        sdio_over_spi_error(transport, ret, "Register burst failed to allocate buffers");
+        goto exit;
+    }
+
+    for (ii = 0; ii < num_ops; ii++)
+    {
+        struct sdio_over_spi_burst_op *op = &ops[ii];
+
+        if (!op->cmd53)
+        {
+            sdio_over_spi_cmd52_frame(transport, &tx->data[op->offset], true, SDIO_FUNC_REG,
+                                      op->addr, op->value);
+            continue;
+        }
+
+        /* Views into the burst buffers so the CMD53 helpers can be reused. */
+        op->tx_view.data = &tx->data[op->offset];
+        op->rx_view.data = &rx->data[op->offset];
+        op->xfer.full_trans = &op->tx_view;
+        op->xfer.resp = &op->rx_view;
+        sdio_over_spi_cmd53_frame(transport, &op->xfer);
+    }
+
+    tx->data_len = total;
+    rx->data_len = total;
+    ret = transport->tops->raw_read_write(transport, rx, tx, true, true);
+    if (ret)
+    {
+        sdio_over_spi_error(transport, ret, "Register burst transfer failed");
+        goto exit;
+    }
+
+    for (ii = 0; (ii < num_ops) && !ret; ii++)
+    {
+        struct sdio_over_spi_burst_op *op = &ops[ii];
+
+        if (op->cmd53)
+            ret = sdio_over_spi_cmd53_parse(transport, &op->xfer);
+        else
+            ret = sdio_over_spi_cmd52_parse(transport, &rx->data[op->offset], true, NULL);
+    }
+
+    if (!ret && !write)
+    {
+        for (ii = 0; ii < count; ii++)
+        {
+            uint32_t le_value;
+
+            memcpy(&le_value, &data[ii * sizeof(uint32_t)], sizeof(le_value));
+            regs[ii].value = le32toh(le_value);
+        }
+    }
+
+exit:
+    morsectrl_transport_buff_free(tx);
+    morsectrl_transport_buff_free(rx);
+    free(data);
+    free(ops);
+
+    return ret;
+}
+
+int sdio_over_spi_read_regs(struct morsectrl_transport *transport,
+                            struct morsectrl_transport_reg *regs,
+                            size_t count)
+{
+    return sdio_over_spi_regs_burst(transport, regs, count, false);
+}
+
+int sdio_over_spi_write_regs(struct morsectrl_transport *transport,
+                             struct morsectrl_transport_reg *regs,
+                             size_t count)
+{
+    return sdio_over_spi_regs_burst(transport, regs, count, true);
+}
+
 int sdio_over_spi_post_hard_reset(struct morsectrl_transport *transport)
 {
     const struct morsectrl_transport_ops *tops = transport->tops;
@@ -927,6 +2028,9 @@ int sdio_over_spi_post_hard_reset(struct morsectrl_transport *transport)
     int ret;
     uint32_t data32;
 
+    /* The function block sizes are lost on reset. */
+    sdio_over_spi_get_state(transport)->block_size_valid = false;
+
     /* First Send a CMD63 */
     for (ii = 0; ii < 3; ii++)
     {
@@ -983,5 +2087,8 @@ int sdio_over_spi_post_hard_reset(struct morsectrl_transport *transport)
         return ret;
     }
 
+    /* Set up the block size now rather than on the first firmware download transfer. */
+    sdio_over_spi_negotiate_block_size(transport);
+
     return ret;
 }
@@ -33,6 +33,32 @@ int sdio_over_spi_write_reg_32bit(struct morsectrl_transport *transport,
                                   uint32_t addr,
                                   uint32_t data);
 
+/**
+ * @brief Read several 32bit registers in a single SPI transfer. Contiguous registers are merged
+ *        into one CMD53 and keyhole registers are only written when the 64k window changes.
+ *
+ * @param transport The transport structure.
+ * @param regs      Registers to read, the value of each entry is filled in.
+ * @param count     Number of entries in @p regs.
+ * @return          0 on success otherwise relevant error.
+ */
+int sdio_over_spi_read_regs(struct morsectrl_transport *transport,
+                            struct morsectrl_transport_reg *regs,
+                            size_t count);
+
+/**
+ * @brief Write several 32bit registers in a single SPI transfer. Contiguous registers are merged
+ *        into one CMD53 and keyhole registers are only written when the 64k window changes.
+ *
+ * @param transport The transport structure.
+ * @param regs      Registers and the values to write, written in order.
+ * @param count     Number of entries in @p regs.
+ * @return          0 on success otherwise relevant error.
+ */
+int sdio_over_spi_write_regs(struct morsectrl_transport *transport,
+                             struct morsectrl_transport_reg *regs,
+                             size_t count);
+
 /**
  * @brief Read a block of word aligned memory.
  *
@@ -0,0 +1,417 @@
+/*
+ * Copyright 2023 Morse Micro
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "sim.h"
+#include "../../utilities.h"
+#include "../../portable_endian.h"
+#include "../../command.h"
+
+#define CHIP_SIM_PAGE_SHIFT             (16)
+#define CHIP_SIM_PAGE_SIZE              BIT(CHIP_SIM_PAGE_SHIFT)
+#define CHIP_SIM_PAGE_MASK              (CHIP_SIM_PAGE_SIZE - 1)
+#define CHIP_SIM_NUM_PAGES              BIT(32 - CHIP_SIM_PAGE_SHIFT)
+
+#define CHIP_SIM_CHIP_ID                (0x00000306)
+
+#define CHIP_SIM_REG_CHIP_ID_ADDR       (0x10054d20)
+#define CHIP_SIM_REG_HOST_MAN_PTR_ADDR  (0x10054d40)
+#define CHIP_SIM_REG_MAC_BOOT_ADDR      (0x10054024)
+#define CHIP_SIM_REG_MAC_BOOT_MASK      BIT(20)
+#define CHIP_SIM_REG_RESET_ADDR         (0x10054050)
+#define CHIP_SIM_REG_RESET_VALUE        (0xDEAD)
+#define CHIP_SIM_REG_TRIGGER_ADDR       (0x100A6010)
+#define CHIP_SIM_REG_STATUS_ADDR        (0x100A6060)
+#define CHIP_SIM_REG_STATUS_CLR_ADDR    (0x100A6068)
+#define CHIP_SIM_CMD_MASK               BIT(1)
+
+/* Host table and mailboxes, clear of the IMEM and DMEM banks used by transraw. */
+#define CHIP_SIM_HOST_TABLE_ADDR        (0x80C00000)
+#define CHIP_SIM_HOST_TABLE_CMD_OFFSET  (16)
+#define CHIP_SIM_HOST_TABLE_RESP_OFFSET (20)
+#define CHIP_SIM_CMD_ADDR               (0x80C00100)
+#define CHIP_SIM_RESP_ADDR              (0x80C01100)
+
+/* Stats responses hold up to this many octets of TLVs, as the host expects. */
+#define CHIP_SIM_STATS_MAX_LEN          (2048)
+#define CHIP_SIM_STATS_TAG_LEN          (sizeof(uint16_t) * 2 + sizeof(uint32_t))
+#define CHIP_SIM_STATS_CORES            (3)
+/* A stats page starts with its flags and the offset of the next page. */
+#define CHIP_SIM_STATS_PAGE_HDR_LEN     (sizeof(uint32_t) * 2)
+#define CHIP_SIM_STATS_PAGE_MORE        BIT(0)
+/* Most stats of a core when paged, as its tags are numbered within a 4k range. */
+#define CHIP_SIM_STATS_MAX_PAGED        (0x1000)
+
+struct chip_sim
+{
+    /** Memory is allocated in 64k pages on first write. */
+    uint8_t **pages;
+    bool fw_running;
+    /** Number of times each core's stats have been read. */
+    uint32_t stats_reads[CHIP_SIM_STATS_CORES];
+};
+
+static struct chip_sim chip_sims[SIM_MAX_BOARDS];
+
+/**
+ * @brief Get the page holding an address.
+ *
+ * @param addr      Chip address.
+ * @param alloc     Whether to allocate the page if it has never been written.
+ * @return          The page or NULL if not allocated.
+ */
+static uint8_t *chip_sim_page(struct chip_sim *chip, uint32_t addr, bool alloc)
+{
+    uint32_t idx = addr >> CHIP_SIM_PAGE_SHIFT;
+
+    if (!chip->pages)
+    {
+        if (!alloc)
+            return NULL;
+
+        chip->pages = calloc(CHIP_SIM_NUM_PAGES, sizeof(*chip->pages));
+        if (!chip->pages)
+            return NULL;
+    }
+
+    if (!chip->pages[idx] && alloc)
+        chip->pages[idx] = calloc(1, CHIP_SIM_PAGE_SIZE);
+
+    return chip->pages[idx];
+}
+
+/**
+ * @brief Copy to or from chip memory without acting on registers.
+ *
+ * @param addr      Chip address.
+ * @param data      Buffer to copy from or into.
+ * @param len       Number of octets.
+ * @param write     Whether this is a write (otherwise it is a read).
+ */
+static void chip_sim_access(struct chip_sim *chip, uint32_t addr, uint8_t *data, size_t len,
+                            bool write)
+{
+    while (len)
+    {
+        size_t chunk = MIN(len, (size_t)(CHIP_SIM_PAGE_SIZE - (addr & CHIP_SIM_PAGE_MASK)));
+        uint8_t *page = chip_sim_page(chip, addr, write);
+
+        if (write && page)
+            memcpy(&page[addr & CHIP_SIM_PAGE_MASK], data, chunk);
+        else if (!write && page)
+            memcpy(data, &page[addr & CHIP_SIM_PAGE_MASK], chunk);
+        else if (!write)
+            memset(data, 0, chunk);
+
+        addr += chunk;
+        data += chunk;
+        len -= chunk;
+    }
+}
+
+static uint32_t chip_sim_read32(struct chip_sim *chip, uint32_t addr)
+{
+    uint32_t value;
+
+    chip_sim_access(chip, addr, (uint8_t *)&value, sizeof(value), false);
+
+    return le32toh(value);
+}
+
+static void chip_sim_write32(struct chip_sim *chip, uint32_t addr, uint32_t value)
+{
+    value = htole32(value);
+    chip_sim_access(chip, addr, (uint8_t *)&value, sizeof(value), true);
+}
+
+/**
+ * @brief Start the firmware: publish the host table with the command and response mailboxes.
+ */
+static void chip_sim_boot(struct chip_sim *chip)
+{
+    chip_sim_write32(chip, CHIP_SIM_HOST_TABLE_ADDR + CHIP_SIM_HOST_TABLE_CMD_OFFSET,
+                     CHIP_SIM_CMD_ADDR);
+    chip_sim_write32(chip, CHIP_SIM_HOST_TABLE_ADDR + CHIP_SIM_HOST_TABLE_RESP_OFFSET,
+                     CHIP_SIM_RESP_ADDR);
+    chip_sim_write32(chip, CHIP_SIM_REG_HOST_MAN_PTR_ADDR, CHIP_SIM_HOST_TABLE_ADDR);
+    chip->fw_running = true;
+}
+
+/**
+ * @brief Get the core a stats log command reads.
+ *
+ * @param message_id    Command message ID.
+ * @return              Index of the core, or -1 if the command is not a stats log command.
+ */
+static int chip_sim_stats_core(uint16_t message_id)
+{
+    switch (message_id)
+    {
+    case MORSE_COMMAND_APP_STATS_LOG:
+        return 0;
+    case MORSE_COMMAND_MAC_STATS_LOG:
+        return 1;
+    case MORSE_COMMAND_UPHY_STATS_LOG:
+        return 2;
+    default:
+        return -1;
+    }
+}
+
+/**
+ * @brief Get whether the firmware returns stats in pages when asked to.
+ */
+static bool chip_sim_stats_paged(void)
+{
+#ifdef ENABLE_STATS_PAGED
+    const char *env = getenv(SIM_ENV_STATS_UNPAGED);
+
+    return !env || !strtoul(env, NULL, 0);
+#else
+    return false;
+#endif
+}
+
+/**
+ * @brief Fill in the TLVs of some of the stats of a core.
+ *
+ * @param chip  Chip reporting the stats.
+ * @param core  Index of the core the stats are from.
+ * @param first Index of the first stat to fill in.
+ * @param count Number of stats to fill in.
+ * @param tlvs  Buffer to fill.
+ * @return      Number of octets filled.
+ */
+static size_t chip_sim_stats(struct chip_sim *chip, int core, uint32_t first, uint32_t count,
+                             uint8_t *tlvs)
+{
+    uint32_t reads = chip->stats_reads[core];
+    size_t len = 0;
+    uint32_t ii;
+
+    for (ii = first; ii < first + count; ii++)
+    {
+        uint16_t tag = htole16((core + 1) * 0x1000 + ii);
+        uint16_t tag_len = htole16(sizeof(uint32_t));
+        uint32_t value = htole32(reads * (ii + 1));
+
+        memcpy(tlvs + len, &tag, sizeof(tag));
+        memcpy(tlvs + len + sizeof(tag), &tag_len, sizeof(tag_len));
+        memcpy(tlvs + len + sizeof(tag) + sizeof(tag_len), &value, sizeof(value));
+        len += CHIP_SIM_STATS_TAG_LEN;
+    }
+
+    return len;
+}
+
+/**
+ * @brief Fill in a stats log response, a page of the stats if the request gives an offset and
+ *        the firmware pages stats, otherwise as many as fit in a single response.
+ *
+ * @param chip      Chip reporting the stats.
+ * @param core      Index of the core the stats are from.
+ * @param req_len   Length of the request payload.
+ * @param data      Buffer of CHIP_SIM_STATS_MAX_LEN octets to fill.
+ * @return          Number of octets filled.
+ */
+static size_t chip_sim_stats_log(struct chip_sim *chip, int core, uint16_t req_len,
+                                 uint8_t *data)
+{
+    const char *env = getenv(SIM_ENV_STATS_PER_CORE);
+    uint32_t total = env ? strtoul(env, NULL, 0) : 0;
+    uint32_t flags = 0;
+    uint32_t offset;
+    uint32_t first;
+    uint32_t count;
+
+    if (!chip_sim_stats_paged() || (req_len < sizeof(offset)))
+    {
+        chip->stats_reads[core]++;
+        count = MIN(total, (uint32_t)(CHIP_SIM_STATS_MAX_LEN / CHIP_SIM_STATS_TAG_LEN));
+        return chip_sim_stats(chip, core, 0, count, data);
+    }
+
+    chip_sim_access(chip, CHIP_SIM_CMD_ADDR + sizeof(struct command_hdr), (uint8_t *)&offset,
+                    sizeof(offset), false);
+    first = le32toh(offset) / CHIP_SIM_STATS_TAG_LEN;
+
+    /* A read starts again from the first page, the later pages are of the same values. */
+    if (!first)
+        chip->stats_reads[core]++;
+
+    total = MIN(total, (uint32_t)CHIP_SIM_STATS_MAX_PAGED);
+    first = MIN(first, total);
+    count = MIN(total - first,
+                (uint32_t)((CHIP_SIM_STATS_MAX_LEN - CHIP_SIM_STATS_PAGE_HDR_LEN) /
+                           CHIP_SIM_STATS_TAG_LEN));
+    if (first + count < total)
+        flags |= CHIP_SIM_STATS_PAGE_MORE;
+
+    flags = htole32(flags);
+    offset = htole32((first + count) * CHIP_SIM_STATS_TAG_LEN);
+    memcpy(data, &flags, sizeof(flags));
+    memcpy(data + sizeof(flags), &offset, sizeof(offset));
+
+    return CHIP_SIM_STATS_PAGE_HDR_LEN +
+           chip_sim_stats(chip, core, first, count, data + CHIP_SIM_STATS_PAGE_HDR_LEN);
+}
+
+/**
+ * @brief Fill in a get capabilities response, reporting paged stats if they are supported.
+ *
+ * @param data  Buffer to fill.
+ * @return      Number of octets filled.
+ */
+static size_t chip_sim_capabilities(uint8_t *data)
+{
+    struct command_get_capabilities_cfm cfm;
+
+    memset(&cfm, 0, sizeof(cfm));
+#ifdef ENABLE_STATS_PAGED
+    if (chip_sim_stats_paged())
+    {
+        cfm.capabilities.flags[MORSE_CAPAB_STATS_PAGED / 32] =
+            htole32(BIT(MORSE_CAPAB_STATS_PAGED % 32));
+    }
+#endif
+    memcpy(data, &cfm, sizeof(cfm));
+
+    return sizeof(cfm);
+}
+
+/**
+ * @brief Handle a command written to the mailbox. Every command succeeds, stats log commands with
+ *        the stats of their core, get capabilities with the supported capabilities and others
+ *        with an empty response.
+ */
+static void chip_sim_handle_cmd(struct chip_sim *chip)
+{
+    struct
+    {
+        struct response resp;
+        uint8_t data[CHIP_SIM_STATS_MAX_LEN];
+    } __attribute__((packed)) msg;
+    uint16_t message_id;
+    size_t len = 0;
+    int core;
+
+    chip_sim_access(chip, CHIP_SIM_CMD_ADDR, (uint8_t *)&msg.resp.hdr, sizeof(msg.resp.hdr),
+                    false);
+    message_id = le16toh(msg.resp.hdr.message_id);
+
+    core = chip_sim_stats_core(message_id);
+    if (core >= 0)
+        len = chip_sim_stats_log(chip, core, le16toh(msg.resp.hdr.len), msg.data);
+    else if (message_id == MORSE_COMMAND_GET_CAPABILITIES)
+        len = chip_sim_capabilities(msg.data);
+
+    msg.resp.hdr.flags = 0;
+    msg.resp.hdr.len = htole16(sizeof(msg.resp.status) + len);
+    msg.resp.status = htole32(0);
+    chip_sim_access(chip, CHIP_SIM_RESP_ADDR, (uint8_t *)&msg, sizeof(msg.resp) + len, true);
+
+    chip_sim_write32(chip, CHIP_SIM_REG_STATUS_ADDR,
+                     chip_sim_read32(chip, CHIP_SIM_REG_STATUS_ADDR) | CHIP_SIM_CMD_MASK);
+}
+
+/**
+ * @brief Act on a register that has just been written.
+ *
+ * @param addr      Register address.
+ * @param value     Value written.
+ */
+static void chip_sim_reg_written(struct chip_sim *chip, uint32_t addr, uint32_t value)
+{
+    switch (addr)
+    {
+    case CHIP_SIM_REG_CHIP_ID_ADDR:
+        /* Read only. */
+        chip_sim_write32(chip, addr, CHIP_SIM_CHIP_ID);
+        break;
+
+    case CHIP_SIM_REG_RESET_ADDR:
+        if (value == CHIP_SIM_REG_RESET_VALUE)
+            chip->fw_running = false;
+        chip_sim_write32(chip, addr, 0);
+        break;
+
+    case CHIP_SIM_REG_MAC_BOOT_ADDR:
+        if (value & CHIP_SIM_REG_MAC_BOOT_MASK)
+            chip_sim_boot(chip);
+        break;
+
+    case CHIP_SIM_REG_TRIGGER_ADDR:
+        if ((value & CHIP_SIM_CMD_MASK) && chip->fw_running)
+            chip_sim_handle_cmd(chip);
+        chip_sim_write32(chip, addr, 0);
+        break;
+
+    case CHIP_SIM_REG_STATUS_CLR_ADDR:
+        chip_sim_write32(chip, CHIP_SIM_REG_STATUS_ADDR,
+                         chip_sim_read32(chip, CHIP_SIM_REG_STATUS_ADDR) & ~value);
+        chip_sim_write32(chip, addr, 0);
+        break;
+
+    default:
+        break;
+    }
+}
+
+void chip_sim_power_on(unsigned int board)
+{
+    struct chip_sim *chip = &chip_sims[board];
+
+    chip_sim_write32(chip, CHIP_SIM_REG_CHIP_ID_ADDR, CHIP_SIM_CHIP_ID);
+    chip_sim_boot(chip);
+}
+
+void chip_sim_power_off(unsigned int board)
+{
+    struct chip_sim *chip = &chip_sims[board];
+    uint32_t ii;
+
+    if (!chip->pages)
+        return;
+
+    for (ii = 0; ii < CHIP_SIM_NUM_PAGES; ii++)
+        free(chip->pages[ii]);
+
+    free(chip->pages);
+    chip->pages = NULL;
+    chip->fw_running = false;
+}
+
+void chip_sim_hard_reset(unsigned int board)
+{
+    struct chip_sim *chip = &chip_sims[board];
+
+    chip->fw_running = false;
+    chip_sim_write32(chip, CHIP_SIM_REG_STATUS_ADDR, 0);
+}
+
+void chip_sim_read(unsigned int board, uint32_t addr, uint8_t *data, size_t len)
+{
+    chip_sim_access(&chip_sims[board], addr, data, len, false);
+}
+
+void chip_sim_write(unsigned int board, uint32_t addr, const uint8_t *data, size_t len)
+{
+    struct chip_sim *chip = &chip_sims[board];
+    uint32_t reg;
+
+    chip_sim_access(chip, addr, (uint8_t *)data, len, true);
+
+    /* Registers are only acted on when fully written. */
+    for (reg = ALIGN_SIZE(addr, sizeof(uint32_t));
+         (reg + sizeof(uint32_t)) <= (addr + len) && (reg >= addr);
+         reg += sizeof(uint32_t))
+    {
+        chip_sim_reg_written(chip, reg, chip_sim_read32(chip, reg));
+    }
+}
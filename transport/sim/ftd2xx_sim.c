@@ -0,0 +1,759 @@
+/*
+ * Copyright 2023 Morse Micro
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+
+#include "ftd2xx.h"
+#include "sim.h"
+#include "../../utilities.h"
+
+/*
+ * Stand-in for libftd2xx. libmpsse looks the FT_* symbols up with dlsym, which finds these when
+ * built with ENABLE_FTDI_SIM. Each board is an FT4232H: channel A is the SPI channel with the
+ * SDIO slave attached and channel B drives the reset line.
+ */
+
+#define FTDI_SIM_CHANNELS_PER_BOARD     (2)
+#define FTDI_SIM_MAX_CHANNELS           (SIM_MAX_BOARDS * FTDI_SIM_CHANNELS_PER_BOARD)
+#define FTDI_SIM_SPI_CHANNEL            (0)
+#define FTDI_SIM_RESET_CHANNEL          (1)
+#define FTDI_SIM_SERIAL_LEN             (24)
+#define FTDI_SIM_DESCRIPTION_LEN        (64)
+#define FTDI_SIM_LIBRARY_VERSION        (0x00010426)
+#define FTDI_SIM_DEVICE_ID              (0x04036011)
+#define FTDI_SIM_USB_SIZE_MIN           (64)
+#define FTDI_SIM_USB_SIZE_MAX           (65536)
+
+/* ADBUS3 is the default (active low) chip select on the SPI channel. */
+#define FTDI_SIM_CS_PIN                 BIT(3)
+/* GPIOL1 (ADBUS5) is the default reset line on the reset channel. */
+#define FTDI_SIM_RESET_PIN              BIT(5)
+
+/* MPSSE data shifting command bits. */
+#define MPSSE_OP_BIT_MODE               BIT(1)
+#define MPSSE_OP_DATA_OUT               BIT(4)
+#define MPSSE_OP_DATA_IN                BIT(5)
+#define MPSSE_OP_TMS                    BIT(6)
+#define MPSSE_OP_NOT_DATA               BIT(7)
+
+/* MPSSE commands that are not data shifting. */
+#define MPSSE_SET_BITS_LOW              (0x80)
+#define MPSSE_GET_BITS_LOW              (0x81)
+#define MPSSE_SET_BITS_HIGH             (0x82)
+#define MPSSE_GET_BITS_HIGH             (0x83)
+#define MPSSE_LOOPBACK_ON               (0x84)
+#define MPSSE_LOOPBACK_OFF              (0x85)
+#define MPSSE_SET_DIVISOR               (0x86)
+#define MPSSE_SEND_IMMEDIATE            (0x87)
+#define MPSSE_WAIT_IO_HIGH              (0x88)
+#define MPSSE_WAIT_IO_LOW               (0x89)
+#define MPSSE_DISABLE_DIV5              (0x8A)
+#define MPSSE_ENABLE_DIV5               (0x8B)
+#define MPSSE_ENABLE_3PHASE             (0x8C)
+#define MPSSE_DISABLE_3PHASE            (0x8D)
+#define MPSSE_CLOCK_BITS                (0x8E)
+#define MPSSE_CLOCK_BYTES               (0x8F)
+#define MPSSE_CLOCK_WAIT_HIGH           (0x94)
+#define MPSSE_CLOCK_WAIT_LOW            (0x95)
+#define MPSSE_ENABLE_ADAPTIVE           (0x96)
+#define MPSSE_DISABLE_ADAPTIVE          (0x97)
+#define MPSSE_CLOCK_BYTES_WAIT_HIGH     (0x9C)
+#define MPSSE_CLOCK_BYTES_WAIT_LOW      (0x9D)
+#define MPSSE_DRIVE_ONLY_ZERO           (0x9E)
+#define MPSSE_BAD_COMMAND               (0xFA)
+#define MPSSE_MAX_ARGS                  (3)
+
+#define MPSSE_CLOCK_HZ                  (60000000ULL)
+#define MPSSE_DIV5_CLOCK_HZ             (12000000ULL)
+
+/* Above the wiring's maximum clock, one in this many octets read from the slave is corrupted. */
+#define FTDI_SIM_CORRUPT_RATE           (256)
+
+struct ftdi_sim_stats
+{
+    /** Calls to FT_Write and FT_Read, each being a USB transfer on real hardware. */
+    uint64_t writes;
+    uint64_t reads;
+    uint64_t octets_written;
+    uint64_t octets_read;
+    /** Octets shifted on the SPI bus and the time that would take at the configured clock. */
+    uint64_t octets_clocked;
+    uint64_t wire_time_ns;
+    uint64_t cs_asserts;
+    /** Octets from the slave corrupted by clocking faster than the wiring supports. */
+    uint64_t octets_corrupted;
+    /** Changes of USB transfer size or latency timer, each a control transfer on real hardware. */
+    uint64_t usb_param_changes;
+};
+
+struct ftdi_sim_channel
+{
+    char serial_num[FTDI_SIM_SERIAL_LEN];
+    char description[FTDI_SIM_DESCRIPTION_LEN];
+    DWORD loc_id;
+    unsigned int board;
+    bool open;
+
+    /** MPSSE command being parsed, commands may be split across writes. */
+    uint8_t op;
+    uint8_t args[MPSSE_MAX_ARGS];
+    size_t num_args;
+    size_t args_needed;
+    /** Octets left to shift out for a data command. */
+    uint32_t data_left;
+
+    bool loopback;
+    bool div5;
+    uint16_t divisor;
+    uint8_t low_value;
+    uint8_t low_dir;
+    uint8_t high_value;
+    uint8_t high_dir;
+
+    /** USB transfer sizes and latency timer. They have no effect on the simulation. */
+    ULONG in_size;
+    ULONG out_size;
+    UCHAR latency;
+
+    /** Octets waiting to be read by the host. */
+    uint8_t *rx;
+    size_t rx_head;
+    size_t rx_len;
+    size_t rx_capacity;
+
+    struct ftdi_sim_stats stats;
+};
+
+static struct ftdi_sim_channel ftdi_sim_channels[FTDI_SIM_MAX_CHANNELS];
+static unsigned int ftdi_sim_num_channels;
+
+static pthread_mutex_t ftdi_sim_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool ftdi_sim_powered[SIM_MAX_BOARDS];
+static uint64_t ftdi_sim_max_clock_hz;
+static uint32_t ftdi_sim_noise = 0x2545F491;
+
+/**
+ * @brief Name the channels of the boards attached, on first use.
+ *
+ * @return  Number of channels.
+ */
+static unsigned int ftdi_sim_channels_init(void)
+{
+    const char *env = getenv(SIM_ENV_BOARDS);
+    unsigned long num_boards = env ? strtoul(env, NULL, 0) : 1;
+    unsigned int ii;
+
+    if (ftdi_sim_num_channels)
+        return ftdi_sim_num_channels;
+
+    num_boards = MAX(1UL, MIN(num_boards, (unsigned long)SIM_MAX_BOARDS));
+    ftdi_sim_num_channels = num_boards * FTDI_SIM_CHANNELS_PER_BOARD;
+
+    for (ii = 0; ii < ftdi_sim_num_channels; ii++)
+    {
+        struct ftdi_sim_channel *chan = &ftdi_sim_channels[ii];
+        unsigned int board = ii / FTDI_SIM_CHANNELS_PER_BOARD;
+        char channel = 'A' + (ii % FTDI_SIM_CHANNELS_PER_BOARD);
+
+        chan->board = board;
+        chan->loc_id = ((board + 1) << 4) | ((ii % FTDI_SIM_CHANNELS_PER_BOARD) + 1);
+        snprintf(chan->serial_num, sizeof(chan->serial_num), "MMSIM%u%c", board, channel);
+        snprintf(chan->description, sizeof(chan->description), "Morse Micro FTDI SIM %u %c",
+                 board, channel);
+    }
+
+    return ftdi_sim_num_channels;
+}
+
+static struct ftdi_sim_channel *ftdi_sim_get_channel(FT_HANDLE handle)
+{
+    struct ftdi_sim_channel *chan = handle;
+
+    if ((chan < &ftdi_sim_channels[0]) ||
+        (chan >= &ftdi_sim_channels[ftdi_sim_num_channels]) ||
+        !chan->open)
+    {
+        return NULL;
+    }
+
+    return chan;
+}
+
+static bool ftdi_sim_is_spi(struct ftdi_sim_channel *chan)
+{
+    return ((chan - ftdi_sim_channels) % FTDI_SIM_CHANNELS_PER_BOARD) == FTDI_SIM_SPI_CHANNEL;
+}
+
+static void ftdi_sim_power_on(unsigned int board)
+{
+    const char *env = getenv(SIM_ENV_MAX_CLOCK_KHZ);
+
+    if (ftdi_sim_powered[board])
+        return;
+
+    ftdi_sim_max_clock_hz = env ? (strtoull(env, NULL, 0) * 1000) : 0;
+
+    chip_sim_power_on(board);
+    sdio_sim_power_on(board);
+    ftdi_sim_powered[board] = true;
+}
+
+/**
+ * @brief Pseudo random number for fault injection (xorshift32, repeatable between runs).
+ */
+static uint32_t ftdi_sim_random(void)
+{
+    ftdi_sim_noise ^= ftdi_sim_noise << 13;
+    ftdi_sim_noise ^= ftdi_sim_noise >> 17;
+    ftdi_sim_noise ^= ftdi_sim_noise << 5;
+
+    return ftdi_sim_noise;
+}
+
+/**
+ * @brief Queue an octet to be read by the host.
+ */
+static void ftdi_sim_rx_push(struct ftdi_sim_channel *chan, uint8_t octet)
+{
+    if (chan->rx_head == chan->rx_len)
+    {
+        chan->rx_head = 0;
+        chan->rx_len = 0;
+    }
+
+    if (chan->rx_len == chan->rx_capacity)
+    {
+        size_t capacity = chan->rx_capacity ? (chan->rx_capacity * 2) : 4096;
+        uint8_t *rx = realloc(chan->rx, capacity);
+
+        if (!rx)
+            return;
+
+        chan->rx = rx;
+        chan->rx_capacity = capacity;
+    }
+
+    chan->rx[chan->rx_len++] = octet;
+}
+
+/**
+ * @brief Shift an octet on the channel's bus, into the SDIO slave on the SPI channel.
+ */
+static uint8_t ftdi_sim_clock(struct ftdi_sim_channel *chan, uint8_t mosi)
+{
+    uint64_t clock_hz = (chan->div5 ? MPSSE_DIV5_CLOCK_HZ : MPSSE_CLOCK_HZ) /
+                        ((1 + chan->divisor) * 2);
+    uint8_t miso;
+
+    chan->stats.octets_clocked++;
+    chan->stats.wire_time_ns += (8 * 1000000000ULL) / clock_hz;
+
+    if (chan->loopback)
+        return mosi;
+
+    if (!ftdi_sim_is_spi(chan))
+        return 0xFF;
+
+    miso = sdio_sim_xfer(chan->board, mosi);
+    if (ftdi_sim_max_clock_hz && (clock_hz > ftdi_sim_max_clock_hz) &&
+        !(ftdi_sim_random() % FTDI_SIM_CORRUPT_RATE))
+    {
+        miso ^= BIT(ftdi_sim_random() % 8);
+        chan->stats.octets_corrupted++;
+    }
+
+    return miso;
+}
+
+/**
+ * @brief Update the low GPIO byte, driving CS on the SPI channel and reset on the reset channel.
+ */
+static void ftdi_sim_set_low(struct ftdi_sim_channel *chan, uint8_t value, uint8_t dir)
+{
+    bool was_reset = (chan->low_dir & ~chan->low_value & FTDI_SIM_RESET_PIN);
+    bool is_reset = (dir & ~value & FTDI_SIM_RESET_PIN);
+    bool was_cs = (chan->low_dir & ~chan->low_value & FTDI_SIM_CS_PIN);
+
+    chan->low_value = value;
+    chan->low_dir = dir;
+
+    if (ftdi_sim_is_spi(chan))
+    {
+        bool cs = (dir & ~value & FTDI_SIM_CS_PIN);
+
+        if (cs && !was_cs)
+            chan->stats.cs_asserts++;
+        sdio_sim_set_cs(chan->board, cs);
+    }
+    else if (was_reset && !is_reset)
+    {
+        chip_sim_hard_reset(chan->board);
+        sdio_sim_hard_reset(chan->board);
+    }
+}
+
+/**
+ * @brief Number of argument octets following an MPSSE opcode.
+ */
+static size_t ftdi_sim_num_args(uint8_t op)
+{
+    if (!(op & MPSSE_OP_NOT_DATA))
+    {
+        /*
+         * Bit mode has a length and (for writes and TMS) a data octet, byte mode a 16-bit
+         * length.
+         */
+        if (op & (MPSSE_OP_BIT_MODE | MPSSE_OP_TMS))
+            return (op & (MPSSE_OP_DATA_OUT | MPSSE_OP_TMS)) ? 2 : 1;
+
+        return 2;
+    }
+
+    switch (op)
+    {
+    case MPSSE_SET_BITS_LOW:
+    case MPSSE_SET_BITS_HIGH:
+    case MPSSE_SET_DIVISOR:
+    case MPSSE_CLOCK_BYTES:
+    case MPSSE_CLOCK_BYTES_WAIT_HIGH:
+    case MPSSE_CLOCK_BYTES_WAIT_LOW:
+    case MPSSE_DRIVE_ONLY_ZERO:
+        return 2;
+
+    case MPSSE_CLOCK_BITS:
+        return 1;
+
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @brief Execute an MPSSE command once its arguments have been received.
+ */
+static void ftdi_sim_execute(struct ftdi_sim_channel *chan)
+{
+    uint8_t op = chan->op;
+    uint32_t ii;
+
+    if (!(op & MPSSE_OP_NOT_DATA))
+    {
+        if (op & (MPSSE_OP_BIT_MODE | MPSSE_OP_TMS))
+        {
+            /* Partial octets aren't used by the SDIO protocol, shift a whole one. */
+            uint8_t out = (op & (MPSSE_OP_DATA_OUT | MPSSE_OP_TMS)) ? chan->args[1] : 0xFF;
+            uint8_t in = ftdi_sim_clock(chan, out);
+
+            if (op & MPSSE_OP_DATA_IN)
+                ftdi_sim_rx_push(chan, in);
+        }
+        else if (op & MPSSE_OP_DATA_OUT)
+        {
+            chan->data_left = (chan->args[0] | (chan->args[1] << 8)) + 1;
+        }
+        else
+        {
+            uint32_t len = (chan->args[0] | (chan->args[1] << 8)) + 1;
+
+            for (ii = 0; ii < len; ii++)
+            {
+                uint8_t in = ftdi_sim_clock(chan, 0xFF);
+
+                if (op & MPSSE_OP_DATA_IN)
+                    ftdi_sim_rx_push(chan, in);
+            }
+        }
+        return;
+    }
+
+    switch (op)
+    {
+    case MPSSE_SET_BITS_LOW:
+        ftdi_sim_set_low(chan, chan->args[0], chan->args[1]);
+        break;
+
+    case MPSSE_SET_BITS_HIGH:
+        chan->high_value = chan->args[0];
+        chan->high_dir = chan->args[1];
+        break;
+
+    case MPSSE_GET_BITS_LOW:
+        /* Inputs are pulled up. */
+        ftdi_sim_rx_push(chan, chan->low_value | ~chan->low_dir);
+        break;
+
+    case MPSSE_GET_BITS_HIGH:
+        ftdi_sim_rx_push(chan, chan->high_value | ~chan->high_dir);
+        break;
+
+    case MPSSE_LOOPBACK_ON:
+        chan->loopback = true;
+        break;
+
+    case MPSSE_LOOPBACK_OFF:
+        chan->loopback = false;
+        break;
+
+    case MPSSE_SET_DIVISOR:
+        chan->divisor = chan->args[0] | (chan->args[1] << 8);
+        break;
+
+    case MPSSE_DISABLE_DIV5:
+        chan->div5 = false;
+        break;
+
+    case MPSSE_ENABLE_DIV5:
+        chan->div5 = true;
+        break;
+
+    case MPSSE_CLOCK_BITS:
+        ftdi_sim_clock(chan, 0xFF);
+        break;
+
+    case MPSSE_CLOCK_BYTES:
+        for (ii = 0; ii <= (chan->args[0] | (chan->args[1] << 8)); ii++)
+            ftdi_sim_clock(chan, 0xFF);
+        break;
+
+    case MPSSE_SEND_IMMEDIATE:
+    case MPSSE_WAIT_IO_HIGH:
+    case MPSSE_WAIT_IO_LOW:
+    case MPSSE_ENABLE_3PHASE:
+    case MPSSE_DISABLE_3PHASE:
+    case MPSSE_CLOCK_WAIT_HIGH:
+    case MPSSE_CLOCK_WAIT_LOW:
+    case MPSSE_ENABLE_ADAPTIVE:
+    case MPSSE_DISABLE_ADAPTIVE:
+    case MPSSE_CLOCK_BYTES_WAIT_HIGH:
+    case MPSSE_CLOCK_BYTES_WAIT_LOW:
+    case MPSSE_DRIVE_ONLY_ZERO:
+        break;
+
+    default:
+        ftdi_sim_rx_push(chan, MPSSE_BAD_COMMAND);
+        ftdi_sim_rx_push(chan, op);
+        break;
+    }
+}
+
+/**
+ * @brief Feed octets written by the host through the MPSSE command parser.
+ */
+static void ftdi_sim_process(struct ftdi_sim_channel *chan, const uint8_t *data, size_t len)
+{
+    size_t ii;
+
+    for (ii = 0; ii < len; ii++)
+    {
+        if (chan->data_left)
+        {
+            uint8_t in = ftdi_sim_clock(chan, data[ii]);
+
+            if (chan->op & MPSSE_OP_DATA_IN)
+                ftdi_sim_rx_push(chan, in);
+            chan->data_left--;
+        }
+        else if (chan->num_args < chan->args_needed)
+        {
+            chan->args[chan->num_args++] = data[ii];
+            if (chan->num_args == chan->args_needed)
+                ftdi_sim_execute(chan);
+        }
+        else
+        {
+            chan->op = data[ii];
+            chan->num_args = 0;
+            chan->args_needed = ftdi_sim_num_args(chan->op);
+            if (!chan->args_needed)
+                ftdi_sim_execute(chan);
+        }
+    }
+}
+
+static void ftdi_sim_print_stats(struct ftdi_sim_channel *chan)
+{
+    struct ftdi_sim_stats *stats = &chan->stats;
+
+    mctrl_err("FTDI SIM channel %s statistics\n", chan->serial_num);
+    mctrl_err("USB writes:            %" PRIu64 " (%" PRIu64 " octets)\n",
+              stats->writes, stats->octets_written);
+    mctrl_err("USB reads:             %" PRIu64 " (%" PRIu64 " octets)\n",
+              stats->reads, stats->octets_read);
+    mctrl_err("SPI octets clocked:    %" PRIu64 "\n", stats->octets_clocked);
+    mctrl_err("SPI CS asserts:        %" PRIu64 "\n", stats->cs_asserts);
+    mctrl_err("SPI octets corrupted:  %" PRIu64 "\n", stats->octets_corrupted);
+    mctrl_err("SPI wire time:         %" PRIu64 " us\n", stats->wire_time_ns / 1000);
+    mctrl_err("USB parameter changes: %" PRIu64 "\n", stats->usb_param_changes);
+    sdio_sim_print_stats(chan->board);
+}
+
+FT_STATUS WINAPI FT_GetLibraryVersion(LPDWORD lpdwDLLVersion)
+{
+    *lpdwDLLVersion = FTDI_SIM_LIBRARY_VERSION;
+    return FT_OK;
+}
+
+FT_STATUS WINAPI FT_CreateDeviceInfoList(LPDWORD lpdwNumDevs)
+{
+    *lpdwNumDevs = ftdi_sim_channels_init();
+    return FT_OK;
+}
+
+FT_STATUS WINAPI FT_GetDeviceInfoList(FT_DEVICE_LIST_INFO_NODE *pDest, LPDWORD lpdwNumDevs)
+{
+    unsigned int num_channels = ftdi_sim_channels_init();
+    unsigned int ii;
+
+    for (ii = 0; ii < num_channels; ii++)
+    {
+        struct ftdi_sim_channel *chan = &ftdi_sim_channels[ii];
+
+        memset(&pDest[ii], 0, sizeof(pDest[ii]));
+        pDest[ii].Type = FT_DEVICE_4232H;
+        pDest[ii].ID = FTDI_SIM_DEVICE_ID;
+        pDest[ii].LocId = chan->loc_id;
+        /* Names are cut to the D2XX fields, which are smaller than ours. */
+        snprintf(pDest[ii].SerialNumber, sizeof(pDest[ii].SerialNumber), "%.*s",
+                 (int)sizeof(pDest[ii].SerialNumber) - 1, chan->serial_num);
+        snprintf(pDest[ii].Description, sizeof(pDest[ii].Description), "%.*s",
+                 (int)sizeof(pDest[ii].Description) - 1, chan->description);
+        pDest[ii].ftHandle = chan->open ? chan : NULL;
+    }
+    *lpdwNumDevs = num_channels;
+
+    return FT_OK;
+}
+
+FT_STATUS WINAPI FT_GetDeviceInfo(FT_HANDLE ftHandle, FT_DEVICE *lpftDevice, LPDWORD lpdwID,
+                                  PCHAR pcSerialNumber, PCHAR pcDescription, LPVOID pvDummy)
+{
+    struct ftdi_sim_channel *chan = ftdi_sim_get_channel(ftHandle);
+
+    if (!chan)
+        return FT_INVALID_HANDLE;
+
+    *lpftDevice = FT_DEVICE_4232H;
+    *lpdwID = FTDI_SIM_DEVICE_ID;
+    strcpy(pcSerialNumber, chan->serial_num);
+    strcpy(pcDescription, chan->description);
+
+    return FT_OK;
+}
+
+FT_STATUS WINAPI FT_Open(int deviceNumber, FT_HANDLE *pHandle)
+{
+    struct ftdi_sim_channel *chan;
+
+    if ((deviceNumber < 0) || (deviceNumber >= (int)ftdi_sim_channels_init()))
+        return FT_DEVICE_NOT_FOUND;
+
+    chan = &ftdi_sim_channels[deviceNumber];
+    if (chan->open)
+        return FT_DEVICE_NOT_OPENED;
+
+    pthread_mutex_lock(&ftdi_sim_lock);
+    ftdi_sim_power_on(chan->board);
+    chan->open = true;
+    chan->loopback = false;
+    chan->args_needed = 0;
+    chan->num_args = 0;
+    chan->data_left = 0;
+    chan->rx_head = 0;
+    chan->rx_len = 0;
+    memset(&chan->stats, 0, sizeof(chan->stats));
+    pthread_mutex_unlock(&ftdi_sim_lock);
+
+    *pHandle = chan;
+
+    return FT_OK;
+}
+
+FT_STATUS WINAPI FT_Close(FT_HANDLE ftHandle)
+{
+    struct ftdi_sim_channel *chan = ftdi_sim_get_channel(ftHandle);
+    struct ftdi_sim_channel *board_chans;
+    int ii;
+
+    if (!chan)
+        return FT_INVALID_HANDLE;
+
+    pthread_mutex_lock(&ftdi_sim_lock);
+    if (ftdi_sim_is_spi(chan) && getenv(SIM_ENV_STATS))
+        ftdi_sim_print_stats(chan);
+
+    chan->open = false;
+    free(chan->rx);
+    chan->rx = NULL;
+    chan->rx_capacity = 0;
+
+    /* The board powers off once both of its channels are closed. */
+    board_chans = &ftdi_sim_channels[chan->board * FTDI_SIM_CHANNELS_PER_BOARD];
+    for (ii = 0; ii < FTDI_SIM_CHANNELS_PER_BOARD; ii++)
+    {
+        if (board_chans[ii].open)
+            break;
+    }
+
+    if (ii == FTDI_SIM_CHANNELS_PER_BOARD)
+    {
+        chip_sim_power_off(chan->board);
+        ftdi_sim_powered[chan->board] = false;
+    }
+    pthread_mutex_unlock(&ftdi_sim_lock);
+
+    return FT_OK;
+}
+
+FT_STATUS WINAPI FT_ResetDevice(FT_HANDLE ftHandle)
+{
+    return ftdi_sim_get_channel(ftHandle) ? FT_OK : FT_INVALID_HANDLE;
+}
+
+FT_STATUS WINAPI FT_Purge(FT_HANDLE ftHandle, ULONG ulMask)
+{
+    struct ftdi_sim_channel *chan = ftdi_sim_get_channel(ftHandle);
+
+    if (!chan)
+        return FT_INVALID_HANDLE;
+
+    pthread_mutex_lock(&ftdi_sim_lock);
+    if (ulMask & FT_PURGE_RX)
+    {
+        chan->rx_head = 0;
+        chan->rx_len = 0;
+    }
+    if (ulMask & FT_PURGE_TX)
+    {
+        chan->args_needed = 0;
+        chan->num_args = 0;
+        chan->data_left = 0;
+    }
+    pthread_mutex_unlock(&ftdi_sim_lock);
+
+    return FT_OK;
+}
+
+FT_STATUS WINAPI FT_SetUSBParameters(FT_HANDLE ftHandle, ULONG ulInTransferSize,
+                                     ULONG ulOutTransferSize)
+{
+    struct ftdi_sim_channel *chan = ftdi_sim_get_channel(ftHandle);
+
+    if (!chan)
+        return FT_INVALID_HANDLE;
+
+    if ((ulInTransferSize < FTDI_SIM_USB_SIZE_MIN) || (ulInTransferSize > FTDI_SIM_USB_SIZE_MAX) ||
+        (ulInTransferSize % FTDI_SIM_USB_SIZE_MIN))
+        return FT_INVALID_PARAMETER;
+
+    if ((chan->in_size != ulInTransferSize) || (chan->out_size != ulOutTransferSize))
+        chan->stats.usb_param_changes++;
+
+    chan->in_size = ulInTransferSize;
+    chan->out_size = ulOutTransferSize;
+
+    return FT_OK;
+}
+
+FT_STATUS WINAPI FT_SetChars(FT_HANDLE ftHandle, UCHAR uEventChar, UCHAR uEventCharEnabled,
+                             UCHAR uErrorChar, UCHAR uErrorCharEnabled)
+{
+    return ftdi_sim_get_channel(ftHandle) ? FT_OK : FT_INVALID_HANDLE;
+}
+
+FT_STATUS WINAPI FT_SetTimeouts(FT_HANDLE ftHandle, ULONG dwReadTimeout, ULONG dwWriteTimeout)
+{
+    return ftdi_sim_get_channel(ftHandle) ? FT_OK : FT_INVALID_HANDLE;
+}
+
+FT_STATUS WINAPI FT_GetLatencyTimer(FT_HANDLE ftHandle, PUCHAR pucLatency)
+{
+    if (!ftdi_sim_get_channel(ftHandle))
+        return FT_INVALID_HANDLE;
+
+    *pucLatency = ftdi_sim_get_channel(ftHandle)->latency;
+
+    return FT_OK;
+}
+
+FT_STATUS WINAPI FT_SetLatencyTimer(FT_HANDLE ftHandle, UCHAR ucLatency)
+{
+    struct ftdi_sim_channel *chan = ftdi_sim_get_channel(ftHandle);
+
+    if (!chan)
+        return FT_INVALID_HANDLE;
+
+    if (chan->latency != ucLatency)
+        chan->stats.usb_param_changes++;
+
+    chan->latency = ucLatency;
+
+    return FT_OK;
+}
+
+FT_STATUS WINAPI FT_SetBitMode(FT_HANDLE ftHandle, UCHAR ucMask, UCHAR ucEnable)
+{
+    return ftdi_sim_get_channel(ftHandle) ? FT_OK : FT_INVALID_HANDLE;
+}
+
+FT_STATUS WINAPI FT_GetQueueStatus(FT_HANDLE ftHandle, DWORD *dwRxBytes)
+{
+    struct ftdi_sim_channel *chan = ftdi_sim_get_channel(ftHandle);
+
+    if (!chan)
+        return FT_INVALID_HANDLE;
+
+    pthread_mutex_lock(&ftdi_sim_lock);
+    *dwRxBytes = chan->rx_len - chan->rx_head;
+    pthread_mutex_unlock(&ftdi_sim_lock);
+
+    return FT_OK;
+}
+
+FT_STATUS WINAPI FT_Read(FT_HANDLE ftHandle, LPVOID lpBuffer, DWORD dwBytesToRead,
+                         LPDWORD lpdwBytesReturned)
+{
+    struct ftdi_sim_channel *chan = ftdi_sim_get_channel(ftHandle);
+    size_t len;
+
+    if (!chan)
+        return FT_INVALID_HANDLE;
+
+    /* Everything written has already been clocked, so a short read is a timeout. */
+    pthread_mutex_lock(&ftdi_sim_lock);
+    len = MIN((size_t)dwBytesToRead, chan->rx_len - chan->rx_head);
+    memcpy(lpBuffer, &chan->rx[chan->rx_head], len);
+    chan->rx_head += len;
+    chan->stats.reads++;
+    chan->stats.octets_read += len;
+    pthread_mutex_unlock(&ftdi_sim_lock);
+
+    *lpdwBytesReturned = len;
+
+    return FT_OK;
+}
+
+FT_STATUS WINAPI FT_Write(FT_HANDLE ftHandle, LPVOID lpBuffer, DWORD dwBytesToWrite,
+                          LPDWORD lpdwBytesWritten)
+{
+    struct ftdi_sim_channel *chan = ftdi_sim_get_channel(ftHandle);
+
+    if (!chan)
+        return FT_INVALID_HANDLE;
+
+    pthread_mutex_lock(&ftdi_sim_lock);
+    ftdi_sim_process(chan, lpBuffer, dwBytesToWrite);
+    chan->stats.writes++;
+    chan->stats.octets_written += dwBytesToWrite;
+    pthread_mutex_unlock(&ftdi_sim_lock);
+
+    *lpdwBytesWritten = dwBytesToWrite;
+
+    return FT_OK;
+}
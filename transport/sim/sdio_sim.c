@@ -0,0 +1,618 @@
+/*
+ * Copyright 2023 Morse Micro
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "sim.h"
+#include "../../utilities.h"
+
+#define SDIO_SIM_CMD_LEN                (6)
+#define SDIO_SIM_CMD_START_MASK         (0xC0)
+#define SDIO_SIM_CMD_START              (0x40)
+#define SDIO_SIM_CMD_INDEX_MASK         (0x3F)
+
+#define SDIO_SIM_JUNK                   (0xFF)
+#define SDIO_SIM_MULTI_BLOCK_TOKEN      (0xFC)
+#define SDIO_SIM_STOP_TOKEN             (0xFD)
+#define SDIO_SIM_SINGLE_BLOCK_TOKEN     (0xFE)
+#define SDIO_SIM_DATA_ACCEPTED          (0x05)
+#define SDIO_SIM_DATA_CRC_ERROR         (0x0B)
+#define SDIO_SIM_BUSY                   (0x00)
+#define SDIO_SIM_CRC_LEN                (2)
+
+/* Response flags (R1 and first octet of R5). */
+#define SDIO_SIM_R1_IDLE                BIT(0)
+#define SDIO_SIM_R1_ILLEGAL_CMD         BIT(2)
+#define SDIO_SIM_R1_CRC_ERROR           BIT(3)
+#define SDIO_SIM_R1_FUNC_ERROR          BIT(4)
+#define SDIO_SIM_R1_PARAM_ERROR         BIT(6)
+
+/* Octets of delay before a command response (Ncr), a read data token (Nac) and after a write. */
+#define SDIO_SIM_NCR_OCTETS             (1)
+#define SDIO_SIM_NAC_OCTETS             (4)
+#define SDIO_SIM_BUSY_OCTETS            (2)
+
+/* CMD52/53 argument fields. */
+#define SDIO_SIM_ARG_WRITE              BIT(31)
+#define SDIO_SIM_ARG_FUNC(arg)          (((arg) >> 28) & 0x7)
+#define SDIO_SIM_ARG_RAW                BIT(27)
+#define SDIO_SIM_ARG_BLOCK_MODE         BIT(27)
+#define SDIO_SIM_ARG_ADDR(arg)          (((arg) >> 9) & 0x1FFFF)
+#define SDIO_SIM_ARG_DATA(arg)          ((arg) & 0xFF)
+#define SDIO_SIM_ARG_COUNT(arg)         ((arg) & 0x1FF)
+#define SDIO_SIM_MAX_BYTE_COUNT         (512)
+
+#define SDIO_SIM_FUNC_CIA               (0)
+#define SDIO_SIM_FUNC_MEM               (2)
+
+/* Keyhole registers in the function 2 register space, selecting the upper 16 address bits. */
+#define SDIO_SIM_KEYHOLE_WIN0           (0x10000)
+#define SDIO_SIM_KEYHOLE_WIN1           (0x10001)
+#define SDIO_SIM_KEYHOLE_CFG            (0x10002)
+
+/* Function 0 (CIA) register space: CCCR, FBRs and the function 2 CIS. */
+#define SDIO_SIM_CIA_SIZE               (0x2000)
+#define SDIO_SIM_FBR_ADDR(func)         ((func) * 0x100)
+#define SDIO_SIM_FBR_CIS_PTR_OFFSET     (0x09)
+#define SDIO_SIM_FBR_BLOCK_SIZE_OFFSET  (0x10)
+#define SDIO_SIM_CIS_ADDR               (0x1000)
+#define SDIO_SIM_CISTPL_MANFID          (0x20)
+#define SDIO_SIM_CISTPL_FUNCE           (0x22)
+#define SDIO_SIM_CISTPL_END             (0xFF)
+#define SDIO_SIM_MANFID_LEN             (4)
+#define SDIO_SIM_FUNCE_LEN              (0x2A)
+#define SDIO_SIM_FUNCE_TYPE_FUNC        (0x01)
+#define SDIO_SIM_FUNCE_MAX_BLK_OFFSET   (0x0C)
+#define SDIO_SIM_VENDOR_ID              (0x325B)
+#define SDIO_SIM_DEVICE_ID              (0x0306)
+
+#define SDIO_SIM_DEFAULT_MAX_BLOCK_SIZE (2048)
+#define SDIO_SIM_MAX_BLOCK_SIZE         (4096)
+
+/* Big enough for the largest read block with its delays, token and CRC. */
+#define SDIO_SIM_OUT_SIZE               (SDIO_SIM_MAX_BLOCK_SIZE + 64)
+
+enum sdio_sim_state
+{
+    /** Waiting for the start of a command. */
+    SDIO_SIM_STATE_IDLE,
+    /** Receiving a command. */
+    SDIO_SIM_STATE_CMD,
+    /** CMD53 write, waiting for a data start token. */
+    SDIO_SIM_STATE_WRITE_TOKEN,
+    /** CMD53 write, receiving a block and its CRC. */
+    SDIO_SIM_STATE_WRITE_DATA,
+    /** CMD53 read, sending blocks. */
+    SDIO_SIM_STATE_READ,
+};
+
+struct sdio_sim_stats
+{
+    uint64_t cmd52;
+    uint64_t cmd53_read;
+    uint64_t cmd53_write;
+    uint64_t blocks_read;
+    uint64_t blocks_written;
+    uint64_t cmd_crc_errors;
+    uint64_t data_crc_errors;
+    uint64_t errors;
+};
+
+struct sdio_sim
+{
+    /** Board the slave is on, to reach its chip. */
+    unsigned int board;
+    bool cs;
+    bool spi_mode;
+    enum sdio_sim_state state;
+    uint8_t cmd[SDIO_SIM_CMD_LEN];
+    size_t cmd_len;
+
+    /** CMD53 in progress. */
+    uint32_t addr;
+    uint32_t block_size;
+    uint32_t blocks_left;
+    uint8_t block[SDIO_SIM_MAX_BLOCK_SIZE + SDIO_SIM_CRC_LEN];
+    size_t block_len;
+
+    /** Octets queued to be clocked out. */
+    uint8_t out[SDIO_SIM_OUT_SIZE];
+    size_t out_head;
+    size_t out_len;
+
+    uint8_t cia[SDIO_SIM_CIA_SIZE];
+    uint8_t win0;
+    uint8_t win1;
+    uint8_t cfg;
+
+    struct sdio_sim_stats stats;
+};
+
+static struct sdio_sim sdio_sims[SIM_MAX_BOARDS];
+
+/**
+ * @brief CRC7 of an SDIO command (polynomial x^7 + x^3 + 1).
+ */
+static uint8_t sdio_sim_crc7(const uint8_t *data, size_t len)
+{
+    uint8_t crc = 0;
+    size_t ii;
+    int bit;
+
+    for (ii = 0; ii < len; ii++)
+    {
+        for (bit = 7; bit >= 0; bit--)
+        {
+            uint8_t in = ((data[ii] >> bit) & 1) ^ ((crc >> 6) & 1);
+
+            crc = (crc << 1) & 0x7F;
+            if (in)
+                crc ^= 0x09;
+        }
+    }
+
+    return crc;
+}
+
+/**
+ * @brief CRC16 of a data block (CCITT polynomial x^16 + x^12 + x^5 + 1, zero seed).
+ */
+static uint16_t sdio_sim_crc16(const uint8_t *data, size_t len)
+{
+    uint16_t crc = 0;
+    size_t ii;
+    int bit;
+
+    for (ii = 0; ii < len; ii++)
+    {
+        crc ^= data[ii] << 8;
+        for (bit = 0; bit < 8; bit++)
+            crc = (crc & 0x8000) ? ((crc << 1) ^ 0x1021) : (crc << 1);
+    }
+
+    return crc;
+}
+
+static uint16_t sdio_sim_fn_block_size(struct sdio_sim *sim, uint8_t func)
+{
+    uint32_t addr = SDIO_SIM_FBR_ADDR(func) + SDIO_SIM_FBR_BLOCK_SIZE_OFFSET;
+
+    return sim->cia[addr] | (sim->cia[addr + 1] << 8);
+}
+
+static void sdio_sim_set_fn_block_size(struct sdio_sim *sim, uint8_t func, uint16_t block_size)
+{
+    uint32_t addr = SDIO_SIM_FBR_ADDR(func) + SDIO_SIM_FBR_BLOCK_SIZE_OFFSET;
+
+    sim->cia[addr] = block_size & 0xFF;
+    sim->cia[addr + 1] = block_size >> 8;
+}
+
+/**
+ * @brief Queue octets to be clocked out after anything already queued.
+ */
+static void sdio_sim_push(struct sdio_sim *sim, const uint8_t *data, size_t len)
+{
+    if (sim->out_head == sim->out_len)
+    {
+        sim->out_head = 0;
+        sim->out_len = 0;
+    }
+
+    len = MIN(len, SDIO_SIM_OUT_SIZE - sim->out_len);
+    memcpy(&sim->out[sim->out_len], data, len);
+    sim->out_len += len;
+}
+
+static void sdio_sim_push_octet(struct sdio_sim *sim, uint8_t octet, size_t count)
+{
+    while (count--)
+        sdio_sim_push(sim, &octet, 1);
+}
+
+/**
+ * @brief Queue a command response: Ncr delay then an R1 or R5.
+ *
+ * @param flags     Response flags.
+ * @param data      R5 data octet.
+ * @param r5        Whether this is an R5 (otherwise R1).
+ */
+static void sdio_sim_respond(struct sdio_sim *sim, uint8_t flags, uint8_t data, bool r5)
+{
+    sdio_sim_push_octet(sim, SDIO_SIM_JUNK, SDIO_SIM_NCR_OCTETS);
+    sdio_sim_push(sim, &flags, 1);
+    if (r5)
+        sdio_sim_push(sim, &data, 1);
+
+    if (flags & ~SDIO_SIM_R1_IDLE)
+        sim->stats.errors++;
+}
+
+/**
+ * @brief Initialise the CIA: default block sizes and a CIS advertising the maximum block size.
+ */
+static void sdio_sim_init_cia(struct sdio_sim *sim)
+{
+    uint8_t *cis = &sim->cia[SDIO_SIM_CIS_ADDR];
+    uint32_t cis_ptr_addr = SDIO_SIM_FBR_ADDR(SDIO_SIM_FUNC_MEM) + SDIO_SIM_FBR_CIS_PTR_OFFSET;
+    uint32_t max_block_size = SDIO_SIM_DEFAULT_MAX_BLOCK_SIZE;
+    const char *env = getenv(SIM_ENV_MAX_BLOCK_SIZE);
+
+    if (env)
+        max_block_size = MIN(strtoul(env, NULL, 0), SDIO_SIM_MAX_BLOCK_SIZE);
+
+    memset(sim->cia, 0, sizeof(sim->cia));
+    sdio_sim_set_fn_block_size(sim, 0, 4);
+    sdio_sim_set_fn_block_size(sim, 1, 8);
+    sdio_sim_set_fn_block_size(sim, SDIO_SIM_FUNC_MEM, 512);
+
+    sim->cia[cis_ptr_addr] = SDIO_SIM_CIS_ADDR & 0xFF;
+    sim->cia[cis_ptr_addr + 1] = (SDIO_SIM_CIS_ADDR >> 8) & 0xFF;
+    sim->cia[cis_ptr_addr + 2] = (SDIO_SIM_CIS_ADDR >> 16) & 0xFF;
+
+    *cis++ = SDIO_SIM_CISTPL_MANFID;
+    *cis++ = SDIO_SIM_MANFID_LEN;
+    *cis++ = SDIO_SIM_VENDOR_ID & 0xFF;
+    *cis++ = SDIO_SIM_VENDOR_ID >> 8;
+    *cis++ = SDIO_SIM_DEVICE_ID & 0xFF;
+    *cis++ = SDIO_SIM_DEVICE_ID >> 8;
+
+    *cis++ = SDIO_SIM_CISTPL_FUNCE;
+    *cis++ = SDIO_SIM_FUNCE_LEN;
+    cis[0] = SDIO_SIM_FUNCE_TYPE_FUNC;
+    cis[SDIO_SIM_FUNCE_MAX_BLK_OFFSET] = max_block_size & 0xFF;
+    cis[SDIO_SIM_FUNCE_MAX_BLK_OFFSET + 1] = max_block_size >> 8;
+    cis += SDIO_SIM_FUNCE_LEN;
+
+    *cis = SDIO_SIM_CISTPL_END;
+}
+
+/**
+ * @brief Chip address accessed through the keyhole.
+ */
+static uint32_t sdio_sim_chip_addr(struct sdio_sim *sim, uint32_t addr)
+{
+    return ((uint32_t)sim->win1 << 24) | ((uint32_t)sim->win0 << 16) | (addr & 0xFFFF);
+}
+
+/**
+ * @brief Access a single octet of a function's register space.
+ *
+ * @param func      Function.
+ * @param addr      Register address.
+ * @param write     Whether this is a write (otherwise it is a read).
+ * @param data      Value to write, filled with the register value.
+ * @return          Response flags.
+ */
+static uint8_t sdio_sim_reg_access(struct sdio_sim *sim, uint8_t func, uint32_t addr, bool write,
+                                   uint8_t *data)
+{
+    uint8_t *reg = NULL;
+    uint8_t chip_octet;
+
+    if (func == SDIO_SIM_FUNC_CIA)
+    {
+        if (addr >= SDIO_SIM_CIA_SIZE)
+            return SDIO_SIM_R1_PARAM_ERROR;
+
+        /* The CIS is read only. */
+        if (write && (addr >= SDIO_SIM_CIS_ADDR))
+            return SDIO_SIM_R1_PARAM_ERROR;
+
+        reg = &sim->cia[addr];
+    }
+    else if (func == SDIO_SIM_FUNC_MEM)
+    {
+        if (addr == SDIO_SIM_KEYHOLE_WIN0)
+        {
+            reg = &sim->win0;
+        }
+        else if (addr == SDIO_SIM_KEYHOLE_WIN1)
+        {
+            reg = &sim->win1;
+        }
+        else if (addr == SDIO_SIM_KEYHOLE_CFG)
+        {
+            reg = &sim->cfg;
+        }
+        else if (addr < SDIO_SIM_KEYHOLE_WIN0)
+        {
+            if (write)
+                chip_sim_write(sim->board, sdio_sim_chip_addr(sim, addr), data, 1);
+            chip_sim_read(sim->board, sdio_sim_chip_addr(sim, addr), &chip_octet, 1);
+            reg = &chip_octet;
+        }
+        else
+        {
+            return SDIO_SIM_R1_PARAM_ERROR;
+        }
+    }
+    else
+    {
+        return SDIO_SIM_R1_FUNC_ERROR;
+    }
+
+    if (write)
+        *reg = *data;
+    *data = *reg;
+
+    return 0;
+}
+
+static void sdio_sim_cmd52(struct sdio_sim *sim, uint32_t arg)
+{
+    bool write = (arg & SDIO_SIM_ARG_WRITE);
+    uint8_t data = SDIO_SIM_ARG_DATA(arg);
+    uint8_t flags;
+
+    sim->stats.cmd52++;
+    flags = sdio_sim_reg_access(sim, SDIO_SIM_ARG_FUNC(arg), SDIO_SIM_ARG_ADDR(arg), write, &data);
+
+    /* Without read after write the R5 carries the value written. */
+    if (write && !(arg & SDIO_SIM_ARG_RAW))
+        data = SDIO_SIM_ARG_DATA(arg);
+
+    sdio_sim_respond(sim, flags, data, true);
+}
+
+static void sdio_sim_cmd53(struct sdio_sim *sim, uint32_t arg)
+{
+    bool write = (arg & SDIO_SIM_ARG_WRITE);
+    uint8_t func = SDIO_SIM_ARG_FUNC(arg);
+    uint32_t count = SDIO_SIM_ARG_COUNT(arg);
+    uint32_t addr = SDIO_SIM_ARG_ADDR(arg);
+
+    if (write)
+        sim->stats.cmd53_write++;
+    else
+        sim->stats.cmd53_read++;
+
+    if (func != SDIO_SIM_FUNC_MEM)
+    {
+        sdio_sim_respond(sim, SDIO_SIM_R1_FUNC_ERROR, 0, true);
+        return;
+    }
+
+    if (arg & SDIO_SIM_ARG_BLOCK_MODE)
+    {
+        sim->block_size = sdio_sim_fn_block_size(sim, func);
+        sim->blocks_left = count;
+    }
+    else
+    {
+        sim->block_size = count ? count : SDIO_SIM_MAX_BYTE_COUNT;
+        sim->blocks_left = 1;
+    }
+
+    /* Infinite block transfers are not supported, nor are windows crossing 64k. */
+    if (!sim->blocks_left || !sim->block_size ||
+        (sim->block_size > SDIO_SIM_MAX_BLOCK_SIZE) ||
+        ((addr & 0xFFFF) + (sim->block_size * sim->blocks_left) > BIT(16)))
+    {
+        sdio_sim_respond(sim, SDIO_SIM_R1_PARAM_ERROR, 0, true);
+        return;
+    }
+
+    sim->addr = sdio_sim_chip_addr(sim, addr);
+    sim->state = write ? SDIO_SIM_STATE_WRITE_TOKEN : SDIO_SIM_STATE_READ;
+    sdio_sim_respond(sim, 0, 0, true);
+}
+
+/**
+ * @brief Queue the next block of a CMD53 read: Nac delay, start token, data and CRC.
+ */
+static void sdio_sim_queue_read_block(struct sdio_sim *sim)
+{
+    uint8_t *block = sim->block;
+    uint16_t crc;
+
+    chip_sim_read(sim->board, sim->addr, block, sim->block_size);
+    crc = sdio_sim_crc16(block, sim->block_size);
+    block[sim->block_size] = crc >> 8;
+    block[sim->block_size + 1] = crc & 0xFF;
+
+    sdio_sim_push_octet(sim, SDIO_SIM_JUNK, SDIO_SIM_NAC_OCTETS);
+    sdio_sim_push_octet(sim, SDIO_SIM_SINGLE_BLOCK_TOKEN, 1);
+    sdio_sim_push(sim, block, sim->block_size + SDIO_SIM_CRC_LEN);
+
+    sim->stats.blocks_read++;
+    sim->addr += sim->block_size;
+    if (!--sim->blocks_left)
+        sim->state = SDIO_SIM_STATE_IDLE;
+}
+
+/**
+ * @brief Handle a received block of a CMD53 write.
+ */
+static void sdio_sim_write_block(struct sdio_sim *sim)
+{
+    uint8_t *crc = &sim->block[sim->block_size];
+
+    if (sdio_sim_crc16(sim->block, sim->block_size) != ((crc[0] << 8) | crc[1]))
+    {
+        sim->stats.data_crc_errors++;
+        sdio_sim_push_octet(sim, SDIO_SIM_DATA_CRC_ERROR, 1);
+        sim->state = SDIO_SIM_STATE_IDLE;
+        return;
+    }
+
+    chip_sim_write(sim->board, sim->addr, sim->block, sim->block_size);
+    sdio_sim_push_octet(sim, SDIO_SIM_DATA_ACCEPTED, 1);
+    sdio_sim_push_octet(sim, SDIO_SIM_BUSY, SDIO_SIM_BUSY_OCTETS);
+
+    sim->stats.blocks_written++;
+    sim->addr += sim->block_size;
+    if (--sim->blocks_left)
+        sim->state = SDIO_SIM_STATE_WRITE_TOKEN;
+    else
+        sim->state = SDIO_SIM_STATE_IDLE;
+}
+
+/**
+ * @brief Handle a complete command.
+ */
+static void sdio_sim_command(struct sdio_sim *sim)
+{
+    uint8_t index = sim->cmd[0] & SDIO_SIM_CMD_INDEX_MASK;
+    uint32_t arg = ((uint32_t)sim->cmd[1] << 24) | (sim->cmd[2] << 16) |
+                   (sim->cmd[3] << 8) | sim->cmd[4];
+
+    /* Only CMD63 is recognised until SPI mode has been entered. */
+    if (!sim->spi_mode && (index != 63))
+        return;
+
+    if (((sdio_sim_crc7(sim->cmd, SDIO_SIM_CMD_LEN - 1) << 1) | 1) != sim->cmd[5])
+    {
+        sim->stats.cmd_crc_errors++;
+        sdio_sim_respond(sim, SDIO_SIM_R1_CRC_ERROR, 0, false);
+        return;
+    }
+
+    switch (index)
+    {
+    case 0:
+        sdio_sim_respond(sim, SDIO_SIM_R1_IDLE, 0, false);
+        break;
+
+    case 63:
+        sim->spi_mode = true;
+        sdio_sim_respond(sim, SDIO_SIM_R1_IDLE, 0, false);
+        break;
+
+    case 52:
+        sdio_sim_cmd52(sim, arg);
+        break;
+
+    case 53:
+        sdio_sim_cmd53(sim, arg);
+        break;
+
+    default:
+        sdio_sim_respond(sim, SDIO_SIM_R1_ILLEGAL_CMD, 0, false);
+        break;
+    }
+}
+
+/**
+ * @brief Process an octet received from the master.
+ */
+static void sdio_sim_receive(struct sdio_sim *sim, uint8_t mosi)
+{
+    switch (sim->state)
+    {
+    case SDIO_SIM_STATE_IDLE:
+        if ((mosi & SDIO_SIM_CMD_START_MASK) == SDIO_SIM_CMD_START)
+        {
+            sim->cmd[0] = mosi;
+            sim->cmd_len = 1;
+            sim->state = SDIO_SIM_STATE_CMD;
+        }
+        break;
+
+    case SDIO_SIM_STATE_CMD:
+        sim->cmd[sim->cmd_len++] = mosi;
+        if (sim->cmd_len == SDIO_SIM_CMD_LEN)
+        {
+            sim->state = SDIO_SIM_STATE_IDLE;
+            sdio_sim_command(sim);
+        }
+        break;
+
+    case SDIO_SIM_STATE_WRITE_TOKEN:
+        if ((mosi == SDIO_SIM_MULTI_BLOCK_TOKEN) || (mosi == SDIO_SIM_SINGLE_BLOCK_TOKEN))
+        {
+            sim->block_len = 0;
+            sim->state = SDIO_SIM_STATE_WRITE_DATA;
+        }
+        else if (mosi != SDIO_SIM_JUNK)
+        {
+            /* Stop token or a new command abandons the write. */
+            sim->state = SDIO_SIM_STATE_IDLE;
+            if (mosi != SDIO_SIM_STOP_TOKEN)
+                sdio_sim_receive(sim, mosi);
+        }
+        break;
+
+    case SDIO_SIM_STATE_WRITE_DATA:
+        sim->block[sim->block_len++] = mosi;
+        if (sim->block_len == (sim->block_size + SDIO_SIM_CRC_LEN))
+            sdio_sim_write_block(sim);
+        break;
+
+    case SDIO_SIM_STATE_READ:
+        /* The master clocks junk while reading. */
+        break;
+    }
+}
+
+void sdio_sim_power_on(unsigned int board)
+{
+    struct sdio_sim *sim = &sdio_sims[board];
+
+    memset(sim, 0, sizeof(*sim));
+    sim->board = board;
+    sdio_sim_init_cia(sim);
+    sim->spi_mode = true;
+}
+
+void sdio_sim_hard_reset(unsigned int board)
+{
+    struct sdio_sim *sim = &sdio_sims[board];
+    struct sdio_sim_stats stats = sim->stats;
+
+    sdio_sim_power_on(board);
+    sim->stats = stats;
+    sim->spi_mode = false;
+}
+
+void sdio_sim_set_cs(unsigned int board, bool asserted)
+{
+    struct sdio_sim *sim = &sdio_sims[board];
+
+    if (sim->cs == asserted)
+        return;
+
+    sim->cs = asserted;
+    sim->state = SDIO_SIM_STATE_IDLE;
+    sim->out_head = 0;
+    sim->out_len = 0;
+}
+
+uint8_t sdio_sim_xfer(unsigned int board, uint8_t mosi)
+{
+    struct sdio_sim *sim = &sdio_sims[board];
+    uint8_t miso = SDIO_SIM_JUNK;
+
+    if (!sim->cs)
+        return miso;
+
+    if ((sim->out_head == sim->out_len) && (sim->state == SDIO_SIM_STATE_READ))
+        sdio_sim_queue_read_block(sim);
+
+    if (sim->out_head < sim->out_len)
+        miso = sim->out[sim->out_head++];
+
+    sdio_sim_receive(sim, mosi);
+
+    return miso;
+}
+
+void sdio_sim_print_stats(unsigned int board)
+{
+    struct sdio_sim_stats *stats = &sdio_sims[board].stats;
+
+    mctrl_err("SDIO CMD52:            %" PRIu64 "\n", stats->cmd52);
+    mctrl_err("SDIO CMD53 read:       %" PRIu64 " (%" PRIu64 " blocks)\n",
+              stats->cmd53_read, stats->blocks_read);
+    mctrl_err("SDIO CMD53 write:      %" PRIu64 " (%" PRIu64 " blocks)\n",
+              stats->cmd53_write, stats->blocks_written);
+    mctrl_err("SDIO CRC errors:       %" PRIu64 " command, %" PRIu64 " data\n",
+              stats->cmd_crc_errors, stats->data_crc_errors);
+    mctrl_err("SDIO error responses:  %" PRIu64 "\n", stats->errors);
+}
@@ -0,0 +1,129 @@
+/*
+ * Copyright 2023 Morse Micro
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Software model of an FTDI debug board with a chip attached, used in place of libftd2xx when
+ * built with CONFIG_MORSE_TRANS_FTDI_SIM=1. The layers are:
+ *
+ *  ftd2xx_sim.c    D2XX API and MPSSE command interpreter for the SPI and reset channels.
+ *  sdio_sim.c      SDIO over SPI slave (CMD0/52/53/63, R5 responses, tokens and CRCs).
+ *  chip_sim.c      Sparse chip memory, keyhole registers and the firmware command mailbox.
+ */
+
+/** Environment variable to print simulator statistics when the SPI channel is closed. */
+#define SIM_ENV_STATS                   "MORSE_FTDI_SIM_STATS"
+/** Environment variable to override the maximum block size advertised in the CIS. */
+#define SIM_ENV_MAX_BLOCK_SIZE          "MORSE_FTDI_SIM_MAX_BLOCK_SIZE"
+/**
+ * Environment variable to set the fastest SPI clock (in kHz) the simulated board wiring supports.
+ * Above it, octets read from the slave are occasionally corrupted.
+ */
+#define SIM_ENV_MAX_CLOCK_KHZ           "MORSE_FTDI_SIM_MAX_CLOCK_KHZ"
+/**
+ * Environment variable to set the number of boards attached (default 1). Board N has serial
+ * numbers MMSIMNA and MMSIMNB for its SPI and reset channels.
+ */
+#define SIM_ENV_BOARDS                  "MORSE_FTDI_SIM_BOARDS"
+
+/**
+ * Environment variable to set the number of stats each core reports (default 0). Stat N of the
+ * app, MAC and UPHY cores has tag 0x1000 + N, 0x2000 + N and 0x3000 + N, and is a 32 bit counter
+ * going up by N + 1 every time it is read. Up to 4096 are reported over several pages, or up to
+ * 256 in a single response when unpaged.
+ */
+#define SIM_ENV_STATS_PER_CORE          "MORSE_FTDI_SIM_STATS_PER_CORE"
+/**
+ * Environment variable to act as firmware that can't return stats in pages, when set to 1. Stats
+ * are only ever unpaged unless built with CONFIG_MORSE_STATS_PAGED.
+ */
+#define SIM_ENV_STATS_UNPAGED           "MORSE_FTDI_SIM_STATS_UNPAGED"
+
+/** Most boards that can be simulated at once. */
+#define SIM_MAX_BOARDS                  (8)
+
+/**
+ * @brief Power on the simulated chip. Firmware is running with its host table in place, as if it
+ *        had been loaded by an earlier invocation.
+ *
+ * @param board Board the chip is on.
+ */
+void chip_sim_power_on(unsigned int board);
+
+/**
+ * @brief Free all simulated chip memory.
+ *
+ * @param board Board the chip is on.
+ */
+void chip_sim_power_off(unsigned int board);
+
+/**
+ * @brief Hard reset the simulated chip (reset pin). Memory is retained but the firmware stops.
+ *
+ * @param board Board the chip is on.
+ */
+void chip_sim_hard_reset(unsigned int board);
+
+/**
+ * @brief Read from simulated chip memory. Memory that has never been written reads as zero.
+ *
+ * @param board Board the chip is on.
+ * @param addr  Chip address to read from.
+ * @param data  Buffer to read into.
+ * @param len   Number of octets to read.
+ */
+void chip_sim_read(unsigned int board, uint32_t addr, uint8_t *data, size_t len);
+
+/**
+ * @brief Write to simulated chip memory, acting on any registers written.
+ *
+ * @param board Board the chip is on.
+ * @param addr  Chip address to write to.
+ * @param data  Data to write.
+ * @param len   Number of octets to write.
+ */
+void chip_sim_write(unsigned int board, uint32_t addr, const uint8_t *data, size_t len);
+
+/**
+ * @brief Power on the simulated SDIO slave. It is left in SPI mode.
+ *
+ * @param board Board the slave is on.
+ */
+void sdio_sim_power_on(unsigned int board);
+
+/**
+ * @brief Hard reset the simulated SDIO slave. A CMD63 is needed to re-enter SPI mode.
+ *
+ * @param board Board the slave is on.
+ */
+void sdio_sim_hard_reset(unsigned int board);
+
+/**
+ * @brief Set the state of the chip select line.
+ *
+ * @param board     Board the slave is on.
+ * @param asserted  Whether CS is asserted. De-asserting aborts any transaction in progress.
+ */
+void sdio_sim_set_cs(unsigned int board, bool asserted);
+
+/**
+ * @brief Clock an octet through the slave.
+ *
+ * @param board Board the slave is on.
+ * @param mosi  Octet sent by the master.
+ * @return      Octet returned by the slave.
+ */
+uint8_t sdio_sim_xfer(unsigned int board, uint8_t mosi);
+
+/**
+ * @brief Print the SDIO slave statistics.
+ *
+ * @param board Board the slave is on.
+ */
+void sdio_sim_print_stats(unsigned int board);
@@ -132,6 +132,27 @@ struct morsectrl_transport_buff *morsectrl_transport_raw_write_alloc(
     return transport->tops->write_alloc(transport, size);
 }
 
+struct morsectrl_transport_buff *morsectrl_transport_raw_write_wrap(
+    struct morsectrl_transport *transport, const uint8_t *data, size_t size)
+{
+    struct morsectrl_transport_buff *buff;
+
+    /* Only memory writes take raw data as it is, everything else needs room for framing. */
+    if (!transport->tops || !transport->tops->mem_write || !data || !size)
+        return NULL;
+
+    buff = malloc(sizeof(*buff));
+    if (!buff)
+        return NULL;
+
+    buff->memblock = NULL;
+    buff->capacity = 0;
+    buff->data = (uint8_t *)data;
+    buff->data_len = size;
+
+    return buff;
+}
+
 int morsectrl_transport_buff_free(struct morsectrl_transport_buff *buff)
 {
     if (!buff)
@@ -167,6 +188,50 @@ int morsectrl_transport_reg_write(struct morsectrl_transport *transport,
     return transport->tops->reg_write(transport, addr, value);
 }
 
+int morsectrl_transport_reg_read_many(struct morsectrl_transport *transport,
+                                      struct morsectrl_transport_reg *regs, size_t count)
+{
+    size_t ii;
+    int ret;
+
+    if (!transport->tops)
+        return -ETRANSERR;
+
+    if (transport->tops->reg_read_many)
+        return transport->tops->reg_read_many(transport, regs, count);
+
+    for (ii = 0; ii < count; ii++)
+    {
+        ret = morsectrl_transport_reg_read(transport, regs[ii].addr, &regs[ii].value);
+        if (ret)
+            return ret;
+    }
+
+    return ETRANSSUCC;
+}
+
+int morsectrl_transport_reg_write_many(struct morsectrl_transport *transport,
+                                       struct morsectrl_transport_reg *regs, size_t count)
+{
+    size_t ii;
+    int ret;
+
+    if (!transport->tops)
+        return -ETRANSERR;
+
+    if (transport->tops->reg_write_many)
+        return transport->tops->reg_write_many(transport, regs, count);
+
+    for (ii = 0; ii < count; ii++)
+    {
+        ret = morsectrl_transport_reg_write(transport, regs[ii].addr, regs[ii].value);
+        if (ret)
+            return ret;
+    }
+
+    return ETRANSSUCC;
+}
+
 int morsectrl_transport_mem_read(struct morsectrl_transport *transport,
                                  struct morsectrl_transport_buff *read,
                                  uint32_t addr)
@@ -197,6 +262,25 @@ int morsectrl_transport_send(struct morsectrl_transport *transport,
     return transport->tops->send(transport, cmd, resp);
 }
 
+int morsectrl_transport_send_many(struct morsectrl_transport *transport,
+                                  struct morsectrl_transport_buff **cmds,
+                                  struct morsectrl_transport_buff **resps,
+                                  int *rets, size_t count)
+{
+    size_t ii;
+
+    if (!transport->tops)
+        return -ETRANSERR;
+
+    if (transport->tops->send_many)
+        return transport->tops->send_many(transport, cmds, resps, rets, count);
+
+    for (ii = 0; ii < count; ii++)
+        rets[ii] = transport->tops->send(transport, cmds[ii], resps[ii]);
+
+    return ETRANSSUCC;
+}
+
 int morsectrl_transport_raw_read(struct morsectrl_transport *transport,
                                  struct morsectrl_transport_buff *read,
                                  bool start,
@@ -238,3 +322,19 @@ int morsectrl_transport_reset_device(struct morsectrl_transport *transport)
 
     return transport->tops->reset_device(transport);
 }
+
+int morsectrl_transport_link_train(struct morsectrl_transport *transport, uint32_t *freq_khz)
+{
+    if (!transport->tops || !transport->tops->link_train)
+        return -ETRANSERR;
+
+    return transport->tops->link_train(transport, freq_khz);
+}
+
+uint32_t morsectrl_transport_mem_retries(struct morsectrl_transport *transport)
+{
+    if (!transport->tops || !transport->tops->mem_retries)
+        return 0;
+
+    return transport->tops->mem_retries(transport);
+}
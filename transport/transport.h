@@ -53,6 +53,17 @@ struct morsectrl_transport_buff
     size_t data_len;
 };
 
+/** A 32bit register address and value, for batched register accesses. */
+struct morsectrl_transport_reg
+{
+    /** Word aligned address of the register. */
+    uint32_t addr;
+    /** Value to write, or the value read. */
+    uint32_t value;
+};
+
+struct morsectrl_transport;
+
 #ifdef ENABLE_TRANS_NL80211
 /** State information for the NL80211 interface. */
 struct morsectrl_nl80211_state
@@ -75,11 +86,52 @@ struct morsectrl_nl80211_cfg
 #endif
 
 #ifdef ENABLE_TRANS_FTDI_SPI
+/** State information for the SDIO over SPI protocol used by the FTDI SPI interface. */
+struct morsectrl_sdio_over_spi_state
+{
+    /** Whether large memory transfers overlap framing/CRC checks with the SPI transfers. */
+    bool stream;
+    /** Whether the memory function block size below has been negotiated with the chip. */
+    bool block_size_valid;
+    /** Block size used for CMD53 block mode transfers on the memory function. */
+    uint32_t mem_block_size;
+    /** CMD53 retries during the current memory transfer. */
+    uint32_t xfer_retries;
+    /** CMD53 retries since the transport was initialised. */
+    uint32_t total_retries;
+    /** Whether a failed CMD53 fails its transfer straight away, without being retried. */
+    bool no_retries;
+    /** Called after repeated CMD53 failures to slow the link down. May be NULL. */
+    int (*step_down_clock)(struct morsectrl_transport *transport);
+};
+
+/** USB parameters applied to the SPI channel for a class of traffic. */
+struct morsectrl_ftdi_spi_usb_profile
+{
+    /** USB IN transfer size in octets. */
+    uint32_t in_size;
+    /** USB OUT transfer size in octets. */
+    uint32_t out_size;
+    /** Latency timer in ms. */
+    uint8_t latency;
+};
+
 /** State information for the FTDI SPI interface. */
 struct morsectrl_ftdi_spi_state
 {
     FT_HANDLE handle;
     FT_HANDLE reset_handle;
+    struct morsectrl_sdio_over_spi_state sdio;
+    /** Whether the cached command/response mailbox addresses below are valid. */
+    bool mbox_valid;
+    /** Cached command mailbox address from the host manifest. */
+    uint32_t cmd_addr;
+    /** Cached response mailbox address from the host manifest. */
+    uint32_t resp_addr;
+    /** Serial number of the SPI channel in use, to cache link training results against. */
+    char serial_num[MAX_SERIAL_NUMBER_LEN];
+    /** Whether the bulk USB profile is applied to the SPI channel (otherwise the small one is). */
+    bool usb_bulk;
 };
 
 /** Configuration for the FTDI SPI interface. */
@@ -89,8 +141,22 @@ struct morsectrl_ftdi_spi_cfg
     UCHAR reset_pin_num;
     UCHAR jtag_reset_pin_num;
     uint32_t reset_ms;
+    /** Whether to stream large memory transfers. */
+    bool stream;
+    /** Whether to train the SPI clock at init (or use the result cached for this board). */
+    bool link_train;
+    /** Whether to step the SPI clock down after repeated transfer errors. */
+    bool clock_step_down;
+    /** USB parameters for register and command traffic. */
+    struct morsectrl_ftdi_spi_usb_profile usb_small;
+    /** USB parameters for large memory transfers. */
+    struct morsectrl_ftdi_spi_usb_profile usb_bulk;
+    /** Whether to tune the USB profiles at init (or use the results cached for this board). */
+    bool usb_tune;
     /** Size taken from FT_DEVICE_LIST_INFO_NODE structure in libmpsse library. */
     char serial_num[MAX_SERIAL_NUMBER_LEN];
+    /** Location ID of the SPI channel to use (the reset channel follows it), 0 for any. */
+    uint32_t loc_id;
 };
 
 struct morsectrl_ftdi_spi_chan_info
@@ -157,12 +223,23 @@ struct morsectrl_transport_ops
     int (*send)(struct morsectrl_transport *transport,
                 struct morsectrl_transport_buff *cmd,
                 struct morsectrl_transport_buff *resp);
+    /** Send several commands, all in flight at once, and receive their responses. May be NULL. */
+    int (*send_many)(struct morsectrl_transport *transport,
+                     struct morsectrl_transport_buff **cmds,
+                     struct morsectrl_transport_buff **resps,
+                     int *rets, size_t count);
     /** Read a 32bit register. */
     int (*reg_read)(struct morsectrl_transport *transport,
                     uint32_t addr, uint32_t *value);
     /** Write a 32bit register. */
     int (*reg_write)(struct morsectrl_transport *transport,
                      uint32_t addr, uint32_t value);
+    /** Read several 32bit registers, filling in their values. May be NULL. */
+    int (*reg_read_many)(struct morsectrl_transport *transport,
+                         struct morsectrl_transport_reg *regs, size_t count);
+    /** Write several 32bit registers in order. May be NULL. */
+    int (*reg_write_many)(struct morsectrl_transport *transport,
+                          struct morsectrl_transport_reg *regs, size_t count);
     /** Read a word aligned memory block. */
     int (*mem_read)(struct morsectrl_transport *transport,
                     struct morsectrl_transport_buff *read,
@@ -189,6 +266,10 @@ struct morsectrl_transport_ops
                           bool finish);
     /** Reset the device. */
     int (*reset_device)(struct morsectrl_transport *transport);
+    /** Find the fastest clock the link works reliably at and switch to it. May be NULL. */
+    int (*link_train)(struct morsectrl_transport *transport, uint32_t *freq_khz);
+    /** Number of transfer retries the last memory read or write needed. May be NULL. */
+    uint32_t (*mem_retries)(struct morsectrl_transport *transport);
 };
 
 /** Special transport string for testing, don't tell anyone. */
@@ -262,6 +343,20 @@ struct morsectrl_transport_buff *morsectrl_transport_resp_alloc(
 struct morsectrl_transport_buff *morsectrl_transport_raw_write_alloc(
     struct morsectrl_transport *transport, size_t size);
 
+/**
+ * @brief Wraps data already in memory for a raw memory write, so it does not need copying into a
+ *        transport buffer. Freeing the buffer does not free the data.
+ *
+ * @note The transport only reads the data, which must be readable up to the next word boundary.
+ *
+ * @param transport Transport the data will be written with.
+ * @param data      Data to write.
+ * @param size      Size of the data.
+ * @return          the allocated @ref morsectrl_transport_buff or NULL on failure.
+ */
+struct morsectrl_transport_buff *morsectrl_transport_raw_write_wrap(
+    struct morsectrl_transport *transport, const uint8_t *data, size_t size);
+
 /**
  * @brief Allocates memory for reading raw data using the provided transport.
  *
@@ -286,6 +381,31 @@ int morsectrl_transport_reg_read(struct morsectrl_transport *transport,
 int morsectrl_transport_reg_write(struct morsectrl_transport *transport,
                                   uint32_t addr, uint32_t value);
 
+/**
+ * @brief Read several 32bit registers, batching them into as few transactions as the transport
+ *        allows. Falls back to a register read per entry if the transport has no batched read.
+ *
+ * @param transport Transport to read the registers with.
+ * @param regs      Registers to read, the value of each entry is filled in.
+ * @param count     Number of entries in @p regs.
+ * @return          0 on success or relevant error.
+ */
+int morsectrl_transport_reg_read_many(struct morsectrl_transport *transport,
+                                      struct morsectrl_transport_reg *regs, size_t count);
+
+/**
+ * @brief Write several 32bit registers in order, batching them into as few transactions as the
+ *        transport allows. Falls back to a register write per entry if the transport has no
+ *        batched write.
+ *
+ * @param transport Transport to write the registers with.
+ * @param regs      Registers and the values to write.
+ * @param count     Number of entries in @p regs.
+ * @return          0 on success or relevant error.
+ */
+int morsectrl_transport_reg_write_many(struct morsectrl_transport *transport,
+                                       struct morsectrl_transport_reg *regs, size_t count);
+
 int morsectrl_transport_mem_read(struct morsectrl_transport *transport,
                                  struct morsectrl_transport_buff *read,
                                  uint32_t addr);
@@ -306,6 +426,22 @@ int morsectrl_transport_send(struct morsectrl_transport *transport,
                              struct morsectrl_transport_buff *cmd,
                              struct morsectrl_transport_buff *resp);
 
+/**
+ * @brief Send several commands, issuing them all before waiting for any response where the
+ *        transport allows. Falls back to sending them one at a time otherwise.
+ *
+ * @param transport Transport to send the commands on.
+ * @param cmds      Buffers containing the commands to send.
+ * @param resps     Buffers to receive the response to each command into.
+ * @param rets      Filled with the result of each command, 0 on success or relevant error.
+ * @param count     Number of commands.
+ * @return          0 if the commands were sent, otherwise relevant error.
+ */
+int morsectrl_transport_send_many(struct morsectrl_transport *transport,
+                                  struct morsectrl_transport_buff **cmds,
+                                  struct morsectrl_transport_buff **resps,
+                                  int *rets, size_t count);
+
 /**
  * @brief Reads raw data from the transport.
  *
@@ -360,6 +496,27 @@ int morsectrl_transport_raw_read_write(struct morsectrl_transport *transport,
  */
 int morsectrl_transport_reset_device(struct morsectrl_transport *transport);
 
+/**
+ * @brief Train the link to the device, stepping the clock down from the fastest supported until
+ *        data transfers are error free with some margin, then use that clock.
+ *
+ * @note This exercises device memory, so is best done before firmware is loaded.
+ *
+ * @param transport Transport to train.
+ * @param freq_khz  Filled with the clock chosen, in kHz.
+ * @return          0 on success or relevant error.
+ */
+int morsectrl_transport_link_train(struct morsectrl_transport *transport, uint32_t *freq_khz);
+
+/**
+ * @brief Get the number of transfer retries the last memory read or write needed. Data that
+ *        needed retries crossed the link while it was unreliable, so is worth checking.
+ *
+ * @param transport Transport the memory transfer was made on.
+ * @return          Number of retries, 0 if the transport does not retry or count them.
+ */
+uint32_t morsectrl_transport_mem_retries(struct morsectrl_transport *transport);
+
 /**
  * @brief Get the interface name
  *
@@ -29,6 +29,8 @@
 #define IMEM_BANK4_ADDR             (0x00140000)
 #define IMEM_BANK5_ADDR             (0x00150000)
 #define IMEM_BANK6_ADDR             (0x00158000)
+/* Banks 0 to 5 are 64k apart, one register is tested in each. */
+#define IMEM_BANK_REG_COUNT         (6)
 
 #define DMEM_BANK0_ADDR             (0x80100000)
 #define DMEM_BANK1_ADDR             (0x80200000)
@@ -50,6 +52,12 @@
 #define BLOCK2_5_TEST_SIZE          ((2 * 512) + 256)
 #define BOUND_TEST_SIZE             (UINT16_MAX + 1 + BLOCK1_5_TEST_SIZE)
 
+#define SCAN_BENCH_SIZE             (1024 * 1024)
+#define SCAN_BENCH_ROUNDS           (256)
+#define SCAN_BENCH_JUNK             (0xFF)
+#define SCAN_BENCH_EARLY_TRANS      (0xFE)
+#define SCAN_BENCH_TOKEN            (0xFE)
+
 typedef enum
 {
     TRANSRAW_UNKNOWN,
@@ -59,14 +67,19 @@ typedef enum
     TRANSRAW_READ,
     TRANSRAW_READ_TO_FILE,
     TRANSRAW_TEST,
+    TRANSRAW_SCAN_BENCHMARK,
+    TRANSRAW_LINK_TRAIN,
 } transraw_type_t;
 
 static void usage(struct morsectrl *mors)
 {
-    mctrl_print("\ttransraw [-a <address> [-w <value>] [-w -f <path to binary>] [-r <read_value>]] [-t]\n"); /* NOLINT */
+    mctrl_print("\ttransraw [-a <address> [-w <value>] [-w -f <path to binary>] [-r <read_value>]] [-t] [-b] [-l]\n"); /* NOLINT */
     mctrl_print("\t\t\t\tWrites or reads raw memory in the chip via transport\n");
     mctrl_print(
         "\t\t\t\tThis command only supports transports that interface directly to the chip\n");
+    mctrl_print("\t\t-t\t\truns the transport read/write tests\n");
+    mctrl_print("\t\t-b\t\tbenchmarks the received data token scanners\n");
+    mctrl_print("\t\t-l\t\ttrains the transport clock and caches the result for the board\n");
 }
 
 static bool transport_buff_is_equal(struct morsectrl_transport_buff *a,
@@ -165,7 +178,7 @@ exit:
 static int transraw_test(struct morsectrl_transport *transport)
 {
     int ret;
-    uint32_t reg_write_val = REG_TEST_VALUE_BASE;
+    struct morsectrl_transport_reg regs[IMEM_BANK_REG_COUNT];
     uint32_t reg_read_val;
     int ii;
 
@@ -178,39 +191,41 @@ static int transraw_test(struct morsectrl_transport *transport)
 
     mctrl_print("\nChip ID: 0x%04x\n", reg_read_val);
 
-    /* Write some single registers first. */
+    /* Write some single registers first, as a batch. */
     mctrl_print("\nWrite and read registers:\n");
-    for (ii = IMEM_BANK0_ADDR; ii <= IMEM_BANK5_ADDR; ii += IMEM_BANK1_ADDR - IMEM_BANK0_ADDR)
+    for (ii = 0; ii < IMEM_BANK_REG_COUNT; ii++)
     {
-        ret = morsectrl_transport_reg_write(transport, ii, reg_write_val);
-        if (ret)
-            goto exit;
-
-        reg_write_val++;
+        regs[ii].addr = IMEM_BANK0_ADDR + (ii * (IMEM_BANK1_ADDR - IMEM_BANK0_ADDR));
+        regs[ii].value = REG_TEST_VALUE_BASE + ii;
     }
 
+    ret = morsectrl_transport_reg_write_many(transport, regs, IMEM_BANK_REG_COUNT);
+    if (ret)
+        goto exit;
+
     /* Read the registers to make sure the values are as expected. */
-    reg_write_val = REG_TEST_VALUE_BASE;
-    for (ii = IMEM_BANK0_ADDR; ii <= IMEM_BANK5_ADDR; ii += IMEM_BANK1_ADDR - IMEM_BANK0_ADDR)
+    for (ii = 0; ii < IMEM_BANK_REG_COUNT; ii++)
+        regs[ii].value = 0;
+
+    ret = morsectrl_transport_reg_read_many(transport, regs, IMEM_BANK_REG_COUNT);
+    if (ret)
+        goto exit;
+
+    for (ii = 0; ii < IMEM_BANK_REG_COUNT; ii++)
     {
-        bool passed;
-        ret = morsectrl_transport_reg_read(transport, ii, &reg_read_val);
-        if (ret)
-            goto exit;
+        uint32_t reg_write_val = REG_TEST_VALUE_BASE + ii;
+        bool passed = (reg_write_val == regs[ii].value);
 
-        passed = (reg_write_val == reg_read_val);
         mctrl_print("0x%08x: 0x%08x %c= 0x%08x - %s\n",
-               ii + 1,
+               regs[ii].addr + 1,
                reg_write_val, passed ? '=' : '!',
-               reg_read_val, passed ? "Pass" : "Fail");
+               regs[ii].value, passed ? "Pass" : "Fail");
 
         if (!passed)
         {
             ret = -1;
             goto exit;
         }
-
-        reg_write_val++;
     }
 
     mctrl_print("\nWrite and read memory blocks:\n");
@@ -291,6 +306,95 @@ exit:
     return ret;
 }
 
+/**
+ * @brief Time a scanner over a buffer, repeated to get a stable measurement.
+ *
+ * @param name      Name of the scanner to print.
+ * @param buff      Buffer to scan.
+ * @param scan      Scanner wrapper, returns the offset found.
+ */
+static void transraw_scan_time(const char *name, const uint8_t *buff,
+                               size_t (*scan)(const uint8_t *buff))
+{
+    volatile size_t found = 0;
+    uint64_t start;
+    uint64_t elapsed_us;
+    int ii;
+
+    start = time_now_us();
+    for (ii = 0; ii < SCAN_BENCH_ROUNDS; ii++)
+        found += scan(buff);
+    elapsed_us = time_now_us() - start;
+
+    mctrl_print("%-32s %10.1f us/MiB\n", name, (double)elapsed_us / SCAN_BENCH_ROUNDS);
+    (void)found;
+}
+
+/* Octet at a time scan, to compare mem_find_not() against. */
+static size_t transraw_scan_resp_scalar(const uint8_t *buff)
+{
+    size_t ii;
+
+    for (ii = 0; ii < SCAN_BENCH_SIZE; ii++)
+    {
+        if ((buff[ii] != SCAN_BENCH_JUNK) && (buff[ii] != SCAN_BENCH_EARLY_TRANS))
+            break;
+    }
+
+    return ii;
+}
+
+static size_t transraw_scan_resp(const uint8_t *buff)
+{
+    return mem_find_not(buff, SCAN_BENCH_SIZE, SCAN_BENCH_JUNK, SCAN_BENCH_EARLY_TRANS);
+}
+
+/* Octet at a time skip of junk before a start token, to compare mem_find_not() against. */
+static size_t transraw_scan_token_scalar(const uint8_t *buff)
+{
+    size_t ii;
+
+    for (ii = 0; ii < SCAN_BENCH_SIZE; ii++)
+    {
+        if (buff[ii] != SCAN_BENCH_JUNK)
+            break;
+    }
+
+    return ii;
+}
+
+/* Block start tokens are found by skipping junk, then checking the token. */
+static size_t transraw_scan_token(const uint8_t *buff)
+{
+    return mem_find_not(buff, SCAN_BENCH_SIZE, SCAN_BENCH_JUNK, SCAN_BENCH_JUNK);
+}
+
+/**
+ * @brief Benchmark the scanners used to skip junk on the SPI read path. A buffer of junk with the
+ *        wanted octet at the very end is the worst case, where every octet is inspected.
+ *
+ * @return  0 on success otherwise relevant error.
+ */
+static int transraw_scan_benchmark(void)
+{
+    uint8_t *buff = malloc(SCAN_BENCH_SIZE);
+
+    if (!buff)
+        return -1;
+
+    memset(buff, SCAN_BENCH_JUNK, SCAN_BENCH_SIZE);
+    buff[SCAN_BENCH_SIZE - 1] = 0;
+    transraw_scan_time("response (not 0xFF/0xFE) scalar", buff, transraw_scan_resp_scalar);
+    transraw_scan_time("response (not 0xFF/0xFE)", buff, transraw_scan_resp);
+
+    buff[SCAN_BENCH_SIZE - 1] = SCAN_BENCH_TOKEN;
+    transraw_scan_time("start token (0xFE) scalar", buff, transraw_scan_token_scalar);
+    transraw_scan_time("start token (0xFE)", buff, transraw_scan_token);
+
+    free(buff);
+    return 0;
+}
+
 int transraw(struct morsectrl *mors, int argc, char *argv[])
 {
     char *path;
@@ -311,7 +415,7 @@ int transraw(struct morsectrl *mors, int argc, char *argv[])
         return 0;
     }
 
-    while ((option = getopt(argc, argv, "a:f:w:rt")) != -1)
+    while ((option = getopt(argc, argv, "a:f:w:rtbl")) != -1)
     {
         switch (option)
         {
@@ -382,6 +486,14 @@ int transraw(struct morsectrl *mors, int argc, char *argv[])
             type = TRANSRAW_TEST;
             break;
 
+        case 'b':
+            type = TRANSRAW_SCAN_BENCHMARK;
+            break;
+
+        case 'l':
+            type = TRANSRAW_LINK_TRAIN;
+            break;
+
         default:
             usage(mors);
             return -1;
@@ -436,6 +548,15 @@ int transraw(struct morsectrl *mors, int argc, char *argv[])
     case TRANSRAW_TEST:
         return transraw_test(&mors->transport);
 
+    case TRANSRAW_SCAN_BENCHMARK:
+        return transraw_scan_benchmark();
+
+    case TRANSRAW_LINK_TRAIN:
+        ret = morsectrl_transport_link_train(transport, &read_val);
+        if (!ret)
+            mctrl_print("Link clock %u kHz\n", read_val);
+        break;
+
     case TRANSRAW_UNKNOWN:
     case TRANSRAW_UNKNOWN_FILE:
     default:
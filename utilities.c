@@ -15,6 +15,11 @@
 #else
 #include <arpa/inet.h>
 #endif
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 #include "utilities.h"
 
@@ -325,6 +330,57 @@ bool crc16_check(uint8_t *buff, size_t len, uint16_t crc16)
     return (crc16 == buff_crc16);
 }
 
+/* Octet at a time search, for the octets left over after the vector loop. */
+static size_t mem_find_not_scalar(const uint8_t *buff, size_t len, uint8_t skip0,
+                                  uint8_t skip1)
+{
+    size_t ii;
+
+    for (ii = 0; ii < len; ii++)
+    {
+        if ((buff[ii] != skip0) && (buff[ii] != skip1))
+            break;
+    }
+
+    return ii;
+}
+
+size_t mem_find_not(const uint8_t *buff, size_t len, uint8_t skip0, uint8_t skip1)
+{
+    size_t ii = 0;
+#if defined(__SSE2__)
+    const __m128i v_skip0 = _mm_set1_epi8((char)skip0);
+    const __m128i v_skip1 = _mm_set1_epi8((char)skip1);
+
+    for (; (ii + sizeof(__m128i)) <= len; ii += sizeof(__m128i))
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)&buff[ii]);
+        __m128i skip = _mm_or_si128(_mm_cmpeq_epi8(v, v_skip0), _mm_cmpeq_epi8(v, v_skip1));
+        uint32_t mask = ~_mm_movemask_epi8(skip) & 0xFFFF;
+
+        if (mask)
+            return ii + __builtin_ctz(mask);
+    }
+#elif defined(__ARM_NEON)
+    const uint8x16_t v_skip0 = vdupq_n_u8(skip0);
+    const uint8x16_t v_skip1 = vdupq_n_u8(skip1);
+
+    for (; (ii + sizeof(uint8x16_t)) <= len; ii += sizeof(uint8x16_t))
+    {
+        uint8x16_t v = vld1q_u8(&buff[ii]);
+        uint8x16_t skip = vorrq_u8(vceqq_u8(v, v_skip0), vceqq_u8(v, v_skip1));
+        /* Narrow to 4 bits per octet to get a 64-bit mask. */
+        uint64_t mask = ~vget_lane_u64(vreinterpret_u64_u8(
+            vshrn_n_u16(vreinterpretq_u16_u8(skip), 4)), 0);
+
+        if (mask)
+            return ii + (__builtin_ctzll(mask) / 4);
+    }
+#endif
+
+    return ii + mem_find_not_scalar(&buff[ii], len - ii, skip0, skip1);
+}
+
 size_t get_file_size(FILE *infile)
 {
     struct stat file_stats;
@@ -16,6 +16,7 @@
 #include <unistd.h>
 #endif
 #include <dirent.h>
+#include <time.h>
 
 #include "morsectrl.h"
 #include "portable_endian.h"
@@ -246,6 +247,20 @@ uint16_t crc16_gen(uint8_t *buff, size_t len);
  */
 bool crc16_check(uint8_t *buff, size_t len, uint16_t crc16);
 
+/**
+ * @brief Find the first octet in a buffer that is neither of two values (e.g. skipping SPI junk).
+ *
+ * @note Uses SSE2 or NEON when built for a target that has them. Pass the same value twice to skip
+ *       a single value.
+ *
+ * @param buff  Buffer to search.
+ * @param len   Length of the buffer.
+ * @param skip0 Value to skip.
+ * @param skip1 Other value to skip.
+ * @return      Offset of the first other octet, or @c len if there is none.
+ */
+size_t mem_find_not(const uint8_t *buff, size_t len, uint8_t skip0, uint8_t skip1);
+
 /**
  * @brief Get the file size of a file.
  *
@@ -278,6 +293,46 @@ static inline void sleep_ms(uint32_t ms)
 #endif
 }
 
+/**
+ * @brief Get a monotonic timestamp for measuring durations.
+ *
+ * @return  Time in us from an arbitrary starting point.
+ */
+static inline uint64_t time_now_us(void)
+{
+#ifdef MORSE_WIN_BUILD
+    LARGE_INTEGER freq;
+    LARGE_INTEGER count;
+
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return ((count.QuadPart / freq.QuadPart) * 1000000) +
+           (((count.QuadPart % freq.QuadPart) * 1000000) / freq.QuadPart);
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+#endif
+}
+
+/**
+ * @brief Get the wall clock time, for timestamps kept beyond the process.
+ *
+ * @return  Time in us since the epoch.
+ */
+static inline uint64_t time_wall_us(void)
+{
+#ifdef MORSE_WIN_BUILD
+    return (uint64_t)time(NULL) * 1000000;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+#endif
+}
+
 /**
  * Convert a MAC address string into a byte array.
  *